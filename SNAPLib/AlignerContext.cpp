@@ -36,6 +36,8 @@ Revision History:
 #include "Error.h"
 #include "Util.h"
 #include "CommandProcessor.h"
+#include "ReadTrimmer.h"
+#include "Tracer.h"
 
 using std::max;
 using std::min;
@@ -50,6 +52,7 @@ AlignerContext::AlignerContext(int i_argc, const char **i_argv, const char *i_ve
     :
     index(NULL),
     writerSupplier(NULL),
+    trimmer(NULL),
     options(NULL),
     stats(NULL),
     extension(i_extension != NULL ? i_extension : new AlignerExtension()),
@@ -118,6 +121,7 @@ AlignerContext::initializeThread()
     void
 AlignerContext::runThread()
 {
+    Tracer::NameThread("aligner");
     extension->beginThread();
     runIterationThread();
     if (readWriter != NULL) {
@@ -198,6 +202,10 @@ AlignerContext::initialize()
         }
     }
 
+    if (options->traceFileName != NULL) {
+        Tracer::Start(options->traceFileName);
+    }
+
     DataSupplier::ThreadCount = options->numThreads;
 
     return true;
@@ -230,6 +238,12 @@ AlignerContext::beginIteration()
     readerContext.genome = index != NULL ? index->getGenome() : NULL;
     readerContext.ignoreSecondaryAlignments = options->ignoreSecondaryAlignments;
     readerContext.ignoreSupplementaryAlignments = options->ignoreSecondaryAlignments;   // Maybe we should split them out
+    readerContext.orderedOutput = options->orderedOutput;
+    if (NULL != options->trimAdapter || 0 != options->trimQualityWindow || options->trimPairOverlap) {
+        trimmer = new ReadTrimmer(options->trimAdapter, options->trimQualityWindow, options->trimQualityThreshold,
+            options->trimPairOverlap, options->hardTrim);
+    }
+    readerContext.trimmer = trimmer;
     DataSupplier::ExpansionFactor = options->expansionFactor;
 
     typeSpecificBeginIteration();
@@ -269,6 +283,16 @@ AlignerContext::finishIteration()
         writerSupplier = NULL;
     }
 
+    //
+    // The aligner threads have joined and the writer has finished, so nothing is still recording into the trace.
+    //
+    if (options->traceFileName != NULL) {
+        Tracer::Stop();
+    }
+
+    delete trimmer;
+    trimmer = NULL;
+
     alignTime = /*timeInMillis() - alignStart -- use the time from ParallelTask.h, that may exclude memory allocation time*/ time;
 }
 
@@ -380,6 +404,27 @@ AlignerContext::printStats()
 		FormatUIntWithCommas((alignTime + 500) / 1000, alignTimeString, strBufLen)
 		);
 
+    if (stats->peakThreadMemory > 0) {
+        WriteStatusMessage("Per-thread aligner memory: peak %lld MB allocated of %lld MB reserved\n",
+            (stats->peakThreadMemory + 1024 * 1024 - 1) / (1024 * 1024), (stats->reservedThreadMemory + 1024 * 1024 - 1) / (1024 * 1024));
+    }
+
+    if (stats->hintedReads > 0) {
+        WriteStatusMessage("Realignment hints used for %lld reads (%0.2f%%); %lld checked with a full search, %lld (%0.2f%%) of those disagreed\n",
+            stats->hintedReads, 100.0 * stats->hintedReads / max(stats->totalReads, (_int64)1),
+            stats->hintValidations, stats->hintDisagreements, 100.0 * stats->hintDisagreements / max(stats->hintValidations, (_int64)1));
+    }
+
+    if (stats->lvCacheLookups > 0) {
+        WriteStatusMessage("LV result cache: %lld hits in %lld lookups (%0.2f%%)\n",
+            stats->lvCacheHits, stats->lvCacheLookups, 100.0 * stats->lvCacheHits / stats->lvCacheLookups);
+    }
+
+    if (stats->seedLookupsSkipped > 0) {
+        WriteStatusMessage("Adaptive seed schedule: skipped %lld seed lookups (%0.2f per pair)\n",
+            stats->seedLookupsSkipped, 2.0 * stats->seedLookupsSkipped / max(stats->totalReads, (_int64)1));
+    }
+
     if (NULL != perfFile) {
         fprintf(perfFile, "%d\t%d\t%0.2f%%\t%0.2f%%\t%0.2f%%\t%0.2f%%\t%0.2f%%\t%lld\t%lld\tt%.0f\n",
                 maxHits_, maxDist_, 
@@ -518,6 +563,18 @@ AlignerContext::parseOptions(
 		return NULL;
     }
 
+    if (options->orderedOutput && nInputs > 1) {
+        WriteErrorMessage("Ordered output (-oo) requires a single input file (or pair of FASTQ files).\n");
+		delete options;
+		return NULL;
+    }
+
+    if (NULL != options->metricsPrefix && (! options->sortOutput || BAMFile != options->outputFile.fileType)) {
+        WriteErrorMessage("Metrics (-met) are computed while sorting, so they require sorted BAM output (-so).\n");
+		delete options;
+		return NULL;
+    }
+
     if (options->maxDist + options->extraSearchDepth >= MAX_K) {
         WriteErrorMessage("You specified too large of a maximum edit distance combined with extra search depth.  The must add up to less than %d.\n", MAX_K);
         WriteErrorMessage("Either reduce their sum, or change MAX_K in LandauVishkin.h and recompile.\n");
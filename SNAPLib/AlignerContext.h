@@ -88,12 +88,15 @@ public:
 
     virtual bool isPaired() = 0;
 
+    static const int AlignTraceBatchSize = 256; // reads (or pairs) per aligner event in the -trace timeline
+
     friend class AlignerContext2;
  
     // common state across all threads
     GenomeIndex                         *index;
     ReadWriterSupplier                  *writerSupplier;
     ReaderContext                        readerContext;
+    ReadTrimmer                         *trimmer;
     _int64                               alignStart;
     _int64                               alignTime;
     AlignerOptions                      *options;
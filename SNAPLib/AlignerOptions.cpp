@@ -44,19 +44,31 @@ AlignerOptions::AlignerOptions(
     bindToProcessors(true),
     ignoreMismatchedIDs(false),
     clipping(ClipBack),
+    trimAdapter(NULL),
+    trimQualityWindow(0),
+    trimQualityThreshold(0),
+    trimPairOverlap(false),
+    hardTrim(false),
     sortOutput(false),
+    orderedOutput(false),
     noIndex(false),
     noDuplicateMarking(false),
     noQualityCalibration(false),
     sortMemory(0),
+    sortSpillDirectories(NULL),
+    metricsPrefix(NULL),
+    metricsBinSize(1000),
     filterFlags(0),
     explorePopularSeeds(false),
     stopOnFirstHit(false),
+    useHints(false),
+    hintValidationInterval(100),
 	useM(true),
     gapPenalty(0),
 	extra(NULL),
     rgLineContents("@RG\tID:FASTQ\tPL:Illumina\tPU:pu\tLB:lb\tSM:sm"),
     perfFileName(NULL),
+    traceFileName(NULL),
     useTimingBarrier(false),
     extraSearchDepth(2),
     defaultReadGroup("FASTQ"),
@@ -120,8 +132,19 @@ AlignerOptions::usageMessage()
         "       with small caches or lots of cores/cache\n"
         "  -so  sort output file by alignment location\n"
         "  -sm  memory to use for sorting in Gb\n"
+        "  -sd  dir1,dir2,...  spill sorted blocks round-robin into these directories rather than next to the output,\n"
+        "       e.g. one on each local drive, so that spill and merge I/O are spread over all of them\n"
+        "  -oo  write output in input order regardless of the number of threads, so that output is identical\n"
+        "       to a -t 1 run.  Not allowed with more than one input file.\n"
+        "  -met prefix  compute metrics while sorting (sorted BAM output only), written to prefix.metrics.txt (summary),\n"
+        "       prefix.depth.txt (depth histogram per contig), prefix.insert.txt (insert sizes) and prefix.bedGraph (mean depth per bin)\n"
+        "  -metbin  bedGraph bin size for -met (default 1000)\n"
         "  -x   explore some hits of overly popular seeds (useful for filtering)\n"
         "  -f   stop on first match within edit distance limit (filtering mode)\n"
+        "  -hint  realign SAM/BAM input starting from its existing alignments (e.g., to a patched reference).  Reads that\n"
+        "       were uniquely aligned and still match at their old location (lifted over by contig name) skip the seed\n"
+        "       search.  Takes an optional N: check every Nth such read with a full search and report how many\n"
+        "       disagree (default 100, 0 for never).  Not used with -om.\n"
         "  -F   filter output (a=aligned only, s=single hit only (MAPQ >= %d), u=unaligned only, l=long enough to align (see -mrl))\n"
         "  -E   an alternate (and fully general) way to specify filter options.  Emit only these types s = single hit (MAPQ >= %d), m = multiple hit (MAPQ < %d),\n"
         "       x = not long enough to align, u = unaligned, b = filter must apply to both ends of a paired-end read.  Combine the letters after\n"
@@ -139,11 +162,18 @@ AlignerOptions::usageMessage()
 #endif  // USE_DEVTEAM_OPTIONS
         "  -Cxx must be followed by two + or - symbols saying whether to clip low-quality\n"
         "       bases from front and back of read respectively; default: back only (-C-+)\n"
+        "  -ta  trim the given adapter sequence (e.g. AGATCGGAAGAGC for Illumina TruSeq) and anything after it from\n"
+        "       reads as they are read, including a partial adapter of at least 3 bases at the end of the read\n"
+        "  -tq  trim the end of reads from where the mean quality in a sliding window drops below a threshold.  Takes\n"
+        "       the window size and the phred quality, e.g. -tq 4 15\n"
+        "  -th  hard trim: drop trimmed bases and record them as hard clipping, rather than soft clipping them (the default)\n"
         "  -M   indicates that CIGAR strings in the generated SAM file should use M (alignment\n"
         "       match) rather than = and X (sequence (mis-)match).  This is the default\n"
         "  -=   use the new style CIGAR strings with = and X rather than M.  The opposite of -M\n"
         "  -G   specify a gap penalty to use when generating CIGAR strings\n"
         "  -pf  specify the name of a file to contain the run speed\n"
+        "  -trace  write a timeline of the reader, decompression, aligner, writer filter, compression and sort\n"
+        "       stages to the given file in Chrome trace format (view with chrome://tracing or ui.perfetto.dev)\n"
         "  --hp Indicates not to use huge pages (this may speed up index load and slow down alignment)  This is the default\n"
         "  -hp  Indicates to use huge pages (this may speed up alignment and slow down index load).\n"
         "  -D   Specifies the extra search depth (the edit distance beyond the best hit that SNAP uses to compute MAPQ).  Default 2\n"
@@ -329,6 +359,9 @@ AlignerOptions::parse(
 	} else if (strcmp(argv[n], "-so") == 0) {
 		sortOutput = true;
 		return true;
+	} else if (strcmp(argv[n], "-oo") == 0) {
+		orderedOutput = true;
+		return true;
 	} else if (strcmp(argv[n], "-map") == 0) {
 		mapIndex = true;
 		return true;
@@ -356,6 +389,24 @@ AlignerOptions::parse(
             }
             return true;
         }
+    } else if (strcmp(argv[n], "-met") == 0) {
+        if (n + 1 < argc) {
+            metricsPrefix = argv[n+1];
+            n++;
+            return true;
+        }
+    } else if (strcmp(argv[n], "-metbin") == 0) {
+        if (n + 1 < argc && argv[n+1][0] >= '1' && argv[n+1][0] <= '9') {
+            metricsBinSize = atoi(argv[n+1]);
+            n++;
+            return true;
+        }
+    } else if (strcmp(argv[n], "-sd") == 0) {
+        if (n + 1 < argc) {
+            sortSpillDirectories = argv[n+1];
+            n++;
+            return true;
+        }
     } else if (strcmp(argv[n], "-sm") == 0) {
         if (n + 1 < argc && argv[n+1][0] >= '0' && argv[n+1][0] <= '9') {
             sortMemory = atoi(argv[n+1]);
@@ -422,6 +473,13 @@ AlignerOptions::parse(
     } else if (strcmp(argv[n], "-f") == 0) {
         stopOnFirstHit = true;
         return true;
+    } else if (strcmp(argv[n], "-hint") == 0) {
+        useHints = true;
+        if (n + 1 < argc && isdigit(argv[n + 1][0])) {
+            hintValidationInterval = atoi(argv[n + 1]);
+            n++;
+        }
+        return true;
 #if     USE_DEVTEAM_OPTIONS
     } else if (strcmp(argv[n], "-I") == 0) {
         ignoreMismatchedIDs = true;
@@ -522,6 +580,34 @@ AlignerOptions::parse(
 	} else if (strcmp(argv[n], "-pc") == 0) {
 		preserveClipping = true;
 		return true;
+    } else if (strcmp(argv[n], "-ta") == 0) {
+        if (n + 1 < argc) {
+            n++;
+            trimAdapter = argv[n];
+            if (strlen(trimAdapter) == 0 || strspn(trimAdapter, "ACGTNacgtn") != strlen(trimAdapter)) {
+                WriteErrorMessage("The adapter after -ta must be a nonempty sequence of ACGTN\n");
+                return false;
+            }
+            return true;
+        } else {
+            WriteErrorMessage("Must specify the adapter sequence after -ta\n");
+        }
+    } else if (strcmp(argv[n], "-tq") == 0) {
+        if (n + 2 < argc) {
+            trimQualityWindow = atoi(argv[n+1]);
+            trimQualityThreshold = atoi(argv[n+2]);
+            n += 2;
+            if (trimQualityWindow < 1 || trimQualityThreshold > 93) {
+                WriteErrorMessage("-tq takes a window size of at least 1 and a phred quality of at most 93\n");
+                return false;
+            }
+            return true;
+        } else {
+            WriteErrorMessage("Must specify the window size and quality after -tq\n");
+        }
+    } else if (strcmp(argv[n], "-th") == 0) {
+        hardTrim = true;
+        return true;
 	} else if (strcmp(argv[n], "-G") == 0) {
         if (n + 1 < argc) {
             gapPenalty = atoi(argv[n+1]);
@@ -676,6 +762,14 @@ AlignerOptions::parse(
             WriteErrorMessage("-R requires a value");
 			return false;
         }
+	} else if (strcmp(argv[n], "-trace") == 0) {
+        if (n + 1 < argc) {
+            traceFileName = argv[n+1];
+            n++;
+            return true;
+        } else {
+            WriteErrorMessage("Must specify the name of the trace file after -trace\n");
+        }
 	} else if (strcmp(argv[n], "-pf") == 0) {
         if (n + 1 < argc) {
             perfFileName = argv[n+1];
@@ -75,19 +75,31 @@ struct AlignerOptions : public AbstractOptions
     int                 nInputs;
     SNAPFile           *inputs;
     ReadClippingType    clipping;
+    const char         *trimAdapter;            // adapter sequence to trim from the 3' end, or NULL
+    unsigned            trimQualityWindow;      // sliding window for quality trimming, 0 for none
+    unsigned            trimQualityThreshold;   // minimum mean phred quality in the window
+    bool                trimPairOverlap;        // trim adapter read through found from mate overlap (paired only)
+    bool                hardTrim;               // drop trimmed bases as hard clipping rather than soft clipping them
     bool                sortOutput;
+    bool                orderedOutput;  // emit alignments in input order, independent of thread count
     bool                noIndex;
     bool                noDuplicateMarking;
     bool                noQualityCalibration;
     unsigned            sortMemory; // total output sorting buffer size in Gb
+    const char         *sortSpillDirectories; // comma-separated directories to spread sort spill files over, or NULL
+    const char         *metricsPrefix;  // write depth, coverage, insert size & duplicate metrics during the sort, or NULL
+    unsigned            metricsBinSize; // bedGraph bin size
     unsigned            filterFlags;
     bool                explorePopularSeeds;
     bool                stopOnFirstHit;
+    bool                useHints;               // start from the alignments in SAM/BAM input (realignment to a patched reference)
+    unsigned            hintValidationInterval; // run the full search on every Nth hinted read as a check, 0 for never
 	bool				useM;	// Should we generate CIGAR strings using = and X, or using the old-style M?
     unsigned            gapPenalty; // if non-zero use gap penalty aligner
     AbstractOptions    *extra; // extra options
     const char         *rgLineContents;
     const char         *perfFileName;
+    const char         *traceFileName;  // write a Chrome trace format timeline of the pipeline stages, or NULL
     bool                useTimingBarrier;
     unsigned            extraSearchDepth;
     const char         *defaultReadGroup; // if not specified in input
@@ -40,7 +40,15 @@ AlignerStats::AlignerStats(AbstractStats* i_extra)
     extra(i_extra),
     lvCalls(0),
     filtered(0),
-    extraAlignments(0)
+    extraAlignments(0),
+    peakThreadMemory(0),
+    reservedThreadMemory(0),
+    hintedReads(0),
+    hintValidations(0),
+    hintDisagreements(0),
+    lvCacheLookups(0),
+    lvCacheHits(0),
+    seedLookupsSkipped(0)
 {
     for (int i = 0; i <= AlignerStats::maxMapq; i++) {
         mapqHistogram[i] = 0;
@@ -91,6 +99,14 @@ AlignerStats::add(
     lvCalls += other->lvCalls;
     filtered += other->filtered;
     extraAlignments += other->extraAlignments;
+    peakThreadMemory = __max(peakThreadMemory, other->peakThreadMemory);
+    reservedThreadMemory = __max(reservedThreadMemory, other->reservedThreadMemory);
+    hintedReads += other->hintedReads;
+    hintValidations += other->hintValidations;
+    hintDisagreements += other->hintDisagreements;
+    lvCacheLookups += other->lvCacheLookups;
+    lvCacheHits += other->lvCacheHits;
+    seedLookupsSkipped += other->seedLookupsSkipped;
 
     if (extra != NULL && other->extra != NULL) {
         extra->add(other->extra);
@@ -53,6 +53,14 @@ struct AlignerStats : public AbstractStats
     _int64 lvCalls;
     _int64 filtered;
     _int64 extraAlignments;
+    _int64 peakThreadMemory;        // Largest per-thread aligner memory allocated (not necessarily touched), in bytes
+    _int64 reservedThreadMemory;    // Largest per-thread aligner address space reserved, in bytes
+    _int64 hintedReads;             // Reads aligned at their original location without a seed search (-hint)
+    _int64 hintValidations;         // Hinted reads that were also run through the full search as a check
+    _int64 hintDisagreements;       // and that came out somewhere else
+    _int64 lvCacheLookups;          // Paired-end location scores looked up in the per-thread LV result cache
+    _int64 lvCacheHits;             // and found there, so LV didn't run
+    _int64 seedLookupsSkipped;      // Paired-end seed lookups the adaptive seed schedule didn't need to do
     static const unsigned maxMapq = 70;
     unsigned mapqHistogram[maxMapq+1];
 
@@ -77,6 +85,11 @@ struct AlignerStats : public AbstractStats
 
     virtual void add(const AbstractStats* other);
 
+    void recordThreadMemory(_int64 committed, _int64 reserved) {
+        peakThreadMemory = __max(peakThreadMemory, committed);
+        reservedThreadMemory = __max(reservedThreadMemory, reserved);
+    }
+
     virtual void printHistograms(FILE* out);
 };
 
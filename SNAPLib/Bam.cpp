@@ -34,17 +34,20 @@ Environment:
 #include "PairedAligner.h"
 #include "GzipDataWriter.h"
 #include "Error.h"
+#include "ReadTrimmer.h"
+#include "SequenceCodec.h"
 
 using std::max;
 using std::min;
 using util::strnchr;
 
-BAMReader::BAMReader(const ReaderContext& i_context) : ReadReader(i_context)
+BAMReader::BAMReader(const ReaderContext& i_context) : ReadReader(i_context), n_ref(0), refLocations(NULL)
 {
 }
 
 BAMReader::~BAMReader()
 {
+    delete [] refLocations;
 }
 
     bool
@@ -67,7 +70,7 @@ BAMReader::init(
 {
     // todo: integrate supplier models
     // might need up to 3x extra for expanded sequence + quality + cigar data
-    if (!strcmp("-", fileName)) {
+    if (IsStreamingInput(fileName)) {
         data = DataSupplier::GzipBamStdio->getDataReader(bufferCount, MAX_RECORD_LENGTH, 3.0 * DataSupplier::ExpansionFactor, 0);
     } else {
         data = DataSupplier::GzipBamDefault->getDataReader(bufferCount, MAX_RECORD_LENGTH, 3.0 * DataSupplier::ExpansionFactor, 0);
@@ -161,10 +164,17 @@ BAMReader::readHeader(
 		soft_exit(1);
 	}
 
-	int n_ref = header->n_ref();
+	n_ref = header->n_ref();
+	refLocations = new GenomeLocation[__max(n_ref, 1)];
 	BAMHeaderRefSeq* refSeq = header->firstRefSeq();
 	for (int i = 0; i < n_ref; i++, refSeq = refSeq->next()) {
-		// just advance
+		//
+		// Map by name rather than by position, so that input aligned against a different
+		// (e.g., patched) reference lands on the same contig in this one.
+		//
+		if (context.genome == NULL || !context.genome->getLocationOfContig(refSeq->name(), &refLocations[i])) {
+			refLocations[i] = InvalidGenomeLocation;
+		}
 	}
 	
 	char* p = new char[textHeaderSize + 1];
@@ -252,17 +262,7 @@ BAMAlignment::decodeSeq(
     const _uint8* nibbles,
     int bases)
 {
-
-
-    _uint16 *o_sequence_pairs = (_uint16 *)o_sequence;
-    int pairs = bases / 2;
-    for (int i = 0; i < pairs; i++) {
-        o_sequence_pairs[i] = CodeToSeqPair[nibbles[i]];
-    }
-
-    if (bases % 2 == 1) {
-        o_sequence[bases - 1] = CodeToSeq[nibbles[bases / 2] >> 4];
-    }
+    SequenceCodec::unpackBases(o_sequence, nibbles, bases);
 
 #ifdef _DEBUG   // Make sure the new one does the same thing as the old.
     for (int i = 0; i < bases; i++) {
@@ -279,15 +279,7 @@ char* o_sequence,
 const _uint8* nibbles,
 int bases)
 {
-    _uint16 *o_sequence_pairs = (_uint16 *)o_sequence;
-    int pairs = bases / 2;
-    for (int i = 0; i < pairs; i++) {
-        o_sequence_pairs[pairs-i-1] = CodeToSeqPairRC[nibbles[i]];
-    }
-
-    if (bases % 2 == 1) {
-        o_sequence[0] = CodeToSeqRC[nibbles[bases / 2] >> 4];
-    }
+    SequenceCodec::unpackBasesRC(o_sequence, nibbles, bases);
 }
     void
 BAMAlignment::decodeQual(
@@ -295,9 +287,7 @@ BAMAlignment::decodeQual(
     char* quality,
     int bases)
 {
-    for (int i = 0; i < bases; i++) {
-        o_qual[i] = CIGAR_QUAL_TO_SAM[((_uint8*)quality)[i]];
-    }
+    SequenceCodec::qualityFromBAM(o_qual, (_uint8*)quality, bases);
 }
 
     void
@@ -306,9 +296,7 @@ BAMAlignment::decodeQualRC(
     char* quality,
     int bases)
 {
-    for (int i = 0; i < bases; i++) {
-        o_qual[bases-i-1] = CIGAR_QUAL_TO_SAM[((_uint8*)quality)[i]];
-    }
+    SequenceCodec::qualityFromBAMReversed(o_qual, (_uint8*)quality, bases);
 }
 
     bool
@@ -388,13 +376,7 @@ BAMAlignment::encodeSeq(
     char* ascii,
     int length)
 {
-    _uint8* p = encoded;
-    for (int i = 0; i + 1 < length; i += 2) {
-        *p++ = (BAMAlignment::SeqToCode[ascii[i]] << 4) | BAMAlignment::SeqToCode[ascii[i+1]];
-    }
-    if (length % 2) {
-        *p = BAMAlignment::SeqToCode[ascii[length - 1]] << 4;
-    }
+    SequenceCodec::packBases(encoded, ascii, length);
 }
 
     int
@@ -533,17 +515,18 @@ BAMReader::getNextRead(
         unsigned auxLen = bam->auxLen();
         read->setReadGroup(context.defaultReadGroup);
         if (auxLen > 0) {
+            //
+            // Don't look inside the aux data here; most of it is passed through or dropped, and the writer looks up RG.
+            //
             read->setAuxiliaryData((char*) bam->firstAux(), auxLen);
-            for (BAMAlignAux* aux = bam->firstAux(); aux < bam->endAux(); aux = aux->next()) {
-                if (aux->val_type == 'Z' && aux->tag[0] == 'R' && aux->tag[1] == 'G') {
-                    read->setReadGroup(READ_GROUP_FROM_AUX);
-                    break;
-                }
-            }
+            read->setReadGroup(READ_GROUP_FROM_AUX);
         }
     } while ((context.ignoreSecondaryAlignments && (*flag & SAM_SECONDARY)) || 
              (context.ignoreSupplementaryAlignments && (*flag & SAM_SUPPLEMENTARY)));
     _ASSERT(read->getData()[0]);
+    if (NULL != context.trimmer) {
+        context.trimmer->trim(read);
+    }
     return true;
 }
 
@@ -567,10 +550,12 @@ BAMReader::getReadFromLine(
     _ASSERT((size_t)(endOfBuffer - line) >= bam->size());
     bam->validate();
 
-    GenomeLocation genomeLocation = bam->getLocation(genome);
+    GenomeLocation genomeLocation = InvalidGenomeLocation;
+    if (bam->refID >= 0 && bam->refID < n_ref && bam->pos >= 0 && !(bam->FLAG & SAM_UNMAPPED) && refLocations[bam->refID] != InvalidGenomeLocation) {
+        genomeLocation = refLocations[bam->refID] + bam->pos;
+    }
 
     if (NULL != out_genomeLocation) {
-        _ASSERT(-1 <= bam->refID && bam->refID < (int)genome->getNumContigs());
         *out_genomeLocation = genomeLocation;
     }
 
@@ -741,7 +726,7 @@ BAMFormat::getWriterSupplier(
 {
     DataWriterSupplier* dataSupplier;
     GzipWriterFilterSupplier* gzipSupplier =
-        DataWriterSupplier::gzip(true, BAM_BLOCK, max(1, options->numThreads - 1), false, options->sortOutput);
+        DataWriterSupplier::gzip(true, BAM_BLOCK, max(1, options->numThreads - 1), false, options->sortOutput || options->orderedOutput);
         // (leave a thread free for main, and let OS map threads to cores to allow system IO etc.)
     if (options->sortOutput) {
         size_t len = strlen(options->outputFile.fileName);
@@ -751,6 +736,10 @@ BAMFormat::getWriterSupplier(
         strcpy(tempFileName + len, ".tmp");
         // todo: make markDuplicates optional?
         DataWriter::FilterSupplier* filters = gzipSupplier;
+        if (NULL != options->metricsPrefix) {
+            // after duplicate marking, so it sees the final flags
+            filters = DataWriterSupplier::metrics(options->metricsPrefix, genome, options->metricsBinSize)->compose(filters);
+        }
         if (! options->noDuplicateMarking) {
             filters = DataWriterSupplier::markDuplicates(genome)->compose(filters);
         }
@@ -760,13 +749,21 @@ BAMFormat::getWriterSupplier(
             strcpy(indexFileName + len, ".bai");
             filters = DataWriterSupplier::bamIndex(indexFileName, genome, gzipSupplier)->compose(filters);
         }
+        // ordered output has a single writer into the sorter, so size its buffers as for one thread
         dataSupplier = DataWriterSupplier::sorted(this, genome, tempFileName,
             options->sortMemory * (1ULL << 30),
-            options->numThreads, options->outputFile.fileName, filters, options->writeBufferSize,
+            options->orderedOutput ? 1 : options->numThreads, options->outputFile.fileName, filters, options->writeBufferSize,
+            options->sortSpillDirectories, FileEncoder::gzip(gzipSupplier, options->numThreads, options->bindToProcessors));
+    } else if (options->orderedOutput) {
+        // everything goes through one writer, so compress on a separate set of threads rather than inline
+        dataSupplier = DataWriterSupplier::create(options->outputFile.fileName, options->writeBufferSize, gzipSupplier,
             FileEncoder::gzip(gzipSupplier, options->numThreads, options->bindToProcessors));
     } else {
         dataSupplier = DataWriterSupplier::create(options->outputFile.fileName, options->writeBufferSize, gzipSupplier);
     }
+    if (options->orderedOutput) {
+        dataSupplier = DataWriterSupplier::ordered(dataSupplier, options->writeBufferSize, 2 * options->numThreads + 2);
+    }
     return ReadWriterSupplier::create(this, dataSupplier, genome);
 }
 
@@ -874,7 +871,7 @@ BAMFormat::writeRead(
     unsigned basesClippedBefore;
     GenomeDistance extraBasesClippedBefore;
     unsigned basesClippedAfter;
-    int editDistance;
+    int editDistance = -1;  // as in SAMFormat; not set for unaligned reads
     int newAddFrontClipping = 0;
 
     if (!SAMFormat::createSAMLine(context.genome, lv, 
@@ -905,21 +902,19 @@ BAMFormat::writeRead(
     char* aux = read->getAuxiliaryData(&auxLen, &auxSAM);
     static bool warningPrinted = false;
     bool translateReadGroupFromSAM = false;
+    const char* readGroup = read->getReadGroup();
     if (aux != NULL && auxSAM) {
         if (! warningPrinted) {
             warningPrinted = true;
             WriteErrorMessage("warning: translating optional data from SAM->BAM is not yet implemented, optional data will not appear in BAM\n");
         }
-        if (read->getReadGroup() == READ_GROUP_FROM_AUX) {
-            for (char* p = aux; p != NULL && p < aux + auxLen; p = SAMReader::skipToBeyondNextFieldSeparator(p, aux + auxLen)) {
-                if (strncmp(p, "RG:Z:", 5) == 0) {
-                    size_t fieldLen;
-                    SAMReader::skipToBeyondNextFieldSeparator(p, aux + auxLen, &fieldLen);
-                    aux = p;
-                    auxLen = (unsigned) fieldLen;
-                    translateReadGroupFromSAM = true;
-                    break;
-                }
+        if (readGroup == READ_GROUP_FROM_AUX) {
+            size_t fieldLen;
+            char* p = SAMReader::findAuxField(aux, auxLen, "RG", &fieldLen);
+            if (p != NULL && fieldLen > 5 && p[3] == 'Z') {
+                aux = p;
+                auxLen = (unsigned) fieldLen;
+                translateReadGroupFromSAM = true;
             }
         }
         if (! translateReadGroupFromSAM) {
@@ -927,10 +922,14 @@ BAMFormat::writeRead(
             auxLen = 0;
         }
     }
+    if (readGroup == READ_GROUP_FROM_AUX && ! translateReadGroupFromSAM &&
+        (aux == NULL || NULL == BAMAlignAux::find(aux, auxLen, "RG", STRING_VAL_TYPE))) {
+        readGroup = context.defaultReadGroup;
+    }
     size_t bamSize = BAMAlignment::size((unsigned)qnameLen + 1, cigarOps, fullLength, auxLen);
-    if (read->getReadGroup() != NULL && read->getReadGroup() != READ_GROUP_FROM_AUX) {
-        if (strcmp(read->getReadGroup(), context.defaultReadGroup) != 0) {
-            bamSize += 4 + strlen(read->getReadGroup());
+    if (readGroup != NULL && readGroup != READ_GROUP_FROM_AUX) {
+        if (strcmp(readGroup, context.defaultReadGroup) != 0) {
+            bamSize += 4 + strlen(readGroup);
         } else {
             bamSize += context.defaultReadGroupAuxLen;
         }
@@ -973,9 +972,7 @@ BAMFormat::writeRead(
     bam->read_name()[qnameLen] = 0;
     memcpy(bam->cigar(), cigarBuf, cigarOps * 4);
     BAMAlignment::encodeSeq(bam->seq(), data, fullLength);
-    for (unsigned i = 0; i < fullLength; i++) {
-        quality[i] -= '!';
-    }
+    SequenceCodec::qualityToBAM(quality, fullLength);
     memcpy(bam->qual(), quality, fullLength);
     if (aux != NULL && auxLen > 0) {
         if (((char*)bam->firstAux()) + auxLen > buffer + bufferSpace) {
@@ -995,14 +992,14 @@ BAMFormat::writeRead(
         }
     }
     // RG
-    if (read->getReadGroup() != NULL && read->getReadGroup() != READ_GROUP_FROM_AUX) {
-        if (strcmp(read->getReadGroup(), context.defaultReadGroup) != 0) {
-            if ((char*)bam->firstAux() + auxLen + 4 + strlen(read->getReadGroup()) > buffer + bufferSpace) {
+    if (readGroup != NULL && readGroup != READ_GROUP_FROM_AUX) {
+        if (strcmp(readGroup, context.defaultReadGroup) != 0) {
+            if ((char*)bam->firstAux() + auxLen + 4 + strlen(readGroup) > buffer + bufferSpace) {
                 return false;
             }
             BAMAlignAux* rg = (BAMAlignAux*)(auxLen + (char*)bam->firstAux());
             rg->tag[0] = 'R'; rg->tag[1] = 'G'; rg->val_type = 'Z';
-            strcpy((char*)rg->value(), read->getReadGroup());
+            strcpy((char*)rg->value(), readGroup);
             auxLen += (unsigned)rg->size();
         } else {
             if ((char*)bam->firstAux() + auxLen + context.defaultReadGroupAuxLen > buffer + bufferSpace) {
@@ -1809,6 +1806,550 @@ BAMIndexSupplier::addInterval(
     }
 }
 
+class BAMMetricsSupplier;
+
+class BAMMetricsFilter : public BAMFilter
+{
+public:
+    BAMMetricsFilter(BAMMetricsSupplier* i_supplier)
+        : BAMFilter(DataWriter::ReadFilter), supplier(i_supplier), pendingLocation(InvalidGenomeLocation),
+        pendingData(NULL), pendingUsed(0), pendingCapacity(0)
+    {}
+
+    ~BAMMetricsFilter()
+    { delete [] pendingData; }
+
+    // process any reads still held back; refreshFlags only while the batches are still available
+    void flush(bool refreshFlags);
+
+protected:
+    virtual void onRead(BAMAlignment* bam, size_t fileOffset, int batchIndex);
+
+private:
+    BAMMetricsSupplier* supplier;
+
+    //
+    // Duplicate marking only settles the flags of a run of reads at the same location when it sees the
+    // next location, and may go back into earlier batches to do it.  So hold copies of each run until then,
+    // and pick up the final flags from the output buffers.
+    //
+    GenomeLocation pendingLocation;
+    VariableSizeVector<size_t> pendingOffsets; // file offset of each held read
+    VariableSizeVector<size_t> pendingCopies; // offset of its copy in pendingData
+    char* pendingData;
+    size_t pendingUsed;
+    size_t pendingCapacity;
+};
+
+class BAMMetricsSupplier : public DataWriter::FilterSupplier
+{
+public:
+    BAMMetricsSupplier(const char* i_prefix, const Genome* i_genome, unsigned i_binSize);
+
+    virtual ~BAMMetricsSupplier();
+
+    virtual DataWriter::Filter* getFilter();
+
+    virtual void onClosing(DataWriterSupplier* supplier);
+    virtual void onClosed(DataWriterSupplier* supplier) {}
+
+private:
+
+    friend class BAMMetricsFilter;
+
+    void onRead(BAMAlignment* bam);
+
+    // finish every contig before refID and start on it
+    void beginContig(int refID);
+
+    // add depth for every base up to position in the current contig
+    void advanceTo(_int64 position);
+
+    void addDepth(_int64 begin, _int64 end, _int64 depth);
+
+    void addBin(_int64 begin, _int64 end, _int64 depthSum);
+
+    void writeBedGraphRun();
+
+    void writeDepthHistogram(const char* name, _int64 length, const _int64* histogram);
+
+    void writeReports();
+
+    FILE* openReport(const char* suffix);
+
+    static const int MaxDepth = 1000; // last histogram entry counts anything deeper
+    static const int MaxInsertSize = 100000; // likewise
+
+    const char* prefix;
+    const Genome* genome;
+    const Genome::Contig* contigs;
+    int numContigs;
+    unsigned binSize;
+    BAMMetricsFilter* filter;
+
+    _int64* contigLengths;
+    _int64 contigDepths[MaxDepth + 1]; // histogram of depth >= 1 for the current contig, written when it's done
+    _int64 totalDepths[MaxDepth + 1];
+    FILE* depthFile;
+    _int64* insertSizes;
+
+    // depth sweep over the current contig
+    int currentContig;
+    _int64 position;
+    _int64 depth;
+    VariableSizeVector<_int64> blockStarts; // min-heaps of aligned block boundaries ahead of position
+    VariableSizeVector<_int64> blockEnds;
+
+    // bedGraph of mean depth per bin, merging adjacent bins with the same value
+    FILE* bedGraph;
+    _int64 binStart;
+    _int64 binDepthSum;
+    _int64 runStart, runEnd;
+    double runValue;
+
+    // primary reads
+    _int64 reads, unmappedReads, secondaryReads, supplementaryReads;
+    _int64 unpairedReads, unpairedDuplicates, pairedReads, pairedDuplicates;
+};
+
+    static bool
+LaterPosition(
+    const _int64& a,
+    const _int64& b)
+{
+    return a > b;
+}
+
+    static void
+PushPosition(
+    VariableSizeVector<_int64>* heap,
+    _int64 value)
+{
+    heap->push_back(value);
+    std::push_heap(heap->begin(), heap->end(), LaterPosition);
+}
+
+    static void
+PopPosition(
+    VariableSizeVector<_int64>* heap)
+{
+    std::pop_heap(heap->begin(), heap->end(), LaterPosition);
+    heap->truncate(heap->size() - 1);
+}
+
+    void
+BAMMetricsFilter::onRead(
+    BAMAlignment* bam,
+    size_t fileOffset,
+    int batchIndex)
+{
+    GenomeLocation location = bam->getLocation(supplier->genome);
+    GenomeLocation logicalLocation = location != InvalidGenomeLocation ? location : bam->getNextLocation(supplier->genome);
+    if ((bam->FLAG & SAM_SECONDARY) != 0 || logicalLocation == InvalidGenomeLocation) {
+        // never marked as duplicates
+        supplier->onRead(bam);
+        return;
+    }
+    if (logicalLocation != pendingLocation) {
+        flush(true);
+        pendingLocation = logicalLocation;
+    }
+    size_t bytes = bam->size();
+    if (pendingUsed + bytes > pendingCapacity) {
+        size_t newCapacity = max(2 * pendingCapacity, pendingUsed + bytes + 65536);
+        char* newData = new char[newCapacity];
+        if (pendingUsed > 0) {
+            memcpy(newData, pendingData, pendingUsed);
+        }
+        delete [] pendingData;
+        pendingData = newData;
+        pendingCapacity = newCapacity;
+    }
+    memcpy(pendingData + pendingUsed, bam, bytes);
+    pendingOffsets.push_back(fileOffset);
+    pendingCopies.push_back(pendingUsed);
+    pendingUsed += bytes;
+}
+
+    void
+BAMMetricsFilter::flush(
+    bool refreshFlags)
+{
+    for (int i = 0; i < pendingOffsets.size(); i++) {
+        BAMAlignment* copy = (BAMAlignment*) (pendingData + pendingCopies[i]);
+        if (refreshFlags) {
+            BAMAlignment* marked = getRead(pendingOffsets[i]);
+            if (marked != NULL) {
+                copy->FLAG = marked->FLAG;
+            }
+        }
+        supplier->onRead(copy);
+    }
+    pendingOffsets.clear();
+    pendingCopies.clear();
+    pendingUsed = 0;
+    pendingLocation = InvalidGenomeLocation;
+}
+
+    DataWriter::FilterSupplier*
+DataWriterSupplier::metrics(
+    const char* prefix,
+    const Genome* genome,
+    unsigned binSize)
+{
+    return new BAMMetricsSupplier(prefix, genome, binSize);
+}
+
+BAMMetricsSupplier::BAMMetricsSupplier(
+    const char* i_prefix,
+    const Genome* i_genome,
+    unsigned i_binSize)
+    : FilterSupplier(DataWriter::ReadFilter), prefix(i_prefix), genome(i_genome), binSize(max(1u, i_binSize)), filter(NULL),
+    currentContig(-1), position(0), depth(0), binStart(0), binDepthSum(0), runStart(0), runEnd(0), runValue(0),
+    reads(0), unmappedReads(0), secondaryReads(0), supplementaryReads(0),
+    unpairedReads(0), unpairedDuplicates(0), pairedReads(0), pairedDuplicates(0)
+{
+    contigs = genome->getContigs();
+    numContigs = genome->getNumContigs();
+    contigLengths = new _int64[numContigs];
+    for (int i = 0; i < numContigs; i++) {
+        GenomeLocation end = i + 1 < numContigs ? contigs[i + 1].beginningLocation : genome->getCountOfBases();
+        contigLengths[i] = (end - genome->getChromosomePadding()) - contigs[i].beginningLocation;
+    }
+    memset(contigDepths, 0, sizeof(contigDepths));
+    memset(totalDepths, 0, sizeof(totalDepths));
+    insertSizes = new _int64[MaxInsertSize + 1];
+    memset(insertSizes, 0, (MaxInsertSize + 1) * sizeof(_int64));
+    bedGraph = openReport(".bedGraph");
+    depthFile = openReport(".depth.txt");
+    fprintf(depthFile, "#contig\tdepth\tbases\n");
+}
+
+BAMMetricsSupplier::~BAMMetricsSupplier()
+{
+    delete [] contigLengths;
+    delete [] insertSizes;
+}
+
+    DataWriter::Filter*
+BAMMetricsSupplier::getFilter()
+{
+    // the merge has a single writer
+    _ASSERT(filter == NULL);
+    filter = new BAMMetricsFilter(this);
+    return filter;
+}
+
+    FILE*
+BAMMetricsSupplier::openReport(
+    const char* suffix)
+{
+    size_t len = strlen(prefix);
+    char* fileName = new char[len + strlen(suffix) + 1];
+    strcpy(fileName, prefix);
+    strcpy(fileName + len, suffix);
+    FILE* file = fopen(fileName, "w");
+    if (file == NULL) {
+        WriteErrorMessage("Unable to open metrics file '%s'\n", fileName);
+        soft_exit(1);
+    }
+    delete [] fileName;
+    return file;
+}
+
+    void
+BAMMetricsSupplier::onRead(
+    BAMAlignment* bam)
+{
+    if (bam->FLAG & SAM_SECONDARY) {
+        secondaryReads++;
+        return;
+    }
+    bool duplicate = (bam->FLAG & SAM_DUPLICATE) != 0;
+    if (bam->FLAG & SAM_SUPPLEMENTARY) {
+        supplementaryReads++;
+    } else {
+        reads++;
+        if (bam->FLAG & SAM_UNMAPPED) {
+            unmappedReads++;
+            return;
+        }
+        if ((bam->FLAG & SAM_MULTI_SEGMENT) && ! (bam->FLAG & SAM_NEXT_UNMAPPED)) {
+            pairedReads++;
+            pairedDuplicates += duplicate;
+            if (! duplicate && (bam->FLAG & SAM_ALL_ALIGNED) && bam->tlen > 0 && bam->refID == bam->next_refID) {
+                insertSizes[min(bam->tlen, MaxInsertSize)]++;
+            }
+        } else {
+            unpairedReads++;
+            unpairedDuplicates += duplicate;
+        }
+    }
+    if ((bam->FLAG & (SAM_UNMAPPED | SAM_DUPLICATE | SAM_FAILED_QC)) || bam->refID < 0 || bam->refID >= numContigs || bam->refID < currentContig) {
+        return;
+    }
+
+    if (bam->refID != currentContig) {
+        beginContig(bam->refID);
+    }
+    advanceTo(bam->pos);
+
+    //
+    // Add the aligned blocks, treating adjacent M/=/X operations as one block.
+    //
+    _int64 contigLength = contigLengths[currentContig];
+    _int64 refPos = bam->pos;
+    _int64 blockStart = refPos;
+    _uint32* cigar = bam->cigar();
+    for (int i = 0; i <= bam->n_cigar_op; i++) {
+        char op = i < bam->n_cigar_op ? BAMAlignment::CodeToCigar[BAMAlignment::GetCigarOpCode(cigar[i])] : 'N';
+        switch (op) {
+        case 'M':
+        case '=':
+        case 'X':
+            refPos += BAMAlignment::GetCigarOpCount(cigar[i]);
+            break;
+        case 'D':
+        case 'N':
+            if (refPos > blockStart && blockStart < contigLength) {
+                PushPosition(&blockStarts, blockStart);
+                PushPosition(&blockEnds, min(refPos, contigLength));
+            }
+            if (i < bam->n_cigar_op) {
+                refPos += BAMAlignment::GetCigarOpCount(cigar[i]);
+            }
+            blockStart = refPos;
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+    void
+BAMMetricsSupplier::beginContig(
+    int refID)
+{
+    while (currentContig < refID) {
+        if (currentContig >= 0) {
+            advanceTo(contigLengths[currentContig]);
+            if (binStart < position) {
+                addBin(binStart, position, binDepthSum);
+            }
+            writeBedGraphRun();
+            writeDepthHistogram(contigs[currentContig].name, contigLengths[currentContig], contigDepths);
+            memset(contigDepths, 0, sizeof(contigDepths));
+        }
+        currentContig++;
+        position = 0;
+        depth = 0;
+        blockStarts.clear();
+        blockEnds.clear();
+        binStart = 0;
+        binDepthSum = 0;
+    }
+}
+
+    void
+BAMMetricsSupplier::advanceTo(
+    _int64 target)
+{
+    for (;;) {
+        while (blockStarts.size() > 0 && blockStarts[0] <= position) {
+            depth++;
+            PopPosition(&blockStarts);
+        }
+        while (blockEnds.size() > 0 && blockEnds[0] <= position) {
+            depth--;
+            PopPosition(&blockEnds);
+        }
+        if (position >= target) {
+            return;
+        }
+        _int64 next = target;
+        if (blockStarts.size() > 0) {
+            next = min(next, blockStarts[0]);
+        }
+        if (blockEnds.size() > 0) {
+            next = min(next, blockEnds[0]);
+        }
+        addDepth(position, next, depth);
+        position = next;
+    }
+}
+
+    void
+BAMMetricsSupplier::addDepth(
+    _int64 begin,
+    _int64 end,
+    _int64 runDepth)
+{
+    //
+    // Zero depth is left out of the histograms, and filled in from the contig lengths when reporting.
+    //
+    if (runDepth > 0) {
+        int bucket = (int) min(runDepth, (_int64) MaxDepth);
+        contigDepths[bucket] += end - begin;
+        totalDepths[bucket] += end - begin;
+    }
+
+    while (begin < end) {
+        _int64 binEnd = min(binStart + binSize, contigLengths[currentContig]);
+        _int64 stop = min(end, binEnd);
+        binDepthSum += (stop - begin) * runDepth;
+        begin = stop;
+        if (stop == binEnd) {
+            addBin(binStart, binEnd, binDepthSum);
+            binStart = binEnd;
+            binDepthSum = 0;
+        }
+    }
+}
+
+    void
+BAMMetricsSupplier::addBin(
+    _int64 begin,
+    _int64 end,
+    _int64 depthSum)
+{
+    double value = (double) depthSum / (double) (end - begin);
+    if (runEnd > runStart && runEnd == begin && runValue == value) {
+        runEnd = end;
+    } else {
+        writeBedGraphRun();
+        runStart = begin;
+        runEnd = end;
+        runValue = value;
+    }
+}
+
+    void
+BAMMetricsSupplier::writeBedGraphRun()
+{
+    if (runEnd > runStart) {
+        fprintf(bedGraph, "%s\t%lld\t%lld\t%.4g\n", contigs[currentContig].name, runStart, runEnd, runValue);
+    }
+    runStart = runEnd = 0;
+}
+
+    void
+BAMMetricsSupplier::onClosing(
+    DataWriterSupplier* supplier)
+{
+    if (filter != NULL) {
+        // the writer's batches are gone by now, so keep the flags as they were when the reads were held
+        filter->flush(false);
+    }
+    beginContig(numContigs);
+    fclose(bedGraph);
+    writeReports();
+}
+
+    void
+BAMMetricsSupplier::writeDepthHistogram(
+    const char* name,
+    _int64 length,
+    const _int64* histogram)
+{
+    _int64 covered = 0;
+    for (int d = 1; d <= MaxDepth; d++) {
+        covered += histogram[d];
+    }
+    fprintf(depthFile, "%s\t0\t%lld\n", name, length - covered);
+    for (int d = 1; d <= MaxDepth; d++) {
+        if (histogram[d] != 0) {
+            fprintf(depthFile, "%s\t%d%s\t%lld\n", name, d, d == MaxDepth ? "+" : "", histogram[d]);
+        }
+    }
+}
+
+    void
+BAMMetricsSupplier::writeReports()
+{
+    //
+    // The per-contig depth histograms were written as each contig was finished; add the one for the whole genome.
+    //
+    _int64 genomeLength = 0, coveredBases = 0, depthSum = 0;
+    for (int i = 0; i < numContigs; i++) {
+        genomeLength += contigLengths[i];
+    }
+    writeDepthHistogram("*", genomeLength, totalDepths);
+    fclose(depthFile);
+
+    _int64 atLeast[3] = {0, 0, 0}; // 1x, 10x, 30x
+    for (int d = 1; d <= MaxDepth; d++) {
+        coveredBases += totalDepths[d];
+        depthSum += d * totalDepths[d];
+        atLeast[0] += totalDepths[d];
+        atLeast[1] += d >= 10 ? totalDepths[d] : 0;
+        atLeast[2] += d >= 30 ? totalDepths[d] : 0;
+    }
+
+    //
+    // Insert size distribution.
+    //
+    FILE* insertFile = openReport(".insert.txt");
+    fprintf(insertFile, "#insert_size\tpairs\n");
+    _int64 pairs = 0;
+    double insertSum = 0;
+    for (int i = 1; i <= MaxInsertSize; i++) {
+        if (insertSizes[i] != 0) {
+            fprintf(insertFile, "%d%s\t%lld\n", i, i == MaxInsertSize ? "+" : "", insertSizes[i]);
+            pairs += insertSizes[i];
+            insertSum += (double) i * insertSizes[i];
+        }
+    }
+    fclose(insertFile);
+    double insertMean = pairs > 0 ? insertSum / pairs : 0;
+    double insertVariance = 0;
+    int insertMedian = 0;
+    _int64 seen = 0;
+    for (int i = 1; i <= MaxInsertSize; i++) {
+        if (insertSizes[i] != 0) {
+            if (insertMedian == 0 && 2 * (seen + insertSizes[i]) >= pairs) {
+                insertMedian = i;
+            }
+            seen += insertSizes[i];
+            insertVariance += (i - insertMean) * (i - insertMean) * insertSizes[i];
+        }
+    }
+    double insertSD = pairs > 1 ? sqrt(insertVariance / (pairs - 1)) : 0;
+
+    //
+    // Summary, with duplication computed the same way as Picard MarkDuplicates.
+    //
+    FILE* summary = openReport(".metrics.txt");
+    double duplication = unpairedReads + pairedReads > 0
+        ? (double) (unpairedDuplicates + pairedDuplicates) / (double) (unpairedReads + pairedReads) : 0;
+    fprintf(summary,
+        "reads\t%lld\n"
+        "unmapped_reads\t%lld\n"
+        "secondary_alignments\t%lld\n"
+        "supplementary_alignments\t%lld\n"
+        "unpaired_reads_examined\t%lld\n"
+        "unpaired_read_duplicates\t%lld\n"
+        "read_pairs_examined\t%lld\n"
+        "read_pair_duplicates\t%lld\n"
+        "percent_duplication\t%.6f\n"
+        "insert_size_pairs\t%lld\n"
+        "median_insert_size\t%d\n"
+        "mean_insert_size\t%.2f\n"
+        "insert_size_sd\t%.2f\n"
+        "genome_length\t%lld\n"
+        "mean_depth\t%.4f\n"
+        "fraction_covered_1x\t%.6f\n"
+        "fraction_covered_10x\t%.6f\n"
+        "fraction_covered_30x\t%.6f\n",
+        reads, unmappedReads, secondaryReads, supplementaryReads,
+        unpairedReads, unpairedDuplicates, pairedReads / 2, pairedDuplicates / 2, duplication,
+        pairs, insertMedian, insertMean, insertSD,
+        genomeLength, genomeLength > 0 ? (double) depthSum / genomeLength : 0,
+        genomeLength > 0 ? (double) atLeast[0] / genomeLength : 0,
+        genomeLength > 0 ? (double) atLeast[1] / genomeLength : 0,
+        genomeLength > 0 ? (double) atLeast[2] / genomeLength : 0);
+    fclose(summary);
+}
+
     bool
 BgzfHeader::validate(char* buffer, size_t bytes)
 {
@@ -263,7 +263,7 @@ struct BAMAlignAux
 
     size_t      size()
     {
-        return val_type == STRING_VAL_TYPE ? strlen((const char*) value()) + 4
+        return val_type == STRING_VAL_TYPE || val_type == HEX_VAL_TYPE ? strlen((const char*) value()) + 4
             : val_type == ARRAY_VAL_TYPE ? size(arrayValType(), count())
             : size(val_type);
     }
@@ -304,6 +304,22 @@ struct BAMAlignAux
 
     BAMAlignAux* next()
     { return (BAMAlignAux*) (size() + (char*) this); }
+
+    //
+    // Find the field with the given two character tag (and value type, if not 0) in a BAM record's aux data, or NULL.
+    // This steps from field to field by size, so it only touches the tags and the string values (via strlen).
+    //
+    static BAMAlignAux* find(void* aux, size_t auxLen, const char* tag, char val_type = 0)
+    {
+        _uint16 key = *(const _uint16*) tag;
+        char* end = (char*) aux + auxLen;
+        for (BAMAlignAux* field = (BAMAlignAux*) aux; (char*) field + 3 <= end; field = field->next()) {
+            if (*(_uint16*) field->tag == key && (val_type == 0 || field->val_type == val_type)) {
+                return field;
+            }
+        }
+        return NULL;
+    }
 };
 
 struct BgzfExtra
@@ -433,7 +449,7 @@ private:
         char* getExtra(_int64 bytes);
 
         DataReader*         data;
-        //unsigned            n_ref; // number of reference sequences
-        //unsigned*           refOffset; // array mapping ref sequence ID to contig location
+        int                 n_ref; // number of reference sequences
+        GenomeLocation*     refLocations; // ref sequence ID to start of the contig with the same name in the index, so alignments lift over to a patched reference
         _int64              extraOffset; // offset into extra data
 };
@@ -35,6 +35,8 @@ Revision History:
 #include "exit.h"
 #include "AlignerOptions.h"
 #include "Error.h"
+#include "SAM.h"
+#include "SequenceCodec.h"
 
 using std::min;
 
@@ -85,7 +87,7 @@ BaseAligner::BaseAligner(
         genomeIndex(i_genomeIndex), maxHitsToConsider(i_maxHitsToConsider), maxK(i_maxK),
         maxReadSize(i_maxReadSize), maxSeedsToUseFromCommandLine(i_maxSeedsToUseFromCommandLine),
         maxSeedCoverage(i_maxSeedCoverage), readId(-1), extraSearchDepth(i_extraSearchDepth),
-        explorePopularSeeds(false), stopOnFirstHit(false), stats(i_stats), 
+        explorePopularSeeds(false), stopOnFirstHit(false), useHints(false), hintValidationInterval(0), stats(i_stats), 
         noUkkonen(i_noUkkonen), noOrderedEvaluation(i_noOrderedEvaluation), noTruncation(i_noTruncation),
 		minWeightToCheck(max(1u, i_minWeightToCheck)), maxSecondaryAlignmentsPerContig(i_maxSecondaryAlignmentsPerContig)
 /*++
@@ -124,9 +126,13 @@ Arguments:
     nHitsIgnoredBecauseOfTooHighPopularity = 0;
     nReadsIgnoredBecauseOfTooManyNs = 0;
     nIndelsMerged = 0;
+    nHintsUsed = 0;
+    nHintsValidated = 0;
+    nHintsDisagreed = 0;
 
     genome = genomeIndex->getGenome();
     seedLen = genomeIndex->getSeedLength();
+    seedMatchProbability = pow(1 - SNP_PROB, genomeIndex->getSeedLength());
     doesGenomeIndexHave64BitLocations = genomeIndex->doesGenomeIndexHave64BitLocations();
 
     probDistance = new ProbabilityDistance(SNP_PROB, GAP_OPEN_PROB, GAP_EXTEND_PROB);  // Match Mason
@@ -181,7 +187,6 @@ Arguments:
 
     // treat everything but ACTG like N
     for (unsigned i = 0; i < 256; i++) {
-        nTable[i] = 1;
         rcTranslationTable[i] = 'N';
     }
     reversedRead[RC] = reversedRead[FORWARD] + maxReadSize;
@@ -192,10 +197,6 @@ Arguments:
     rcTranslationTable['T'] = 'A';
     rcTranslationTable['N'] = 'N';
 
-    memset(nTable, 0, sizeof(nTable));
-
-    nTable['N'] = 1;
-
     if (allocator) {
         seedUsed = (BYTE *)allocator->allocate((sizeof(BYTE) * (maxReadSize + 7 + 128) / 8));    // +128 to make sure it extends at both
     } else {
@@ -211,7 +212,6 @@ Arguments:
         candidateHashTable[FORWARD] = (HashTableAnchor *)allocator->allocate(sizeof(HashTableAnchor) * candidateHashTablesSize);
         candidateHashTable[RC] = (HashTableAnchor *)allocator->allocate(sizeof(HashTableAnchor) * candidateHashTablesSize);
         weightLists = (HashTableElement *)allocator->allocate(sizeof(HashTableElement) * numWeightLists);
-        hashTableElementPool = (HashTableElement *)allocator->allocate(sizeof(HashTableElement) * hashTableElementPoolSize); // Allocte last, because it's biggest and usually unused.  This puts all of the commonly used stuff into one large page.
         hitCountByExtraSearchDepth = (unsigned *)allocator->allocate(sizeof(*hitCountByExtraSearchDepth) * extraSearchDepth);
         if (maxSecondaryAlignmentsPerContig > 0) {
             hitsPerContigCounts = (HitsPerContigCounts *)allocator->allocate(sizeof(*hitsPerContigCounts) * genome->getNumContigs());
@@ -223,7 +223,6 @@ Arguments:
         candidateHashTable[FORWARD] = (HashTableAnchor *)BigAlloc(sizeof(HashTableAnchor) * candidateHashTablesSize);
         candidateHashTable[RC] = (HashTableAnchor *)BigAlloc(sizeof(HashTableAnchor) * candidateHashTablesSize);
         weightLists = (HashTableElement *)BigAlloc(sizeof(HashTableElement) * numWeightLists);
-        hashTableElementPool = (HashTableElement *)BigAlloc(sizeof(HashTableElement) * hashTableElementPoolSize);
         hitCountByExtraSearchDepth = (unsigned *)BigAlloc(sizeof(*hitCountByExtraSearchDepth) * extraSearchDepth);
         if (maxSecondaryAlignmentsPerContig > 0) {
             hitsPerContigCounts = (HitsPerContigCounts *)BigAlloc(sizeof(*hitsPerContigCounts) * genome->getNumContigs());
@@ -234,9 +233,11 @@ Arguments:
         }
     }
 
-    for (unsigned i = 0; i < hashTableElementPoolSize; i++) {
-        hashTableElementPool[i].init();
-    }
+    //
+    // The element pool is sized for every hit of every seed, which almost never happens, so it's only reserved here
+    // and elements are committed (and initialized) as alignments use them.
+    //
+    hashTableElementPool.reserve(allocator, hashTableElementPoolSize);
 
     for (unsigned i = 0; i < maxSeedsToUse + 1; i++) {
         weightLists[i].init();
@@ -245,6 +246,7 @@ Arguments:
     for (Direction rc = 0; rc < NUM_DIRECTIONS; rc++) {
         memset(candidateHashTable[rc],0,sizeof(HashTableAnchor) * candidateHashTablesSize);
     }
+
     hashTableEpoch = 0;
 
  
@@ -255,7 +257,85 @@ Arguments:
 bool _DumpAlignments = false;
 #endif  // _DEBUG
 
-    void
+    bool
+BaseAligner::alignFromHint(
+    Read                    *read,
+    SingleAlignmentResult   *result)
+/*++
+
+Routine Description:
+
+    Try the location at which the read was aligned in its input file (lifted over by contig name by the reader),
+    rather than searching for it.  This is for realigning to a patched reference, where almost every read lands
+    where it was before.
+
+    We only accept the hint if the read was a unique (high MAPQ) primary alignment and it still matches within
+    HintMaxScore.  Since we don't look anywhere else we can't compute a MAPQ, so we keep the original one.
+
+Arguments:
+
+    read                                - the read to align
+    result                              - the result if the hint is accepted
+
+Return Value:
+
+    true if the hint was accepted
+
+--*/
+{
+    GenomeLocation originalLocation = read->getOriginalAlignedLocation();
+    unsigned originalFlags = read->getOriginalSAMFlags();
+    unsigned readLen = read->getDataLength();
+
+    if (InvalidGenomeLocation == originalLocation || (originalFlags & (SAM_UNMAPPED | SAM_SECONDARY | SAM_SUPPLEMENTARY)) != 0 ||
+        read->getOriginalMAPQ() < HintMinMAPQ || readLen == 0 || readLen > maxReadSize) {
+        return false;
+    }
+
+    //
+    // The original location is where the first unclipped base landed, and the clipping that was used for it
+    // isn't necessarily the same as ours, so adjust for both.  For an RC read the front of the alignment is the back
+    // of the read.
+    //
+    Direction direction;
+    GenomeLocation location;
+    const char *dataToScore;
+    const char *qualityToScore;
+    if (originalFlags & SAM_REVERSE_COMPLEMENT) {
+        direction = RC;
+        location = originalLocation - read->getOriginalBackClipping() + read->getBackClippedLength();
+        SequenceCodec::reverseComplement(rcReadData, read->getData(), readLen, rcTranslationTable);
+        SequenceCodec::reverse(rcReadQuality, read->getQuality(), readLen);
+        dataToScore = rcReadData;
+        qualityToScore = rcReadQuality;
+    } else {
+        direction = FORWARD;
+        location = originalLocation - read->getOriginalFrontClipping() + read->getFrontClippedLength();
+        dataToScore = read->getData();
+        qualityToScore = read->getQuality();
+    }
+
+    const char *text = genome->getSubstring(location, readLen + MAX_K);
+    if (NULL == text) {
+        return false;
+    }
+
+    double matchProbability;
+    int score = landauVishkin->computeEditDistance(text, readLen + MAX_K, dataToScore, qualityToScore, readLen, __min(HintMaxScore, maxK), &matchProbability);
+    nLocationsScored++;
+    if (score < 0) {
+        return false;
+    }
+
+    result->location = location;
+    result->direction = direction;
+    result->score = score;
+    result->mapq = __min(read->getOriginalMAPQ(), AlignerStats::maxMapq);
+    result->status = SingleHit;
+    return true;
+}
+
+    bool
 BaseAligner::AlignRead(
         Read                    *inputRead,
         SingleAlignmentResult   *primaryResult,
@@ -293,6 +373,7 @@ Return Value:
     if (NULL != nSecondaryResults) {
         *nSecondaryResults = 0;
     }
+    secondaryResultBufferFull = false;
 
     firstPassSeedsNotSkipped[FORWARD] = firstPassSeedsNotSkipped[RC] = 0;
     smallestSkippedSeed[FORWARD] = smallestSkippedSeed[RC] = 0x8fffffffffffffff;
@@ -323,12 +404,36 @@ Return Value:
         soft_exit(1);
     }
 
+    if (useHints && maxEditDistanceForSecondaryResults < 0 && alignFromHint(inputRead, primaryResult)) {
+        nHintsUsed++;
+        if (0 == hintValidationInterval || 0 != nHintsUsed % hintValidationInterval) {
+            return true;
+        }
+
+        //
+        // Sample this one: do the full search and see whether it comes out the same.  We return the full
+        // search result, since if they differ it's the better one.
+        //
+        SingleAlignmentResult hintResult = *primaryResult;
+        useHints = false;
+        bool worked = AlignRead(inputRead, primaryResult, maxEditDistanceForSecondaryResults, secondaryResultBufferSize, nSecondaryResults,
+                                maxSecondaryResults, secondaryResults);
+        useHints = true;
+        if (worked) {
+            nHintsValidated++;
+            if (primaryResult->location != hintResult.location || primaryResult->direction != hintResult.direction) {
+                nHintsDisagreed++;
+            }
+        }
+        return worked;
+    }
+
     if ((int)inputRead->getDataLength() < seedLen) {
         //
         // Too short to have any seeds, it's hopeless.
         // No need to finalize secondary results, since we don't have any.
         //
-        return;
+        return true;
     }
 
 #ifdef TRACE_ALIGNER
@@ -349,22 +454,15 @@ Return Value:
 
     unsigned readLen = inputRead->getDataLength();
     const char *readData = inputRead->getData();
-    const char *readQuality = inputRead->getQuality();
-    unsigned countOfNs = 0;
-    for (unsigned i = 0; i < readLen; i++) {
-        char baseByte = readData[i];
-        char complement = rcTranslationTable[baseByte];
-        rcReadData[readLen - i - 1] = complement;
-        rcReadQuality[readLen - i - 1] = readQuality[i];
-        reversedRead[FORWARD][readLen - i - 1] = baseByte;
-        reversedRead[RC][i] = complement;
-        countOfNs += nTable[baseByte];
-    }
+    //
+    // The RC read reversed is just the read complemented.
+    //
+    unsigned countOfNs = inputRead->prepareForAlignment(rcReadData, rcReadQuality, reversedRead[FORWARD], reversedRead[RC], rcTranslationTable);
 
     if (countOfNs > maxK) {
         nReadsIgnoredBecauseOfTooManyNs++;
         // No need to finalize secondary results, since we don't have any.
-        return;
+        return true;
     }
 
     //
@@ -442,12 +540,16 @@ Return Value:
                     nSecondaryResults,
                     secondaryResults);
 
+                if (secondaryResultBufferFull) {
+                    return false;
+                }
+
 #ifdef  _DEBUG
                 if (_DumpAlignments) printf("\tFinal result score %d MAPQ %d (%e probability of best candidate, %e probability of all candidates)  at %u\n", 
                                             primaryResult->score, primaryResult->mapq, probabilityOfBestCandidate, probabilityOfAllCandidates, primaryResult->location);
 #endif  // _DEBUG
                 finalizeSecondaryResults(*primaryResult, nSecondaryResults, secondaryResults, maxSecondaryResults, maxEditDistanceForSecondaryResults, bestScore);
-                return;
+                return true;
             }
             nextSeedToTest = GetWrappedNextSeedToTest(seedLen, wrapCount);
 
@@ -640,12 +742,16 @@ Return Value:
                     nSecondaryResults,
                     secondaryResults)) {
 
+                if (secondaryResultBufferFull) {
+                    return false;
+                }
+
 #ifdef  _DEBUG
                 if (_DumpAlignments) printf("\tFinal result score %d MAPQ %d at %u\n", primaryResult->score, primaryResult->mapq, primaryResult->location);
 #endif  // _DEBUG
 
                 finalizeSecondaryResults(*primaryResult, nSecondaryResults, secondaryResults, maxSecondaryResults, maxEditDistanceForSecondaryResults, bestScore);
-                return;
+                return true;
             }
         }
     }
@@ -665,12 +771,16 @@ Return Value:
         nSecondaryResults,
         secondaryResults);
 
+    if (secondaryResultBufferFull) {
+        return false;
+    }
+
 #ifdef  _DEBUG
     if (_DumpAlignments) printf("\tFinal result score %d MAPQ %d (%e probability of best candidate, %e probability of all candidates) at %u\n", primaryResult->score, primaryResult->mapq, probabilityOfBestCandidate, probabilityOfAllCandidates, primaryResult->location);
 #endif  // _DEBUG
 
     finalizeSecondaryResults(*primaryResult, nSecondaryResults, secondaryResults, maxSecondaryResults, maxEditDistanceForSecondaryResults, bestScore);
-    return;
+    return true;
 }
 
   /**
@@ -962,7 +1072,7 @@ Return Value:
                         } else {
                             score = score1 + score2;
                             // Map probabilities for substrings can be multiplied, but make sure to count seed too
-                            matchProbability = matchProb1 * matchProb2 * pow(1 - SNP_PROB, seedLen);
+                            matchProbability = matchProb1 * matchProb2 * seedMatchProbability;
 
                             //
                             // Adjust the genome location based on any indels that we found.
@@ -1093,8 +1203,8 @@ Return Value:
                     //
                     if (NULL != secondaryResults && (int)(bestScore - score) <= maxEditDistanceForSecondaryResults) { // bestScore is initialized to UnusedScoreValue, which is large, so this won't fire if this is the first candidate
                         if (secondaryResultBufferSize <= *nSecondaryResults) {
-                            WriteErrorMessage("Out of secondary result buffer in BaseAliner::score(), which shouldn't be possible");
-                            soft_exit(1);
+                            secondaryResultBufferFull = true;
+                            return true;    // AlignRead will tell the caller to retry with a bigger buffer
                         }
 
                         SingleAlignmentResult *result = &secondaryResults[*nSecondaryResults];
@@ -1133,8 +1243,8 @@ Return Value:
                     //
                     if (-1 != maxEditDistanceForSecondaryResults && NULL != secondaryResults && (int)(bestScore - score) <= maxEditDistanceForSecondaryResults && score != -1) {
                          if (secondaryResultBufferSize <= *nSecondaryResults) {
-                            WriteErrorMessage("Out of secondary result buffer in BaseAliner::score(), which shouldn't be possible");
-                            soft_exit(1);
+                            secondaryResultBufferFull = true;
+                            return true;    // AlignRead will tell the caller to retry with a bigger buffer
                         }
 
                         SingleAlignmentResult *result = &secondaryResults[*nSecondaryResults];
@@ -1313,6 +1423,7 @@ Return Value:
 #endif  // DBG
 
     _ASSERT(nUsedHashTableElements < hashTableElementPoolSize);
+    hashTableElementPool.ensure(nUsedHashTableElements + 1);
     element = &hashTableElementPool[nUsedHashTableElements];
     nUsedHashTableElements++;
 
@@ -1416,7 +1527,6 @@ Return Value:
         weightLists = NULL;
 
         BigDealloc(hashTableElementPool);
-        hashTableElementPool = NULL;
 
         if (NULL != hitsPerContigCounts) {
             BigDealloc(hitsPerContigCounts);
@@ -1513,7 +1623,6 @@ BaseAligner::getBigAllocatorReservation(GenomeIndex *index, bool ownLandauVishki
         maxSeedsToUse = (unsigned)(maxReadSize * seedCoverage / seedLen);
     }
     size_t candidateHashTablesSize = (maxHitsToConsider * maxSeedsToUse * 3)/2;    // *1.5 for hash table slack
-    size_t hashTableElementPoolSize = maxHitsToConsider * maxSeedsToUse * 2 ;   // *2 for RC
     size_t contigCounters;
     if (maxSecondaryAlignmentsPerContig > 0) {
         contigCounters = sizeof(HitsPerContigCounts)* index->getGenome()->getNumContigs();
@@ -1531,7 +1640,6 @@ BaseAligner::getBigAllocatorReservation(GenomeIndex *index, bool ownLandauVishki
         sizeof(char) * maxReadSize * 2                                  + // rcReadData
         sizeof(char) * maxReadSize * 4 + 2 * MAX_K                      + // reversed read (both)
         sizeof(BYTE) * (maxReadSize + 7 + 128) / 8                      + // seed used
-        sizeof(HashTableElement) * hashTableElementPoolSize             + // hash table element pool
         sizeof(HashTableAnchor) * candidateHashTablesSize * 2           + // candidate hash table (both)
         sizeof(HashTableElement) * (maxSeedsToUse + 1);                   // weight lists
 }
@@ -60,9 +60,15 @@ public:
 
     static unsigned getMaxSecondaryResults(unsigned maxSeedsToUse, double maxSeedCoverage, unsigned maxReadSize, unsigned maxHits, unsigned seedLength);
 
+    //
+    // The callers start their secondary result buffers at this size and double them when AlignRead returns false,
+    // rather than allocating getMaxSecondaryResults() up front.  That's almost never needed.
+    //
+    static const unsigned InitialSecondaryResultBufferCount = 32;
+
     virtual ~BaseAligner();
 
-        void
+        bool
     AlignRead(
         Read                    *read,
         SingleAlignmentResult   *primaryResult,
@@ -83,6 +89,9 @@ public:
     _int64 getNHitsIgnoredBecauseOfTooHighPopularity() const {return nHitsIgnoredBecauseOfTooHighPopularity;}
     _int64 getNReadsIgnoredBecauseOfTooManyNs() const {return nReadsIgnoredBecauseOfTooManyNs;}
     _int64 getNIndelsMerged() const {return nIndelsMerged;}
+    _int64 getNHintsUsed() const {return nHintsUsed;}
+    _int64 getNHintsValidated() const {return nHintsValidated;}
+    _int64 getNHintsDisagreed() const {return nHintsDisagreed;}
     void addIgnoredReads(_int64 newlyIgnoredReads) {nReadsIgnoredBecauseOfTooManyNs += newlyIgnoredReads;}
 
     const char *getRCTranslationTable() const {return rcTranslationTable;}
@@ -109,6 +118,23 @@ public:
     inline bool getStopOnFirstHit() {return stopOnFirstHit;}
     inline void setStopOnFirstHit(bool newValue) {stopOnFirstHit = newValue;}
 
+    //
+    // Realignment hints.  When set, AlignRead first scores the read at the location it had in its input (SAM/BAM)
+    // file, and if that verifies and the read was uniquely aligned before, uses it without doing a seed search.
+    // Every validationInterval-th hinted read gets the full search anyway, to measure how often the hint is wrong
+    // (0 means never).
+    //
+    inline void setUseHints(bool newValue, unsigned validationInterval) {useHints = newValue; hintValidationInterval = validationInterval;}
+
+    //
+    // Score the read at its original alignment, and fill in result if it's within HintMaxScore.  Doesn't depend
+    // on any seed search state, so the paired-end aligner can call it directly.
+    //
+    bool alignFromHint(Read *read, SingleAlignmentResult *result);
+
+    static const unsigned HintMinMAPQ = 30;     // Only trust hints that were unique when they were aligned
+    static const int HintMaxScore = 3;          // and are still close to the (patched) reference
+
     static size_t getBigAllocatorReservation(GenomeIndex *index, bool ownLandauVishkin, unsigned maxHitsToConsider, unsigned maxReadSize, unsigned seedLen, 
         unsigned numSeedsFromCommandLine, double seedCoverage, int maxSecondaryAlignmentsPerContig);
 
@@ -135,6 +161,9 @@ private:
     _int64 nHitsIgnoredBecauseOfTooHighPopularity;
     _int64 nReadsIgnoredBecauseOfTooManyNs;
     _int64 nIndelsMerged;
+    _int64 nHintsUsed;
+    _int64 nHintsValidated;
+    _int64 nHintsDisagreed;
 
     //
     // A bitvector indexed by offset in the read indicating whether this seed is used.
@@ -217,7 +246,7 @@ private:
 
     unsigned nUsedHashTableElements;
     unsigned hashTableElementPoolSize;
-    HashTableElement *hashTableElementPool;
+    GrowingBigArray<HashTableElement> hashTableElementPool;    // Worst case is huge and rarely approached, so it's committed as it's used
 
     const HashTableElement emptyHashTableElement;
 
@@ -285,6 +314,7 @@ private:
     const Genome *genome;
     GenomeIndex *genomeIndex;
     unsigned seedLen;
+    double seedMatchProbability;    // The chance that seedLen bases have no mutations, which the seed hit doesn't score
     unsigned maxHitsToConsider;
     unsigned maxK;
     unsigned maxReadSize;
@@ -310,13 +340,13 @@ private:
     char *rcReadQuality;
     char *reversedRead[NUM_DIRECTIONS];
 
-    unsigned nTable[256];
-
     int readId;
     
     // How many overly popular (> maxHits) seeds we skipped this run
     unsigned popularSeedsSkipped;
 
+    bool secondaryResultBufferFull;  // Set by score() when it has to give up because secondaryResults is full
+
     bool explorePopularSeeds; // Whether we should explore the first maxHits hits even for overly
                               // popular seeds (useful for filtering reads that come from a database
                               // with many very similar sequences).
@@ -324,6 +354,9 @@ private:
     bool stopOnFirstHit;      // Whether to stop the first time a location matches with less than
                               // maxK edit distance (useful when using SNAP for filtering only).
 
+    bool useHints;
+    unsigned hintValidationInterval;
+
     AlignerStats *stats;
 
     unsigned *hitCountByExtraSearchDepth;   // How many hits at each depth bigger than the current best edit distance.
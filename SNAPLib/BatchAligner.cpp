@@ -0,0 +1,922 @@
+/*++
+
+Module Name:
+
+    BatchAligner.cpp
+
+Abstract:
+
+    Aligning in-memory batches of reads for programs that embed SNAPLib.
+
+Environment:
+
+    User mode service.
+
+Revision History:
+
+--*/
+
+#include "stdafx.h"
+#include "BatchAligner.h"
+#include "AlignerOptions.h"
+#include "PairedAligner.h"
+#include "BaseAligner.h"
+#include "IntersectingPairedEndAligner.h"
+#include "ChimericPairedEndAligner.h"
+#include "GenomeIndex.h"
+#include "LandauVishkin.h"
+#include "BigAlloc.h"
+#include "ParallelTask.h"
+#include "SAM.h"
+#include "SeedSequencer.h"
+#include "Error.h"
+
+using std::min;
+using std::max;
+
+    void
+BatchCigars::clear()
+{
+    text.clear();
+    offsets.clear();
+    editDistances.clear();
+}
+
+    void
+BatchCigars::add(
+    const char *cigar,
+    int editDistance)
+{
+    if (NULL == cigar) {
+        offsets.push_back(-1);
+    } else {
+        offsets.push_back((int)text.size());
+        for (const char *p = cigar; ; p++) {
+            text.push_back(*p);
+            if ('\0' == *p) {
+                break;
+            }
+        }
+    }
+    editDistances.push_back(editDistance);
+}
+
+    const char *
+BatchCigars::getCigar(
+    int whichAlignment) const
+{
+    if (whichAlignment >= offsets.size() || offsets[whichAlignment] < 0) {
+        return NULL;
+    }
+    return &text[offsets[whichAlignment]];
+}
+
+    int
+BatchCigars::getEditDistance(
+    int whichAlignment) const
+{
+    return whichAlignment < editDistances.size() ? editDistances[whichAlignment] : -1;
+}
+
+    void
+SingleBatchResults::Chunk::clear()
+{
+    firstAlignment.clear();
+    alignments.clear();
+    cigars.clear();
+}
+
+SingleBatchResults::~SingleBatchResults()
+{
+    for (int i = 0; i < chunks.size(); i++) {
+        delete chunks[i];
+    }
+}
+
+    void
+SingleBatchResults::reset(
+    int i_nReads,
+    int nChunks)
+{
+    nReads = i_nReads;
+    while (chunks.size() < nChunks) {
+        chunks.push_back(new Chunk());
+    }
+}
+
+    const SingleBatchResults::Chunk *
+SingleBatchResults::getChunk(
+    int whichRead,
+    int *o_first) const
+{
+    _ASSERT(whichRead >= 0 && whichRead < nReads);
+    const Chunk *chunk = chunks[whichRead / BatchAligner::ChunkSize];
+    *o_first = chunk->firstAlignment[whichRead % BatchAligner::ChunkSize];
+    return chunk;
+}
+
+    int
+SingleBatchResults::getNumAlignments(
+    int whichRead) const
+{
+    int first;
+    const Chunk *chunk = getChunk(whichRead, &first);
+    return chunk->firstAlignment[whichRead % BatchAligner::ChunkSize + 1] - first;
+}
+
+    const SingleAlignmentResult *
+SingleBatchResults::getAlignments(
+    int whichRead) const
+{
+    int first;
+    const Chunk *chunk = getChunk(whichRead, &first);
+    return &chunk->alignments[first];
+}
+
+    const char *
+SingleBatchResults::getCigar(
+    int whichRead,
+    int whichAlignment) const
+{
+    int first;
+    const Chunk *chunk = getChunk(whichRead, &first);
+    return chunk->cigars.getCigar(first + whichAlignment);
+}
+
+    int
+SingleBatchResults::getEditDistance(
+    int whichRead,
+    int whichAlignment) const
+{
+    int first;
+    const Chunk *chunk = getChunk(whichRead, &first);
+    return chunk->cigars.getEditDistance(first + whichAlignment);
+}
+
+    void
+PairedBatchResults::Chunk::clear()
+{
+    firstPaired.clear();
+    paired.clear();
+    pairedCigars.clear();
+    for (int whichRead = 0; whichRead < NUM_READS_PER_PAIR; whichRead++) {
+        firstSingle[whichRead].clear();
+        single[whichRead].clear();
+        singleCigars[whichRead].clear();
+    }
+}
+
+PairedBatchResults::~PairedBatchResults()
+{
+    for (int i = 0; i < chunks.size(); i++) {
+        delete chunks[i];
+    }
+}
+
+    void
+PairedBatchResults::reset(
+    int i_nPairs,
+    int nChunks)
+{
+    nPairs = i_nPairs;
+    while (chunks.size() < nChunks) {
+        chunks.push_back(new Chunk());
+    }
+}
+
+    const PairedBatchResults::Chunk *
+PairedBatchResults::getChunk(
+    int whichPair,
+    int *o_first) const
+{
+    _ASSERT(whichPair >= 0 && whichPair < nPairs);
+    *o_first = whichPair % BatchAligner::ChunkSize;
+    return chunks[whichPair / BatchAligner::ChunkSize];
+}
+
+    int
+PairedBatchResults::getNumPairedAlignments(
+    int whichPair) const
+{
+    int i;
+    const Chunk *chunk = getChunk(whichPair, &i);
+    return chunk->firstPaired[i + 1] - chunk->firstPaired[i];
+}
+
+    const PairedAlignmentResult *
+PairedBatchResults::getPairedAlignments(
+    int whichPair) const
+{
+    int i;
+    const Chunk *chunk = getChunk(whichPair, &i);
+    return &chunk->paired[chunk->firstPaired[i]];
+}
+
+    int
+PairedBatchResults::getNumSingleAlignments(
+    int whichPair,
+    int whichRead) const
+{
+    int i;
+    const Chunk *chunk = getChunk(whichPair, &i);
+    return chunk->firstSingle[whichRead][i + 1] - chunk->firstSingle[whichRead][i];
+}
+
+    const SingleAlignmentResult *
+PairedBatchResults::getSingleAlignments(
+    int whichPair,
+    int whichRead) const
+{
+    int i;
+    const Chunk *chunk = getChunk(whichPair, &i);
+    return &chunk->single[whichRead][chunk->firstSingle[whichRead][i]];
+}
+
+    const char *
+PairedBatchResults::getPairedCigar(
+    int whichPair,
+    int whichAlignment,
+    int whichRead) const
+{
+    int i;
+    const Chunk *chunk = getChunk(whichPair, &i);
+    return chunk->pairedCigars.getCigar(NUM_READS_PER_PAIR * (chunk->firstPaired[i] + whichAlignment) + whichRead);
+}
+
+    int
+PairedBatchResults::getPairedEditDistance(
+    int whichPair,
+    int whichAlignment,
+    int whichRead) const
+{
+    int i;
+    const Chunk *chunk = getChunk(whichPair, &i);
+    return chunk->pairedCigars.getEditDistance(NUM_READS_PER_PAIR * (chunk->firstPaired[i] + whichAlignment) + whichRead);
+}
+
+    const char *
+PairedBatchResults::getSingleCigar(
+    int whichPair,
+    int whichRead,
+    int whichAlignment) const
+{
+    int i;
+    const Chunk *chunk = getChunk(whichPair, &i);
+    return chunk->singleCigars[whichRead].getCigar(chunk->firstSingle[whichRead][i] + whichAlignment);
+}
+
+    int
+PairedBatchResults::getSingleEditDistance(
+    int whichPair,
+    int whichRead,
+    int whichAlignment) const
+{
+    int i;
+    const Chunk *chunk = getChunk(whichPair, &i);
+    return chunk->singleCigars[whichRead].getEditDistance(chunk->firstSingle[whichRead][i] + whichAlignment);
+}
+
+//
+// The aligners and scratch memory for one thread at a time.  These are set up the same way as in
+// the single and paired aligner contexts' runIterationThread.
+//
+class BatchAligner::Worker
+{
+public:
+    Worker(BatchAligner *i_owner) : owner(i_owner), options(i_owner->options), genome(i_owner->index->getGenome()) {}
+
+    virtual ~Worker() {}
+
+    virtual void alignChunk(Batch *batch, int whichChunk) = 0;
+
+protected:
+
+    //
+    // Compute the CIGAR string for an alignment the way SimpleReadWriter does when it writes SAM or BAM, including moving
+    // the alignment when the CIGAR would start with an indel.  Updates the status and location to match what would be
+    // written.  Returns NULL for an unaligned read.
+    //
+    const char *computeCigar(Read *read, AlignmentResult *status, GenomeLocation *location, Direction direction, int *o_editDistance);
+
+    BatchAligner           *owner;
+    AlignerOptions         *options;
+    const Genome           *genome;
+
+private:
+    static const int CigarBufSize = 2 * MAX_READ_LENGTH;
+    static const int CigarBufWithClippingSize = 2 * MAX_READ_LENGTH + 32;
+
+    LandauVishkinWithCigar  lvc;
+    char                    data[MAX_READ_LENGTH];
+    char                    quality[MAX_READ_LENGTH];
+    char                    cigarBuf[CigarBufSize];
+    char                    cigarBufWithClipping[CigarBufWithClippingSize];
+};
+
+    const char *
+BatchAligner::Worker::computeCigar(
+    Read *read,
+    AlignmentResult *status,
+    GenomeLocation *location,
+    Direction direction,
+    int *o_editDistance)
+{
+    *o_editDistance = -1;
+    if (NotFound == *status || InvalidGenomeLocation == *location) {
+        *location = InvalidGenomeLocation;
+        return NULL;
+    }
+
+    const GenomeLocation originalLocation = *location;
+    const Genome::Contig *originalContig = genome->getContigAtLocation(originalLocation);
+    int cumulativeAddFrontClipping = 0;
+    unsigned nAdjustments = 0;
+    const char *cigar = NULL;
+
+    read->setAdditionalFrontClipping(0);
+    for (;;) {
+        const char *contigName;
+        int contigIndex;
+        int flags;
+        GenomeDistance positionInContig;
+        int mapQuality = 0;
+        const char *mateContigName;
+        int mateContigIndex;
+        GenomeDistance matePositionInContig;
+        _int64 templateLength;
+        unsigned fullLength;
+        const char *clippedData;
+        unsigned clippedLength;
+        unsigned basesClippedBefore;
+        unsigned basesClippedAfter;
+        GenomeDistance extraBasesClippedBefore;
+        size_t qnameLen = read->getIdLength();
+
+        if (!SAMFormat::createSAMLine(genome, &lvc, data, quality, MAX_READ_LENGTH, contigName, contigIndex, flags, positionInContig,
+                mapQuality, mateContigName, mateContigIndex, matePositionInContig, templateLength, fullLength, clippedData, clippedLength,
+                basesClippedBefore, basesClippedAfter, qnameLen, read, *status, *location, direction, false, options->useM,
+                false, false, false, NULL, NotFound, InvalidGenomeLocation, FORWARD, &extraBasesClippedBefore)) {
+            cigar = NULL;
+            break;
+        }
+
+        int addFrontClipping = 0;
+        cigar = SAMFormat::computeCigarString(genome, &lvc, cigarBuf, CigarBufSize, cigarBufWithClipping, CigarBufWithClippingSize,
+            clippedData, clippedLength, basesClippedBefore, extraBasesClippedBefore, basesClippedAfter,
+            read->getOriginalFrontHardClipping(), read->getOriginalBackHardClipping(), *location, direction, options->useM,
+            o_editDistance, &addFrontClipping);
+        if (0 == addFrontClipping) {
+            break;
+        }
+
+        nAdjustments++;
+        const Genome::Contig *newContig = genome->getContigAtLocation(originalLocation + addFrontClipping);
+        if (newContig == NULL || newContig != originalContig ||
+            *location + addFrontClipping > originalContig->beginningLocation + originalContig->length - genome->getChromosomePadding() ||
+            nAdjustments > read->getDataLength()) {
+            //
+            // Altering this would push us over a contig boundary, or we're stuck in a loop.  Give up on the alignment, as the writer does.
+            //
+            *status = NotFound;
+            *location = InvalidGenomeLocation;
+            *o_editDistance = -1;
+            cigar = NULL;
+            break;
+        }
+
+        cumulativeAddFrontClipping += addFrontClipping;
+        if (addFrontClipping > 0) {
+            read->setAdditionalFrontClipping(cumulativeAddFrontClipping);
+        }
+        *location = originalLocation + cumulativeAddFrontClipping;
+    }
+
+    read->setAdditionalFrontClipping(0);
+    return cigar;
+}
+
+class BatchAligner::SingleWorker : public BatchAligner::Worker
+{
+public:
+    SingleWorker(BatchAligner *i_owner);
+    virtual ~SingleWorker();
+
+    virtual void alignChunk(Batch *batch, int whichChunk);
+
+private:
+    BigAllocator           *allocator;
+    BaseAligner            *aligner;
+    SingleAlignmentResult  *alignmentResults;
+    unsigned                alignmentResultBufferCount;
+    unsigned                maxAlignmentResultBufferCount;
+};
+
+BatchAligner::SingleWorker::SingleWorker(BatchAligner *i_owner) : Worker(i_owner)
+{
+    GenomeIndex *index = owner->index;
+    unsigned maxReadSize = MAX_READ_LENGTH;
+
+    if (options->maxSecondaryAlignmentAdditionalEditDistance < 0) {
+        maxAlignmentResultBufferCount = 1; // For the primary alignment
+    } else {
+        maxAlignmentResultBufferCount = BaseAligner::getMaxSecondaryResults(options->numSeedsFromCommandLine, options->seedCoverage, maxReadSize,
+            options->maxHits, index->getSeedLength()) + 1; // +1 for the primary alignment
+    }
+    alignmentResultBufferCount = min(maxAlignmentResultBufferCount, BaseAligner::InitialSecondaryResultBufferCount + 1);
+
+    allocator = new BigAllocator(BaseAligner::getBigAllocatorReservation(index, true, options->maxHits, maxReadSize, index->getSeedLength(),
+        options->numSeedsFromCommandLine, options->seedCoverage, options->maxSecondaryAlignmentsPerContig));
+
+    aligner = new (allocator) BaseAligner(
+            index,
+            options->maxHits,
+            options->maxDist,
+            maxReadSize,
+            options->numSeedsFromCommandLine,
+            options->seedCoverage,
+            options->minWeightToCheck,
+            options->extraSearchDepth,
+            options->noUkkonen,
+            options->noOrderedEvaluation,
+            options->noTruncation,
+            options->maxSecondaryAlignmentsPerContig,
+            NULL,               // LV (no need to cache in the single aligner)
+            NULL,               // reverse LV
+            NULL,               // stats
+            allocator);
+
+    alignmentResults = (SingleAlignmentResult *)BigAlloc(sizeof(*alignmentResults) * alignmentResultBufferCount);
+
+    allocator->checkCanaries();
+
+    aligner->setExplorePopularSeeds(options->explorePopularSeeds);
+    aligner->setStopOnFirstHit(options->stopOnFirstHit);
+    aligner->setUseHints(options->useHints, options->hintValidationInterval);
+}
+
+BatchAligner::SingleWorker::~SingleWorker()
+{
+    aligner->~BaseAligner(); // This calls the destructor without calling operator delete, allocator owns the memory.
+    BigDealloc(alignmentResults);
+    delete allocator;
+}
+
+    void
+BatchAligner::SingleWorker::alignChunk(
+    Batch *batch,
+    int whichChunk)
+{
+    SingleBatchResults::Chunk *chunk = batch->singleResults->chunks[whichChunk];
+    chunk->clear();
+
+    int end = min(batch->nReads, (whichChunk + 1) * ChunkSize);
+    for (int whichRead = whichChunk * ChunkSize; whichRead < end; whichRead++) {
+        Read *read = batch->reads[whichRead];
+        read->clip(options->clipping);
+        chunk->firstAlignment.push_back(chunk->alignments.size());
+
+        int nSecondaryResults = 0;
+        if (read->getDataLength() < options->minReadLength || read->countOfNs() > options->maxDist) {
+            alignmentResults[0].status = NotFound;
+            alignmentResults[0].location = InvalidGenomeLocation;
+            alignmentResults[0].mapq = 0;
+            alignmentResults[0].direction = FORWARD;
+            alignmentResults[0].score = 0;
+        } else {
+            while (!aligner->AlignRead(read, alignmentResults, options->maxSecondaryAlignmentAdditionalEditDistance, alignmentResultBufferCount - 1,
+                    &nSecondaryResults, options->maxSecondaryAlignments, alignmentResults + 1)) {
+                if (alignmentResultBufferCount >= maxAlignmentResultBufferCount) {
+                    WriteErrorMessage("Out of secondary result buffer aligning read %.*s, which shouldn't be possible\n", read->getIdLength(), read->getId());
+                    soft_exit(1);
+                }
+                alignmentResultBufferCount = min(maxAlignmentResultBufferCount, 2 * alignmentResultBufferCount);
+                BigDealloc(alignmentResults);
+                alignmentResults = (SingleAlignmentResult *)BigAlloc(sizeof(*alignmentResults) * alignmentResultBufferCount);
+            }
+            allocator->checkCanaries();
+        }
+
+        for (int i = 0; i <= nSecondaryResults; i++) {
+            SingleAlignmentResult *result = &alignmentResults[i];
+            if (batch->computeCigars) {
+                int editDistance;
+                const char *cigar = computeCigar(read, &result->status, &result->location, result->direction, &editDistance);
+                chunk->cigars.add(cigar, editDistance);
+            } else if (NotFound == result->status) {
+                result->location = InvalidGenomeLocation;
+            }
+            chunk->alignments.push_back(*result);
+        }
+    }
+    chunk->firstAlignment.push_back(chunk->alignments.size());
+}
+
+class BatchAligner::PairedWorker : public BatchAligner::Worker
+{
+public:
+    PairedWorker(BatchAligner *i_owner);
+    virtual ~PairedWorker();
+
+    virtual void alignChunk(Batch *batch, int whichChunk);
+
+private:
+    PairedAlignerOptions           *pairedOptions;
+    BigAllocator                   *allocator;
+    IntersectingPairedEndAligner   *intersectingAligner;
+    ChimericPairedEndAligner       *aligner;
+    PairedAlignmentResult          *results;
+    SingleAlignmentResult          *singleSecondaryResults;
+    unsigned                        maxPairedSecondaryHits;
+    unsigned                        maxSingleSecondaryHits;
+    unsigned                        pairedSecondaryBufferCount;
+    unsigned                        singleSecondaryBufferCount;
+    int                             prefetchDepth;
+};
+
+BatchAligner::PairedWorker::PairedWorker(BatchAligner *i_owner) : Worker(i_owner), pairedOptions((PairedAlignerOptions *)i_owner->options)
+{
+    GenomeIndex *index = owner->index;
+    unsigned maxReadSize = MAX_READ_LENGTH;
+    prefetchDepth = doAlignerPrefetch ? pairedOptions->prefetchDepth : 0;
+
+    size_t memoryPoolSize = IntersectingPairedEndAligner::getBigAllocatorReservation(index, pairedOptions->intersectingAlignerMaxHits, maxReadSize,
+        index->getSeedLength(), options->numSeedsFromCommandLine, options->seedCoverage, options->maxDist, options->extraSearchDepth,
+        pairedOptions->maxCandidatePoolSize, options->maxSecondaryAlignmentsPerContig);
+
+    memoryPoolSize += ChimericPairedEndAligner::getBigAllocatorReservation(index, maxReadSize, options->maxHits, index->getSeedLength(),
+        options->numSeedsFromCommandLine, options->seedCoverage, options->maxDist, options->extraSearchDepth, pairedOptions->maxCandidatePoolSize,
+        options->maxSecondaryAlignmentsPerContig);
+
+    memoryPoolSize += LVResultCache::getBigAllocatorReservation(pairedOptions->lvCacheEntries);
+
+    if (options->maxSecondaryAlignmentAdditionalEditDistance < 0) {
+        maxPairedSecondaryHits = 0;
+        maxSingleSecondaryHits = 0;
+    } else {
+        maxPairedSecondaryHits = IntersectingPairedEndAligner::getMaxSecondaryResults(options->numSeedsFromCommandLine, options->seedCoverage,
+            maxReadSize, options->maxHits, index->getSeedLength(), pairedOptions->minSpacing, pairedOptions->maxSpacing);
+        maxSingleSecondaryHits = ChimericPairedEndAligner::getMaxSingleEndSecondaryResults(options->numSeedsFromCommandLine, options->seedCoverage,
+            maxReadSize, options->maxHits, index->getSeedLength());
+    }
+
+    pairedSecondaryBufferCount = min(maxPairedSecondaryHits, BaseAligner::InitialSecondaryResultBufferCount);
+    singleSecondaryBufferCount = min(maxSingleSecondaryHits, BaseAligner::InitialSecondaryResultBufferCount);
+
+    allocator = new BigAllocator(memoryPoolSize);
+
+    intersectingAligner = new (allocator) IntersectingPairedEndAligner(index, maxReadSize, options->maxHits, options->maxDist,
+        options->numSeedsFromCommandLine, options->seedCoverage, pairedOptions->minSpacing, pairedOptions->maxSpacing,
+        pairedOptions->intersectingAlignerMaxHits, options->extraSearchDepth, pairedOptions->maxCandidatePoolSize,
+        options->maxSecondaryAlignmentsPerContig, allocator, options->noUkkonen, options->noOrderedEvaluation, options->noTruncation);
+
+    intersectingAligner->setLVResultCache(allocator, pairedOptions->lvCacheEntries);
+    intersectingAligner->setAdaptiveSeedSchedule(pairedOptions->adaptiveSeedSchedule);
+
+    aligner = new (allocator) ChimericPairedEndAligner(
+        index,
+        maxReadSize,
+        options->maxHits,
+        options->maxDist,
+        options->numSeedsFromCommandLine,
+        options->seedCoverage,
+        options->minWeightToCheck,
+        pairedOptions->forceSpacing,
+        options->extraSearchDepth,
+        options->noUkkonen,
+        options->noOrderedEvaluation,
+        options->noTruncation,
+        intersectingAligner,
+        options->minReadLength,
+        options->maxSecondaryAlignmentsPerContig,
+        allocator);
+
+    aligner->setUseHints(options->useHints, options->hintValidationInterval, pairedOptions->minSpacing, pairedOptions->maxSpacing);
+
+    allocator->checkCanaries();
+
+    results = (PairedAlignmentResult *)BigAlloc((1 + pairedSecondaryBufferCount) * sizeof(*results)); // 1 + is for the primary result
+    singleSecondaryResults = (SingleAlignmentResult *)BigAlloc(max(singleSecondaryBufferCount, 1u) * sizeof(*singleSecondaryResults));
+}
+
+BatchAligner::PairedWorker::~PairedWorker()
+{
+    aligner->~ChimericPairedEndAligner();
+    intersectingAligner->~IntersectingPairedEndAligner();
+    BigDealloc(results);
+    BigDealloc(singleSecondaryResults);
+    delete allocator;
+}
+
+    void
+BatchAligner::PairedWorker::alignChunk(
+    Batch *batch,
+    int whichChunk)
+{
+    PairedBatchResults::Chunk *chunk = batch->pairedResults->chunks[whichChunk];
+    chunk->clear();
+
+    int begin = whichChunk * ChunkSize;
+    int end = min(batch->nReads, begin + ChunkSize);
+
+    //
+    // Clip the whole chunk first, so the prefetch pipeline sees the reads as they'll be aligned.
+    //
+    for (int i = begin * NUM_READS_PER_PAIR; i < end * NUM_READS_PER_PAIR; i++) {
+        batch->reads[i]->clip(options->clipping);
+    }
+
+    int maxDist = options->maxDist;
+    for (int whichPair = begin; whichPair < end; whichPair++) {
+        Read **reads = batch->reads + NUM_READS_PER_PAIR * whichPair;
+
+        if (prefetchDepth > 0) {
+            if (whichPair + prefetchDepth < end) {
+                Read **aheadReads = reads + NUM_READS_PER_PAIR * prefetchDepth;
+                intersectingAligner->beginPrefetch(aheadReads[0], aheadReads[1]);
+            }
+            if (whichPair + 1 < end) {     // with a depth of 1, the pair that was just begun
+                Read **aheadReads = reads + NUM_READS_PER_PAIR;
+                intersectingAligner->continuePrefetch(aheadReads[0], aheadReads[1]);
+            }
+        }
+
+        chunk->firstPaired.push_back(chunk->paired.size());
+        for (int whichRead = 0; whichRead < NUM_READS_PER_PAIR; whichRead++) {
+            chunk->firstSingle[whichRead].push_back(chunk->single[whichRead].size());
+        }
+
+        int nSecondaryResults = 0;
+        int nSingleSecondaryResults[NUM_READS_PER_PAIR] = {0, 0};
+
+        bool useful0 = reads[0]->getDataLength() >= options->minReadLength && (int)reads[0]->countOfNs() <= maxDist;
+        bool useful1 = reads[1]->getDataLength() >= options->minReadLength && (int)reads[1]->countOfNs() <= maxDist;
+        if (!useful0 && !useful1) {
+            memset(&results[0], 0, sizeof(results[0]));
+            results[0].status[0] = results[0].status[1] = NotFound;
+            results[0].location[0] = results[0].location[1] = InvalidGenomeLocation;
+        } else {
+            while (!aligner->align(reads[0], reads[1], results, options->maxSecondaryAlignmentAdditionalEditDistance, pairedSecondaryBufferCount,
+                    &nSecondaryResults, results + 1, singleSecondaryBufferCount, options->maxSecondaryAlignments, &nSingleSecondaryResults[0],
+                    &nSingleSecondaryResults[1], singleSecondaryResults)) {
+                //
+                // We don't know which of the buffers overflowed, so grow both.
+                //
+                if (pairedSecondaryBufferCount >= maxPairedSecondaryHits && singleSecondaryBufferCount >= maxSingleSecondaryHits) {
+                    WriteErrorMessage("Out of secondary result buffer aligning read %.*s, which shouldn't be possible\n", reads[0]->getIdLength(), reads[0]->getId());
+                    soft_exit(1);
+                }
+                pairedSecondaryBufferCount = min(maxPairedSecondaryHits, 2 * pairedSecondaryBufferCount);
+                singleSecondaryBufferCount = min(maxSingleSecondaryHits, 2 * singleSecondaryBufferCount);
+                BigDealloc(results);
+                BigDealloc(singleSecondaryResults);
+                results = (PairedAlignmentResult *)BigAlloc((1 + pairedSecondaryBufferCount) * sizeof(*results));
+                singleSecondaryResults = (SingleAlignmentResult *)BigAlloc(max(singleSecondaryBufferCount, 1u) * sizeof(*singleSecondaryResults));
+            }
+            allocator->checkCanaries();
+
+            if (pairedOptions->forceSpacing && isOneLocation(results[0].status[0]) != isOneLocation(results[0].status[1])) {
+                // either both align or neither do
+                results[0].status[0] = results[0].status[1] = NotFound;
+                results[0].location[0] = results[0].location[1] = InvalidGenomeLocation;
+            }
+        }
+
+        for (int i = 0; i <= nSecondaryResults; i++) {
+            PairedAlignmentResult *result = &results[i];
+            for (int whichRead = 0; whichRead < NUM_READS_PER_PAIR; whichRead++) {
+                if (batch->computeCigars) {
+                    int editDistance;
+                    const char *cigar = computeCigar(reads[whichRead], &result->status[whichRead], &result->location[whichRead],
+                        result->direction[whichRead], &editDistance);
+                    chunk->pairedCigars.add(cigar, editDistance);
+                } else if (NotFound == result->status[whichRead]) {
+                    result->location[whichRead] = InvalidGenomeLocation;
+                }
+            }
+            chunk->paired.push_back(*result);
+        }
+
+        SingleAlignmentResult *singleResults = singleSecondaryResults;
+        for (int whichRead = 0; whichRead < NUM_READS_PER_PAIR; whichRead++) {
+            for (int i = 0; i < nSingleSecondaryResults[whichRead]; i++) {
+                SingleAlignmentResult *result = &singleResults[i];
+                if (batch->computeCigars) {
+                    int editDistance;
+                    const char *cigar = computeCigar(reads[whichRead], &result->status, &result->location, result->direction, &editDistance);
+                    chunk->singleCigars[whichRead].add(cigar, editDistance);
+                }
+                chunk->single[whichRead].push_back(*result);
+            }
+            singleResults += nSingleSecondaryResults[whichRead];
+        }
+    }
+
+    chunk->firstPaired.push_back(chunk->paired.size());
+    for (int whichRead = 0; whichRead < NUM_READS_PER_PAIR; whichRead++) {
+        chunk->firstSingle[whichRead].push_back(chunk->single[whichRead].size());
+    }
+}
+
+//
+// The internal thread pool: each thread runs one task of the current batch per step.
+//
+class BatchAligner::PoolManager : public ParallelWorkerManager
+{
+public:
+    PoolManager() : batch(NULL) {}
+
+    virtual ParallelWorker *createWorker();
+
+    Batch  *batch;
+};
+
+class BatchAligner::PoolWorker : public ParallelWorker
+{
+public:
+    virtual void step()
+    {
+        BatchAligner::runTask(((PoolManager *)getManager())->batch, getThreadNum());
+    }
+};
+
+    ParallelWorker *
+BatchAligner::PoolManager::createWorker()
+{
+    return new PoolWorker();
+}
+
+BatchAligner::BatchAligner(
+    GenomeIndex *i_index,
+    AlignerOptions *i_options,
+    Executor *i_executor)
+    : index(i_index), options(i_options), paired(i_options->isPaired()), executor(i_executor), pool(NULL), poolManager(NULL)
+{
+    InitializeSeedSequencers();
+
+    nTasks = max(1, options->numThreads);
+    InitializeExclusiveLock(&lock);
+    InitializeExclusiveLock(&poolLock);
+
+    if (NULL == executor && NULL != index) {
+        poolManager = new PoolManager();
+        pool = new ParallelCoworker(nTasks, options->bindToProcessors, poolManager);
+        pool->start();
+    }
+}
+
+BatchAligner::~BatchAligner()
+{
+    if (NULL != pool) {
+        pool->stop();
+        delete pool;
+        delete poolManager;
+    }
+
+    for (int i = 0; i < allWorkers.size(); i++) {
+        delete allWorkers[i];
+    }
+
+    DestroyExclusiveLock(&lock);
+    DestroyExclusiveLock(&poolLock);
+}
+
+    bool
+BatchAligner::alignReads(
+    Read **reads,
+    int nReads,
+    SingleBatchResults *results,
+    bool computeCigars)
+{
+    if (NULL == index) {
+        WriteErrorMessage("BatchAligner::alignReads called without an index\n");
+        return false;
+    }
+
+    if (paired) {
+        WriteErrorMessage("BatchAligner::alignReads called on a paired-end aligner\n");
+        return false;
+    }
+
+    Batch batch;
+    batch.aligner = this;
+    batch.reads = reads;
+    batch.nReads = nReads;
+    batch.nChunks = (nReads + ChunkSize - 1) / ChunkSize;
+    batch.computeCigars = computeCigars;
+    batch.singleResults = results;
+    batch.pairedResults = NULL;
+    batch.nextChunk = 0;
+
+    results->reset(nReads, batch.nChunks);
+    run(&batch);
+    return true;
+}
+
+    bool
+BatchAligner::alignPairs(
+    Read **reads,
+    int nPairs,
+    PairedBatchResults *results,
+    bool computeCigars)
+{
+    if (NULL == index) {
+        WriteErrorMessage("BatchAligner::alignPairs called without an index\n");
+        return false;
+    }
+
+    if (!paired) {
+        WriteErrorMessage("BatchAligner::alignPairs called on a single-end aligner\n");
+        return false;
+    }
+
+    Batch batch;
+    batch.aligner = this;
+    batch.reads = reads;
+    batch.nReads = nPairs;
+    batch.nChunks = (nPairs + ChunkSize - 1) / ChunkSize;
+    batch.computeCigars = computeCigars;
+    batch.singleResults = NULL;
+    batch.pairedResults = results;
+    batch.nextChunk = 0;
+
+    results->reset(nPairs, batch.nChunks);
+    run(&batch);
+    return true;
+}
+
+    void
+BatchAligner::run(
+    Batch *batch)
+{
+    if (0 == batch->nChunks) {
+        return;
+    }
+
+    if (NULL != executor) {
+        executor->run(min(nTasks, batch->nChunks), runTask, batch);
+    } else {
+        AcquireExclusiveLock(&poolLock);
+        poolManager->batch = batch;
+        pool->step();
+        poolManager->batch = NULL;
+        ReleaseExclusiveLock(&poolLock);
+    }
+}
+
+    void
+BatchAligner::runTask(
+    void *context,
+    int whichTask)
+{
+    Batch *batch = (Batch *)context;
+    if (batch->nextChunk >= batch->nChunks) {
+        return; // Nothing left, so don't tie up a worker
+    }
+
+    BatchAligner *aligner = batch->aligner;
+    Worker *worker = aligner->getWorker();
+
+    int whichChunk;
+    while ((whichChunk = InterlockedIncrementAndReturnNewValue(&batch->nextChunk) - 1) < batch->nChunks) {
+        worker->alignChunk(batch, whichChunk);
+    }
+
+    aligner->releaseWorker(worker);
+}
+
+    BatchAligner::Worker *
+BatchAligner::getWorker()
+{
+    Worker *worker = NULL;
+    AcquireExclusiveLock(&lock);
+    if (idleWorkers.size() > 0) {
+        worker = idleWorkers[idleWorkers.size() - 1];
+        idleWorkers.erase(idleWorkers.size() - 1);
+    }
+    ReleaseExclusiveLock(&lock);
+
+    if (NULL == worker) {
+        //
+        // Make a new one outside the lock, since setting up the aligners takes a while.
+        //
+        if (paired) {
+            worker = new PairedWorker(this);
+        } else {
+            worker = new SingleWorker(this);
+        }
+        AcquireExclusiveLock(&lock);
+        allWorkers.push_back(worker);
+        ReleaseExclusiveLock(&lock);
+    }
+
+    return worker;
+}
+
+    void
+BatchAligner::releaseWorker(
+    Worker *worker)
+{
+    AcquireExclusiveLock(&lock);
+    idleWorkers.push_back(worker);
+    ReleaseExclusiveLock(&lock);
+}
@@ -0,0 +1,251 @@
+/*++
+
+Module Name:
+
+    BatchAligner.h
+
+Abstract:
+
+    Aligning reads that are already in memory, for programs that embed SNAPLib rather than running
+    snap-aligner on files.  A BatchAligner takes an array of reads or read pairs and fills in a results
+    object with the alignments of each, and optionally their CIGAR strings and edit distances.
+
+    The aligners and their scratch memory are created once and reused from batch to batch.  Each batch
+    is split into chunks that are aligned in parallel, either on an internal pool of threads or on the
+    embedding program's own threads through an Executor.
+
+Environment:
+
+    User mode service.
+
+    Thread safe: any number of threads may call alignReads or alignPairs on the same BatchAligner at once,
+    as long as each uses its own results object.
+
+Revision History:
+
+--*/
+
+#pragma once
+
+#include "Compat.h"
+#include "Read.h"
+#include "AlignmentResult.h"
+#include "VariableSizeVector.h"
+
+class GenomeIndex;
+struct AlignerOptions;
+class ParallelCoworker;
+
+//
+// CIGAR strings and edit distances for a list of alignments, in one block of text.
+//
+class BatchCigars
+{
+public:
+    BatchCigars() {}
+
+    void clear();
+
+    // cigar may be NULL if the alignment didn't get one (e.g., it's unaligned)
+    void add(const char *cigar, int editDistance);
+
+    const char *getCigar(int whichAlignment) const;
+    int getEditDistance(int whichAlignment) const;
+
+private:
+    VariableSizeVector<char> text;
+    VariableSizeVector<int> offsets;   // -1 for none
+    VariableSizeVector<int> editDistances;
+};
+
+//
+// Results of aligning a batch of single-end reads.  Reusing one across batches avoids reallocating it.
+//
+class SingleBatchResults
+{
+public:
+    SingleBatchResults() {}
+    ~SingleBatchResults();
+
+    int getNumReads() const {return nReads;}
+
+    //
+    // The primary alignment is first, followed by any secondary alignments.  Reads that are too short or have too many Ns
+    // aren't aligned and just get a NotFound primary.
+    //
+    int getNumAlignments(int whichRead) const;
+    const SingleAlignmentResult *getAlignments(int whichRead) const;
+
+    //
+    // Only if the batch was aligned with computeCigars.  The CIGAR is as it would be written to SAM, including clipping,
+    // and is NULL for unaligned results.  Valid until the results are reused.
+    //
+    const char *getCigar(int whichRead, int whichAlignment) const;
+    int getEditDistance(int whichRead, int whichAlignment) const;
+
+private:
+    friend class BatchAligner;
+
+    struct Chunk
+    {
+        VariableSizeVector<int> firstAlignment;  // for each read in the chunk and one past the end
+        VariableSizeVector<SingleAlignmentResult> alignments;
+        BatchCigars cigars;
+
+        void clear();
+    };
+
+    void reset(int nReads, int nChunks);
+
+    const Chunk *getChunk(int whichRead, int *o_first) const;
+
+    int nReads;
+    VariableSizeVector<Chunk*> chunks;
+};
+
+//
+// Results of aligning a batch of read pairs.
+//
+class PairedBatchResults
+{
+public:
+    PairedBatchResults() {}
+    ~PairedBatchResults();
+
+    int getNumPairs() const {return nPairs;}
+
+    //
+    // The primary paired alignment is first, followed by any secondary paired alignments.
+    //
+    int getNumPairedAlignments(int whichPair) const;
+    const PairedAlignmentResult *getPairedAlignments(int whichPair) const;
+
+    //
+    // Secondary alignments of each read on its own, when there are secondary alignments and the pair
+    // aligned better unpaired.
+    //
+    int getNumSingleAlignments(int whichPair, int whichRead) const;
+    const SingleAlignmentResult *getSingleAlignments(int whichPair, int whichRead) const;
+
+    //
+    // Only if the batch was aligned with computeCigars, as for SingleBatchResults.
+    //
+    const char *getPairedCigar(int whichPair, int whichAlignment, int whichRead) const;
+    int getPairedEditDistance(int whichPair, int whichAlignment, int whichRead) const;
+    const char *getSingleCigar(int whichPair, int whichRead, int whichAlignment) const;
+    int getSingleEditDistance(int whichPair, int whichRead, int whichAlignment) const;
+
+private:
+    friend class BatchAligner;
+
+    struct Chunk
+    {
+        VariableSizeVector<int> firstPaired;    // for each pair in the chunk and one past the end
+        VariableSizeVector<PairedAlignmentResult> paired;
+        BatchCigars pairedCigars;               // two for each paired alignment
+        VariableSizeVector<int> firstSingle[NUM_READS_PER_PAIR];
+        VariableSizeVector<SingleAlignmentResult> single[NUM_READS_PER_PAIR];
+        BatchCigars singleCigars[NUM_READS_PER_PAIR];
+
+        void clear();
+    };
+
+    void reset(int nPairs, int nChunks);
+
+    const Chunk *getChunk(int whichPair, int *o_first) const;
+
+    int nPairs;
+    VariableSizeVector<Chunk*> chunks;
+};
+
+class BatchAligner
+{
+public:
+
+    //
+    // Runs work on the embedding program's threads.  run must call task(context, i) once for each i in [0, nTasks),
+    // in any order and with any amount of parallelism, and return once they've all finished.
+    //
+    class Executor
+    {
+    public:
+        virtual ~Executor() {}
+
+        typedef void (*Task)(void *context, int whichTask);
+
+        virtual void run(int nTasks, Task task, void *context) = 0;
+    };
+
+    //
+    // options says how to align: it's an AlignerOptions for single-end reads or a PairedAlignerOptions for pairs, set up
+    // as it would be from the command line (e.g., with -d, -n, -h, -om, -s).  Only the alignment settings are used, plus
+    // clipping, which is applied to each read.  The index and options must outlive the BatchAligner.  With a NULL index, every
+    // batch fails.
+    //
+    // With no executor, batches run on an internal pool of options->numThreads threads that lives as long as the
+    // BatchAligner.  Either way, aligners are made as threads first need them and then kept for later batches.
+    //
+    // Sets up the seed sequencers if the program hasn't already, so construct it before starting any threads of your own
+    // that use SNAPLib.
+    //
+    BatchAligner(GenomeIndex *index, AlignerOptions *options, Executor *executor = NULL);
+
+    ~BatchAligner();
+
+    bool isPaired() const {return paired;}
+
+    //
+    // Align a batch, replacing whatever was in results.  The reads may have clipping applied, but are otherwise unchanged.
+    // Returns false without aligning anything if the BatchAligner has no index or is for the other kind of read.
+    //
+    bool alignReads(Read **reads, int nReads, SingleBatchResults *results, bool computeCigars = false);
+
+    // reads[2 * i] and reads[2 * i + 1] are pair i
+    bool alignPairs(Read **reads, int nPairs, PairedBatchResults *results, bool computeCigars = false);
+
+    // reads per chunk, i.e. the unit of parallelism
+    static const int ChunkSize = 64;
+
+private:
+
+    class Worker;
+    class SingleWorker;
+    class PairedWorker;
+    class PoolManager;
+    class PoolWorker;
+
+    struct Batch
+    {
+        BatchAligner       *aligner;
+        Read              **reads;
+        int                 nChunks;
+        int                 nReads;         // or pairs
+        bool                computeCigars;
+        SingleBatchResults *singleResults;
+        PairedBatchResults *pairedResults;
+        volatile int        nextChunk;
+    };
+
+    void run(Batch *batch);
+
+    static void runTask(void *context, int whichTask);
+
+    // take an idle worker, or make a new one
+    Worker *getWorker();
+
+    void releaseWorker(Worker *worker);
+
+    GenomeIndex                *index;
+    AlignerOptions             *options;
+    const bool                  paired;
+    Executor                   *executor;
+    int                         nTasks;
+
+    ExclusiveLock               lock;           // protects idleWorkers & allWorkers
+    VariableSizeVector<Worker*> idleWorkers;
+    VariableSizeVector<Worker*> allWorkers;
+
+    ParallelCoworker           *pool;           // internal threads if there's no executor
+    PoolManager                *poolManager;
+    ExclusiveLock               poolLock;       // one batch at a time on the internal pool
+};
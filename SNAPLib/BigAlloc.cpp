@@ -432,8 +432,39 @@ void *BigReserve(
     }
 #ifdef PROFILE_BIGALLOC
     return BigAllocInternal(sizeToReserve, sizeReserved);
+#elif defined(USE_HUGETLB)
+    return BigAlloc(sizeToReserve, sizeReserved);   // hugetlb pages are backed when they're mapped, so there's no reserving them
 #else
-    return BigAlloc(sizeToReserve, sizeReserved);
+    //
+    // Callers reserve room to grow into (the IO readers reserve 4x the buffers they start with), so don't charge
+    // the whole reservation against the commit limit up front; pages are only backed when they're touched.  This is
+    // otherwise the same mapping BigAlloc makes, huge pages included.
+    //
+    sizeToReserve += sizeof(size_t);
+    const size_t ALIGN_SIZE = 4096;
+    if (sizeToReserve % ALIGN_SIZE != 0) {
+        sizeToReserve += ALIGN_SIZE - (sizeToReserve % ALIGN_SIZE);
+    }
+    if (sizeReserved != NULL) {
+        *sizeReserved = sizeToReserve - sizeof(size_t);
+    }
+
+    char *mem = (char *) mmap(NULL, sizeToReserve, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+    if (mem == MAP_FAILED) {
+        perror("mmap");
+        soft_exit(1);
+    }
+
+#ifdef MADV_HUGEPAGE
+    if (BigAllocUseHugePages) {
+        if (madvise(mem, sizeToReserve, MADV_HUGEPAGE) == -1) {
+            WriteErrorMessage("WARNING: failed to enable huge pages -- your kernel may not support it\n"); 
+        }
+    }
+#endif
+
+    *((size_t *) mem) = sizeToReserve;
+    return (void *) (mem + sizeof(size_t));
 #endif
 }
 
@@ -449,7 +480,8 @@ bool BigCommit(
 
 #endif /* _MSC_VER */
 
-BigAllocator::BigAllocator(size_t i_maxMemory, size_t i_allocationGranularity) : maxMemory(i_maxMemory), allocationGranularity(i_allocationGranularity)
+BigAllocator::BigAllocator(size_t i_maxMemory, size_t i_allocationGranularity) : maxMemory(i_maxMemory), allocationGranularity(i_allocationGranularity),
+    nReservations(0), reservedTotal(0), reservedCommitted(0)
 {
 #if     _DEBUG
     maxMemory += maxCanaries * sizeof(unsigned);
@@ -470,9 +502,36 @@ BigAllocator::BigAllocator(size_t i_maxMemory, size_t i_allocationGranularity) :
 
 BigAllocator::~BigAllocator()
 {
+    for (unsigned i = 0; i < nReservations; i++) {
+        BigDealloc(reservations[i]);
+    }
     BigDealloc(basePointer);
 }
 
+void *
+BigAllocator::reserve(size_t amountToReserve)
+{
+    if (nReservations >= maxReservations) {
+        WriteErrorMessage("BigAllocator: too many reservations\n");
+        soft_exit(1);
+    }
+    size_t sizeReserved;
+    void *reserved = BigReserve(__max(amountToReserve, (size_t)1), &sizeReserved);
+    reservations[nReservations++] = reserved;
+    reservedTotal += sizeReserved;
+    return reserved;
+}
+
+void
+BigAllocator::commit(void *memoryToCommit, size_t amountToCommit)
+{
+    if (!BigCommit(memoryToCommit, amountToCommit)) {
+        WriteErrorMessage("BigAllocator: unable to commit %lld bytes\n", (_int64)amountToCommit);
+        soft_exit(1);
+    }
+    reservedCommitted += amountToCommit;
+}
+
 void *
 BigAllocator::allocate(size_t amountToAllocate)
 {
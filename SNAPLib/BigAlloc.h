@@ -21,6 +21,8 @@ Revision History:
 --*/
 
 #pragma once
+#include <new>
+#include "Compat.h"
 
 inline unsigned RoundUpToPageSize(unsigned size)
 {
@@ -87,6 +89,23 @@ public:
 
     virtual void *allocate(size_t amountToAllocate);
 
+    //
+    // Reserve address space for a structure that grows on demand, without committing any of it.  The structure
+    // commits it front to back as it grows (see GrowingBigArray), so it never has to move.  The reservation is
+    // freed along with the allocator.
+    //
+    virtual void *reserve(size_t amountToReserve);
+
+    virtual void commit(void *memoryToCommit, size_t amountToCommit);
+
+    //
+    // Everything allocated plus what has been committed from reservations, i.e., the high water mark of what
+    // this allocator has handed out.  This counts bytes, not pages actually touched.
+    //
+    size_t getMemoryCommitted() const {return (allocPointer - basePointer) + reservedCommitted;}
+
+    size_t getMemoryReserved() const {return maxMemory + reservedTotal;}
+
 #if     _DEBUG
     void checkCanaries();
 #else  // DEBUG
@@ -99,6 +118,12 @@ private:
     size_t  maxMemory;
     size_t  allocationGranularity;
 
+    static const unsigned maxReservations = 16;
+    unsigned nReservations;
+    void    *reservations[maxReservations];
+    size_t  reservedTotal;
+    size_t  reservedCommitted;
+
 #if     _DEBUG
     //
     // Stick a canary between each allocation and 
@@ -122,6 +147,8 @@ public:
     ~CountingBigAllocator();
 
     virtual void *allocate(size_t amountToAllocate);
+    virtual void *reserve(size_t amountToReserve) {return NULL;}  // Reservations don't count toward the allocator's size
+    virtual void commit(void *memoryToCommit, size_t amountToCommit) {}
     virtual void assertAllMemoryUsed() {}
     size_t getMemoryUsed() {return size;}
 
@@ -135,6 +162,68 @@ private:
     } *allocations;
 };
 
+//
+// An array that reserves space for its worst case size but only commits (and constructs) elements a segment at a
+// time as they're asked for, so per-thread structures sized for the worst case cost only what they actually use.
+// Elements never move, so pointers into the array stay valid.  If allocator is NULL, the array reserves its own
+// memory, and the owner frees it with BigDealloc.
+//
+template<class T> class GrowingBigArray
+{
+public:
+    GrowingBigArray() : elements(NULL), maxCount(0), committedCount(0), allocator(NULL) {}
+
+    void reserve(BigAllocator *i_allocator, size_t i_maxCount)
+    {
+        allocator = i_allocator;
+        maxCount = i_maxCount;
+        committedCount = 0;
+        elements = (T *)(NULL != allocator ? allocator->reserve(sizeof(T) * maxCount) : BigReserve(sizeof(T) * maxCount));
+    }
+
+    //
+    // Make sure the first count elements exist.
+    //
+    inline void ensure(size_t count)
+    {
+        if (count > committedCount) {
+            grow(count);
+        }
+    }
+
+    operator T*() const {return elements;}
+
+    size_t getMaxCount() const {return maxCount;}
+    size_t getCommittedCount() const {return committedCount;}
+
+private:
+    void grow(size_t count)
+    {
+        _ASSERT(count <= maxCount);
+        //
+        // Grow geometrically, so a structure that's used heavily doesn't commit page by page.
+        //
+        size_t newCount = __max(count, __max(2 * committedCount, MinSegmentBytes / sizeof(T) + 1));
+        newCount = __min(newCount, maxCount);
+        if (NULL != allocator) {
+            allocator->commit(elements + committedCount, (newCount - committedCount) * sizeof(T));
+        } else {
+            BigCommit(elements + committedCount, (newCount - committedCount) * sizeof(T));
+        }
+        for (size_t i = committedCount; i < newCount; i++) {
+            new (elements + i) T;
+        }
+        committedCount = newCount;
+    }
+
+    static const size_t MinSegmentBytes = 64 * 1024;
+
+    T               *elements;
+    size_t          maxCount;
+    size_t          committedCount;
+    BigAllocator    *allocator;
+};
+
 extern bool BigAllocUseHugePages;
 
 
@@ -220,4 +220,204 @@ BufferedAsyncWriter::close()
     BigDealloc(buffer[1]);
     return ok;
 }
-    
\ No newline at end of file
+    
+    bool
+AlignedAsyncReader::open(
+    AsyncFile* file,
+    size_t offset,
+    size_t bytes,
+    char* i_buffer,
+    size_t i_chunk,
+    size_t i_pad,
+    ReadAheadScheduler* i_scheduler)
+{
+    const size_t align = AsyncFile::UnbufferedAlignment;
+    _ASSERT(i_chunk % align == 0 && i_pad % align == 0 && ((size_t) i_buffer) % align == 0);
+    scheduler = i_scheduler;
+    chunk = i_chunk;
+    pad = i_pad;
+    startOffset = offset;
+    endOffset = offset + bytes;
+    nextFileOffset = offset - offset % align;
+    waitTime = 0;
+    priority = 0;
+    queued = false;
+    for (int i = 0; i < 2; i++) {
+        reader[i] = file->getReader();
+        buffer[i] = i_buffer + pad + i * (pad + chunk);
+        bufferOffset[i] = 0;
+        length[i] = 0;
+        state[i] = Empty;
+        if (reader[i] == NULL) {
+            WriteErrorMessage("unable to setup temp file reader\n");
+            return false;
+        }
+    }
+    // start out reading from the empty second half, so the first getData moves on to the first
+    current = 1;
+    pos = limit = buffer[1];
+    return refill();
+}
+
+    bool
+AlignedAsyncReader::refill()
+{
+    _ASSERT(wantsRefill());
+    int h = 1 - current;
+    bufferOffset[h] = nextFileOffset;
+    size_t bytes = min(chunk, endOffset - nextFileOffset);
+    bytes += (AsyncFile::UnbufferedAlignment - bytes % AsyncFile::UnbufferedAlignment) % AsyncFile::UnbufferedAlignment;
+    nextFileOffset += chunk;
+    state[h] = Reading;
+    if (! reader[h]->beginRead(buffer[h], bytes, bufferOffset[h], &length[h])) {
+        WriteErrorMessage("AlignedAsyncReader read of %lld bytes at %lld failed\n", bytes, bufferOffset[h]);
+        return false;
+    }
+    return true;
+}
+
+    bool
+AlignedAsyncReader::getData(
+    size_t bytes,
+    char** o_data)
+{
+    if (pos + bytes <= limit) {
+        *o_data = pos;
+        return true;
+    }
+    if (bytes > pad) {
+        WriteErrorMessage("AlignedAsyncReader: %lld byte record is longer than the %lld allowed\n", bytes, pad);
+        return false;
+    }
+
+    //
+    // Switch halves until there's enough data, getting the other one read first if need be.  A record can be longer
+    // than one half has to offer (a chunk smaller than the pad, or a first half that starts before the range), but
+    // what's left over is always shorter than the record, so it still fits in the pad in front of the next half.
+    //
+    while (pos + bytes > limit) {
+        int next = 1 - current;
+        if (state[next] == Empty) {
+            if (nextFileOffset >= endOffset) {
+                return false;
+            }
+            scheduler->noteMiss();
+            if (! refill()) {
+                return false;
+            }
+        }
+        if (state[next] == Reading) {
+            _int64 start = timeInNanos();
+            bool ok = reader[next]->waitForCompletion();
+            waitTime += timeInNanos() - start;
+            if (! ok) {
+                WriteErrorMessage("AlignedAsyncReader read at %lld failed\n", bufferOffset[next]);
+                return false;
+            }
+            state[next] = Full;
+        }
+        char* data = buffer[next];
+        size_t valid = min(length[next], endOffset - bufferOffset[next]);
+        if (bufferOffset[next] < startOffset) {
+            data += startOffset - bufferOffset[next];
+            valid -= startOffset - bufferOffset[next];
+        }
+        size_t left = limit - pos;
+        _ASSERT(left < bytes && left <= pad);
+        memcpy(data - left, pos, left);
+        pos = data - left;
+        limit = data + valid;
+        state[current] = Empty;
+        current = next;
+
+        if (wantsRefill()) {
+            scheduler->enqueue(this);
+        }
+        if (! scheduler->pump()) {
+            return false;
+        }
+    }
+    *o_data = pos;
+    return true;
+}
+
+    bool
+AlignedAsyncReader::close()
+{
+    scheduler->remove(this);
+    bool ok = true;
+    for (int i = 0; i < 2; i++) {
+        ok &= reader[i]->waitForCompletion();
+        ok &= reader[i]->close();
+        delete reader[i];
+        reader[i] = NULL;
+    }
+    return ok;
+}
+
+ReadAheadScheduler::ReadAheadScheduler(
+    int i_minInFlight,
+    int i_maxInFlight)
+    : inFlightLimit(i_minInFlight), maxInFlight(i_maxInFlight), misses(0), reads(0)
+{
+}
+
+    void
+ReadAheadScheduler::enqueue(
+    AlignedAsyncReader* reader)
+{
+    if (! reader->queued) {
+        reader->queued = true;
+        waiting.add(reader, reader->getPriority());
+    }
+}
+
+    void
+ReadAheadScheduler::remove(
+    AlignedAsyncReader* reader)
+{
+    if (reader->queued) {
+        waiting.remove(reader);
+        reader->queued = false;
+    }
+    for (_int64 i = 0; i < inFlight.size(); i++) {
+        if (inFlight[i] == reader) {
+            inFlight[i] = inFlight[inFlight.size() - 1];
+            inFlight.erase(inFlight.size() - 1);
+            break;
+        }
+    }
+}
+
+    bool
+ReadAheadScheduler::pump()
+{
+    for (_int64 i = 0; i < inFlight.size(); ) {
+        if (inFlight[i]->reader[0]->isComplete() && inFlight[i]->reader[1]->isComplete()) {
+            inFlight[i] = inFlight[inFlight.size() - 1];
+            inFlight.erase(inFlight.size() - 1);
+        } else {
+            i++;
+        }
+    }
+
+    while (inFlight.size() < inFlightLimit && waiting.size() > 0) {
+        _int64 queuedPriority;
+        AlignedAsyncReader* reader = waiting.pop(&queuedPriority);
+        if (queuedPriority != reader->getPriority()) {
+            // priorities only go up as a reader moves through its range, so it's still in order after this
+            waiting.add(reader, reader->getPriority());
+            continue;
+        }
+        reader->queued = false;
+        if (! reader->wantsRefill()) {
+            continue; // it got there first
+        }
+        if (! reader->refill()) {
+            return false;
+        }
+        reads++;
+        inFlight.push_back(reader);
+    }
+    return true;
+}
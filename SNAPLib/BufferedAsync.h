@@ -21,6 +21,8 @@ Environment:
 
 #include "stdafx.h"
 #include "Compat.h"
+#include "VariableSizeVector.h"
+#include "PriorityQueue.h"
  
 class BufferedAsyncReader
 {
@@ -64,3 +66,99 @@ private:
     char*               buffer[2];
     _int64              waitTime; // in nanos
 };
+
+class ReadAheadScheduler;
+
+//
+// Double-buffered reader for a range of a file opened unbuffered, which hands out data in place rather than
+// copying it.  Each half is preceded by room for one record, so a record that straddles the end of one half
+// is moved in front of the next and stays contiguous.  Refills are issued by a ReadAheadScheduler shared by
+// all the readers rather than as soon as a half is empty, so that with many readers it decides which to read next.
+//
+class AlignedAsyncReader
+{
+public:
+    // buffer is 2 * (pad + chunk) bytes, both multiples of AsyncFile::UnbufferedAlignment, as is buffer itself;
+    // no record can be longer than pad, though it may be longer than chunk.  Begins reading the first half.
+    bool                open(AsyncFile* file, size_t offset, size_t length, char* buffer, size_t chunk, size_t pad,
+                            ReadAheadScheduler* scheduler);
+
+    // get the next bytes of the range in place, waiting for them if necessary; false if there aren't that many left
+    bool                getData(size_t bytes, char** o_data);
+
+    void                advance(size_t bytes) { _ASSERT(pos + bytes <= limit); pos += bytes; }
+
+    // how soon this reader's data will be needed, lower is sooner; set by the caller as it goes
+    void                setPriority(_int64 i_priority) { priority = i_priority; }
+    _int64              getPriority() { return priority; }
+
+    // waits for any reads in flight and takes the reader off its scheduler, so it can be deleted
+    bool                close();
+    _int64              getWaitTimeInNanos() { return waitTime; }
+
+private:
+    friend class ReadAheadScheduler;
+
+    // the half that isn't being read from is empty and there's more of the range to read
+    bool                wantsRefill() { return state[1 - current] == Empty && nextFileOffset < endOffset; }
+    bool                refill();
+
+    enum HalfState { Empty, Reading, Full };
+
+    ReadAheadScheduler* scheduler;
+    size_t              chunk;
+    size_t              pad;
+    size_t              startOffset; // range in file
+    size_t              endOffset;
+    size_t              nextFileOffset; // aligned
+    AsyncFile::Reader*  reader[2];
+    char*               buffer[2]; // aligned, after the pad
+    size_t              bufferOffset[2]; // file offset of buffer
+    size_t              length[2]; // bytes read
+    HalfState           state[2];
+    int                 current; // half being read from
+    char*               pos;
+    char*               limit;
+    _int64              priority;
+    bool                queued; // with the scheduler
+    _int64              waitTime; // in nanos
+};
+
+//
+// Issues refills for a set of AlignedAsyncReaders, most urgent first, with a bounded number in flight so the
+// reads stay large and the device isn't flooded with requests for data that won't be needed for a while.
+// Starts with minInFlight and allows one more each time a reader has to read synchronously because its refill
+// was never issued, up to maxInFlight.
+//
+class ReadAheadScheduler
+{
+public:
+    ReadAheadScheduler(int i_minInFlight, int i_maxInFlight);
+
+    // a reader has an empty half to fill
+    void                enqueue(AlignedAsyncReader* reader);
+
+    // a reader needed its other half before it was scheduled
+    void                noteMiss() { misses++; inFlightLimit = min(inFlightLimit + 1, maxInFlight); }
+
+    // reap finished reads and issue more
+    bool                pump();
+
+    // forget a reader that's being closed, wherever it is
+    void                remove(AlignedAsyncReader* reader);
+
+    _int64              getMisses() { return misses; }
+    _int64              getReads() { return reads; }
+    int                 getInFlightLimit() { return inFlightLimit; }
+
+private:
+    typedef PriorityQueue<_int64, AlignedAsyncReader*> ReaderQueue;
+    typedef VariableSizeVector<AlignedAsyncReader*> ReaderVector;
+
+    ReaderQueue         waiting;
+    ReaderVector        inFlight;
+    int                 inFlightLimit;
+    int                 maxInFlight;
+    _int64              misses;
+    _int64              reads;
+};
@@ -29,6 +29,7 @@ Revision History:
 #include "directions.h"
 #include "BigAlloc.h"
 #include "Util.h"
+#include "SAM.h"
 
 using namespace std;
 
@@ -55,7 +56,8 @@ ChimericPairedEndAligner::ChimericPairedEndAligner(
 	   unsigned				minReadLength_,
        int                  maxSecondaryAlignmentsPerContig,
         BigAllocator        *allocator)
-		: underlyingPairedEndAligner(underlyingPairedEndAligner_), forceSpacing(forceSpacing_), index(index_), minReadLength(minReadLength_)
+		: underlyingPairedEndAligner(underlyingPairedEndAligner_), forceSpacing(forceSpacing_), index(index_), minReadLength(minReadLength_),
+          useHints(false), hintValidationInterval(0), minSpacing(0), maxSpacing(0), nHintsUsed(0), nHintsValidated(0), nHintsDisagreed(0)
 {
     // Create single-end aligners.
     singleAligner = new (allocator) BaseAligner(index, maxHits, maxK, maxReadSize,
@@ -92,8 +94,50 @@ ChimericPairedEndAligner::~ChimericPairedEndAligner()
 extern bool _DumpAlignments;
 #endif // _DEBUG
 
+    bool
+ChimericPairedEndAligner::alignFromHints(
+    Read                  *read0,
+    Read                  *read1,
+    PairedAlignmentResult *result)
+{
+    Read *read[NUM_READS_PER_PAIR] = {read0, read1};
+    SingleAlignmentResult hint[NUM_READS_PER_PAIR];
+    for (int r = 0; r < NUM_READS_PER_PAIR; r++) {
+        if (read[r]->getDataLength() < minReadLength || !(read[r]->getOriginalSAMFlags() & SAM_ALL_ALIGNED) ||
+            !singleAligner->alignFromHint(read[r], &hint[r])) {
+            return false;
+        }
+    }
+
+    //
+    // The pair was proper in the original reference, but contigs may have been rearranged since, and the original
+    // aligner may have allowed a different spacing.  Hold the hints to the same limits as the intersecting aligner.
+    //
+    const Genome *genome = index->getGenome();
+    if (hint[0].direction == hint[1].direction ||
+        genome->getContigNumAtLocation(hint[0].location) != genome->getContigNumAtLocation(hint[1].location) ||
+        !genomeLocationIsWithin(hint[0].location, hint[1].location, maxSpacing) ||
+        genomeLocationIsWithin(hint[0].location, hint[1].location, minSpacing)) {
+        return false;
+    }
 
-void ChimericPairedEndAligner::align(
+    for (int r = 0; r < NUM_READS_PER_PAIR; r++) {
+        result->status[r] = hint[r].status;
+        result->location[r] = hint[r].location;
+        result->direction[r] = hint[r].direction;
+        result->score[r] = hint[r].score;
+        result->mapq[r] = hint[r].mapq;
+    }
+    result->alignedAsPair = true;
+    result->fromAlignTogether = true;
+    result->nanosInAlignTogether = 0;
+    result->nLVCalls = NUM_READS_PER_PAIR;
+    result->nSmallHits = 0;
+    return true;
+}
+
+
+bool ChimericPairedEndAligner::align(
         Read                  *read0,
         Read                  *read1,
         PairedAlignmentResult *result,
@@ -126,7 +170,31 @@ void ChimericPairedEndAligner::align(
 		result->nanosInAlignTogether = 0;
 		result->nLVCalls = 0;
 		result->nSmallHits = 0;
-		return;
+		return true;
+    }
+
+    if (useHints && maxEditDistanceForSecondaryResults < 0 && alignFromHints(read0, read1, result)) {
+        nHintsUsed++;
+        if (0 == hintValidationInterval || 0 != nHintsUsed % hintValidationInterval) {
+            return true;
+        }
+
+        PairedAlignmentResult hintResult = *result;
+        useHints = false;
+        bool worked = align(read0, read1, result, maxEditDistanceForSecondaryResults, secondaryResultBufferSize, nSecondaryResults, secondaryResults,
+                            singleSecondaryBufferSize, maxSecondaryAlignmentsToReturn, nSingleEndSecondaryResultsForFirstRead,
+                            nSingleEndSecondaryResultsForSecondRead, singleEndSecondaryResults);
+        useHints = true;
+        if (worked) {
+            nHintsValidated++;
+            for (int r = 0; r < NUM_READS_PER_PAIR; r++) {
+                if (result->location[r] != hintResult.location[r] || result->direction[r] != hintResult.direction[r]) {
+                    nHintsDisagreed++;
+                    break;
+                }
+            }
+        }
+        return worked;
     }
 
     _int64 start = timeInNanos();
@@ -134,9 +202,11 @@ void ChimericPairedEndAligner::align(
 		//
 		// Let the LVs use the cache that we built up.
 		//
-		underlyingPairedEndAligner->align(read0, read1, result, maxEditDistanceForSecondaryResults, secondaryResultBufferSize, nSecondaryResults, secondaryResults,
-            singleSecondaryBufferSize, maxSecondaryAlignmentsToReturn, nSingleEndSecondaryResultsForFirstRead, nSingleEndSecondaryResultsForSecondRead, 
-            singleEndSecondaryResults);
+		if (!underlyingPairedEndAligner->align(read0, read1, result, maxEditDistanceForSecondaryResults, secondaryResultBufferSize, nSecondaryResults, secondaryResults,
+                singleSecondaryBufferSize, maxSecondaryAlignmentsToReturn, nSingleEndSecondaryResultsForFirstRead, nSingleEndSecondaryResultsForSecondRead, 
+                singleEndSecondaryResults)) {
+            return false;
+        }
 
 		_int64 end = timeInNanos();
 
@@ -151,14 +221,14 @@ void ChimericPairedEndAligner::align(
 			else {
 				_ASSERT(result->status[1] != NotFound); // If one's not found, so is the other
 			}
-			return;
+			return true;
 		}
 
 		if (result->status[0] != NotFound && result->status[1] != NotFound) {
 			//
 			// Not a chimeric read.
 			//
-			return;
+			return true;
 		}
 	}
 
@@ -181,9 +251,11 @@ void ChimericPairedEndAligner::align(
 			result->score[r] = 0;
 		} else {
 			// We're using *nSingleEndSecondaryResultsForFirstRead because it's either 0 or what all we've seen (i.e., we know NUM_READS_PER_PAIR is 2)
-			singleAligner->AlignRead(read[r], &singleResult, maxEditDistanceForSecondaryResults,
-				singleSecondaryBufferSize - *nSingleEndSecondaryResultsForFirstRead, &singleEndSecondaryResultsThisTime,
-                maxSecondaryAlignmentsToReturn, singleEndSecondaryResults + *nSingleEndSecondaryResultsForFirstRead);
+			if (!singleAligner->AlignRead(read[r], &singleResult, maxEditDistanceForSecondaryResults,
+				    singleSecondaryBufferSize - *nSingleEndSecondaryResultsForFirstRead, &singleEndSecondaryResultsThisTime,
+                    maxSecondaryAlignmentsToReturn, singleEndSecondaryResults + *nSingleEndSecondaryResultsForFirstRead)) {
+                return false;
+            }
 
 			*(resultCount[r]) = singleEndSecondaryResultsThisTime;
 
@@ -204,5 +276,6 @@ void ChimericPairedEndAligner::align(
             result->score[0], result->score[1], result->mapq[0], result->mapq[1]);
     }
 #endif // _DEBUG
-                    
+
+    return true;
 }
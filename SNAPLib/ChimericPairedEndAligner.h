@@ -62,7 +62,7 @@ public:
     void *operator new(size_t size, BigAllocator *allocator) {_ASSERT(size == sizeof(ChimericPairedEndAligner)); return allocator->allocate(size);}
     void operator delete(void *ptr, BigAllocator *allocator) {/* do nothing.  Memory gets cleaned up when the allocator is deleted.*/}
 
-    virtual void align(
+    virtual bool align(
         Read                  *read0,
         Read                  *read1,
         PairedAlignmentResult *result,
@@ -84,9 +84,33 @@ public:
         return underlyingPairedEndAligner->getLocationsScored() + singleAligner->getLocationsScored();
     }
 
+    //
+    // Realignment hints for pairs: use the original alignments of both mates if they were a proper pair, both
+    // still verify (see BaseAligner::setUseHints), and they're within the same spacing limits as a paired alignment.
+    //
+    inline void setUseHints(bool newValue, unsigned validationInterval, unsigned i_minSpacing, unsigned i_maxSpacing) {
+        useHints = newValue;
+        hintValidationInterval = validationInterval;
+        minSpacing = i_minSpacing;
+        maxSpacing = i_maxSpacing;
+    }
+
+    _int64 getNHintsUsed() const {return nHintsUsed;}
+    _int64 getNHintsValidated() const {return nHintsValidated;}
+    _int64 getNHintsDisagreed() const {return nHintsDisagreed;}
+
 private:
+
+    bool alignFromHints(Read *read0, Read *read1, PairedAlignmentResult *result);
    
     bool        forceSpacing;
+    bool        useHints;
+    unsigned    hintValidationInterval;
+    unsigned    minSpacing;
+    unsigned    maxSpacing;
+    _int64      nHintsUsed;
+    _int64      nHintsValidated;
+    _int64      nHintsDisagreed;
     BaseAligner *singleAligner;
     PairedEndAligner *underlyingPairedEndAligner;
 
@@ -43,6 +43,7 @@ static void usage()
 		"Usage: snap-aligner <command> [<options>]\n"
 		"Commands:\n"
 		"   index    build a genome index\n"
+		"   snapshot copy an index into a single file that loads with one mapping\n"
 		"   single   align single-end reads\n"
 		"   paired   align paired-end reads\n"
 		"   daemon   run in daemon mode--accept commands remotely\n"
@@ -59,6 +60,8 @@ void ProcessNonDaemonCommands(int argc, const char **argv) {
 			//
 			WriteErrorMessage("The index command is not available in daemon mode.  Please run 'snap-aligner index' directly.\n");
 		}
+	} else if (strcmp(argv[1], "snapshot") == 0) {
+		GenomeIndex::runSnapshot(argc - 2, argv + 2);
 	} else if (strcmp(argv[1], "single") == 0 || strcmp(argv[1], "paired") == 0) {
 		for (int i = 1; i < argc; /* i is increased below */) {
 			unsigned nArgsConsumed;
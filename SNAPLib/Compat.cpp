@@ -319,6 +319,20 @@ _int64 QueryFileSize(const char *fileName) {
     return fileSize.QuadPart;
 }
 
+bool IsStreamingInput(const char *fileName)
+{
+    if (!strcmp(fileName, "-")) {
+        return true;
+    }
+
+    struct _stat64 sb;
+    if (_stat64(fileName, &sb) != 0) {
+        return false;   // Let whoever opens it report the error
+    }
+
+    return (sb.st_mode & _S_IFREG) == 0;
+}
+
     bool
 DeleteSingleFile(
     const char* filename)
@@ -428,7 +442,8 @@ OpenMemoryMappedFile(
     size_t length,
     void** o_contents,
     bool write,
-    bool sequential)
+    bool sequential,
+    bool populate)
 {
     MemoryMappedFile* result = new MemoryMappedFile();
     result->fileHandle = CreateFile(filename, (write ? GENERIC_WRITE : 0) | GENERIC_READ, 0, NULL, OPEN_EXISTING,
@@ -454,6 +469,12 @@ OpenMemoryMappedFile(
         delete result;
         return NULL;
     }
+    if (populate) {
+        volatile char touch;
+        for (size_t i = 0; i < length; i += 4096) {
+            touch = ((volatile char*) *o_contents)[i];
+        }
+    }
     return result;
 }
 
@@ -480,7 +501,7 @@ void AdviseMemoryMappedFilePrefetch(const MemoryMappedFile *mappedFile)
 class WindowsAsyncFile : public AsyncFile
 {
 public:
-    static WindowsAsyncFile* open(const char* filename, bool write);
+    static WindowsAsyncFile* open(const char* filename, bool write, bool unbuffered);
 
     WindowsAsyncFile(HANDLE i_hFile);
 
@@ -515,6 +536,8 @@ public:
         virtual bool beginRead(void* buffer, size_t length, size_t offset, size_t *bytesRead);
 
         virtual bool waitForCompletion();
+
+        virtual bool isComplete();
     
     private:
         WindowsAsyncFile*   file;
@@ -531,14 +554,15 @@ private:
     WindowsAsyncFile*
 WindowsAsyncFile::open(
     const char* filename,
-    bool write)
+    bool write,
+    bool unbuffered)
 {
     HANDLE hFile = CreateFile(filename,
         GENERIC_READ | (write ? GENERIC_WRITE : 0),
         write ? 0 : FILE_SHARE_READ,
         NULL,
         write ? CREATE_ALWAYS : OPEN_EXISTING,
-        FILE_FLAG_OVERLAPPED,
+        FILE_FLAG_OVERLAPPED | (unbuffered ? FILE_FLAG_NO_BUFFERING : 0),
         NULL);
     if (INVALID_HANDLE_VALUE == hFile) {
         WriteErrorMessage("Unable to create SAM file '%s', %d\n",filename,GetLastError());
@@ -667,6 +691,12 @@ WindowsAsyncFile::Reader::waitForCompletion()
     return true;
 }
 
+    bool
+WindowsAsyncFile::Reader::isComplete()
+{
+    return (! reading) || HasOverlappedIoCompleted(&lap);
+}
+
 _int64 InterlockedAdd64AndReturnNewValue(volatile _int64 *valueToWhichToAdd, _int64 amountToAdd)
 {
     return InterlockedAdd64((volatile LONGLONG *)valueToWhichToAdd,(LONGLONG)amountToAdd);
@@ -1119,6 +1149,7 @@ public:
     bool destroy() {
         pthread_cond_destroy(&cond);
         pthread_mutex_destroy(&lock);
+        return true;
     }
 };
 
@@ -1305,6 +1336,20 @@ _int64 QueryFileSize(const char *fileName)
     return fileSize;
 }
 
+bool IsStreamingInput(const char *fileName)
+{
+    if (!strcmp(fileName, "-")) {
+        return true;
+    }
+
+    struct stat sb;
+    if (stat(fileName, &sb) != 0) {
+        return false;   // Let whoever opens it report the error
+    }
+
+    return !S_ISREG(sb.st_mode);
+}
+
     bool
 DeleteSingleFile(
     const char* filename)
@@ -1386,7 +1431,8 @@ OpenMemoryMappedFile(
     size_t length,
     void** o_contents,
     bool write,
-    bool sequential)
+    bool sequential,
+    bool populate)
 {
   int fd = open(filename, write ? O_CREAT | O_RDWR : O_RDONLY, S_IRUSR | S_IWUSR);
     if (fd < 0) {
@@ -1406,6 +1452,22 @@ OpenMemoryMappedFile(
     if (e < 0) {
         warn("OpenMemoryMappedFile %s madvise failed", filename);
     }
+    if (populate) {
+        // the huge page advice has to come before the pages are faulted in; it fails harmlessly where it isn't supported
+        bool populated = false;
+#ifdef MADV_HUGEPAGE
+        madvise(map, length + extra, MADV_HUGEPAGE);
+#endif
+#ifdef MADV_POPULATE_READ
+        populated = madvise(map, length + extra, MADV_POPULATE_READ) == 0;
+#endif
+        if (! populated) {
+            volatile char touch;
+            for (size_t i = 0; i < length + extra; i += page) {
+                touch = ((volatile char*) map)[i];
+            }
+        }
+    }
     MemoryMappedFile* result = new MemoryMappedFile();
     result->fd = fd;
     result->map = map;
@@ -1441,9 +1503,9 @@ void AdviseMemoryMappedFilePrefetch(const MemoryMappedFile *mappedFile)
 class PosixAsyncFile : public AsyncFile
 {
 public:
-    static PosixAsyncFile* open(const char* filename, bool write);
+    static PosixAsyncFile* open(const char* filename, bool write, bool unbuffered);
 
-    PosixAsyncFile(int i_fd);
+    PosixAsyncFile(int i_fd, bool i_dropCache);
 
     virtual bool close();
 
@@ -1478,6 +1540,8 @@ public:
         virtual bool beginRead(void* buffer, size_t length, size_t offset, size_t *bytesRead);
 
         virtual bool waitForCompletion();
+
+        virtual bool isComplete();
     
     private:
         PosixAsyncFile*     file;
@@ -1491,24 +1555,38 @@ public:
 
 private:
     int         fd;
+    bool        dropCache; // unbuffered, but O_DIRECT wasn't available
 };
 
     PosixAsyncFile*
 PosixAsyncFile::open(
     const char* filename,
-    bool write)
+    bool write,
+    bool unbuffered)
 {
-    int fd = ::open(filename, write ? O_CREAT | O_RDWR | O_TRUNC : O_RDONLY, write ? S_IRWXU | S_IRGRP : 0);
+    int flags = write ? O_CREAT | O_RDWR | O_TRUNC : O_RDONLY;
+    int fd = ::open(filename, flags | (unbuffered ? O_DIRECT : 0), write ? S_IRWXU | S_IRGRP : 0);
+    bool dropCache = false;
+    if (fd < 0 && unbuffered && errno == EINVAL) {
+        // e.g. tmpfs
+        fd = ::open(filename, flags, write ? S_IRWXU | S_IRGRP : 0);
+        dropCache = true;
+    }
     if (fd < 0) {
         WriteErrorMessage("Unable to create SAM file '%s', %d\n",filename,errno);
         return NULL;
     }
-    return new PosixAsyncFile(fd);
+    if (unbuffered) {
+        // whatever's cached from writing it won't be read through the cache again
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    }
+    return new PosixAsyncFile(fd, dropCache);
 }
 
 PosixAsyncFile::PosixAsyncFile(
-    int i_fd)
-    : fd(i_fd)
+    int i_fd,
+    bool i_dropCache)
+    : fd(i_fd), dropCache(i_dropCache)
 {
 }
 
@@ -1666,10 +1744,19 @@ PosixAsyncFile::Reader::waitForCompletion()
         if (result != NULL) {
             *result = max((ssize_t)0, ret);
         }
+        if (file->dropCache) {
+            posix_fadvise(file->fd, aiocb.aio_offset, aiocb.aio_nbytes, POSIX_FADV_DONTNEED);
+        }
     }
     return true;
 }
 
+    bool
+PosixAsyncFile::Reader::isComplete()
+{
+    return (! reading) || aio_error(&aiocb) != EINPROGRESS;
+}
+
 #else
 
 // todo: make this actually async!
@@ -1677,7 +1764,7 @@ PosixAsyncFile::Reader::waitForCompletion()
 class OsxAsyncFile : public AsyncFile
 {
 public:
-    static OsxAsyncFile* open(const char* filename, bool write);
+    static OsxAsyncFile* open(const char* filename, bool write, bool unbuffered);
 
     OsxAsyncFile(int i_fd);
 
@@ -1714,6 +1801,8 @@ public:
         virtual bool beginRead(void* buffer, size_t length, size_t offset, size_t *bytesRead);
 
         virtual bool waitForCompletion();
+
+        virtual bool isComplete();
     
     private:
         OsxAsyncFile*       file;
@@ -1730,13 +1819,17 @@ private:
     OsxAsyncFile*
 OsxAsyncFile::open(
     const char* filename,
-    bool write)
+    bool write,
+    bool unbuffered)
 {
     int fd = ::open(filename, write ? O_CREAT | O_RDWR | O_TRUNC : O_RDONLY, write ? S_IRWXU | S_IRGRP : 0);
     if (fd < 0) {
         WriteErrorMessage("Unable to create SAM file '%s', %d\n",filename,errno);
         return NULL;
     }
+    if (unbuffered) {
+        fcntl(fd, F_NOCACHE, 1);
+    }
     return new OsxAsyncFile(fd);
 }
 
@@ -1831,6 +1924,12 @@ OsxAsyncFile::Reader::beginRead(
 
     bool
 OsxAsyncFile::Reader::waitForCompletion()
+{
+    return true;
+}
+
+    bool
+OsxAsyncFile::Reader::isComplete()
 {
     return true;
 }
@@ -2200,18 +2299,18 @@ const char *DEFAULT_NAMED_PIPE_NAME = "SNAP";
 
 #endif  // _MSC_VER
 
-AsyncFile* AsyncFile::open(const char* filename, bool write)
+AsyncFile* AsyncFile::open(const char* filename, bool write, bool unbuffered)
 {
     if (!strcmp("-", filename) && write) {
         return StdoutAsyncFile::open("-", true);
     }
 #ifdef _MSC_VER
-    return WindowsAsyncFile::open(filename, write);
+    return WindowsAsyncFile::open(filename, write, unbuffered);
 #else
 #ifdef __linux__
-    return PosixAsyncFile::open(filename, write);
+    return PosixAsyncFile::open(filename, write, unbuffered);
 #else
-    return OsxAsyncFile::open(filename, write);
+    return OsxAsyncFile::open(filename, write, unbuffered);
 #endif
 #endif
 }
@@ -54,6 +54,7 @@ typedef HANDLE SingleWaiterObject;      // This is an event in Windows.  It's ju
 typedef HANDLE EventObject;
 
 #define PATH_SEP '\\'
+#define NULL_DEVICE "NUL"
 #define snprintf _snprintf
 #define mkdir(path, mode) _mkdir(path)
 #define strdup(s) _strdup(s)
@@ -68,6 +69,8 @@ typedef HANDLE EventObject;
 #define bit_rotate_right64(value, shift) _rotr64(value, shift)
 #define bit_rotate_left64(value, shift) _rotl64(value, shift)
 
+#define THREAD_LOCAL __declspec(thread)
+
 int getpagesize();
 #else   // _MSC_VER
 
@@ -107,6 +110,7 @@ inline double exp10(double x) { return exp(x * LOG10); }
 #define __in /* nothing */
 
 #define PATH_SEP '/'
+#define NULL_DEVICE "/dev/null"
 
 #ifdef DEBUG
 #define _ASSERT assert
@@ -130,6 +134,8 @@ inline double exp10(double x) { return exp(x * LOG10); }
 
 #define _stricmp strcasecmp
 
+#define THREAD_LOCAL __thread
+
 inline bool _BitScanForward64(unsigned long *result, _uint64 x) {
     *result = __builtin_ctzll(x);
     return x != 0;
@@ -355,6 +361,13 @@ unsigned GetNumberOfProcessors();
 
 _int64 QueryFileSize(const char *fileName);
 
+//
+// True for stdin ("-") and for inputs that can't be seeked or sized, such as named pipes, shell process substitution
+// (<(zcat ...)) and character devices.  These have to be read front to back on one thread.  This doesn't open the
+// file, since opening and closing a FIFO would disturb whatever is writing it.
+//
+bool IsStreamingInput(const char *fileName);
+
 // returns true on success
 bool DeleteSingleFile(const char* filename); // DeleteFile is a Windows macro...
 
@@ -378,7 +391,9 @@ void CloseLargeFile(LargeFileHandle* file);
 
 class MemoryMappedFile;
 
-MemoryMappedFile* OpenMemoryMappedFile(const char* filename, size_t offset, size_t length, void** o_contents, bool write = false, bool sequential = false);
+// populate reads the whole range in before returning, asking for huge pages where the filesystem can provide them (e.g. tmpfs)
+MemoryMappedFile* OpenMemoryMappedFile(const char* filename, size_t offset, size_t length, void** o_contents, bool write = false, bool sequential = false,
+    bool populate = false);
 
 // closes and deallocates the file structure
 void CloseMemoryMappedFile(MemoryMappedFile* mappedFile);
@@ -391,7 +406,11 @@ class AsyncFile
 public:
 
     // open a new file for reading and/or writing
-    static AsyncFile* open(const char* filename, bool write);
+    // unbuffered reads bypass the OS file cache, so offsets, lengths & buffers must be multiples of UnbufferedAlignment;
+    // where the filesystem doesn't support that, reads are cached as usual but dropped from the cache afterwards
+    static AsyncFile* open(const char* filename, bool write, bool unbuffered = false);
+
+    static const size_t UnbufferedAlignment = 4096;
 
     // free resources; must have destroyed all readers & writers first
     virtual bool close() = 0;
@@ -425,6 +444,9 @@ public:
 
         // wait for all prior beginReads to complete
         virtual bool waitForCompletion() = 0;
+
+        // true if there's no read in progress, without waiting
+        virtual bool isComplete() = 0;
     };
 
     // get a new reader, e.g. for another thread to use
@@ -27,6 +27,10 @@ Environment:
 #include "zlib.h"
 #include "exit.h"
 #include "Error.h"
+#include "Tracer.h"
+#ifndef _MSC_VER
+#include <poll.h>
+#endif
 
 using std::max;
 using std::min;
@@ -521,6 +525,7 @@ ReadBasedDataReader::advance(
     void
 ReadBasedDataReader::nextBatch()
 {
+    TraceScope trace(TraceReadData);
     AcquireExclusiveLock(&lock);
     _ASSERT(nextBufferForConsumer >= 0);
     BufferInfo* info = &bufferInfo[nextBufferForConsumer];
@@ -567,6 +572,7 @@ ReadBasedDataReader::nextBatch()
 
     bufferInfo[nextBufferForConsumer].offset = overflow;
     bufferInfo[nextBufferForConsumer].holds = 0;
+    trace.setBatch(bufferInfo[nextBufferForConsumer].batchID);
     //fprintf(stderr,"emitting buffer starting at 0x%llx\n", info->fileOffset);
     //if (nextStart != 0) fprintf(stderr, "checking NextStart 0x%llx\n", nextStart);  
     _ASSERT(nextStart == 0 || nextStart == bufferInfo[nextBufferForConsumer].fileOffset || bufferInfo[nextBufferForConsumer].isEOF);
@@ -751,6 +757,11 @@ ReadBasedDataReader::addBuffer()
     }
 }
 
+//
+// Reads from stdin, or from a named pipe or other input that can't seek.  Those can only be read front to back, so
+// a dedicated thread does the reads in order into the ring of buffers, and the consumer (and the aligner threads
+// that release batches and so restart IO) never wait on the pipe themselves, only on buffers that aren't full yet.
+//
 class StdioDataReader : public ReadBasedDataReader 
 {
 public:
@@ -760,7 +771,7 @@ public:
     virtual bool init(const char* i_fileName);
 
     virtual const char* getFilename()
-    { return "-"; }
+    { return fileName; }
 
  protected:
     
@@ -771,6 +782,13 @@ public:
     virtual void waitForBuffer(unsigned bufferNumber);
 
 private:
+
+    static void readerThread(void *context);
+
+    // Fills one buffer from the input; called on the reader thread without the lock held.  Returns false
+    // if it gave up because the reader is being destroyed.
+    bool readBuffer(BufferInfo *info);
+
     //
     // Because reads don't necessarily divide evenly into buffers, we have to assure that
     // the buffers that we read can overlap.  In file-IO based readers, we do this by reading
@@ -787,20 +805,62 @@ private:
     char    *overflowBuffer;
     bool     overflowBufferFilled;   // For the very first read, there may be no overlap buffer data.
 
-    bool    started;
-    bool    hitEOF;
+    bool    hitEOF;                  // Set (under the lock) once the reader thread has read the end of the input
 
     _int64 readOffset;
+
+    FILE    *input;
+    char    *fileName;
+
+    //
+    // Buffers handed to the reader thread, in the order they have to be filled.  Protected by the lock.
+    //
+    int     *readQueue;
+    int      readQueueHead;
+    int      readQueueCount;
+
+    bool         threadStarted;
+    volatile bool stopping;
+    EventObject  readRequested;      // Set when readQueue is non-empty, or on shutdown
+    EventObject  readCompleted;      // Set when the reader thread finishes a buffer
+    EventObject  readerThreadDone;
+
+    static bool stdinSupplied;
 };
 
+bool StdioDataReader::stdinSupplied = false;
+
 StdioDataReader::StdioDataReader(unsigned i_nBuffers, _int64 i_overflowBytes, double extraFactor) :
-    ReadBasedDataReader(i_nBuffers, i_overflowBytes, extraFactor), started(false), hitEOF(false), overflowBufferFilled(false),
-    readOffset(0), overflowBuffer(NULL)
+    ReadBasedDataReader(i_nBuffers, i_overflowBytes, extraFactor), hitEOF(false), overflowBufferFilled(false),
+    readOffset(0), overflowBuffer(NULL), input(NULL), fileName(NULL), readQueueHead(0), readQueueCount(0),
+    threadStarted(false), stopping(false)
 {
+    readQueue = new int[maxBuffers];
+    CreateEventObject(&readRequested);
+    CreateEventObject(&readCompleted);
+    CreateEventObject(&readerThreadDone);
 }
 
 StdioDataReader::~StdioDataReader()
 {
+    if (threadStarted) {
+        AcquireExclusiveLock(&lock);
+        stopping = true;
+        AllowEventWaitersToProceed(&readRequested);
+        ReleaseExclusiveLock(&lock);
+        WaitForEvent(&readerThreadDone);
+    }
+
+    if (NULL != input && stdin != input) {
+        fclose(input);
+    }
+    delete [] fileName;
+    delete [] readQueue;
+
+    DestroyEventObject(&readRequested);
+    DestroyEventObject(&readCompleted);
+    DestroyEventObject(&readerThreadDone);
+
     BigDealloc(overflowBuffer);
     overflowBuffer = NULL;
 }
@@ -808,10 +868,20 @@ StdioDataReader::~StdioDataReader()
 bool
 StdioDataReader::init(const char * i_fileName)
 {
+    fileName = new char[strlen(i_fileName) + 1];
+    strcpy(fileName, i_fileName);
+
     if (strcmp(i_fileName, "-")) {
-        WriteErrorMessage("StdioDataReader: must have filename of '-', got '%s'\n", i_fileName);
-        soft_exit(1);
+        input = fopen(i_fileName, "rb");
+        return NULL != input;
+    }
+
+    if (stdinSupplied) {
+        WriteErrorMessage("You can only use stdin input for one run per execution of SNAP (i.e., if you use ',' to run SNAP more than once without reloading the index, you can only use stdin once)\n");
+        soft_exit_no_print(1);
     }
+    stdinSupplied = true;
+    input = stdin;
 
 #ifdef _MSC_VER
     int result = _setmode( _fileno( stdin ), _O_BINARY );  // puts stdin in to non-translated mode, so if we're reading compressed data windows' CRLF processing doesn't destroy it.
@@ -828,11 +898,9 @@ void
 StdioDataReader::startIo()
 {
 	AssertExclusiveLockHeld(&lock);
-	
-	started = true;
 
     //
-    // Synchronously read data into whatever buffers are ready.
+    // Queue up whatever buffers are free to be read, in order.
     //
     while (nextBufferForReader != -1) {
         // remove from free list
@@ -854,7 +922,10 @@ StdioDataReader::startIo()
 			nextBufferForConsumer = index;
 		}
        
-        if (hitEOF) {
+        if (hitEOF && 0 == readQueueCount) {
+            //
+            // Nothing more is coming, so there's no need to involve the reader thread.
+            //
             info->validBytes = 0;
             info->buffer[0] = '\0';
             info->nBytesThatMayBeginARead = 0;
@@ -863,69 +934,164 @@ StdioDataReader::startIo()
             return;
         }
 
-        size_t amountToRead;
-        size_t bufferOffset;
-        if (overflowBufferFilled) {
-            //
-            // Copy the bytes from the overflow buffer into our buffer.
-            //
-			memcpy(info->buffer, overflowBuffer, overflowBytes);
-			bufferOffset = overflowBytes;
-			amountToRead = bufferSize - overflowBytes;
-			info->fileOffset = readOffset - overflowBytes;
-        } else {
-            amountToRead = bufferSize;
-            bufferOffset = 0;
-            info->fileOffset = readOffset;
+        info->state = Reading;
+        _ASSERT(readQueueCount < (int)maxBuffers);
+        readQueue[(readQueueHead + readQueueCount) % maxBuffers] = index;
+        readQueueCount++;
+        AllowEventWaitersToProceed(&readRequested);
+
+        if (!threadStarted) {
+            threadStarted = true;
+            if (!StartNewThread(readerThread, this)) {
+                WriteErrorMessage("StdioDataReader: failed to start reader thread\n");
+                soft_exit(1);
+            }
         }
+    }
 
-        //
-        // We have to run this holding the lock, because otherwise there's no way to make the overflow buffer work properly.  
-        //
-        size_t bytesRead = fread(info->buffer + bufferOffset, 1, amountToRead, stdin);
-        //fprintf(stderr,"StdioDataReader:startIO(): Read offset 0x%llx into buffer at 0x%llx, size %d, copied 0x%x overflow bytes, start at 0x%llx, tid %d\n", readOffset, info->buffer, bytesRead, bufferOffset, readOffset - bufferOffset, GetCurrentThreadId());
+    if (nextBufferForConsumer == -1) {
+        //fprintf(stderr, "startIo thread %x reset releaseEvent\n", GetCurrentThreadId());
+        PreventEventWaitersFromProceeding(&releaseEvent);
+    }
+}
 
-        readOffset += bytesRead;
+    void
+StdioDataReader::readerThread(void *context)
+{
+    StdioDataReader *reader = (StdioDataReader *)context;
 
-        if (bytesRead != amountToRead) {
-            if (feof(stdin)) {
-                info->isEOF = true;
-                hitEOF = true;
-            } else {
-                WriteErrorMessage("StdinDataReader: Error reading stdin (but not EOF).\n");
-                soft_exit(1);
-            }
-        } else {
-            info->isEOF = false;
+    AcquireExclusiveLock(&reader->lock);
+    for (;;) {
+        while (0 == reader->readQueueCount && !reader->stopping) {
+            PreventEventWaitersFromProceeding(&reader->readRequested);
+            ReleaseExclusiveLock(&reader->lock);
+            WaitForEvent(&reader->readRequested);
+            AcquireExclusiveLock(&reader->lock);
         }
 
-        info->validBytes = (unsigned)(bytesRead + bufferOffset);
+        if (reader->stopping) {
+            break;
+        }
 
-        if (hitEOF) {
-            info->nBytesThatMayBeginARead = (unsigned)(bytesRead + bufferOffset);
-            overflowBufferFilled = false;
-        } else {
-            info->nBytesThatMayBeginARead = (unsigned)(bytesRead + bufferOffset - overflowBytes);
-            //
-            // Fill the overflow buffer with the last bytes from this buffer.
-            //
-            if (NULL == overflowBuffer) {
-                //
-                // We can get here if we never called readHeader().  If so, we know we never will and so
-                // we can just allocate the overflow buffer to be the size of the header.
-                //
-                overflowBuffer = (char *)BigAlloc(overflowBytes);
-            }
-            memcpy(overflowBuffer, info->buffer + bufferOffset + bytesRead - overflowBytes, overflowBytes);
-            overflowBufferFilled = true;
+        BufferInfo *info = &reader->bufferInfo[reader->readQueue[reader->readQueueHead]];
+        reader->readQueueHead = (reader->readQueueHead + 1) % reader->maxBuffers;
+        reader->readQueueCount--;
+
+        //
+        // Only this thread touches the input, the overflow buffer and a buffer that's Reading, so the read itself
+        // doesn't need the lock.
+        //
+        bool eofBefore = reader->hitEOF;
+        ReleaseExclusiveLock(&reader->lock);
+        if (eofBefore) {
+            info->validBytes = 0;
+            info->nBytesThatMayBeginARead = 0;
+            info->isEOF = true;
+        } else if (!reader->readBuffer(info)) {
+            AcquireExclusiveLock(&reader->lock);
+            break;
+        }
+        info->buffer[info->validBytes] = '\0';
+        AcquireExclusiveLock(&reader->lock);
+
+        if (info->isEOF) {
+            reader->hitEOF = true;
         }
         info->state = Full;
+        AllowEventWaitersToProceed(&reader->readCompleted);
     }
+    ReleaseExclusiveLock(&reader->lock);
 
-    if (nextBufferForConsumer == -1) {
-        //fprintf(stderr, "startIo thread %x reset releaseEvent\n", GetCurrentThreadId());
-        PreventEventWaitersFromProceeding(&releaseEvent);
+    AllowEventWaitersToProceed(&reader->readerThreadDone);
+}
+
+    bool
+StdioDataReader::readBuffer(BufferInfo *info)
+{
+    size_t amountToRead;
+    size_t bufferOffset;
+    if (overflowBufferFilled) {
+        //
+        // Copy the bytes from the overflow buffer into our buffer.
+        //
+		memcpy(info->buffer, overflowBuffer, overflowBytes);
+		bufferOffset = overflowBytes;
+		amountToRead = bufferSize - overflowBytes;
+		info->fileOffset = readOffset - overflowBytes;
+    } else {
+        amountToRead = bufferSize;
+        bufferOffset = 0;
+        info->fileOffset = readOffset;
     }
+
+    //
+    // Reads from a pipe can come back short before EOF, so keep going until the buffer is full or the input ends.
+    //
+    size_t bytesRead = 0;
+    bool eof = false;
+    while (bytesRead < amountToRead) {
+#ifdef _MSC_VER
+        size_t bytesThisTime = fread(info->buffer + bufferOffset + bytesRead, 1, amountToRead - bytesRead, input);
+        bytesRead += bytesThisTime;
+        if (0 == bytesThisTime || feof(input) || ferror(input)) {
+            eof = feof(input) != 0;
+            break;
+        }
+#else   // _MSC_VER
+        //
+        // Wait for input with a timeout rather than blocking in a read, so the destructor can stop this thread
+        // even if whatever is writing into a pipe never closes it.  Everything is read straight from the file
+        // descriptor, so there's nothing buffered in the FILE that poll wouldn't see.
+        //
+        struct pollfd pollFd;
+        pollFd.fd = fileno(input);
+        pollFd.events = POLLIN;
+        pollFd.revents = 0;
+        int ready = poll(&pollFd, 1, 100);
+        if (stopping) {
+            return false;
+        }
+        if (ready <= 0) {
+            continue;   // timed out or interrupted
+        }
+        ssize_t bytesThisTime = read(pollFd.fd, info->buffer + bufferOffset + bytesRead, amountToRead - bytesRead);
+        if (bytesThisTime < 0 && EINTR == errno) {
+            continue;
+        }
+        if (bytesThisTime <= 0) {
+            eof = 0 == bytesThisTime;
+            break;
+        }
+        bytesRead += bytesThisTime;
+#endif  // _MSC_VER
+    }
+    //fprintf(stderr,"StdioDataReader:readBuffer(): Read offset 0x%llx into buffer at 0x%llx, size %d, copied 0x%x overflow bytes, start at 0x%llx, tid %d\n", readOffset, info->buffer, bytesRead, bufferOffset, readOffset - bufferOffset, GetCurrentThreadId());
+
+    readOffset += bytesRead;
+
+    if (bytesRead != amountToRead && !eof) {
+        WriteErrorMessage("StdioDataReader: Error reading %s (but not EOF).\n", fileName);
+        soft_exit(1);
+    }
+    info->isEOF = eof;
+
+    info->validBytes = (unsigned)(bytesRead + bufferOffset);
+
+    if (eof) {
+        info->nBytesThatMayBeginARead = (unsigned)(bytesRead + bufferOffset);
+        overflowBufferFilled = false;
+    } else {
+        info->nBytesThatMayBeginARead = (unsigned)(bytesRead + bufferOffset - overflowBytes);
+        //
+        // Fill the overflow buffer with the last bytes from this buffer.
+        //
+        if (NULL == overflowBuffer) {
+            overflowBuffer = (char *)BigAlloc(overflowBytes);
+        }
+        memcpy(overflowBuffer, info->buffer + bufferOffset + bytesRead - overflowBytes, overflowBytes);
+        overflowBufferFilled = true;
+    }
+    return true;
 }
  
     void
@@ -962,15 +1128,21 @@ StdioDataReader::waitForBuffer(
 #endif
     }
 
-    if (info->state == Full) {
-        return;
+    if (info->state == Empty) {
+        startIo();
     }
 
-    _ASSERT(info->state != Reading);    // We're synchronous, we don't use Reading
-    startIo();
-    
-    info->state = Full;
-    info->buffer[info->validBytes] = 0;
+    //
+    // Only the consumer waits for reads, so resetting the event here can't hide a completion from anyone else.
+    //
+    while (info->state == Reading) {
+        PreventEventWaitersFromProceeding(&readCompleted);
+        ReleaseExclusiveLock(&lock);
+        _int64 start = timeInNanos();
+        WaitForEvent(&readCompleted);
+        InterlockedAdd64AndReturnNewValue(&ReadWaitTime, timeInNanos() - start);
+        AcquireExclusiveLock(&lock);
+    }
 }
 
 class StdioDataSupplier : public DataSupplier
@@ -979,22 +1151,10 @@ public:
     StdioDataSupplier() : DataSupplier() {}
     virtual DataReader* getDataReader(int bufferCount, _int64 overflowBytes, double extraFactor = 0.0, size_t bufferSpace = 0)
     {
-        if (supplied) {
-            WriteErrorMessage("You can only use stdin input for one run per execution of SNAP (i.e., if you use ',' to run SNAP more than once without reloading the index, you can only use stdin once)\n");
-            soft_exit_no_print(1);
-        }
-
-        supplied = true;
-
         return new StdioDataReader(bufferCount, overflowBytes, extraFactor);
     }
-private:
-
-    static bool supplied;
 };
 
-bool StdioDataSupplier::supplied = false;
-
 
 #ifdef _MSC_VER
 class WindowsOverlappedDataReader : public ReadBasedDataReader
@@ -1530,6 +1690,7 @@ DecompressDataReader::nextBatch()
     if (eof) {
         return;
     }
+    TraceScope trace(TraceReadData);
     Entry* old = peekReady();
     popReady();
     if (old->decompressedValid == overflowBytes) {
@@ -1538,6 +1699,7 @@ DecompressDataReader::nextBatch()
     }
     Entry* next = peekReady();
     _ASSERT(next->state == EntryReady && next->decompressed != NULL);
+    trace.setBatch(next->batch.batchID);
     _int64 copy = old->decompressedValid - max(offset, old->decompressedStart);
     memcpy(next->decompressed + overflowBytes - copy, old->decompressed + old->decompressedValid - copy, copy);
     offset = overflowBytes - copy;
@@ -1740,6 +1902,7 @@ DecompressWorker::DecompressWorker()
 DecompressWorker::step()
 {
     DecompressManager* manager = (DecompressManager*) getManager();
+    TraceScope trace(TraceDecompress, manager->entry->batch.batchID);
     for (int i = getThreadNum(); i < manager->inputs->size() - 1; i += getNumThreads()) {
         _int64 inputUsed, outputUsed;
         DecompressDataReader::decompress(&zstream,
@@ -1761,6 +1924,7 @@ DecompressDataReader::decompressThread(
     void* context)
 {
     DecompressDataReader* reader = (DecompressDataReader*) context;
+    Tracer::NameThread("decompress reader");
     OffsetVector inputs, outputs;
     DecompressManager manager(&inputs, &outputs);
     ParallelCoworker coworker(min(8, DataSupplier::ThreadCount), false, &manager);
@@ -1841,6 +2005,7 @@ DecompressDataReader::decompressThreadContinuous(
     void* context)
 {
     DecompressDataReader* reader = (DecompressDataReader*) context;
+    Tracer::NameThread("decompress reader");
     z_stream zstream;
     bool first = true;
     bool stop = false;
@@ -1875,6 +2040,7 @@ DecompressDataReader::decompressThreadContinuous(
             reader->holdBatch(entry->batch); // hold batch while decompressing
             reader->inner->advance(entry->compressedValid);
             reader->inner->nextBatch(); // start reading next batch
+            TraceScope trace(TraceDecompress, entry->batch.batchID);
             decompress(&zstream, NULL,
                 entry->compressed, entry->compressedValid, &compressedRead,
                 entry->decompressed + reader->overflowBytes, reader->extraBytes - reader->overflowBytes, &decompressedWritten,
@@ -2284,6 +2450,7 @@ MemMapDataReader::nextBatch()
     if (isEOF()) {
         return;
     }
+    TraceScope trace(TraceReadData);
     while (true) {
         acquireLock();
         if (extraBatches == NULL || extraUsed < batchCount) {
@@ -2310,6 +2477,7 @@ MemMapDataReader::nextBatch()
             startBytes = min(batchSize, currentMapStartSize - (currentBatch - 1) * batchSize);
             validBytes = min(batchSize + overflowBytes, currentMapSize - (currentBatch - 1) * batchSize);
             _ASSERT(validBytes >= 0);
+            trace.setBatch(currentBatch);
             return;
         }
         releaseLock();
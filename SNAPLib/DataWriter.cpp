@@ -21,9 +21,11 @@ Environment:
 #include "Compat.h"
 #include "DataWriter.h"
 #include "ParallelTask.h"
+#include "VariableSizeVector.h"
 #include "exit.h"
 #include "Bam.h"
 #include "Error.h"
+#include "Tracer.h"
 
 using std::min;
 using std::max;
@@ -49,9 +51,13 @@ private:
     FileEncoder* encoder;
     const int bufferCount;
     const size_t bufferSize;
-    ExclusiveLock lock;
-    size_t sharedOffset;
-    size_t sharedLogical;
+    ExclusiveLock lock; // only used when pairedOffsets
+    volatile _int64 sharedOffset;
+    volatile _int64 sharedLogical;
+    // physical & logical sizes differ per batch and have to be assigned together; otherwise they're independent
+    // (one of them is always 0 when there's an encoder) or always equal, and each is a single atomic add
+    bool pairedOffsets;
+    bool sameOffsets;
     bool closing;
 };
 
@@ -75,6 +81,8 @@ public:
         DestroyExclusiveLock(&lock);
     }
 
+    virtual void inHeader(bool flag);
+
     virtual bool getBuffer(char** o_buffer, size_t* o_size);
 
     virtual void advance(GenomeDistance bytes, GenomeLocation location = 0);
@@ -87,6 +95,9 @@ public:
 
 private:
 
+    // run the filter over the records advanced into the current batch since the last call
+    void filterRecords();
+
     void acquireLock()
     { if (encoder != NULL) { AcquireExclusiveLock(&lock); } }
 
@@ -104,6 +115,17 @@ private:
         EventObject encoded;
     };
     Batch* batches;
+
+    // records advanced into the current batch, so the filter sees them all at once when the batch is handed off
+    // rather than being called in between formatting each one
+    struct Record
+    {
+        size_t          batchOffset;
+        GenomeDistance  bytes;
+        GenomeLocation  location;
+    };
+    VariableSizeVector<Record> records;
+
     const int count;
     const size_t bufferSize;
     AsyncDataWriterSupplier* supplier;
@@ -238,7 +260,7 @@ FileEncoder::getOffsets(
     // logical has already been set correctly in batch
     *o_logicalOffset = writer->batches[encoderBatch].logicalOffset;
     // physical is not yet updated, use shared
-    *o_physicalOffset = writer->supplier->sharedOffset;
+    *o_physicalOffset = (size_t)writer->supplier->sharedOffset;
 }
 
     void
@@ -265,6 +287,7 @@ AsyncDataWriter::AsyncDataWriter(
     FileEncoder* i_encoder)
     :
     DataWriter(i_filter),
+    records(4096),
     encoder(i_encoder),
     supplier(i_supplier),
     count(i_count),
@@ -297,6 +320,14 @@ AsyncDataWriter::AsyncDataWriter(
     }
 }
     
+    void
+AsyncDataWriter::inHeader(
+    bool flag)
+{
+    filterRecords(); // so they're seen with the flag they were written under
+    DataWriter::inHeader(flag);
+}
+
     bool
 AsyncDataWriter::getBuffer(
     char** o_buffer,
@@ -313,14 +344,28 @@ AsyncDataWriter::advance(
     GenomeLocation location)
 {
     _ASSERT((size_t)bytes <= bufferSize - batches[current].used);
-    char* data = batches[current].buffer + batches[current].used;
     size_t batchOffset = batches[current].used;
     batches[current].used = min<long long>(bufferSize, batchOffset + bytes);
     if (filter != NULL) {
-        //_int64 start = timeInNanos();
-        filter->onAdvance(this, batchOffset, data, bytes, location);
-        //InterlockedAdd64AndReturnNewValue(&FilterTime, timeInNanos() - start);
+        Record record;
+        record.batchOffset = batchOffset;
+        record.bytes = bytes;
+        record.location = location;
+        records.push_back(record);
+    }
+}
+
+    void
+AsyncDataWriter::filterRecords()
+{
+    if (filter == NULL) {
+        return;
+    }
+    char* buffer = batches[current].buffer;
+    for (int i = 0; i < records.size(); i++) {
+        filter->onAdvance(this, records[i].batchOffset, buffer + records[i].batchOffset, records[i].bytes, records[i].location);
     }
+    records.clear();
 }
 
     bool
@@ -358,6 +403,7 @@ AsyncDataWriter::getBatch(
         *o_logicalOffset = relative <=0 ? batch->logicalOffset : 0;
     }
     if (relative >= 0) {
+        TraceScope trace(TraceWriteWait);
         if (encoder != NULL) {
             WaitForEvent(&batch->encoded);
         }
@@ -369,7 +415,10 @@ AsyncDataWriter::getBatch(
     bool
 AsyncDataWriter::nextBatch()
 {
+    TraceScope trace(TraceWriteBatch);
     _int64 start = timeInNanos();
+    // the encoder never looks at the current batch, so this doesn't need the lock
+    filterRecords();
     if (encoder != NULL) {
         WaitForEvent(&batches[(current + 1) % count].encoded);
     }
@@ -384,13 +433,18 @@ AsyncDataWriter::nextBatch()
     bool newSize = filter != NULL && (filter->filterType == TransformFilter || filter->filterType == ResizeFilter);
     if (newSize) {
         // advisory only
-        write->fileOffset = supplier->sharedOffset;
-        write->logicalOffset = supplier->sharedLogical;
+        write->fileOffset = (size_t)supplier->sharedOffset;
+        write->logicalOffset = (size_t)supplier->sharedLogical;
     } else {
         supplier->advance(encoder == NULL ? write->used : 0, write->logicalUsed, &write->fileOffset, &write->logicalOffset);
     }
+    trace.setBatch(write->fileOffset);
     if (filter != NULL) {
-        size_t n = filter->onNextBatch(this, write->fileOffset, write->used);
+        size_t n;
+        {
+            TraceScope filterTrace(TraceWriteFilter, write->fileOffset);
+            n = filter->onNextBatch(this, write->fileOffset, write->used);
+        }
 	    if (newSize) {
 	        write->used = n;
             supplier->advance(encoder == NULL ? write->used : 0, write->logicalUsed, &write->fileOffset, &write->logicalOffset);
@@ -424,9 +478,12 @@ AsyncDataWriter::nextBatch()
         PreventEventWaitersFromProceeding(&write->encoded);
         encoder->inputReady();
     }
-    if (! batches[current].file->waitForCompletion()) {
-        WriteErrorMessage("error: file write failed\n");
-        soft_exit(1);
+    {
+        TraceScope waitTrace(TraceWriteWait);
+        if (! batches[current].file->waitForCompletion()) {
+            WriteErrorMessage("error: file write failed\n");
+            soft_exit(1);
+        }
     }
     InterlockedAdd64AndReturnNewValue(&WaitTime, timeInNanos() - start2);
     return true;
@@ -436,6 +493,9 @@ AsyncDataWriter::nextBatch()
 AsyncDataWriter::close()
 {
     nextBatch(); // ensure last buffer gets written
+    if (filter != NULL) {
+        filter->onClose(this);
+    }
     if (encoder != NULL) {
         encoder->close();
         for (int i = 0; i < count; i++) {
@@ -463,6 +523,9 @@ AsyncDataWriterSupplier::AsyncDataWriterSupplier(
     sharedLogical(0),
     closing(false)
 {
+    bool resizing = filterSupplier != NULL && (filterSupplier->filterType == DataWriter::TransformFilter || filterSupplier->filterType == DataWriter::ResizeFilter);
+    pairedOffsets = encoder == NULL && resizing;
+    sameOffsets = encoder == NULL && ! resizing;
     file = AsyncFile::open(filename, true);
     if (file == NULL) {
         WriteErrorMessage("failed to open %s for write\n", filename);
@@ -499,13 +562,23 @@ AsyncDataWriterSupplier::advance(
     size_t* o_physical,
     size_t* o_logical)
 {
-    AcquireExclusiveLock(&lock);
-    *o_physical = sharedOffset;
-    sharedOffset += physical;
-    *o_logical = sharedLogical;
-    sharedLogical += logical;
-    //fprintf(stderr, "advance %lld + %lld = %lld, logical %lld + %lld = %lld\n", *o_physical, physical, sharedOffset, *o_logical, logical, sharedLogical);
-    ReleaseExclusiveLock(&lock);
+    if (pairedOffsets) {
+        AcquireExclusiveLock(&lock);
+        *o_physical = (size_t)sharedOffset;
+        sharedOffset += physical;
+        *o_logical = (size_t)sharedLogical;
+        sharedLogical += logical;
+        ReleaseExclusiveLock(&lock);
+        return;
+    }
+    *o_physical = (size_t)(InterlockedAdd64AndReturnNewValue(&sharedOffset, physical) - physical);
+    if (sameOffsets) {
+        _ASSERT(logical == physical);
+        InterlockedAdd64AndReturnNewValue(&sharedLogical, logical);
+        *o_logical = *o_physical;
+    } else {
+        *o_logical = (size_t)(InterlockedAdd64AndReturnNewValue(&sharedLogical, logical) - logical);
+    }
 }
 
     DataWriterSupplier*
@@ -547,6 +620,12 @@ public:
         return sb;
     }
 
+    virtual void onClose(DataWriter* writer)
+    {
+        a->onClose(writer);
+        b->onClose(writer);
+    }
+
 private:
     DataWriter::Filter* a;
     DataWriter::Filter* b;
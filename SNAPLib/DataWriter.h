@@ -28,6 +28,7 @@ Revision History:
 #include "Genome.h"
 
 class DataWriterSupplier;
+class InputOrderListener;
 
 // per-thread writer for data into a single destination
 class DataWriter
@@ -64,6 +65,10 @@ public:
         // TransformFilters return #byte of transformed data in current buffer, so we need to advance again
         // TransformFilters should call getBatch(0) to ensure current buffer has been written before they write into it
         virtual size_t onNextBatch(DataWriter* writer, size_t offset, size_t bytes) = 0;
+
+        // called when the writer is closed, after the last batch; anything the filter is still doing with the
+        // writer's buffers must be finished before this returns, since they're freed next
+        virtual void onClose(DataWriter* writer) {} // default do nothing
     };
     
     // factory for per-thread filters
@@ -89,7 +94,7 @@ public:
 
     virtual ~DataWriter() {}
 
-	void inHeader(bool flag)
+	virtual void inHeader(bool flag)
 	{ if (filter != NULL) { filter->inHeader(flag); } }
 
     // get remaining space in current buffer for writing
@@ -110,6 +115,9 @@ public:
     // this thread is complete
     virtual void close() = 0;
 
+    // non-NULL for writers that put output back into input order
+    virtual InputOrderListener* getInputOrderListener() { return NULL; }
+
     // nanosecond timers
     static volatile _int64 FilterTime;
     static volatile _int64 WaitTime;
@@ -150,14 +158,25 @@ public:
         const char* sortedFileName,
         DataWriter::FilterSupplier* sortedFilterSupplier,
         size_t maxBufferSize,
+        const char* spillDirectories = NULL, // comma-separated, to spread spill I/O over several devices
         FileEncoder* encoder = NULL);
 
+    // wraps inner so that output appears in input order, as reported through each writer's InputOrderListener
+    // keeps at most window input units of output in memory, stalling writers that get too far ahead
+    static DataWriterSupplier* ordered(
+        DataWriterSupplier* inner,
+        size_t bufferSize,
+        int window);
+
     // defaults follow BAM output spec
     static GzipWriterFilterSupplier* gzip(bool bamFormat, size_t chunkSize, int numThreads, bool bindToProcessors, bool multiThreaded);
 
     static DataWriter::FilterSupplier* markDuplicates(const Genome* genome);
 
     static DataWriter::FilterSupplier* bamIndex(const char* indexFileName, const Genome* genome, GzipWriterFilterSupplier* gzipSupplier);
+
+    // depth, coverage, insert size & duplicate metrics written to files starting with prefix when closed
+    static DataWriter::FilterSupplier* metrics(const char* prefix, const Genome* genome, unsigned binSize);
 };
 
 class AsyncDataWriter;
@@ -170,7 +170,7 @@ ReadFASTAGenome(
     //
     genome->addData(paddingBuffer);
     genome->fillInContigLengths();
-    genome->sortContigsByName();
+    genome->indexContigs();
 
     fclose(fastaFile);
     delete [] paddingBuffer;
@@ -33,6 +33,7 @@ Revision History:
 #include "Util.h"
 #include "exit.h"
 #include "Error.h"
+#include "ReadTrimmer.h"
 
 using std::min;
 using util::strnchr;
@@ -275,6 +276,9 @@ FASTQReader::getReadFromBuffer(char *buffer, _int64 validBytes, Read *readToUpda
     const char* space = strnchr(id, ' ', lineLengths[0] - 1);
     readToUpdate->init(id, space != NULL ? (unsigned) (space - id) : (unsigned) lineLengths[0] - 1, lines[1], lines[3], lineLengths[1]);
     readToUpdate->clip(context.clipping);
+    if (NULL != context.trimmer) {
+        context.trimmer->trim(readToUpdate);
+    }
     readToUpdate->setBatch(data->getBatch());
     readToUpdate->setReadGroup(context.defaultReadGroup);
 
@@ -552,13 +556,14 @@ PairedFASTQReader::createPairedReadSupplierGenerator(
     //
     // Decide whether to use the range splitter or a queue based on whether the files are the same size.
     //
-    if (!strcmp("-", fileNames[0]) || !strcmp("-", fileNames[1]) || QueryFileSize(fileNames[0]) != QueryFileSize(fileNames[1]) || gzip) {
+    bool isStream[2] = {IsStreamingInput(fileNames[0]), IsStreamingInput(fileNames[1])};
+    if (isStream[0] || isStream[1] || QueryFileSize(fileNames[0]) != QueryFileSize(fileNames[1]) || gzip) {
         //WriteStatusMessage("FASTQ using supplier queue\n");
         DataSupplier* dataSupplier[2];
         size_t fileSize[2];
 
         for (int i = 0; i < 2; i++) {
-            if (!strcmp(fileNames[i], "-")) {
+            if (isStream[i]) {
                 fileSize[i] = 0;
                 if (gzip) {
                     dataSupplier[i] = DataSupplier::GzipStdio;
@@ -600,8 +605,8 @@ FASTQReader::createReadSupplierGenerator(
     const ReaderContext& context,
     bool gzip)
 {
-    bool isStdin = !strcmp(fileName,"-");
-    if (! gzip && !isStdin) {
+    bool isStream = IsStreamingInput(fileName);
+    if (! gzip && !isStream) {
         //
         // Single ended uncompressed FASTQ files can be handled by a range splitter.
         //
@@ -609,9 +614,9 @@ FASTQReader::createReadSupplierGenerator(
     } else {
         ReadReader* fastq;
         //
-        // Because we can only have one stdin reader, we need to use a queue if we're reading from stdin
+        // Pipes and stdin can't seek or be read by more than one reader, so they need to use a queue
         //
-        if (isStdin) {
+        if (isStream) {
             if (gzip) {
                 fastq = FASTQReader::create(DataSupplier::GzipStdio, fileName, ReadSupplierQueue::BufferCount(numThreads), 0, 0, context);
             } else {
@@ -637,12 +642,12 @@ PairedInterleavedFASTQReader::createPairedReadSupplierGenerator(
     const ReaderContext& context,
     bool gzip)
 {
-     bool isStdin = !strcmp(fileName,"-");
+     bool isStream = IsStreamingInput(fileName);
  
-     if (gzip || isStdin) {
+     if (gzip || isStream) {
         //WriteStatusMessage("PairedInterleavedFASTQ using supplier queue\n");
         DataSupplier *dataSupplier;
-        if (isStdin) {
+        if (isStream) {
             if (gzip) {
                 dataSupplier = DataSupplier::GzipStdio;
             } else {
@@ -653,7 +658,7 @@ PairedInterleavedFASTQReader::createPairedReadSupplierGenerator(
         }
         
         PairedReadReader *reader = PairedInterleavedFASTQReader::create(dataSupplier, fileName,
-            ReadSupplierQueue::BufferCount(numThreads), 0,(stdin ? 0 : QueryFileSize(fileName)),context);
+            ReadSupplierQueue::BufferCount(numThreads), 0,(isStream ? 0 : QueryFileSize(fileName)),context);
  
         if (NULL == reader ) {
             delete reader;
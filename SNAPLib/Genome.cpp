@@ -36,8 +36,9 @@ Genome::Genome(GenomeDistance i_maxBases, GenomeDistance nBasesStored, unsigned
 : maxBases(i_maxBases), minLocation(0), maxLocation(i_maxBases), chromosomePadding(i_chromosomePadding), maxContigs(i_maxContigs),
   mappedFile(NULL)
 {
-    bases = ((char *) BigAlloc(nBasesStored + 2 * N_PADDING)) + N_PADDING;
-    if (NULL == bases) {
+    basesAllocation = (char *) BigAlloc(nBasesStored + 2 * N_PADDING);
+    bases = basesAllocation + N_PADDING;
+    if (NULL == basesAllocation) {
         WriteErrorMessage("Genome: unable to allocate memory for %llu bases\n", GenomeLocationAsInt64(maxBases));
         soft_exit(1);
     }
@@ -50,7 +51,15 @@ Genome::Genome(GenomeDistance i_maxBases, GenomeDistance nBasesStored, unsigned
 
     nContigs = 0;
     contigs = new Contig[maxContigs];
-    contigsByName = NULL;
+
+    contigAtBucket = NULL;
+    nBuckets = 0;
+    bucketShift = 0;
+    contigByNameHash = NULL;
+    nameHashMask = 0;
+
+    contigNameBlock = NULL;
+    contigNameBlockUsed = contigNameBlockSize = 0;
 }
 
     void
@@ -96,7 +105,7 @@ Genome::startContig(const char *contigName)
 
     contigs[nContigs].beginningLocation = nBases;
     size_t len = strlen(contigName) + 1;
-    contigs[nContigs].name = new char[len];
+    contigs[nContigs].name = allocateContigName(len);
     contigs[nContigs].nameLength = (unsigned)len-1;
 
     strncpy(contigs[nContigs].name,contigName,len);
@@ -108,16 +117,16 @@ Genome::startContig(const char *contigName)
 
 Genome::~Genome()
 {
-    BigDealloc(bases - N_PADDING);
-    for (int i = 0; i < nContigs; i++) {
-        delete [] contigs[i].name;
-        contigs[i].name = NULL;
+    BigDealloc(basesAllocation);
+    while (NULL != contigNameBlock) {
+        char *previousBlock = *(char **)contigNameBlock;
+        delete [] contigNameBlock;
+        contigNameBlock = previousBlock;
     }
 
     delete [] contigs;
-    if (contigsByName) {
-        delete [] contigsByName;
-    }
+    delete [] contigAtBucket;
+    delete [] contigByNameHash;
     contigs = NULL;
 
 	if (NULL != mappedFile) {
@@ -203,10 +212,11 @@ Genome::loadFromFile(const char *fileName, unsigned chromosomePadding, GenomeLoc
         maxLocation = minLocation + length;
     }
 
-    Genome *genome = new Genome(nBases, length, chromosomePadding);
+    Genome *genome = new Genome(nBases, map ? 0 : length, chromosomePadding);   // A mapped genome's bases stay in the file
    
     genome->nBases = nBases;
     genome->nContigs = genome->maxContigs = nContigs;
+    delete [] genome->contigs;
     genome->contigs = new Contig[nContigs];
     genome->minLocation = minLocation;
     if (GenomeLocationAsInt64(minLocation) >= nBases) {
@@ -216,17 +226,55 @@ Genome::loadFromFile(const char *fileName, unsigned chromosomePadding, GenomeLoc
 
     genome->maxLocation = maxLocation;
 
+    if (!loadContigs(genome, loadFile, fileName)) {
+        delete genome;
+        return NULL;
+    }
+
+    if (0 != loadFile->advance(GenomeLocationAsInt64(minLocation))) {
+        WriteErrorMessage("Genome::loadFromFile: _fseek64bit failed\n");
+        soft_exit(1);
+    }
+
+    size_t readSize;
+	if (map) {
+		GenericFile_map *mappedFile = (GenericFile_map *)loadFile;
+		genome->bases = (char *)mappedFile->mapAndAdvance(length, &readSize);
+		genome->mappedFile = mappedFile;
+		mappedFile->prefetch();
+	} else {
+		readSize = loadFile->read(genome->bases, length);
+
+		loadFile->close();
+		delete loadFile;
+		loadFile = NULL;
+	}
+
+	if (length != readSize) {
+		WriteErrorMessage("Genome::loadFromFile: fread of bases failed; wanted %u, got %d\n", length, readSize);
+		delete loadFile;
+		delete genome;
+		return NULL;
+	}
+	
+	genome->fillInContigLengths();
+    genome->indexContigs();
+    return genome;
+}
+
+    bool
+Genome::loadContigs(Genome *genome, GenericFile *loadFile, const char *fileName)
+{
     int contigNameBufferSize = 0;
     char *contigNameBuffer = NULL;
     unsigned n;
     size_t contigSize;
     char *curName;
-    for (unsigned i = 0; i < nContigs; i++) {
+    for (int i = 0; i < genome->nContigs; i++) {
         if (NULL == reallocatingFgetsGenericFile(&contigNameBuffer, &contigNameBufferSize, loadFile)) {	 
             WriteErrorMessage("Unable to read contig description\n");
             delete[] contigNameBuffer;
-            delete genome;
-            return NULL;
+            return false;
         }
 
         for (n = 0; n < (unsigned)contigNameBufferSize; n++) {
@@ -245,7 +293,7 @@ Genome::loadFromFile(const char *fileName, unsigned chromosomePadding, GenomeLoc
 	    contigNameBuffer[n] = ' '; 
 	    n++; // increment n so we start copying at the position after the space
 	    contigSize = strlen(contigNameBuffer + n) - 1; //don't include the final \n
-        genome->contigs[i].name = new char[contigSize + 1];
+        genome->contigs[i].name = genome->allocateContigName(contigSize + 1);
         genome->contigs[i].nameLength = (unsigned)contigSize;
 	    curName = genome->contigs[i].name;
 	    for (unsigned pos = 0; pos < contigSize; pos++) {
@@ -254,55 +302,182 @@ Genome::loadFromFile(const char *fileName, unsigned chromosomePadding, GenomeLoc
         curName[contigSize] = '\0';
     } // for each contig
 
-    if (0 != loadFile->advance(GenomeLocationAsInt64(minLocation))) {
-        WriteErrorMessage("Genome::loadFromFile: _fseek64bit failed\n");
-        soft_exit(1);
+    delete[] contigNameBuffer;
+    return true;
+}
+
+    bool
+Genome::appendPaddedSaveFile(const char *fileName, FILE *outputFile, _int64 *o_bytesWritten)
+{
+    GenomeDistance nBases;
+    unsigned nContigs;
+    if (!getSizeFromFile(fileName, &nBases, &nContigs)) {
+        return false;
     }
 
-    size_t readSize;
-	if (map) {
-		GenericFile_map *mappedFile = (GenericFile_map *)loadFile;
-		genome->bases = (char *)mappedFile->mapAndAdvance(length, &readSize);
-		genome->mappedFile = mappedFile;
-		mappedFile->prefetch();
-	} else {
-		readSize = loadFile->read(genome->bases, length);
+    FILE *inputFile = fopen(fileName, "rb");
+    if (NULL == inputFile) {
+        WriteErrorMessage("Genome::appendPaddedSaveFile: unable to open file '%s'\n", fileName);
+        return false;
+    }
 
-		loadFile->close();
-		delete loadFile;
-		loadFile = NULL;
-	}
+    //
+    // Copy it through, putting the padding in after the header line and the contig lines, and again at the end.
+    //
+    const size_t bufferSize = 16 * 1024 * 1024;
+    char *buffer = (char *)BigAlloc(bufferSize);
+    char padding[N_PADDING];
+    memset(padding, 'n', N_PADDING);
+    unsigned linesLeft = nContigs + 1;
+    _int64 bytesWritten = 0;
+    bool ok = true;
+    size_t bytesRead;
+    while (ok && 0 != (bytesRead = fread(buffer, 1, bufferSize, inputFile))) {
+        size_t headerBytes = 0;
+        if (linesLeft > 0) {
+            while (headerBytes < bytesRead && linesLeft > 0) {
+                if ('\n' == buffer[headerBytes++]) {
+                    linesLeft--;
+                }
+            }
+            ok = headerBytes == fwrite(buffer, 1, headerBytes, outputFile);
+            bytesWritten += headerBytes;
+            if (ok && 0 == linesLeft) {
+                ok = N_PADDING == fwrite(padding, 1, N_PADDING, outputFile);
+                bytesWritten += N_PADDING;
+            }
+        }
+        ok = ok && bytesRead - headerBytes == fwrite(buffer + headerBytes, 1, bytesRead - headerBytes, outputFile);
+        bytesWritten += bytesRead - headerBytes;
+    }
+    ok = ok && 0 == linesLeft && N_PADDING == fwrite(padding, 1, N_PADDING, outputFile);
+    bytesWritten += N_PADDING;
 
-	if (length != readSize) {
-		WriteErrorMessage("Genome::loadFromFile: fread of bases failed; wanted %u, got %d\n", length, readSize);
-		delete loadFile;
-		delete genome;
-		return NULL;
-	}
-	
-	genome->fillInContigLengths();
-    genome->sortContigsByName();
-    delete[] contigNameBuffer;
+    BigDealloc(buffer);
+    fclose(inputFile);
+    if (!ok) {
+        WriteErrorMessage("Genome::appendPaddedSaveFile: failed copying '%s'\n", fileName);
+        return false;
+    }
+    *o_bytesWritten = bytesWritten;
+    return true;
+}
+
+    const Genome *
+Genome::loadFromBlob(GenericFile_Blob *blob, unsigned chromosomePadding)
+{
+    char linebuf[2000];
+    GenomeDistance nBases;
+    unsigned nContigs;
+    if (NULL == blob->gets(linebuf, sizeof(linebuf)) || 2 != sscanf(linebuf, "%lld %u\n", &nBases, &nContigs)) {
+        WriteErrorMessage("Genome::loadFromBlob: unable to read header\n");
+        return NULL;
+    }
+
+    Genome *genome = new Genome(nBases, 0, chromosomePadding);
+    genome->nBases = nBases;
+    genome->nContigs = genome->maxContigs = nContigs;
+    delete [] genome->contigs;
+    genome->contigs = new Contig[nContigs];
+    genome->maxLocation = GenomeLocation(nBases);
+
+    if (!loadContigs(genome, blob, "snapshot")) {
+        delete genome;
+        return NULL;
+    }
+
+    size_t bytesMapped;
+    char *paddedBases = (char *)blob->mapAndAdvance(nBases + 2 * N_PADDING, &bytesMapped);
+    if (bytesMapped != nBases + 2 * N_PADDING) {
+        WriteErrorMessage("Genome::loadFromBlob: bases truncated, %lld of %lld bytes\n", bytesMapped, nBases + 2 * N_PADDING);
+        delete genome;
+        return NULL;
+    }
+    genome->bases = paddedBases + N_PADDING;
+
+    genome->fillInContigLengths();
+    genome->indexContigs();
     return genome;
 }
 
-    bool
-contigComparator(
-    const Genome::Contig& a,
-    const Genome::Contig& b)
+    char *
+Genome::allocateContigName(size_t size)
+{
+    if (NULL == contigNameBlock || contigNameBlockUsed + size > contigNameBlockSize) {
+        size_t blockSize = __max(sizeof(char *) + size, ContigNameBlockSize);
+        char *newBlock = new char[blockSize];
+        *(char **)newBlock = contigNameBlock;
+        contigNameBlock = newBlock;
+        contigNameBlockUsed = sizeof(char *);
+        contigNameBlockSize = blockSize;
+    }
+
+    char *name = contigNameBlock + contigNameBlockUsed;
+    contigNameBlockUsed += size;
+    return name;
+}
+
+    static inline _uint64
+hashContigName(const char *name)
 {
-    return strcmp(a.name, b.name) < 0;
+    //
+    // FNV-1a
+    //
+    _uint64 hash = 0xcbf29ce484222325;
+    for (const unsigned char *p = (const unsigned char *)name; *p != '\0'; p++) {
+        hash = (hash ^ *p) * 0x100000001b3;
+    }
+    return hash;
 }
 
     void
-Genome::sortContigsByName()
+Genome::indexContigs()
 {
-    if (contigsByName) {
-        delete [] contigsByName;
+    delete [] contigAtBucket;
+    delete [] contigByNameHash;
+    contigAtBucket = NULL;
+    contigByNameHash = NULL;
+
+    if (0 == nContigs) {
+        return;
+    }
+
+    //
+    // Size the buckets for about two per contig.
+    //
+    bucketShift = 0;
+    while ((nBases >> bucketShift) > 2 * (_int64)nContigs) {
+        bucketShift++;
+    }
+    nBuckets = (nBases >> bucketShift) + 2;  // So that the bucket after the last location's is always there
+
+    contigAtBucket = new int[nBuckets];
+    int contigNum = -1;
+    for (_int64 bucket = 0; bucket < nBuckets; bucket++) {
+        GenomeLocation bucketStart(bucket << bucketShift);
+        while (contigNum + 1 < nContigs && contigs[contigNum + 1].beginningLocation <= bucketStart) {
+            contigNum++;
+        }
+        contigAtBucket[bucket] = contigNum;
+    }
+
+    unsigned nameHashSize = 1;
+    while (nameHashSize < 2 * (unsigned)nContigs) {
+        nameHashSize *= 2;
+    }
+    nameHashMask = nameHashSize - 1;
+    contigByNameHash = new int[nameHashSize];
+    memset(contigByNameHash, 0, sizeof(*contigByNameHash) * nameHashSize);
+
+    for (int i = 0; i < nContigs; i++) {
+        unsigned slot = (unsigned)hashContigName(contigs[i].name) & nameHashMask;
+        while (0 != contigByNameHash[slot] && strcmp(contigs[contigByNameHash[slot] - 1].name, contigs[i].name)) {
+            slot = (slot + 1) & nameHashMask;
+        }
+        if (0 == contigByNameHash[slot]) {
+            contigByNameHash[slot] = i + 1; // If the name's a duplicate, the first contig with it wins
+        }
     }
-    contigsByName = new Contig[nContigs];
-    memcpy(contigsByName, contigs, nContigs * sizeof(Contig));
-    std::sort(contigsByName, contigsByName + nContigs, contigComparator);
 }
 
     bool
@@ -353,24 +528,17 @@ Genome::getSizeFromFile(const char *fileName, GenomeDistance *nBases, unsigned *
     bool
 Genome::getLocationOfContig(const char *contigName, GenomeLocation *location, int * index) const
 {
-    if (contigsByName) {
-        int low = 0;
-        int high = nContigs - 1;
-        while (low <= high) {
-            int mid = (low + high) / 2;
-            int c = strcmp(contigsByName[mid].name, contigName);
-            if (c == 0) {
-                if (location != NULL) {
-                    *location = contigsByName[mid].beginningLocation;
+    if (NULL != contigByNameHash) {
+        for (unsigned slot = (unsigned)hashContigName(contigName) & nameHashMask; 0 != contigByNameHash[slot]; slot = (slot + 1) & nameHashMask) {
+            int i = contigByNameHash[slot] - 1;
+            if (!strcmp(contigs[i].name, contigName)) {
+                if (NULL != location) {
+                    *location = contigs[i].beginningLocation;
                 }
                 if (index != NULL) {
-                    *index = mid;
+                    *index = i;
                 }
                 return true;
-            } else if (c < 0) {
-                low = mid + 1;
-            } else {
-                high = mid - 1;
             }
         }
         return false;
@@ -389,25 +557,49 @@ Genome::getLocationOfContig(const char *contigName, GenomeLocation *location, in
     return false;
 }
 
-
-    const Genome::Contig *
-Genome::getContigAtLocation(GenomeLocation location) const
+    int
+Genome::findContigNumAtLocation(GenomeLocation location) const
 {
-    _ASSERT(location < nBases);
+    if (0 == nContigs) {
+        return -1;
+    }
+
     int low = 0;
     int high = nContigs - 1;
-    while (low <= high) {
-        int mid = (low + high) / 2;
-        if (contigs[mid].beginningLocation <= location &&
-                (mid == nContigs-1 || contigs[mid+1].beginningLocation > location)) {
-            return &contigs[mid];
-        } else if (contigs[mid].beginningLocation <= location) {
-            low = mid + 1;
+    if (NULL != contigAtBucket) {
+        _int64 bucket = __max(GenomeLocationAsInt64(location), (_int64)0) >> bucketShift;
+        bucket = __min(bucket, nBuckets - 2);
+        low = __max(contigAtBucket[bucket], 0);
+        high = contigAtBucket[bucket + 1];
+        if (high < 0) {
+            return -1;
+        }
+    }
+
+    //
+    // Find the last contig that starts at or before location.
+    //
+    while (low < high) {
+        int mid = (low + high + 1) / 2;
+        if (contigs[mid].beginningLocation <= location) {
+            low = mid;
         } else {
             high = mid - 1;
         }
     }
-    return NULL; // Should not be reached
+
+    if (contigs[low].beginningLocation > location) {
+        return -1;
+    }
+    return low;
+}
+
+    const Genome::Contig *
+Genome::getContigAtLocation(GenomeLocation location) const
+{
+    _ASSERT(location < nBases);
+    int contigNum = findContigNumAtLocation(location);
+    return contigNum < 0 ? NULL : &contigs[contigNum];
 }
 
     int
@@ -421,31 +613,14 @@ Genome::getContigNumAtLocation(GenomeLocation location) const
 Genome::getNextContigAfterLocation(GenomeLocation location) const
 {
     _ASSERT(location < nBases);
-    if (nContigs > 0 && location < contigs[0].beginningLocation) {
-            return &contigs[0];
-    }
-
-    int low = 0;
-    int high = nContigs - 1;
-    while (low <= high) {
-        int mid = (low + high) / 2;
-        if (contigs[mid].beginningLocation <= location &&
-                (mid == nContigs-1 || contigs[mid+1].beginningLocation > location)) {
-            if (mid >= nContigs - 1) {
-                //
-                // This location landed in the last contig, so return NULL for the next one.
-                //
-                return NULL;
-            } else {
-                return &contigs[mid+1];
-            }
-        } else if (contigs[mid].beginningLocation <= location) {
-            low = mid + 1;
-        } else {
-            high = mid - 1;
-        }
+    int contigNum = findContigNumAtLocation(location);
+    if (contigNum >= nContigs - 1) {
+        //
+        // This location landed in the last contig, so return NULL for the next one.
+        //
+        return NULL;
     }
-    return NULL; // Should not be reached
+    return &contigs[contigNum + 1];
 }
 
 GenomeDistance DistanceBetweenGenomeLocations(GenomeLocation locationA, GenomeLocation locationB) 
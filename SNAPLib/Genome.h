@@ -202,6 +202,14 @@ public:
 
         bool saveToFile(const char *fileName) const;
 
+        //
+        // Index snapshots hold the genome in place, as a copy of the save file with the padding around the bases
+        // already there.  appendPaddedSaveFile writes one from a save file to the end of an open file, and
+        // loadFromBlob uses one without copying the bases, so the blob has to outlive the genome.
+        //
+        static bool appendPaddedSaveFile(const char *fileName, FILE *outputFile, _int64 *o_bytesWritten);
+        static const Genome *loadFromBlob(GenericFile_Blob *blob, unsigned chromosomePadding);
+
         //
         // Methods to read the genome.
         //
@@ -275,10 +283,11 @@ public:
 // unused        Genome *copyGenomeOneSex(bool useY, bool useM) const {return copy(!useY,useY,useM);}
 
         //
-        // These are only public so creators of new genomes (i.e., FASTA) can use them.
+        // These are only public so creators of new genomes (i.e., FASTA) can use them.  indexContigs builds the
+        // location and name lookup structures, and has to be called once all of the contigs are in.
         //
         void    fillInContigLengths();
-        void    sortContigsByName();
+        void    indexContigs();
 
 private:
 
@@ -287,6 +296,7 @@ private:
         //
         // The actual genome.
         char                *bases;       // Will point to offset N_PADDING in an array of nBases + 2 * N_PADDING
+        char                *basesAllocation;   // What the constructor allocated, which bases no longer points into if it's mapped
         GenomeDistance       nBases;
         GenomeLocation       maxBases;
 
@@ -302,10 +312,39 @@ private:
 
         Contig      *contigs;    // This is always in order (it's not possible to express it otherwise in FASTA).
 
-        Contig      *contigsByName;
+        //
+        // Location -> contig directory.  The genome is cut into 2^bucketShift sized buckets, about two per contig, and
+        // contigAtBucket[i] is the contig that holds the first base of bucket i (-1 if that's before the first contig).
+        // The contig for any location is then between the entries for its bucket and the next one, which is almost
+        // always the same contig or the one after it, so lookups don't depend on how many contigs there are.
+        //
+        int         *contigAtBucket;
+        _int64       nBuckets;
+        unsigned     bucketShift;
+
+        //
+        // Name -> contig, open addressed with linear probing.  Entries are contig numbers + 1, with 0 for empty.
+        //
+        int         *contigByNameHash;
+        unsigned     nameHashMask;
+
+        int     findContigNumAtLocation(GenomeLocation location) const;     // -1 if it's before the first contig
+
+        //
+        // Contig names are packed end to end into large blocks instead of each getting its own allocation, which
+        // adds up with millions of contigs.  Blocks never move, so the names stay put as more are added.  Each block
+        // starts with a pointer to the one allocated before it.
+        //
+        static const size_t ContigNameBlockSize = 64 * 1024;
+        char        *contigNameBlock;
+        size_t       contigNameBlockUsed;
+        size_t       contigNameBlockSize;
+
+        char   *allocateContigName(size_t size);
         Genome *copy(bool copyX, bool copyY, bool copyM) const;
 
         static bool openFileAndGetSizes(const char *filename, GenericFile **file, GenomeDistance *nBases, unsigned *nContigs, bool map);
+        static bool loadContigs(Genome *genome, GenericFile *loadFile, const char *fileName);
 
         const unsigned chromosomePadding;
 
@@ -38,6 +38,9 @@ Revision History:
 #include "exit.h"
 #include "Error.h"
 #include "directions.h"
+#include <map>
+#include <vector>
+#include <algorithm>
 
 using namespace std;
 
@@ -85,12 +88,16 @@ static void usage()
 		"                   In particular, this will generally use less memory than the index will use once it's built, so if this doesn't work you\n"
 		"                   won't be able to use the index anyway. However, if you've got sufficient memory to begin with, this option will just\n"
 		"                   slow down the index build by doing extra, useless IO.\n"
+		" -noDirect         Build hash tables even for a genome small enough to index directly.  Genomes of up to %lld bases (bacteria, viruses\n"
+		"                   and the like) normally get a table addressed directly by seed prefix in place of the hash tables, which is faster to\n"
+		"                   look seeds up in.  It ignores -h, -hg19, -exact, -keysize, -large and -sm, which only apply to hash tables.\n"
 			,
             DEFAULT_SEED_SIZE,
             DEFAULT_SLACK,
             DEFAULT_PADDING,
             DEFAULT_KEY_BYTES,
-            DEFAULT_LOCATION_SIZE);
+            DEFAULT_LOCATION_SIZE,
+            (_int64)GenomeIndex::DirectMaxBases);
     soft_exit_no_print(1);    // Don't use soft-exit, it's confusing people to get an error message after the usage
 }
 
@@ -121,6 +128,7 @@ GenomeIndex::runIndexer(
 	bool large = false;
     unsigned locationSize = DEFAULT_LOCATION_SIZE;
 	bool smallMemory = false;
+    bool allowDirect = true;
 
     for (int n = 2; n < argc; n++) {
         if (strcmp(argv[n], "-s") == 0) {
@@ -154,6 +162,8 @@ GenomeIndex::runIndexer(
             }
         } else if (strcmp(argv[n], "-large") == 0) {
             large = true;
+        } else if (strcmp(argv[n], "-noDirect") == 0) {
+            allowDirect = false;
         } else if (argv[n][0] == '-' && argv[n][1] == 'H') {
             histogramFileName = argv[n] + 2;
         } else if (argv[n][0] == '-' && argv[n][1] == 'O') {
@@ -233,7 +243,7 @@ GenomeIndex::runIndexer(
     GenomeDistance nBases = genome->getCountOfBases();
 
     if (!GenomeIndex::BuildIndexToDirectory(genome, seedLen, slack, computeBias, outputDir, maxThreads, chromosomePadding, forceExact, keySizeInBytes, 
-		large, histogramFileName, locationSize, smallMemory)) {
+		large, histogramFileName, locationSize, smallMemory, allowDirect)) {
         WriteErrorMessage("Genome index build failed\n");
         soft_exit(1);
     }
@@ -258,10 +268,37 @@ SetInvalidGenomeLocation(unsigned locationSize)
     }
 }
 
+//
+// The GenomeIndex file is one line: major version, minor version, nHashTables, overflowTableSize, seedLen, chromosomePaddingSize,
+// hashTableKeySize, the size of the hash tables file, 1 for small hash tables (0 for large), locationSize and, for direct seed
+// tables (major version 6), the prefix size of the table.
+//
+    bool
+GenomeIndex::writeIndexHeader(const char *fileName, unsigned nHashTables, _uint64 overflowTableSize, int seedLen, unsigned chromosomePaddingSize,
+                 unsigned hashTableKeySize, size_t tablesFileSize, bool large, unsigned locationSize, unsigned directPrefixBases)
+{
+    FILE *indexFile = fopen(fileName, "w");
+    if (indexFile == NULL) {
+        WriteErrorMessage("Unable to open file '%s' for write.\n", fileName);
+        return false;
+    }
+
+    if (0 == directPrefixBases) {
+        fprintf(indexFile,"%d %d %d %lld %d %d %d %lld %d %d", GenomeIndexFormatMajorVersion, GenomeIndexFormatMinorVersion, nHashTables,
+            overflowTableSize, seedLen, chromosomePaddingSize, hashTableKeySize, (_int64)tablesFileSize, large ? 0 : 1, locationSize);
+    } else {
+        fprintf(indexFile,"%d %d %d %lld %d %d %d %lld %d %d %d", GenomeIndexDirectFormatMajorVersion, GenomeIndexFormatMinorVersion, nHashTables,
+            overflowTableSize, seedLen, chromosomePaddingSize, hashTableKeySize, (_int64)tablesFileSize, large ? 0 : 1, locationSize, directPrefixBases);
+    }
+
+    fclose(indexFile);
+    return true;
+}
+
     bool
 GenomeIndex::BuildIndexToDirectory(const Genome *genome, int seedLen, double slack, bool computeBias, const char *directoryName,
                                     unsigned maxThreads, unsigned chromosomePaddingSize, bool forceExact, unsigned hashTableKeySize, 
-									bool large, const char *histogramFileName, unsigned locationSize, bool smallMemory)
+									bool large, const char *histogramFileName, unsigned locationSize, bool smallMemory, bool allowDirect)
 {
 	PreventMachineHibernationWhileThisThreadIsAlive();
 
@@ -304,6 +341,47 @@ GenomeIndex::BuildIndexToDirectory(const Genome *genome, int seedLen, double sla
         soft_exit(1);
     }
 
+    unsigned directPrefixBases = allowDirect ? chooseDirectPrefixBases(countOfBases, seedLen) : 0;
+    if (0 != directPrefixBases) {
+        //
+        // A small genome, so no hash tables.  The direct seed table is saved in their place, with the locations
+        // in the overflow table.
+        //
+        delete index;
+        index = NULL;
+
+        WriteStatusMessage("Building direct seed table with %d base prefixes...", directPrefixBases);
+        start = timeInMillis();
+
+        char *tablesFileName = new char[filenameBufferSize];
+        snprintf(filenameBuffer, filenameBufferSize, "%s%c%s", directoryName, PATH_SEP, OverflowTableFileName);
+        snprintf(tablesFileName, filenameBufferSize, "%s%c%s", directoryName, PATH_SEP, GenomeIndexHashFileName);
+
+        _uint64 overflowTableSize;
+        size_t tablesFileSize;
+        bool worked = BuildDirectSeedTable(genome, seedLen, directPrefixBases, locationSize, filenameBuffer, tablesFileName,
+            buildHistogram ? histogramFile : NULL, &overflowTableSize, &tablesFileSize);
+
+        delete[] tablesFileName;
+        delete genome;
+        genome = NULL;
+        if (buildHistogram) {
+            fclose(histogramFile);
+        }
+
+        if (worked) {
+            snprintf(filenameBuffer, filenameBufferSize, "%s%c%s", directoryName, PATH_SEP, GenomeIndexFileName);
+            worked = writeIndexHeader(filenameBuffer, 0, overflowTableSize, seedLen, chromosomePaddingSize, hashTableKeySize, tablesFileSize,
+                large, locationSize, directPrefixBases);
+        }
+
+        delete[] filenameBuffer;
+        if (worked) {
+            WriteStatusMessage("%llds\n", (timeInMillis() + 500 - start) / 1000);
+        }
+        return worked;
+    }
+
     // Compute bias table sizes, unless we're using the precomputed ones hardcoded in BiasTables.cpp
     double *biasTable = NULL;
     if (!computeBias) {
@@ -730,17 +808,11 @@ GenomeIndex::BuildIndexToDirectory(const Genome *genome, int seedLen, double sla
     //
     snprintf(filenameBuffer, filenameBufferSize, "%s%c%s", directoryName, PATH_SEP, GenomeIndexFileName);
 
-    FILE *indexFile = fopen(filenameBuffer,"w");
-    if (indexFile == NULL) {
-        WriteErrorMessage("Unable to open file '%s' for write.\n", filenameBuffer);
+    if (!writeIndexHeader(filenameBuffer, index->nHashTables, index->overflowTableSize, seedLen, chromosomePaddingSize, hashTableKeySize,
+            totalBytesWritten, large, locationSize, 0)) {
         delete[] filenameBuffer;
         return false;
     }
-
-    fprintf(indexFile,"%d %d %d %lld %d %d %d %lld %d %d", GenomeIndexFormatMajorVersion, GenomeIndexFormatMinorVersion, index->nHashTables, 
-        index->overflowTableSize, seedLen, chromosomePaddingSize, hashTableKeySize, totalBytesWritten, large ? 0 : 1, locationSize); 
-
-    fclose(indexFile);
  
     delete index;
     if (computeBias && biasTable != NULL) {
@@ -842,10 +914,234 @@ SNAPHashTable** GenomeIndex::allocateHashTables(
     return hashTables;
 }
 
+    unsigned
+GenomeIndex::chooseDirectPrefixBases(GenomeDistance countOfBases, int seedLen)
+{
+    if (countOfBases > DirectMaxBases) {
+        return 0;
+    }
+
+    //
+    // About one genome location per bucket, but the suffixes have to fit in 32 bits.
+    //
+    unsigned prefixBases = 1;
+    while (prefixBases < DirectMaxPrefixBases && ((GenomeDistance)1 << (2 * (prefixBases + 1))) <= countOfBases) {
+        prefixBases++;
+    }
 
+    if ((unsigned)seedLen > prefixBases + 16) {
+        prefixBases = seedLen - 16;
+    }
 
+    return prefixBases > DirectMaxPrefixBases ? 0 : prefixBases;
+}
 
-GenomeIndex::GenomeIndex() : nHashTables(0), hashTables(NULL), overflowTable32(NULL), overflowTable64(NULL), genome(NULL), tablesBlob(NULL), mappedOverflowTable(NULL), mappedTables(NULL)
+    static bool
+writeTableFile(FILE *file, const void *table, size_t bytes)
+{
+    const size_t writeSize = 32 * 1024 * 1024;
+    for (size_t offset = 0; offset < bytes; offset += writeSize) {
+        size_t amountToWrite = __min(writeSize, bytes - offset);
+        if (amountToWrite != fwrite((const char *)table + offset, 1, amountToWrite, file)) {
+            WriteErrorMessage("GenomeIndex::BuildDirectSeedTable: fwrite failed, %d\n", errno);
+            return false;
+        }
+    }
+    return true;
+}
+
+//
+// Gets the seeds (the same ones that would go in the hash tables) in [start, end), backwards by location.
+//
+    static unsigned
+getDirectSeedBatch(const Genome *genome, int seedLen, GenomeLocation start, GenomeLocation end, _uint64 *seeds, GenomeLocation *locations)
+{
+    unsigned nSeeds = 0;
+    for (GenomeLocation genomeLocation = end - 1; genomeLocation >= start; genomeLocation--) {
+        const char *bases = genome->getSubstring(genomeLocation, seedLen);
+        if (NULL != bases && Seed::DoesTextRepresentASeed(bases, seedLen)) {
+            seeds[nSeeds] = Seed(bases, seedLen).getBases();
+            locations[nSeeds] = genomeLocation;
+            nSeeds++;
+        }
+    }
+    return nSeeds;
+}
+
+struct DirectSeedEntry {
+    unsigned        suffix;
+    _int64          location;
+
+    bool operator<(const DirectSeedEntry &peer) const {
+        return suffix < peer.suffix;
+    }
+};
+
+    bool
+GenomeIndex::BuildDirectSeedTable(const Genome *genome, int seedLen, unsigned prefixBases, unsigned locationSize,
+    const char *overflowTableFileName, const char *tablesFileName, FILE *histogramFile,
+    _uint64 *o_overflowTableSize, size_t *o_tablesFileSize)
+{
+    GenomeDistance countOfBases = genome->getCountOfBases();
+    unsigned suffixBits = (seedLen - prefixBases) * 2;
+    _uint64 suffixMask = ((_uint64)1 << suffixBits) - 1;
+    size_t nBuckets = (size_t)1 << (2 * prefixBases);
+
+    //
+    // Count the seeds in each bucket and turn the counts into where each bucket starts.  The genome is walked in
+    // batches so that the updates, which are all cache misses, run back to back and overlap.
+    //
+    GenomeLocation end = countOfBases - seedLen - 1;
+    unsigned *buckets = (unsigned *)BigAlloc((nBuckets + 1) * sizeof(*buckets));
+    memset(buckets, 0, (nBuckets + 1) * sizeof(*buckets));
+    _int64 nonSeeds = 0;
+
+    const unsigned batchSize = 4096;
+    _uint64 *batchSeeds = new _uint64[batchSize];
+    GenomeLocation *batchLocations = new GenomeLocation[batchSize];
+
+    for (GenomeLocation batchEnd = end, batchStart; batchEnd > 0; batchEnd = batchStart) {
+        batchStart = (batchEnd > batchSize) ? batchEnd - batchSize : 0;
+        unsigned nSeeds = getDirectSeedBatch(genome, seedLen, batchStart, batchEnd, batchSeeds, batchLocations);
+        nonSeeds += (batchEnd - batchStart) - nSeeds;
+        for (unsigned i = 0; i < nSeeds; i++) {
+            buckets[(batchSeeds[i] >> suffixBits) + 1]++;
+        }
+    }
+
+    for (size_t i = 0; i < nBuckets; i++) {
+        buckets[i + 1] += buckets[i];
+    }
+    _uint64 nEntries = buckets[nBuckets];
+
+    //
+    // Fill the buckets in walking the genome backwards, so each one is backwards by location, and then sort them by
+    // suffix, keeping that order within each seed.  The locations start after the unused slot.
+    //
+    unsigned *suffixes = (unsigned *)BigAlloc(__max(nEntries, (_uint64)1) * sizeof(*suffixes));
+    _int64 *locations = (_int64 *)BigAlloc((nEntries + 1) * sizeof(*locations));
+    locations[0] = 0;
+
+    unsigned *nextEntry = (unsigned *)BigAlloc(nBuckets * sizeof(*nextEntry));
+    memcpy(nextEntry, buckets, nBuckets * sizeof(*nextEntry));
+
+    for (GenomeLocation batchEnd = end, batchStart; batchEnd > 0; batchEnd = batchStart) {
+        batchStart = (batchEnd > batchSize) ? batchEnd - batchSize : 0;
+        unsigned nSeeds = getDirectSeedBatch(genome, seedLen, batchStart, batchEnd, batchSeeds, batchLocations);
+        for (unsigned i = 0; i < nSeeds; i++) {
+            unsigned entry = nextEntry[batchSeeds[i] >> suffixBits]++;
+            suffixes[entry] = (unsigned)(batchSeeds[i] & suffixMask);
+            locations[entry + 1] = GenomeLocationAsInt64(batchLocations[i]);
+        }
+    }
+
+    BigDealloc(nextEntry);
+    delete[] batchSeeds;
+    delete[] batchLocations;
+
+    std::vector<DirectSeedEntry> bucket;
+    for (size_t i = 0; i < nBuckets; i++) {
+        unsigned first = buckets[i], last = buckets[i + 1];
+        bool sorted = true;
+        for (unsigned entry = first + 1; sorted && entry < last; entry++) {
+            sorted = suffixes[entry - 1] <= suffixes[entry];
+        }
+        if (sorted) {
+            continue;
+        }
+
+        bucket.resize(last - first);
+        for (unsigned entry = first; entry < last; entry++) {
+            bucket[entry - first].suffix = suffixes[entry];
+            bucket[entry - first].location = locations[entry + 1];
+        }
+        std::stable_sort(bucket.begin(), bucket.end());
+        for (unsigned entry = first; entry < last; entry++) {
+            suffixes[entry] = bucket[entry - first].suffix;
+            locations[entry + 1] = bucket[entry - first].location;
+        }
+    }
+
+    //
+    // Count the seeds with more than one hit, and build the histogram if there is one.
+    //
+    _int64 seedsWithMultipleOccurrences = 0;
+    _int64 genomeLocationsInRepeats = 0;
+    std::map<_uint64, _uint64> histogram;
+    for (size_t i = 0; i < nBuckets; i++) {
+        for (unsigned entry = buckets[i]; entry < buckets[i + 1]; ) {
+            unsigned runEnd = entry + 1;
+            while (runEnd < buckets[i + 1] && suffixes[runEnd] == suffixes[entry]) {
+                runEnd++;
+            }
+            if (runEnd - entry > 1) {
+                seedsWithMultipleOccurrences++;
+                genomeLocationsInRepeats += runEnd - entry;
+            }
+            if (NULL != histogramFile) {
+                histogram[runEnd - entry]++;
+            }
+            entry = runEnd;
+        }
+    }
+
+    WriteStatusMessage("%lld seeds, %lld(%lld%%) occur more than once, total of %lld(%lld%%) genome locations are not unique, %lld(%lld%%) bad seeds\n",
+        nEntries, seedsWithMultipleOccurrences, seedsWithMultipleOccurrences * 100 / __max(countOfBases, (GenomeDistance)1),
+        genomeLocationsInRepeats, genomeLocationsInRepeats * 100 / __max(countOfBases, (GenomeDistance)1),
+        nonSeeds, nonSeeds * 100 / __max(countOfBases, (GenomeDistance)1));
+
+    if (NULL != histogramFile) {
+        for (std::map<_uint64, _uint64>::iterator it = histogram.begin(); it != histogram.end(); it++) {
+            fprintf(histogramFile, "%lld\t%lld\n", it->first, it->second);
+        }
+    }
+
+    //
+    // The locations go in the overflow table at the index's location size, and the directory and suffixes
+    // in the hash table file.
+    //
+    size_t locationBytes = (locationSize > 4) ? sizeof(_int64) : sizeof(unsigned);
+    if (locationBytes == sizeof(unsigned)) {
+        unsigned *locations32 = (unsigned *)locations;     // Shrinking in place is safe walking forwards
+        for (_uint64 i = 0; i <= nEntries; i++) {
+            locations32[i] = (unsigned)locations[i];
+        }
+    }
+
+    bool worked = true;
+    FILE *overflowTableFile = fopen(overflowTableFileName, "wb");
+    FILE *tablesFile = fopen(tablesFileName, "wb");
+    if (NULL == overflowTableFile || NULL == tablesFile) {
+        WriteErrorMessage("Unable to open '%s' or '%s' for write\n", overflowTableFileName, tablesFileName);
+        worked = false;
+    } else {
+        worked = writeTableFile(overflowTableFile, locations, (nEntries + 1) * locationBytes) &&
+            writeTableFile(tablesFile, buckets, (nBuckets + 1) * sizeof(*buckets)) &&
+            writeTableFile(tablesFile, suffixes, nEntries * sizeof(*suffixes));
+    }
+
+    if (NULL != overflowTableFile) {
+        fclose(overflowTableFile);
+    }
+    if (NULL != tablesFile) {
+        fclose(tablesFile);
+    }
+
+    BigDealloc(locations);
+    BigDealloc(suffixes);
+    BigDealloc(buckets);
+
+    *o_overflowTableSize = nEntries + 1;
+    *o_tablesFileSize = (nBuckets + 1 + nEntries) * sizeof(unsigned);
+    return worked;
+}
+
+
+
+
+
+GenomeIndex::GenomeIndex() : nHashTables(0), hashTables(NULL), overflowTable32(NULL), overflowTable64(NULL), genome(NULL), tablesBlob(NULL), mappedOverflowTable(NULL), mappedTables(NULL), snapshot(NULL),
+    directPrefixBases(0), directSuffixBits(0), directBuckets(NULL), directSuffixes(NULL)
 {
 }
 
@@ -862,7 +1158,9 @@ GenomeIndex::~GenomeIndex()
     delete [] hashTables;
     hashTables = NULL;
 
-	if (NULL != mappedTables) {
+	if (NULL != snapshot) {
+		// Everything's in the snapshot mapping, which goes once the genome's done with it
+	} else if (NULL != mappedTables) {
 		mappedTables->close();
 		mappedOverflowTable->close();
 	} else {
@@ -885,6 +1183,10 @@ GenomeIndex::~GenomeIndex()
 	delete genome;
 	genome = NULL;
 
+	if (NULL != snapshot) {
+		CloseMemoryMappedFile(snapshot);
+		snapshot = NULL;
+	}
 }
 
     void
@@ -1606,26 +1908,8 @@ GenomeIndex::printBiasTables()
 }
 
         GenomeIndex *
-GenomeIndex::loadFromDirectory(char *directoryName, bool map, bool prefetch)
+GenomeIndex::createFromHeader(const char *indexFileBuf, unsigned *o_chromosomePadding, size_t *o_hashTablesFileSize)
 {
-    int filenameBufferSize = (int)(strlen(directoryName) + 1 + __max(strlen(GenomeIndexFileName), __max(strlen(OverflowTableFileName), __max(strlen(GenomeIndexHashFileName), strlen(GenomeFileName)))) + 1);
-    char *filenameBuffer = new char[filenameBufferSize];
-    
-    snprintf(filenameBuffer, filenameBufferSize, "%s%c%s", directoryName, PATH_SEP, GenomeIndexFileName);
-
-    GenericFile *indexFile = GenericFile::open(filenameBuffer, GenericFile::ReadOnly);
-
-    if (NULL == indexFile) {
-        WriteErrorMessage("Unable to open file '%s' for read.\n",filenameBuffer);
-        delete[] filenameBuffer;
-        filenameBuffer = NULL;
-        return NULL;
-    }
-
-    char indexFileBuf[1000];
-    size_t indexFileSize = indexFile->read(indexFileBuf, sizeof(indexFileBuf) - 1);
-    indexFileBuf[indexFileSize] = 0;
-
     unsigned seedLen;
     unsigned majorVersion, minorVersion, chromosomePadding;
     int nRead;
@@ -1635,31 +1919,38 @@ GenomeIndex::loadFromDirectory(char *directoryName, bool map, bool prefetch)
     unsigned hashTableKeySize;
     unsigned smallHashTable;
     unsigned locationSize;
-    if (10 != (nRead = sscanf(indexFileBuf,"%d %d %d %lld %d %d %d %lld %d %d", &majorVersion, &minorVersion, &nHashTables, &overflowTableSize, &seedLen, &chromosomePadding, 
-											&hashTableKeySize, &hashTablesFileSize, &smallHashTable, &locationSize))) {
+    unsigned directPrefixBases = 0;     // Only there for direct seed tables
+    if (10 > (nRead = sscanf(indexFileBuf,"%d %d %d %lld %d %d %d %lld %d %d %d", &majorVersion, &minorVersion, &nHashTables, &overflowTableSize, &seedLen, &chromosomePadding, 
+											&hashTableKeySize, &hashTablesFileSize, &smallHashTable, &locationSize, &directPrefixBases))) {
         if (3 == nRead || 6 == nRead || 7 == nRead || 9 == nRead) {
             WriteErrorMessage("Indices built by versions before 1.0dev.21 are no longer supported.  Please rebuild your index.\n");
         } else {
             WriteErrorMessage("GenomeIndex::LoadFromDirectory: didn't read initial values\n");
         }
-        indexFile->close();		
-        delete indexFile;
         return NULL;
     }
-    indexFile->close();
-    delete indexFile;
 
-    if (majorVersion != GenomeIndexFormatMajorVersion) {
+    if (majorVersion != GenomeIndexFormatMajorVersion && majorVersion != GenomeIndexDirectFormatMajorVersion) {
         WriteErrorMessage("This genome index appears to be from a different version of SNAP than this, and so we can't read it.  Index version %d, SNAP index format version %d\n",
-            majorVersion, GenomeIndexFormatMajorVersion);
+            majorVersion, GenomeIndexDirectFormatMajorVersion);
         soft_exit(1);
     }
 
+    if ((majorVersion == GenomeIndexDirectFormatMajorVersion) != (11 == nRead && 0 != directPrefixBases)) {
+        WriteErrorMessage("GenomeIndex::LoadFromDirectory: index version %d doesn't match its seed table.  Please rebuild your index.\n", majorVersion);
+        return NULL;
+    }
+
     if (0 == seedLen) {
         WriteErrorMessage("GenomeIndex::LoadFromDirectory: saw seed size of 0.\n");
         return NULL;
     }
 
+    if (0 != directPrefixBases && (directPrefixBases > DirectMaxPrefixBases || seedLen > directPrefixBases + 16)) {
+        WriteErrorMessage("GenomeIndex::LoadFromDirectory: bad direct seed table prefix size %d for seed size %d.  Index corrupt\n", directPrefixBases, seedLen);
+        return NULL;
+    }
+
     SetInvalidGenomeLocation(locationSize);
 
     GenomeIndex *index;
@@ -1671,6 +1962,49 @@ GenomeIndex::loadFromDirectory(char *directoryName, bool map, bool prefetch)
     index->seedLen = seedLen;
     index->locationSize = locationSize;
     index->largeHashTable = !smallHashTable;
+    index->directPrefixBases = directPrefixBases;
+    index->directSuffixBits = (seedLen - directPrefixBases) * 2;
+
+    *o_chromosomePadding = chromosomePadding;
+    *o_hashTablesFileSize = hashTablesFileSize;
+    return index;
+}
+
+        GenomeIndex *
+GenomeIndex::loadFromDirectory(char *directoryName, bool map, bool prefetch)
+{
+    if (isSnapshot(directoryName)) {
+        return loadFromSnapshot(directoryName);    // It's already laid out for mapping, so map and prefetch don't apply
+    }
+
+    int filenameBufferSize = (int)(strlen(directoryName) + 1 + __max(strlen(GenomeIndexFileName), __max(strlen(OverflowTableFileName), __max(strlen(GenomeIndexHashFileName), strlen(GenomeFileName)))) + 1);
+    char *filenameBuffer = new char[filenameBufferSize];
+    
+    snprintf(filenameBuffer, filenameBufferSize, "%s%c%s", directoryName, PATH_SEP, GenomeIndexFileName);
+
+    GenericFile *indexFile = GenericFile::open(filenameBuffer, GenericFile::ReadOnly);
+
+    if (NULL == indexFile) {
+        WriteErrorMessage("Unable to open file '%s' for read.\n",filenameBuffer);
+        delete[] filenameBuffer;
+        filenameBuffer = NULL;
+        return NULL;
+    }
+
+    char indexFileBuf[1000];
+    size_t indexFileSize = indexFile->read(indexFileBuf, sizeof(indexFileBuf) - 1);
+    indexFileBuf[indexFileSize] = 0;
+    indexFile->close();
+    delete indexFile;
+
+    unsigned chromosomePadding;
+    size_t hashTablesFileSize;
+    GenomeIndex *index = createFromHeader(indexFileBuf, &chromosomePadding, &hashTablesFileSize);
+    if (NULL == index) {
+        delete[] filenameBuffer;
+        return NULL;
+    }
+    unsigned locationSize = index->locationSize;
 
     unsigned overflowEntrySize = (locationSize > 4) ? sizeof(*index->overflowTable64) : sizeof(*index->overflowTable32);
 
@@ -1742,12 +2076,6 @@ GenomeIndex::loadFromDirectory(char *directoryName, bool map, bool prefetch)
 		fOverflowTable = NULL;
 	}
 
-    index->hashTables = new SNAPHashTable*[index->nHashTables];
-
-    for (unsigned i = 0; i < index->nHashTables; i++) {
-        index->hashTables[i] = NULL; // We need to do this so the destructor doesn't crash if loading a hash table fails.
-    }
-
     snprintf(filenameBuffer, filenameBufferSize, "%s%c%s", directoryName, PATH_SEP, GenomeIndexHashFileName);
 
 	GenericFile_Blob *blobFile = NULL;
@@ -1796,27 +2124,10 @@ GenomeIndex::loadFromDirectory(char *directoryName, bool map, bool prefetch)
 		blobFile = GenericFile_Blob::open(index->tablesBlob, hashTablesFileSize);
 	}
 
-    for (unsigned i = 0; i < index->nHashTables; i++) {
-        if (NULL == (index->hashTables[i] = SNAPHashTable::loadFromBlob(blobFile))) {
-            WriteErrorMessage("GenomeIndex::loadFromDirectory: Failed to load hash table %d\n",i);
-            delete[] filenameBuffer;
-            delete index;
-            return NULL;
-        }
-
-		unsigned expectedValueCount;
-		if (smallHashTable) {
-			expectedValueCount = 1;
-		} else {
-			expectedValueCount = 2;
-		}
-
-        if (index->hashTables[i]->GetValueCount() != expectedValueCount) {
-            WriteErrorMessage("Expected loaded hash table to have value count of %d, but it had %d.  Index corrupt\n", expectedValueCount, index->hashTables[i]->GetValueCount());
-            delete[] filenameBuffer;
-            delete index;
-            return NULL;
-        }
+    if (!index->loadHashTables(blobFile, hashTablesFileSize)) {
+        delete[] filenameBuffer;
+        delete index;
+        return NULL;
     }
 
 	if (!map) {
@@ -1851,6 +2162,371 @@ GenomeIndex::loadFromDirectory(char *directoryName, bool map, bool prefetch)
     return index;
 }
 
+    bool
+GenomeIndex::loadHashTables(GenericFile_Blob *blobFile, size_t hashTablesFileSize)
+{
+    if (0 != directPrefixBases) {
+        return loadDirectSeedTable(blobFile, hashTablesFileSize);
+    }
+
+    hashTables = new SNAPHashTable*[nHashTables];
+
+    for (unsigned i = 0; i < nHashTables; i++) {
+        hashTables[i] = NULL; // We need to do this so the destructor doesn't crash if loading a hash table fails.
+    }
+
+    for (unsigned i = 0; i < nHashTables; i++) {
+        if (NULL == (hashTables[i] = SNAPHashTable::loadFromBlob(blobFile))) {
+            WriteErrorMessage("GenomeIndex::loadFromDirectory: Failed to load hash table %d\n",i);
+            return false;
+        }
+
+		unsigned expectedValueCount;
+		if (!largeHashTable) {
+			expectedValueCount = 1;
+		} else {
+			expectedValueCount = 2;
+		}
+
+        if (hashTables[i]->GetValueCount() != expectedValueCount) {
+            WriteErrorMessage("Expected loaded hash table to have value count of %d, but it had %d.  Index corrupt\n", expectedValueCount, hashTables[i]->GetValueCount());
+            return false;
+        }
+    }
+
+    return true;
+}
+
+    bool
+GenomeIndex::loadDirectSeedTable(GenericFile_Blob *blobFile, size_t tablesFileSize)
+{
+    size_t nBuckets = (size_t)1 << (2 * directPrefixBases);
+    if (0 == overflowTableSize || tablesFileSize != (nBuckets + overflowTableSize) * sizeof(unsigned)) {
+        WriteErrorMessage("Direct seed table is %lld bytes, which doesn't match its index header.  Index corrupt\n", (_int64)tablesFileSize);
+        return false;
+    }
+    _uint64 nEntries = overflowTableSize - 1;
+
+    size_t bytesMapped;
+    directBuckets = (const unsigned *)blobFile->mapAndAdvance((nBuckets + 1) * sizeof(*directBuckets), &bytesMapped);
+    if (bytesMapped != (nBuckets + 1) * sizeof(*directBuckets) || directBuckets[nBuckets] != nEntries) {
+        WriteErrorMessage("GenomeIndex::loadFromDirectory: Failed to load direct seed table directory\n");
+        return false;
+    }
+
+    directSuffixes = (const unsigned *)blobFile->mapAndAdvance(nEntries * sizeof(*directSuffixes), &bytesMapped);
+    if (bytesMapped != nEntries * sizeof(*directSuffixes)) {
+        WriteErrorMessage("GenomeIndex::loadFromDirectory: Failed to load direct seed table suffixes\n");
+        return false;
+    }
+
+    return true;
+}
+
+const char *SnapshotMagic = "SNAPIndexSnapshot";
+
+    bool
+GenomeIndex::isSnapshot(const char *fileName)
+{
+    FILE *file = fopen(fileName, "rb");
+    if (NULL == file) {
+        return false;
+    }
+    char magic[32];
+    size_t magicLength = strlen(SnapshotMagic);
+    bool result = magicLength == fread(magic, 1, magicLength, file) && 0 == memcmp(magic, SnapshotMagic, magicLength);
+    fclose(file);
+    return result;
+}
+
+//
+// Copy a whole file to the end of the snapshot.
+//
+    static bool
+appendFileToSnapshot(const char *fileName, FILE *snapshotFile, _int64 *o_bytesWritten)
+{
+    FILE *inputFile = fopen(fileName, "rb");
+    if (NULL == inputFile) {
+        WriteErrorMessage("Unable to open file '%s' for read.\n", fileName);
+        return false;
+    }
+
+    const size_t bufferSize = 16 * 1024 * 1024;
+    char *buffer = (char *)BigAlloc(bufferSize);
+    _int64 bytesWritten = 0;
+    bool ok = true;
+    size_t bytesRead;
+    while (ok && 0 != (bytesRead = fread(buffer, 1, bufferSize, inputFile))) {
+        ok = bytesRead == fwrite(buffer, 1, bytesRead, snapshotFile);
+        bytesWritten += bytesRead;
+    }
+
+    BigDealloc(buffer);
+    fclose(inputFile);
+    if (!ok) {
+        WriteErrorMessage("Write failed copying '%s' into snapshot\n", fileName);
+        return false;
+    }
+    *o_bytesWritten = bytesWritten;
+    return true;
+}
+
+//
+// Pad the snapshot out from offset to the next section boundary, which is where the next section starts.
+//
+    static bool
+alignSnapshot(FILE *snapshotFile, _int64 *offset, _int64 *o_sectionOffset)
+{
+    _int64 aligned = (*offset + GenomeIndex::SnapshotAlignment - 1) / GenomeIndex::SnapshotAlignment * GenomeIndex::SnapshotAlignment;
+    static const char zeroes[4096] = {0};
+    while (*offset < aligned) {
+        size_t bytes = (size_t)__min(aligned - *offset, (_int64)sizeof(zeroes));
+        if (bytes != fwrite(zeroes, 1, bytes, snapshotFile)) {
+            WriteErrorMessage("Write failed padding snapshot\n");
+            return false;
+        }
+        *offset += bytes;
+    }
+    *o_sectionOffset = aligned;
+    return true;
+}
+
+    bool
+GenomeIndex::saveSnapshot(const char *directoryName, const char *snapshotFileName)
+{
+    int filenameBufferSize = (int)(strlen(directoryName) + 1 + __max(strlen(GenomeIndexFileName), __max(strlen(OverflowTableFileName), __max(strlen(GenomeIndexHashFileName), strlen(GenomeFileName)))) + 1);
+    char *filenameBuffer = new char[filenameBufferSize];
+
+    snprintf(filenameBuffer, filenameBufferSize, "%s%c%s", directoryName, PATH_SEP, GenomeIndexFileName);
+    FILE *indexFile = fopen(filenameBuffer, "rb");
+    if (NULL == indexFile) {
+        WriteErrorMessage("Unable to open file '%s' for read.\n", filenameBuffer);
+        delete[] filenameBuffer;
+        return false;
+    }
+    char indexFileBuf[1000];
+    size_t indexFileSize = fread(indexFileBuf, 1, sizeof(indexFileBuf) - 1, indexFile);
+    fclose(indexFile);
+    indexFileBuf[indexFileSize] = 0;
+    char *newline = strchr(indexFileBuf, '\n');
+    if (NULL != newline) {
+        *newline = '\0';
+    }
+
+    //
+    // Check that it's an index this version can load before going to the trouble of copying it.
+    //
+    unsigned chromosomePadding;
+    size_t hashTablesFileSize;
+    GenomeIndex *index = createFromHeader(indexFileBuf, &chromosomePadding, &hashTablesFileSize);
+    if (NULL == index) {
+        delete[] filenameBuffer;
+        return false;
+    }
+    delete index;
+
+    FILE *snapshotFile = fopen(snapshotFileName, "wb");
+    if (NULL == snapshotFile) {
+        WriteErrorMessage("Unable to open snapshot file '%s' for write.\n", snapshotFileName);
+        delete[] filenameBuffer;
+        return false;
+    }
+
+    //
+    // The header gets the first section to itself, and the rest each start on a huge page boundary after it.
+    // The header's written last, once it's known where they ended up.
+    //
+    _int64 offset = 1, overflowOffset, overflowBytes, tablesOffset, tablesBytes, genomeOffset, genomeBytes, end;
+    bool ok = 1 == fwrite("", 1, 1, snapshotFile) && alignSnapshot(snapshotFile, &offset, &overflowOffset);
+
+    snprintf(filenameBuffer, filenameBufferSize, "%s%c%s", directoryName, PATH_SEP, OverflowTableFileName);
+    ok = ok && appendFileToSnapshot(filenameBuffer, snapshotFile, &overflowBytes);
+    offset += overflowBytes;
+    ok = ok && alignSnapshot(snapshotFile, &offset, &tablesOffset);
+
+    snprintf(filenameBuffer, filenameBufferSize, "%s%c%s", directoryName, PATH_SEP, GenomeIndexHashFileName);
+    ok = ok && appendFileToSnapshot(filenameBuffer, snapshotFile, &tablesBytes);
+    offset += tablesBytes;
+    ok = ok && alignSnapshot(snapshotFile, &offset, &genomeOffset);
+
+    snprintf(filenameBuffer, filenameBufferSize, "%s%c%s", directoryName, PATH_SEP, GenomeFileName);
+    ok = ok && Genome::appendPaddedSaveFile(filenameBuffer, snapshotFile, &genomeBytes);
+    offset += genomeBytes;
+    ok = ok && alignSnapshot(snapshotFile, &offset, &end);
+
+    if (ok) {
+        char header[2000];
+        int headerLength = snprintf(header, sizeof(header), "%s %d\n%s\n%lld %lld %lld %lld %lld %lld\n", SnapshotMagic, SnapshotFormatVersion, indexFileBuf,
+            overflowOffset, overflowBytes, tablesOffset, tablesBytes, genomeOffset, genomeBytes);
+        ok = 0 == _fseek64bit(snapshotFile, 0, SEEK_SET) && headerLength == fwrite(header, 1, headerLength, snapshotFile);
+    }
+
+    ok = 0 == fclose(snapshotFile) && ok;
+    delete[] filenameBuffer;
+    if (!ok) {
+        WriteErrorMessage("Failed writing snapshot file '%s'\n", snapshotFileName);
+        DeleteSingleFile(snapshotFileName);
+    }
+    return ok;
+}
+
+        GenomeIndex *
+GenomeIndex::loadFromSnapshot(const char *snapshotFileName)
+{
+    //
+    // One mapping of the whole file, read in up front.
+    //
+    size_t fileSize = QueryFileSize(snapshotFileName);
+    char *contents;
+    MemoryMappedFile *snapshotFile = OpenMemoryMappedFile(snapshotFileName, 0, fileSize, (void **)&contents, false, true, true);
+    if (NULL == snapshotFile) {
+        WriteErrorMessage("Unable to map snapshot file '%s'\n", snapshotFileName);
+        return NULL;
+    }
+
+    char magic[32], indexFileBuf[1000], sectionBuf[1000];
+    int version;
+    _int64 overflowOffset, overflowBytes, tablesOffset, tablesBytes, genomeOffset, genomeBytes;
+    GenericFile_Blob *header = GenericFile_Blob::open(contents, __min(fileSize, (size_t)SnapshotAlignment));
+    bool headerOk = NULL != header->gets(magic, sizeof(magic)) && NULL != header->gets(indexFileBuf, sizeof(indexFileBuf)) &&
+        NULL != header->gets(sectionBuf, sizeof(sectionBuf)) &&
+        1 == sscanf(magic + strlen(SnapshotMagic), "%d", &version) &&
+        6 == sscanf(sectionBuf, "%lld %lld %lld %lld %lld %lld", &overflowOffset, &overflowBytes, &tablesOffset, &tablesBytes, &genomeOffset, &genomeBytes);
+    delete header;
+    if (!headerOk) {
+        WriteErrorMessage("Snapshot file '%s' has a bad header\n", snapshotFileName);
+        CloseMemoryMappedFile(snapshotFile);
+        return NULL;
+    }
+    if (version != SnapshotFormatVersion) {
+        WriteErrorMessage("Snapshot file '%s' is version %d, but this SNAP reads version %d.  Please make it again from the index.\n",
+            snapshotFileName, version, SnapshotFormatVersion);
+        CloseMemoryMappedFile(snapshotFile);
+        return NULL;
+    }
+    if ((size_t)genomeOffset + genomeBytes > fileSize || (size_t)tablesOffset + tablesBytes > fileSize || (size_t)overflowOffset + overflowBytes > fileSize) {
+        WriteErrorMessage("Snapshot file '%s' is truncated\n", snapshotFileName);
+        CloseMemoryMappedFile(snapshotFile);
+        return NULL;
+    }
+
+    unsigned chromosomePadding;
+    size_t hashTablesFileSize;
+    GenomeIndex *index = createFromHeader(indexFileBuf, &chromosomePadding, &hashTablesFileSize);
+    if (NULL == index) {
+        CloseMemoryMappedFile(snapshotFile);
+        return NULL;
+    }
+    index->snapshot = snapshotFile;
+
+    //
+    // Everything is used where it lies in the mapping.
+    //
+    size_t overflowEntrySize = (index->locationSize > 4) ? sizeof(*index->overflowTable64) : sizeof(*index->overflowTable32);
+    if ((size_t)overflowBytes != index->overflowTableSize * overflowEntrySize || (size_t)tablesBytes != hashTablesFileSize) {
+        WriteErrorMessage("Snapshot file '%s' sections don't match its index header\n", snapshotFileName);
+        delete index;
+        return NULL;
+    }
+    if (index->locationSize > 4) {
+        index->overflowTable64 = (_int64 *)(contents + overflowOffset);
+    } else {
+        index->overflowTable32 = (unsigned *)(contents + overflowOffset);
+    }
+
+    GenericFile_Blob *tablesBlob = GenericFile_Blob::open(contents + tablesOffset, tablesBytes);
+    bool ok = index->loadHashTables(tablesBlob, tablesBytes);
+    delete tablesBlob;
+    if (!ok) {
+        delete index;
+        return NULL;
+    }
+
+    GenericFile_Blob *genomeBlob = GenericFile_Blob::open(contents + genomeOffset, genomeBytes);
+    index->genome = Genome::loadFromBlob(genomeBlob, chromosomePadding);
+    delete genomeBlob;
+    if (NULL == index->genome) {
+        WriteErrorMessage("GenomeIndex::loadFromSnapshot: Failed to load the genome itself\n");
+        delete index;
+        return NULL;
+    }
+
+    return index;
+}
+
+    void
+GenomeIndex::runSnapshot(int argc, const char **argv)
+{
+    if (2 != argc) {
+        WriteErrorMessage(
+            "Usage: snap-aligner snapshot <index-dir> <snapshot-file>\n"
+            "Copies an index into a single file that single and paired can take in place of the index directory.\n"
+            "It's loaded with one sequential mapping, into huge pages where the filesystem supports them, so on\n"
+            "a tmpfs mounted with huge=within_size it stays resident and ready between runs.\n");
+        soft_exit_no_print(1);
+    }
+
+    _int64 start = timeInMillis();
+    if (!saveSnapshot(argv[0], argv[1])) {
+        soft_exit(1);
+    }
+    WriteStatusMessage("Wrote snapshot %s in %llds\n", argv[1], (timeInMillis() - start + 500) / 1000);
+}
+
+    inline _int64
+GenomeIndex::lookupDirect(_uint64 bases, _uint64 *o_firstHit) const
+{
+    const unsigned *bucket = directBuckets + (bases >> directSuffixBits);
+    unsigned suffix = (unsigned)(bases & (((_uint64)1 << directSuffixBits) - 1));
+    const unsigned *first = directSuffixes + bucket[0];
+    const unsigned *bucketEnd = directSuffixes + bucket[1];
+    const unsigned *last;
+
+    if (bucketEnd - first <= DirectScanLimit) {
+        //
+        // The usual case: a few entries, so just walk them.
+        //
+        while (first < bucketEnd && *first < suffix) {
+            first++;
+        }
+        last = first;
+        while (last < bucketEnd && *last == suffix) {
+            last++;
+        }
+    } else {
+        std::pair<const unsigned *, const unsigned *> range = std::equal_range(first, bucketEnd, suffix);
+        first = range.first;
+        last = range.second;
+    }
+
+    *o_firstHit = 1 + (first - directSuffixes);
+    return last - first;
+}
+
+    void
+GenomeIndex::prefetchSeed(Seed seed) const
+{
+    if (0 != directPrefixBases) {
+        _mm_prefetch((const char *)(directBuckets + (seed.getBases() >> directSuffixBits)), _MM_HINT_T2);
+        _mm_prefetch((const char *)(directBuckets + (seed.getRCBases() >> directSuffixBits)), _MM_HINT_T2);
+    } else if (largeHashTable) {
+        //
+        // Large tables store a seed and its reverse complement in one entry, under whichever is smaller.
+        //
+        if (seed.isBiggerThanItsReverseComplement()) {
+            seed = ~seed;
+        }
+        _ASSERT(seed.getHighBases(hashTableKeySize) < nHashTables);
+        hashTables[seed.getHighBases(hashTableKeySize)]->PrefetchEntryForKey(seed.getLowBases(hashTableKeySize));
+    } else {
+        for (int dir = 0; dir < NUM_DIRECTIONS; dir++) {
+            _ASSERT(seed.getHighBases(hashTableKeySize) < nHashTables);
+            hashTables[seed.getHighBases(hashTableKeySize)]->PrefetchEntryForKey(seed.getLowBases(hashTableKeySize));
+            seed = ~seed;
+        }
+    }
+}
+
     void
 GenomeIndex::lookupSeed32(
     Seed              seed,
@@ -1861,7 +2537,13 @@ GenomeIndex::lookupSeed32(
 {
     _ASSERT(locationSize == 4);   // This is the caller's responsibility to check.
 
-    if (largeHashTable) {
+    if (0 != directPrefixBases) {
+        _uint64 firstHit;
+        *nHits = lookupDirect(seed.getBases(), &firstHit);
+        *hits = &overflowTable32[firstHit];
+        *nRCHits = lookupDirect(seed.getRCBases(), &firstHit);
+        *rcHits = &overflowTable32[firstHit];
+    } else if (largeHashTable) {
         bool lookedUpComplement;
 
         lookedUpComplement = seed.isBiggerThanItsReverseComplement();
@@ -1988,7 +2670,13 @@ GenomeIndex::lookupSeed(
 {
     _ASSERT(locationSize > 4 && locationSize <= 8);
 
-    if (largeHashTable) {
+    if (0 != directPrefixBases) {
+        _uint64 firstHit;
+        *nHits = lookupDirect(seed.getBases(), &firstHit);
+        *hits = (const GenomeLocation *)&overflowTable64[firstHit];
+        *nRCHits = lookupDirect(seed.getRCBases(), &firstHit);
+        *rcHits = (const GenomeLocation *)&overflowTable64[firstHit];
+    } else if (largeHashTable) {
         bool lookedUpComplement;
 
         lookedUpComplement = seed.isBiggerThanItsReverseComplement();
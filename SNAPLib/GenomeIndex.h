@@ -59,6 +59,12 @@ public:
 
     bool doesGenomeIndexHave64BitLocations() const {return locationSize > 4;}
 
+    //
+    // Issues cache prefetches for the index entries that a lookupSeed of this seed will read first.  It's
+    // only a hint, so it works for every index format and has no effect on results.
+    //
+    void prefetchSeed(Seed seed) const;
+
     //
     // Looks up a seed and its reverse complement, restricting the search to a given range of locations,
     // and returns the number and list of hits for each.
@@ -82,7 +88,22 @@ public:
     //
     static void runIndexer(int argc, const char **argv);
 
-    static GenomeIndex *loadFromDirectory(char *directoryName, bool map, bool prefetch);
+    static GenomeIndex *loadFromDirectory(char *directoryName, bool map, bool prefetch);    // Or a snapshot file
+
+    //
+    // A snapshot is a whole index in one file: a text header, then the overflow table, hash tables and genome, each
+    // starting on a huge page boundary and laid out just as they're used, so loading it is a single mapping that's
+    // read in sequentially with nothing to copy or fix up.  runSnapshot makes one from an index directory.
+    //
+    static void runSnapshot(int argc, const char **argv);
+    static bool saveSnapshot(const char *directoryName, const char *snapshotFileName);
+    static bool isSnapshot(const char *fileName);
+    static GenomeIndex *loadFromSnapshot(const char *snapshotFileName);
+
+    static const _int64 SnapshotAlignment = 2 * 1024 * 1024;
+
+    // Genomes up to this size are indexed directly rather than with hash tables, unless it's built with -noDirect
+    static const GenomeDistance DirectMaxBases = 64 * 1024 * 1024;
 
     static void printBiasTables();
 
@@ -110,6 +131,48 @@ protected:
     void *tablesBlob;   // All of the hash tables in one giant blob
 	GenericFile_map *mappedTables;
 
+    MemoryMappedFile *snapshot;     // If loaded from one, everything above points into it
+
+    //
+    // Small genomes (see DirectMaxBases) are indexed without hash tables.  A seed's high directPrefixBases bases select a
+    // bucket in directBuckets, which gives the range of entries whose seeds start with that prefix.  The entries are
+    // sorted by the rest of the seed (their suffix, in directSuffixes) and then backwards by location, which is kept
+    // in the overflow table after one unused slot (so that hits[-1] is always valid).  So each seed's hits are a run
+    // of the overflow table, found with one load from the bucket directory and a search of a bucket that's usually
+    // only a few entries long.  The directory and suffixes are saved in place of the hash tables.  directPrefixBases
+    // is 0 for indices with hash tables.
+    //
+    unsigned directPrefixBases;
+    unsigned directSuffixBits;
+    const unsigned *directBuckets;      // 4^directPrefixBases + 1 entries
+    const unsigned *directSuffixes;
+
+    static const unsigned DirectMaxPrefixBases = 12;
+    static const int DirectScanLimit = 16;    // Longer buckets are binary searched
+
+    // 0 if the genome should get hash tables
+    static unsigned chooseDirectPrefixBases(GenomeDistance countOfBases, int seedLen);
+
+    static bool BuildDirectSeedTable(const Genome *genome, int seedLen, unsigned prefixBases, unsigned locationSize,
+                                     const char *overflowTableFileName, const char *tablesFileName, FILE *histogramFile,
+                                     _uint64 *o_overflowTableSize, size_t *o_tablesFileSize);
+
+    bool loadDirectSeedTable(GenericFile_Blob *blobFile, size_t tablesFileSize);
+
+    // Returns the number of hits, the first of which is at overflow table index *o_firstHit
+    inline _int64 lookupDirect(_uint64 bases, _uint64 *o_firstHit) const;
+
+    static const int SnapshotFormatVersion = 1;
+
+    static bool writeIndexHeader(const char *fileName, unsigned nHashTables, _uint64 overflowTableSize, int seedLen, unsigned chromosomePaddingSize,
+                                 unsigned hashTableKeySize, size_t tablesFileSize, bool large, unsigned locationSize, unsigned directPrefixBases);
+
+    //
+    // Make an index with the values from the GenomeIndex file, but nothing loaded yet.
+    //
+    static GenomeIndex *createFromHeader(const char *indexFileBuf, unsigned *o_chromosomePadding, size_t *o_hashTablesFileSize);
+    bool loadHashTables(GenericFile_Blob *blobFile, size_t hashTablesFileSize);     // Or the direct seed table
+
     //
     // We have to build the overflow table in two stages.  While we're walking the genome, we first
     // assign tentative overflow table locations, and build up a list of places where each repeat
@@ -159,7 +222,7 @@ protected:
                                       bool computeBias, const char *directory,
                                       unsigned maxThreads, unsigned chromosomePaddingSize, bool forceExact, 
                                       unsigned hashTableKeySize, bool large, const char *histogramFileName,
-                                      unsigned locationSize, bool smallMemory);
+                                      unsigned locationSize, bool smallMemory, bool allowDirect);
 
  
     //
@@ -170,6 +233,12 @@ protected:
     
     static const unsigned GenomeIndexFormatMajorVersion = 5;
     static const unsigned GenomeIndexFormatMinorVersion = 0;
+
+    //
+    // Indices with direct seed tables get their own major version, so that versions of SNAP that only know hash tables
+    // refuse to load them rather than reading the direct table as if it were hash tables.
+    //
+    static const unsigned GenomeIndexDirectFormatMajorVersion = 6;
     
     static const unsigned largestBiasTable = 32;    // Can't be bigger than the biggest seed size, which is set in Seed.h.  Bigger than 32 means a new Seed structure.
     static const unsigned largestKeySize = 8;
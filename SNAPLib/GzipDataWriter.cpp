@@ -26,6 +26,7 @@ Environment:
 #include "zlib.h"
 #include "exit.h"
 #include "Error.h"
+#include "Tracer.h"
 
 using std::min;
 using std::max;
@@ -175,6 +176,7 @@ GzipCompressWorker::step()
         zstream.opaque = heap;
     }
     //fprintf(stderr, "zip task thread %d begin\n", GetCurrentThreadId());
+    TraceScope trace(TraceCompress);
     _int64 start = timeInMillis();
     int begin = (getThreadNum() * supplier->nChunks) / getNumThreads();
     int end = ((1 + getThreadNum()) * supplier->nChunks) / getNumThreads();
@@ -290,6 +292,18 @@ GzipCompressWorker::compressChunk(
     return toUsed;
 }
 
+    size_t
+GzipCompressChunk(
+    z_stream& zstream,
+    bool bamFormat,
+    char* toBuffer,
+    size_t toSize,
+    char* fromBuffer,
+    size_t fromUsed)
+{
+    return GzipCompressWorker::compressChunk(zstream, bamFormat, toBuffer, toSize, fromBuffer, fromUsed);
+}
+
 GzipWriterFilter::GzipWriterFilter(GzipWriterFilterSupplier* i_supplier)
     : DataWriter::Filter(DataWriter::ResizeFilter), supplier(i_supplier), manager(NULL), worker(NULL)
 {}
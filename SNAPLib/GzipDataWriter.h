@@ -99,3 +99,9 @@ private:
     VariableSizeVector< pair<_uint64,_uint64> > translation;
     bool closing;
 };
+
+//
+// Compress one chunk into a single gzip member (a BGZF block if bamFormat), exactly as the writer
+// filters do.  Exposed for the benchmarks.
+//
+size_t GzipCompressChunk(z_stream& zstream, bool bamFormat, char* toBuffer, size_t toSize, char* fromBuffer, size_t fromUsed);
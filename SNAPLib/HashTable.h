@@ -118,6 +118,14 @@ class SNAPHashTable {
         }
 
 
+        //
+        // Issue a cache prefetch for the entry that GetFirstValueForKey will look at first, so that a lookup
+        // made a little later doesn't have to wait on DRAM.
+        //
+        inline void PrefetchEntryForKey(KeyType key) const {
+            _mm_prefetch((const char *)getEntry(hash(key) % tableSize), _MM_HINT_T2);
+        }
+
         inline bool Lookup(KeyType key, unsigned nValuesToFill, ValueType *values) const {
             _ASSERT(nValuesToFill <= valueCount);
             char *entry = (char *)GetFirstValueForKey(key);
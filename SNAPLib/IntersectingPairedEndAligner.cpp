@@ -28,6 +28,7 @@ Revision History:
 #include "Error.h"
 #include "BigAlloc.h"
 #include "AlignerOptions.h"
+#include "SequenceCodec.h"
 
 #ifdef  _DEBUG
 extern bool _DumpAlignments;    // From BaseAligner.cpp
@@ -71,22 +72,140 @@ IntersectingPairedEndAligner::IntersectingPairedEndAligner(
     rcTranslationTable['T'] = 'A';
     rcTranslationTable['N'] = 'N';
 
-    for (unsigned i = 0; i < 256; i++) {
-        nTable[i] = 0;
-    }
-
-    nTable['N'] = 1;
-
     seedLen = index->getSeedLength();
+    seedMatchProbability = pow(1 - SNP_PROB, seedLen);
 
     genome = index->getGenome();
     genomeSize = genome->getCountOfBases();
+
+    firstPrefetchState = 0;
+    nPrefetchStates = 0;
+
+    adaptiveSeedSchedule = false;
+    seedLookupsSkipped = 0;
 }
 
 IntersectingPairedEndAligner::~IntersectingPairedEndAligner()
 {
 }
 
+    void
+IntersectingPairedEndAligner::beginPrefetch(Read *read0, Read *read1)
+{
+    if (nPrefetchStates == MaxPrefetchDepth) {
+        //
+        // The caller is running further ahead than we can track.  Drop the oldest pair; its hash table
+        // entries are already on their way, it just won't get its genome prefetched.
+        //
+        firstPrefetchState = (firstPrefetchState + 1) % MaxPrefetchDepth;
+        nPrefetchStates--;
+    }
+
+    PrefetchState *state = &prefetchStates[(firstPrefetchState + nPrefetchStates) % MaxPrefetchDepth];
+    nPrefetchStates++;
+
+    state->read[0] = read0;
+    state->read[1] = read1;
+
+    int maxSeeds;
+    if (numSeedsFromCommandLine != 0) {
+        maxSeeds = (int)numSeedsFromCommandLine;
+    } else {
+        maxSeeds = (int)(max(read0->getDataLength(), read1->getDataLength()) * seedCoverage / seedLen);
+    }
+    maxSeeds = min(maxSeeds, MaxPrefetchSeedsPerRead);
+
+    //
+    // Follow the first pass of the seed schedule in phase 1 of align(), which is where almost all of its lookups
+    // come from.  Wrapping around for more seeds is rare enough not to be worth predicting.
+    //
+    for (unsigned whichRead = 0; whichRead < NUM_READS_PER_PAIR; whichRead++) {
+        const char *data = state->read[whichRead]->getData();
+        int nPossibleSeeds = (int)state->read[whichRead]->getDataLength() - (int)seedLen + 1;
+        int nextSeedToTest = 0;
+        int nSeeds = 0;
+
+        while (nextSeedToTest < nPossibleSeeds && nSeeds < maxSeeds) {
+            if (!Seed::DoesTextRepresentASeed(data + nextSeedToTest, seedLen)) {
+                nextSeedToTest++;
+                continue;
+            }
+
+            Seed seed(data + nextSeedToTest, seedLen);
+            index->prefetchSeed(seed);
+            state->seeds[whichRead][nSeeds] = seed;
+            state->seedOffsets[whichRead][nSeeds] = nextSeedToTest;
+            nSeeds++;
+
+            if ((maxSeeds - nSeeds + 1) * (int)seedLen + nextSeedToTest < nPossibleSeeds) {
+                nextSeedToTest += (nPossibleSeeds - nextSeedToTest - 1) / (maxSeeds - nSeeds + 1);
+            } else {
+                nextSeedToTest += seedLen;
+            }
+        }
+        state->nSeeds[whichRead] = nSeeds;
+    }
+}
+
+    void
+IntersectingPairedEndAligner::continuePrefetch(Read *read0, Read *read1)
+{
+    //
+    // Pairs come out in the order they went in, but the caller may have skipped some (say, at the end of a batch
+    // of input), so discard any older ones.
+    //
+    while (nPrefetchStates > 0 && (prefetchStates[firstPrefetchState].read[0] != read0 || prefetchStates[firstPrefetchState].read[1] != read1)) {
+        firstPrefetchState = (firstPrefetchState + 1) % MaxPrefetchDepth;
+        nPrefetchStates--;
+    }
+
+    if (nPrefetchStates == 0) {
+        return;
+    }
+
+    PrefetchState *state = &prefetchStates[firstPrefetchState];
+    firstPrefetchState = (firstPrefetchState + 1) % MaxPrefetchDepth;
+    nPrefetchStates--;
+
+    for (unsigned whichRead = 0; whichRead < NUM_READS_PER_PAIR; whichRead++) {
+        unsigned readLength = state->read[whichRead]->getDataLength();
+        for (int i = 0; i < state->nSeeds[whichRead]; i++) {
+            _int64 nHits[NUM_DIRECTIONS];
+            const GenomeLocation *hits[NUM_DIRECTIONS] = {NULL, NULL};
+            const unsigned *hits32[NUM_DIRECTIONS] = {NULL, NULL};
+            GenomeLocation singleHit[NUM_DIRECTIONS];
+
+            //
+            // The unlifted lookups are fine for indices with alts, since all we want is to touch the right memory.
+            //
+            if (doesGenomeIndexHave64BitLocations) {
+                index->lookupSeed(state->seeds[whichRead][i], &nHits[FORWARD], &hits[FORWARD], &nHits[RC], &hits[RC], &singleHit[FORWARD], &singleHit[RC]);
+            } else {
+                index->lookupSeed32(state->seeds[whichRead][i], &nHits[FORWARD], &hits32[FORWARD], &nHits[RC], &hits32[RC]);
+            }
+
+            unsigned seedOffset = state->seedOffsets[whichRead][i];
+            prefetchGenomeAtHits(nHits[FORWARD], hits[FORWARD], hits32[FORWARD], seedOffset);
+            prefetchGenomeAtHits(nHits[RC], hits[RC], hits32[RC], readLength - seedLen - seedOffset);
+        }
+    }
+}
+
+    void
+IntersectingPairedEndAligner::prefetchGenomeAtHits(_int64 nHits, const GenomeLocation *hits, const unsigned *hits32, unsigned offsetInRead)
+{
+    if (nHits > MaxHitsToPrefetch) {
+        return;
+    }
+
+    for (_int64 i = 0; i < nHits; i++) {
+        GenomeLocation hit = doesGenomeIndexHave64BitLocations ? hits[i] : GenomeLocation(hits32[i]);
+        if (hit >= offsetInRead) {
+            index->prefetchGenomeData(hit - offsetInRead);
+        }
+    }
+}
+
     size_t
 IntersectingPairedEndAligner::getBigAllocatorReservation(GenomeIndex * index, unsigned maxBigHitsToConsider, unsigned maxReadSize, unsigned seedLen, unsigned numSeedsFromCommandLine,
                                                          double seedCoverage, unsigned maxEditDistanceToConsider, unsigned maxExtraSearchDepth, unsigned maxCandidatePoolSize,
@@ -115,15 +234,14 @@ IntersectingPairedEndAligner::allocateDynamicMemory(BigAllocator *allocator, uns
                                                     unsigned maxEditDistanceToConsider, unsigned maxExtraSearchDepth, unsigned maxCandidatePoolSize,
                                                     int maxSecondaryAlignmentsPerContig)
 {
-    seedUsed = (BYTE *) allocator->allocate(100 + (maxReadSize + 7) / 8);
-
     for (unsigned whichRead = 0; whichRead < NUM_READS_PER_PAIR; whichRead++) {
+        seedUsed[whichRead] = (BYTE *) allocator->allocate(100 + (maxReadSize + 7) / 8);
         rcReadData[whichRead] = (char *)allocator->allocate(maxReadSize);
         rcReadQuality[whichRead] = (char *)allocator->allocate(maxReadSize);
 
         for (Direction dir = 0; dir < NUM_DIRECTIONS; dir++) {
             reversedRead[whichRead][dir] = (char *)allocator->allocate(maxReadSize);
-            hashTableHitSets[whichRead][dir] =(HashTableHitSet *)allocator->allocate(sizeof(HashTableHitSet)); /*new HashTableHitSet();*/
+            hashTableHitSets[whichRead][dir] = new (allocator->allocate(sizeof(HashTableHitSet))) HashTableHitSet();
             hashTableHitSets[whichRead][dir]->firstInit(maxSeedsToUse, maxMergeDistance, allocator, doesGenomeIndexHave64BitLocations);
         }
     }
@@ -131,14 +249,14 @@ IntersectingPairedEndAligner::allocateDynamicMemory(BigAllocator *allocator, uns
     scoringCandidatePoolSize = min(maxCandidatePoolSize, maxBigHitsToConsider * maxSeedsToUse * NUM_READS_PER_PAIR);
 
     scoringCandidates = (ScoringCandidate **) allocator->allocate(sizeof(ScoringCandidate *) * (maxEditDistanceToConsider + maxExtraSearchDepth + 1));  //+1 is for 0.
-    scoringCandidatePool = (ScoringCandidate *)allocator->allocate(sizeof(ScoringCandidate) * scoringCandidatePoolSize);
+    scoringCandidatePool.reserve(allocator, scoringCandidatePoolSize);
 
     for (unsigned i = 0; i < NUM_READS_PER_PAIR; i++) {
-        scoringMateCandidates[i] = (ScoringMateCandidate *) allocator->allocate(sizeof(ScoringMateCandidate) * scoringCandidatePoolSize / NUM_READS_PER_PAIR);
+        scoringMateCandidates[i].reserve(allocator, scoringCandidatePoolSize / NUM_READS_PER_PAIR);
     }
 
     mergeAnchorPoolSize = scoringCandidatePoolSize;
-    mergeAnchorPool = (MergeAnchor *)allocator->allocate(sizeof(MergeAnchor) * mergeAnchorPoolSize);
+    mergeAnchorPool.reserve(allocator, mergeAnchorPoolSize);
 
     if (maxSecondaryAlignmentsPerContig > 0) {
         size_t size = sizeof(*hitsPerContigCounts) * index->getGenome()->getNumContigs();
@@ -150,7 +268,7 @@ IntersectingPairedEndAligner::allocateDynamicMemory(BigAllocator *allocator, uns
     }
 }
 
-    void
+    bool
 IntersectingPairedEndAligner::align(
         Read                  *read0,
         Read                  *read1,
@@ -211,7 +329,7 @@ IntersectingPairedEndAligner::align(
 	// minimum enforced by our called
     //
     if (read0->getDataLength() < seedLen || read1->getDataLength() < seedLen) {
-         return;
+         return true;
     }
 
     //
@@ -241,30 +359,21 @@ IntersectingPairedEndAligner::align(
             soft_exit(1);
         }
 
-        for (unsigned i = 0; i < reads[whichRead][FORWARD]->getDataLength(); i++) {
-            rcReadData[whichRead][i] = rcTranslationTable[read->getData()[readLen[whichRead] - i - 1]];
-            rcReadQuality[whichRead][i] = read->getQuality()[readLen[whichRead] - i - 1];
-            countOfNs += nTable[read->getData()[i]];
-        }
+        //
+        // This also builds the reverse data for both directions for the backwards LV to use; the RC read reversed is
+        // just the read complemented.
+        //
+        countOfNs += read->prepareForAlignment(rcReadData[whichRead], rcReadQuality[whichRead], reversedRead[whichRead][FORWARD], reversedRead[whichRead][RC], rcTranslationTable);
         reads[whichRead][RC] = &rcReads[whichRead];
         reads[whichRead][RC]->init(read->getId(), read->getIdLength(), rcReadData[whichRead], rcReadQuality[whichRead], read->getDataLength());
-    }
 
-    if (countOfNs > maxK) {
-        return;
+        if (lvResultCache.isEnabled()) {
+            readCacheKey[whichRead] = LVResultCache::hashRead(read->getData(), read->getQuality(), readLen[whichRead]);
+        }
     }
 
-    //
-    // Build the reverse data for both reads in both directions for the backwards LV to use.
-    //
-    for (unsigned whichRead = 0; whichRead < NUM_READS_PER_PAIR; whichRead++) {
-        for (Direction dir = 0; dir < NUM_DIRECTIONS; dir++) {
-            Read *read = reads[whichRead][dir];
-
-            for (unsigned i = 0; i < read->getDataLength(); i++) {
-                reversedRead[whichRead][dir][i] = read->getData()[read->getDataLength() - i - 1];
-            }
-        }
+    if (countOfNs > maxK) {
+        return true;
     }
 
     unsigned thisPassSeedsNotSkipped[NUM_READS_PER_PAIR][NUM_DIRECTIONS] = {{0,0}, {0,0}};
@@ -284,123 +393,41 @@ IntersectingPairedEndAligner::align(
     // Phase 1: do the hash table lookups for each of the seeds for each of the reads and add them to the hit sets.
     //
     for (unsigned whichRead = 0; whichRead < NUM_READS_PER_PAIR; whichRead++) {
-        int nextSeedToTest = 0;
-        unsigned wrapCount = 0;
-        int nPossibleSeeds = (int)readLen[whichRead] - seedLen + 1;
-        memset(seedUsed, 0, (__max(readLen[0], readLen[1]) + 7) / 8);
-        bool beginsDisjointHitSet[NUM_DIRECTIONS] = {true, true};
-
-        while (countOfHashTableLookups[whichRead] < nPossibleSeeds && countOfHashTableLookups[whichRead] < maxSeeds) {
-            if (nextSeedToTest >= nPossibleSeeds) {
-                wrapCount++;
-				beginsDisjointHitSet[FORWARD] = beginsDisjointHitSet[RC] = true;
-                if (wrapCount >= seedLen) {
-                    //
-                    // There aren't enough valid seeds in this read to reach our target.
-                    //
-                    break;
-                }
-                nextSeedToTest = GetWrappedNextSeedToTest(seedLen, wrapCount);
-            }
-
-
-            while (nextSeedToTest < nPossibleSeeds && IsSeedUsed(nextSeedToTest)) {
-                //
-                // This seed is already used.  Try the next one.
-                //
-                nextSeedToTest++;
-            }
-
-            if (nextSeedToTest >= nPossibleSeeds) {
-                //
-                // Unusable seeds have pushed us past the end of the read.  Go back around the outer loop so we wrap properly.
-                //
-                continue;
-            }
-
-            SetSeedUsed(nextSeedToTest);
-
-            if (!Seed::DoesTextRepresentASeed(reads[whichRead][FORWARD]->getData() + nextSeedToTest, seedLen)) {
-                //
-                // It's got Ns in it, so just skip it.
-                //
-                nextSeedToTest++;
-                continue;
-            }
-
-            Seed seed(reads[whichRead][FORWARD]->getData() + nextSeedToTest, seedLen);
-            //
-            // Find all instances of this seed in the genome.
-            //
-            _int64 nHits[NUM_DIRECTIONS];
-            const GenomeLocation *hits[NUM_DIRECTIONS];
-            const unsigned *hits32[NUM_DIRECTIONS];
-            const GenomeLocation *unliftedHits[NUM_DIRECTIONS];
-            const unsigned *unliftedHits32[NUM_DIRECTIONS];
+        SeedSchedule *schedule = &seedSchedules[whichRead];
+        schedule->nextSeedToTest = 0;
+        schedule->wrapCount = 0;
+        schedule->nPossibleSeeds = (int)readLen[whichRead] - seedLen + 1;
+        schedule->beginsDisjointHitSet[FORWARD] = schedule->beginsDisjointHitSet[RC] = true;
+        memset(seedUsed[whichRead], 0, (readLen[whichRead] + 7) / 8);
+    }
 
-            if (!doesGenomeIndexHaveAlts) {
-                if (doesGenomeIndexHave64BitLocations) {
-                    index->lookupSeed(seed, &nHits[FORWARD], &hits[FORWARD], &nHits[RC], &hits[RC],
-                        hashTableHitSets[whichRead][FORWARD]->getNextSingletonLocation(), hashTableHitSets[whichRead][RC]->getNextSingletonLocation());
-                }
-                else {
-                    index->lookupSeed32(seed, &nHits[FORWARD], &hits32[FORWARD], &nHits[RC], &hits32[RC]);
-                }
-            }
-            else {
-                if (doesGenomeIndexHave64BitLocations) {
-                    index->lookupSeedAlt(seed, &nHits[FORWARD], &hits[FORWARD], &nHits[RC], &hits[RC], &unliftedHits[FORWARD], &unliftedHits[RC],
-                        hashTableHitSets[whichRead][FORWARD]->getNextSingletonLocation(), hashTableHitSets[whichRead][RC]->getNextSingletonLocation());
-                }
-                else {
-                    index->lookupSeedAlt32(seed, &nHits[FORWARD], &hits32[FORWARD], &nHits[RC], &hits32[RC], &unliftedHits32[FORWARD], &unliftedHits32[RC]);
-                }
+    if (!adaptiveSeedSchedule) {
+        for (unsigned whichRead = 0; whichRead < NUM_READS_PER_PAIR; whichRead++) {
+            while (lookupNextSeed(whichRead, maxSeeds, &popularSeedsSkipped[whichRead])) {
+                // lookupNextSeed does the work
             }
-
-            countOfHashTableLookups[whichRead]++;
-            for (Direction dir = FORWARD; dir < NUM_DIRECTIONS; dir++) {
-                int offset;
-                if (dir == FORWARD) {
-                    offset = nextSeedToTest;
-                } else {
-                    offset = readLen[whichRead] - seedLen - nextSeedToTest;
-                }
-                if (nHits[dir] < maxBigHits) {
-                    totalHashTableHits[whichRead][dir] += nHits[dir];
-                    if (!doesGenomeIndexHaveAlts) {
-                        if (doesGenomeIndexHave64BitLocations) {
-                            hashTableHitSets[whichRead][dir]->recordLookup(offset, nHits[dir], hits[dir], NULL, beginsDisjointHitSet[dir]);
-                        }
-                        else {
-                            hashTableHitSets[whichRead][dir]->recordLookup(offset, nHits[dir], hits32[dir], NULL, beginsDisjointHitSet[dir]);
-                        }
-                    }
-                    else {
-                        if (doesGenomeIndexHave64BitLocations) {
-                            hashTableHitSets[whichRead][dir]->recordLookup(offset, nHits[dir], hits[dir], unliftedHits[dir], beginsDisjointHitSet[dir]);
-                        }
-                        else {
-                            hashTableHitSets[whichRead][dir]->recordLookup(offset, nHits[dir], hits32[dir], unliftedHits32[dir], beginsDisjointHitSet[dir]);
-                        }
-                    }
-                    beginsDisjointHitSet[dir]= false;
-                } else {
-                    popularSeedsSkipped[whichRead]++;
+        }
+    } else {
+        //
+        // Alternate between the reads, so that if one of them turns out to be nearly unique we find out before
+        // doing all of the other one's (possibly expensive) lookups.  The read with few hits always runs its whole
+        // schedule: its lookups are cheap, and they're what find its other possible locations.
+        //
+        bool moreSeeds[NUM_READS_PER_PAIR] = {true, true};
+        while (moreSeeds[0] || moreSeeds[1]) {
+            for (unsigned whichRead = 0; whichRead < NUM_READS_PER_PAIR; whichRead++) {
+                if (moreSeeds[whichRead]) {
+                    moreSeeds[whichRead] = lookupNextSeed(whichRead, maxSeeds, &popularSeedsSkipped[whichRead]);
                 }
             }
 
-            //
-            // If we don't have enough seeds left to reach the end of the read, space out the seeds more-or-less evenly.
-            //
-            if ((maxSeeds - countOfHashTableLookups[whichRead] + 1) * (int)seedLen + nextSeedToTest < nPossibleSeeds) {
-                _ASSERT((nPossibleSeeds - nextSeedToTest - 1) / (maxSeeds - countOfHashTableLookups[whichRead] + 1) >= (int)seedLen);
-                nextSeedToTest += (nPossibleSeeds - nextSeedToTest - 1) / (maxSeeds - countOfHashTableLookups[whichRead] + 1);
-                _ASSERT(nextSeedToTest < nPossibleSeeds);   // We haven't run off the end of the read.
-            } else {
-                nextSeedToTest += seedLen;
+            unsigned readToStop;
+            if (moreSeeds[0] && moreSeeds[1] && canStopSeeding(popularSeedsSkipped, &readToStop)) {
+                moreSeeds[readToStop] = false;
+                seedLookupsSkipped += __max(0, __min(maxSeeds, seedSchedules[readToStop].nPossibleSeeds) - countOfHashTableLookups[readToStop]);
             }
-        } // while we need to lookup seeds for this read
-    } // for each read
+        }
+    }
 
     readWithMoreHits = totalHashTableHits[0][FORWARD] + totalHashTableHits[0][RC] > totalHashTableHits[1][FORWARD] + totalHashTableHits[1][RC] ? 0 : 1;
     readWithFewerHits = 1 - readWithMoreHits;
@@ -517,6 +544,7 @@ IntersectingPairedEndAligner::align(
                     WriteErrorMessage("Ran out of scoring candidate pool entries.  Perhaps trying with a larger value of -mcp will help.\n");
                     soft_exit(1);
                 }
+                scoringMateCandidates[whichSetPair].ensure(lowestFreeScoringMateCandidate[whichSetPair] + 1);
                 scoringMateCandidates[whichSetPair][lowestFreeScoringMateCandidate[whichSetPair]].init(
                                 lastGenomeLocationForReadWithMoreHits, bestPossibleScoreForReadWithMoreHits, lastSeedOffsetForReadWithMoreHits,
                                 doesGenomeIndexHaveAlts ? lastUnliftedGenomeLocationForReadWithMoreHits : lastGenomeLocationForReadWithMoreHits);
@@ -570,6 +598,7 @@ IntersectingPairedEndAligner::align(
                     WriteErrorMessage("Ran out of scoring candidate pool entries.  Perhaps rerunning with a larger value of -mcp will help.\n");
                     soft_exit(1);
                 }
+                scoringCandidatePool.ensure(lowestFreeScoringCandidatePoolEntry + 1);
 
                 //
                 // If we have noOrderedEvaluation set, just stick everything on list 0, regardless of what it really is.  This will cause us to
@@ -741,6 +770,7 @@ IntersectingPairedEndAligner::align(
                                 soft_exit(1);
                             }
 
+                            mergeAnchorPool.ensure(firstFreeMergeAnchor + 1);
                             mergeAnchor = &mergeAnchorPool[firstFreeMergeAnchor];
 
                             firstFreeMergeAnchor++;
@@ -779,8 +809,7 @@ IntersectingPairedEndAligner::align(
                                     //
                                     //
                                     if (*nSecondaryResults >= secondaryResultBufferSize) {
-                                        WriteErrorMessage("IntersectingPairedEndAligner::align(): out of secondary result buffer\n");
-                                        soft_exit(1);
+                                        return false;
                                     }
 
                                     PairedAlignmentResult *result = &secondaryResults[*nSecondaryResults];
@@ -818,8 +847,7 @@ IntersectingPairedEndAligner::align(
                                     // A secondary result to save.
                                     //
                                     if (*nSecondaryResults >= secondaryResultBufferSize) {
-                                        WriteErrorMessage("IntersectingPairedEndAligner::align(): out of secondary result buffer.  Read ID %.*s\n", read0->getIdLength(), read0->getId());
-                                        soft_exit(1);
+                                        return false;
                                     }
 
                                     PairedAlignmentResult *result = &secondaryResults[*nSecondaryResults];
@@ -996,6 +1024,8 @@ doneScoring:
         qsort(secondaryResults, *nSecondaryResults, sizeof(*secondaryResults), PairedAlignmentResult::compareByScore);
         *nSecondaryResults = maxSecondaryResultsToReturn;   // Just truncate it
     }
+
+    return true;
 }
 
     void
@@ -1011,6 +1041,12 @@ IntersectingPairedEndAligner::scoreLocation(
 {
     nLocationsScored++;
 
+    _uint64 cacheKey = readCacheKey[whichRead] ^ ((_uint64)direction << 1);   // Still odd, so never 0
+    if (lvResultCache.isEnabled() &&
+        lvResultCache.lookup(cacheKey, genomeLocation, seedOffset, scoreLimit, score, matchProbability, genomeLocationOffset)) {
+        return;
+    }
+
     Read *readToScore = reads[whichRead][direction];
     unsigned readDataLength = readToScore->getDataLength();
     GenomeDistance genomeDataLength = readDataLength + MAX_K; // Leave extra space in case the read has deletions
@@ -1084,13 +1120,227 @@ IntersectingPairedEndAligner::scoreLocation(
             *score = score1 + score2;
             _ASSERT(*score <= scoreLimit);
             // Map probabilities for substrings can be multiplied, but make sure to count seed too
-            *matchProbability = matchProb1 * matchProb2 * pow(1 - SNP_PROB, seedLen);
+            *matchProbability = matchProb1 * matchProb2 * seedMatchProbability;
         }
     }
 
     if (*score == -1) {
         *matchProbability = 0;
     }
+
+    if (lvResultCache.isEnabled()) {
+        lvResultCache.insert(cacheKey, genomeLocation, seedOffset, scoreLimit, *score, *matchProbability, -1 == *score ? 0 : *genomeLocationOffset);
+    }
+}
+
+    bool
+IntersectingPairedEndAligner::lookupNextSeed(unsigned whichRead, int maxSeeds, unsigned *popularSeedsSkipped)
+{
+    SeedSchedule *schedule = &seedSchedules[whichRead];
+    int &nextSeedToTest = schedule->nextSeedToTest;
+    unsigned &wrapCount = schedule->wrapCount;
+    bool *beginsDisjointHitSet = schedule->beginsDisjointHitSet;
+    const int nPossibleSeeds = schedule->nPossibleSeeds;
+
+    while (countOfHashTableLookups[whichRead] < nPossibleSeeds && countOfHashTableLookups[whichRead] < maxSeeds) {
+        if (nextSeedToTest >= nPossibleSeeds) {
+            wrapCount++;
+            beginsDisjointHitSet[FORWARD] = beginsDisjointHitSet[RC] = true;
+            if (wrapCount >= seedLen) {
+                //
+                // There aren't enough valid seeds in this read to reach our target.
+                //
+                return false;
+            }
+            nextSeedToTest = GetWrappedNextSeedToTest(seedLen, wrapCount);
+        }
+
+
+        while (nextSeedToTest < nPossibleSeeds && IsSeedUsed(whichRead, nextSeedToTest)) {
+            //
+            // This seed is already used.  Try the next one.
+            //
+            nextSeedToTest++;
+        }
+
+        if (nextSeedToTest >= nPossibleSeeds) {
+            //
+            // Unusable seeds have pushed us past the end of the read.  Go back around the loop so we wrap properly.
+            //
+            continue;
+        }
+
+        SetSeedUsed(whichRead, nextSeedToTest);
+
+        if (!Seed::DoesTextRepresentASeed(reads[whichRead][FORWARD]->getData() + nextSeedToTest, seedLen)) {
+            //
+            // It's got Ns in it, so just skip it.
+            //
+            nextSeedToTest++;
+            continue;
+        }
+
+        Seed seed(reads[whichRead][FORWARD]->getData() + nextSeedToTest, seedLen);
+        //
+        // Find all instances of this seed in the genome.
+        //
+        _int64 nHits[NUM_DIRECTIONS];
+        const GenomeLocation *hits[NUM_DIRECTIONS];
+        const unsigned *hits32[NUM_DIRECTIONS];
+        const GenomeLocation *unliftedHits[NUM_DIRECTIONS];
+        const unsigned *unliftedHits32[NUM_DIRECTIONS];
+
+        if (!doesGenomeIndexHaveAlts) {
+            if (doesGenomeIndexHave64BitLocations) {
+                index->lookupSeed(seed, &nHits[FORWARD], &hits[FORWARD], &nHits[RC], &hits[RC],
+                    hashTableHitSets[whichRead][FORWARD]->getNextSingletonLocation(), hashTableHitSets[whichRead][RC]->getNextSingletonLocation());
+            }
+            else {
+                index->lookupSeed32(seed, &nHits[FORWARD], &hits32[FORWARD], &nHits[RC], &hits32[RC]);
+            }
+        }
+        else {
+            if (doesGenomeIndexHave64BitLocations) {
+                index->lookupSeedAlt(seed, &nHits[FORWARD], &hits[FORWARD], &nHits[RC], &hits[RC], &unliftedHits[FORWARD], &unliftedHits[RC],
+                    hashTableHitSets[whichRead][FORWARD]->getNextSingletonLocation(), hashTableHitSets[whichRead][RC]->getNextSingletonLocation());
+            }
+            else {
+                index->lookupSeedAlt32(seed, &nHits[FORWARD], &hits32[FORWARD], &nHits[RC], &hits32[RC], &unliftedHits32[FORWARD], &unliftedHits32[RC]);
+            }
+        }
+
+        countOfHashTableLookups[whichRead]++;
+        for (Direction dir = FORWARD; dir < NUM_DIRECTIONS; dir++) {
+            int offset;
+            if (dir == FORWARD) {
+                offset = nextSeedToTest;
+            } else {
+                offset = readLen[whichRead] - seedLen - nextSeedToTest;
+            }
+            if (nHits[dir] < maxBigHits) {
+                totalHashTableHits[whichRead][dir] += nHits[dir];
+                if (!doesGenomeIndexHaveAlts) {
+                    if (doesGenomeIndexHave64BitLocations) {
+                        hashTableHitSets[whichRead][dir]->recordLookup(offset, nHits[dir], hits[dir], NULL, beginsDisjointHitSet[dir]);
+                    }
+                    else {
+                        hashTableHitSets[whichRead][dir]->recordLookup(offset, nHits[dir], hits32[dir], NULL, beginsDisjointHitSet[dir]);
+                    }
+                }
+                else {
+                    if (doesGenomeIndexHave64BitLocations) {
+                        hashTableHitSets[whichRead][dir]->recordLookup(offset, nHits[dir], hits[dir], unliftedHits[dir], beginsDisjointHitSet[dir]);
+                    }
+                    else {
+                        hashTableHitSets[whichRead][dir]->recordLookup(offset, nHits[dir], hits32[dir], unliftedHits32[dir], beginsDisjointHitSet[dir]);
+                    }
+                }
+                beginsDisjointHitSet[dir]= false;
+            } else {
+                (*popularSeedsSkipped)++;
+            }
+        }
+
+        //
+        // If we don't have enough seeds left to reach the end of the read, space out the seeds more-or-less evenly.
+        //
+        if ((maxSeeds - countOfHashTableLookups[whichRead] + 1) * (int)seedLen + nextSeedToTest < nPossibleSeeds) {
+            _ASSERT((nPossibleSeeds - nextSeedToTest - 1) / (maxSeeds - countOfHashTableLookups[whichRead] + 1) >= (int)seedLen);
+            nextSeedToTest += (nPossibleSeeds - nextSeedToTest - 1) / (maxSeeds - countOfHashTableLookups[whichRead] + 1);
+            _ASSERT(nextSeedToTest < nPossibleSeeds);   // We haven't run off the end of the read.
+        } else {
+            nextSeedToTest += seedLen;
+        }
+
+        return true;
+    } // while we need to lookup seeds for this read
+
+    return false;
+}
+
+    bool
+IntersectingPairedEndAligner::canStopSeeding(const unsigned *popularSeedsSkipped, unsigned *o_readToStop)
+{
+    if (countOfHashTableLookups[0] < MinSeedsBeforeStopping || countOfHashTableLookups[1] < MinSeedsBeforeStopping) {
+        return false;
+    }
+
+    //
+    // The bound below needs each read's lookups so far to be of disjoint seeds that all went into the hit sets, so only
+    // decide during the first pass through the reads, and not after skipping popular seeds.
+    //
+    for (unsigned whichRead = 0; whichRead < NUM_READS_PER_PAIR; whichRead++) {
+        if (0 != seedSchedules[whichRead].wrapCount || 0 != popularSeedsSkipped[whichRead]) {
+            return false;
+        }
+    }
+
+    _int64 hits[NUM_READS_PER_PAIR];
+    for (unsigned whichRead = 0; whichRead < NUM_READS_PER_PAIR; whichRead++) {
+        hits[whichRead] = totalHashTableHits[whichRead][FORWARD] + totalHashTableHits[whichRead][RC];
+    }
+
+    unsigned fewer = hits[0] <= hits[1] ? 0 : 1;
+    unsigned more = 1 - fewer;
+
+    //
+    // The read with fewer hits needs to be down to about one location (no more than one hit per lookup), and the other
+    // one needs to have a lot more.  Otherwise there's little to save.
+    //
+    if (0 == hits[fewer] || hits[fewer] > countOfHashTableLookups[fewer] || hits[more] < ManyHitsFactor * hits[fewer]) {
+        return false;
+    }
+
+    //
+    // A location that none of a read's seeds have hit has an edit in each of them, so any pair that the skipped lookups
+    // could add has a score of at least the smaller number of lookups.  Stop only if there's already a pair that beats
+    // that by more than extraSearchDepth, so the skipped pairs couldn't be the best one or count toward its MAPQ.  The
+    // read with fewer hits keeps going, but its new locations could only pair with hits already in the other set.
+    //
+    int scoreLimit = (int)__min(countOfHashTableLookups[0], countOfHashTableLookups[1]) - 1 - (int)extraSearchDepth;
+    if (scoreLimit < 0) {
+        return false;
+    }
+
+    //
+    // Set pairs are read0 FORWARD with read1 RC and read0 RC with read1 FORWARD, so the mates are in the opposite direction.
+    //
+    for (Direction dir = FORWARD; dir < NUM_DIRECTIONS; dir++) {
+        Direction mateDir = OppositeDirection(dir);
+        unsigned lookup = 0;
+        _int64 hit = 0;
+        GenomeLocation location;
+        unsigned seedOffset;
+        while (hashTableHitSets[fewer][dir]->getNextHit(&lookup, &hit, &location, &seedOffset)) {
+            unsigned score;
+            double matchProbability;
+            int genomeLocationOffset;
+            scoreLocation(fewer, dir, location, seedOffset, scoreLimit, &score, &matchProbability, &genomeLocationOffset);
+            if (-1 == score) {
+                continue;
+            }
+
+            unsigned mateLookup = 0;
+            _int64 mateHit = 0;
+            GenomeLocation mateLocation;
+            unsigned mateSeedOffset;
+            while (hashTableHitSets[more][mateDir]->getNextHitWithin(GenomeLocationAsInt64(location) - maxSpacing, GenomeLocationAsInt64(location) + maxSpacing,
+                    &mateLookup, &mateHit, &mateLocation, &mateSeedOffset)) {
+                if (genomeLocationIsWithin(mateLocation, location, minSpacing)) {
+                    continue;
+                }
+
+                unsigned mateScore;
+                scoreLocation(more, mateDir, mateLocation, mateSeedOffset, scoreLimit - score, &mateScore, &matchProbability, &genomeLocationOffset);
+                if (-1 != mateScore) {
+                    *o_readToStop = more;
+                    return true;
+                }
+            }
+        }
+    }
+
+    return false;
 }
 
     void
@@ -1101,13 +1351,11 @@ IntersectingPairedEndAligner::scoreLocation(
     doesGenomeIndexHave64BitLocations = doesGenomeIndexHave64BitLocations_;
     nLookupsUsed = 0;
     if (doesGenomeIndexHave64BitLocations) {
-        lookups64 = (HashTableLookup<GenomeLocation> *)allocator->allocate(sizeof(HashTableLookup<GenomeLocation>) * maxSeeds);
-        lookups32 = NULL;
+        lookups64.reserve(allocator, maxSeeds);
     } else {
-        lookups32 = (HashTableLookup<unsigned> *)allocator->allocate(sizeof(HashTableLookup<unsigned>) * maxSeeds);
-        lookups64 = NULL;
+        lookups32.reserve(allocator, maxSeeds);
     }
-    disjointHitSets = (DisjointHitSet *)allocator->allocate(sizeof(DisjointHitSet) * maxSeeds);
+    disjointHitSets.reserve(allocator, maxSeeds);
  }
     void
 IntersectingPairedEndAligner::HashTableHitSet::init()
@@ -1138,6 +1386,7 @@ IntersectingPairedEndAligner::HashTableHitSet::recordLookup(unsigned seedOffset,
     if (beginsDisjointHitSet) {                                                                                                                             \
         currentDisjointHitSet++;                                                                                                                            \
         _ASSERT(currentDisjointHitSet < (int)maxSeeds);                                                                                                     \
+        disjointHitSets.ensure(currentDisjointHitSet + 1);                                                                                                  \
         disjointHitSets[currentDisjointHitSet].countOfExhaustedHits = 0;                                                                                    \
     }                                                                                                                                                       \
                                                                                                                                                             \
@@ -1145,6 +1394,7 @@ IntersectingPairedEndAligner::HashTableHitSet::recordLookup(unsigned seedOffset,
         disjointHitSets[currentDisjointHitSet].countOfExhaustedHits++;                                                                                      \
     } else {                                                                                                                                                \
         _ASSERT(currentDisjointHitSet != -1);    /* Essentially that beginsDisjointHitSet is set for the first recordLookup call */                         \
+        lookups.ensure(nLookupsUsed + 1);                                                                                                                   \
         lookups[nLookupsUsed].currentHitForIntersection = 0;                                                                                                \
         lookups[nLookupsUsed].hits = hits;                                                                                                                  \
         lookups[nLookupsUsed].unliftedHits = unliftedHits;                                                                                                  \
@@ -1222,6 +1472,76 @@ IntersectingPairedEndAligner::HashTableHitSet::computeBestPossibleScoreForCurren
 	return bestPossibleScoreSoFar;
 }
 
+    bool
+IntersectingPairedEndAligner::HashTableHitSet::getNextHit(unsigned *io_lookup, _int64 *io_hit, GenomeLocation *o_location, unsigned *o_seedOffset)
+{
+#define LOOP(lookups)                                                                                                                       \
+    while (*io_lookup < nLookupsUsed) {                                                                                                     \
+        if (*io_hit < lookups[*io_lookup].nHits) {                                                                                          \
+            *o_seedOffset = lookups[*io_lookup].seedOffset;                                                                                 \
+            *o_location = GenomeLocationAsInt64(lookups[*io_lookup].hits[*io_hit]) - *o_seedOffset;                                         \
+            (*io_hit)++;                                                                                                                    \
+            return true;                                                                                                                    \
+        }                                                                                                                                   \
+        (*io_lookup)++;                                                                                                                     \
+        *io_hit = 0;                                                                                                                        \
+    }
+
+    if (doesGenomeIndexHave64BitLocations) {
+        LOOP(lookups64);
+    } else {
+        LOOP(lookups32);
+    }
+
+#undef LOOP
+
+    return false;
+}
+
+    bool
+IntersectingPairedEndAligner::HashTableHitSet::getNextHitWithin(_int64 minGenomeLocation, _int64 maxGenomeLocation, unsigned *io_lookup, _int64 *io_hit,
+    GenomeLocation *o_location, unsigned *o_seedOffset)
+{
+    //
+    // The hits for each lookup are sorted from largest to smallest, so binary search for the first one that's not past
+    // the end of the range, and then walk down from there until we leave it.
+    //
+#define LOOP(lookups)                                                                                                                       \
+    while (*io_lookup < nLookupsUsed) {                                                                                                     \
+        _int64 minHit = minGenomeLocation + lookups[*io_lookup].seedOffset;                                                                 \
+        _int64 maxHit = maxGenomeLocation + lookups[*io_lookup].seedOffset;                                                                 \
+        if (0 == *io_hit) {                                                                                                                 \
+            _int64 high = lookups[*io_lookup].nHits;                                                                                        \
+            while (*io_hit < high) {                                                                                                        \
+                _int64 probe = (*io_hit + high) / 2;                                                                                        \
+                if (GenomeLocationAsInt64(lookups[*io_lookup].hits[probe]) > maxHit) {                                                      \
+                    *io_hit = probe + 1;                                                                                                    \
+                } else {                                                                                                                    \
+                    high = probe;                                                                                                           \
+                }                                                                                                                           \
+            }                                                                                                                               \
+        }                                                                                                                                   \
+        if (*io_hit < lookups[*io_lookup].nHits && GenomeLocationAsInt64(lookups[*io_lookup].hits[*io_hit]) >= minHit) {                    \
+            *o_seedOffset = lookups[*io_lookup].seedOffset;                                                                                 \
+            *o_location = GenomeLocationAsInt64(lookups[*io_lookup].hits[*io_hit]) - *o_seedOffset;                                         \
+            (*io_hit)++;                                                                                                                    \
+            return true;                                                                                                                    \
+        }                                                                                                                                   \
+        (*io_lookup)++;                                                                                                                     \
+        *io_hit = 0;                                                                                                                        \
+    }
+
+    if (doesGenomeIndexHave64BitLocations) {
+        LOOP(lookups64);
+    } else {
+        LOOP(lookups32);
+    }
+
+#undef LOOP
+
+    return false;
+}
+
 	bool
         IntersectingPairedEndAligner::HashTableHitSet::getNextHitLessThanOrEqualTo(GenomeLocation maxGenomeLocationToFind, GenomeLocation *actualGenomeLocationFound, unsigned *seedOffsetFound, GenomeLocation *actualUnliftedGenomeLocationFound)
 {
@@ -27,6 +27,7 @@ Revision History:
 #include "BigAlloc.h"
 #include "directions.h"
 #include "LandauVishkin.h"
+#include "LVResultCache.h"
 #include "FixedSizeMap.h"
 
 const unsigned DEFAULT_INTERSECTING_ALIGNER_MAX_HITS = 2000;
@@ -76,10 +77,28 @@ public:
         landauVishkin = landauVishkin_;
         reverseLandauVishkin = reverseLandauVishkin_;
     }
+
+    //
+    // Turn on the LV result cache (see LVResultCache.h).  The caller has to leave room for it in the allocator.
+    //
+    void setLVResultCache(BigAllocator *allocator, unsigned nEntries)
+    {
+        lvResultCache.init(allocator, nEntries);
+    }
+
+    //
+    // Turn on the adaptive seed schedule, which alternates seed lookups between the two reads and stops looking up
+    // seeds for a read with many hits once the other read is down to a few locations and a pair has already been
+    // found that's better than anything the skipped seeds could turn up (see canStopSeeding).  Off unless asked for.
+    //
+    void setAdaptiveSeedSchedule(bool enabled)
+    {
+        adaptiveSeedSchedule = enabled;
+    }
     
     virtual ~IntersectingPairedEndAligner();
     
-    virtual void align(
+    virtual bool align(
         Read                  *read0,
         Read                  *read1,
         PairedAlignmentResult *result,
@@ -108,6 +127,23 @@ public:
          return nLocationsScored;
      }
 
+    _int64 getLVCacheLookups() const {return lvResultCache.getLookups();}
+    _int64 getLVCacheHits() const {return lvResultCache.getHits();}
+    _int64 getSeedLookupsSkipped() const {return seedLookupsSkipped;}
+
+    //
+    // Cross-pair seeding pipeline.  The caller looks a few pairs ahead in its input and steps each upcoming pair
+    // through two stages before it gets to align(): beginPrefetch() picks the pair's first-pass seeds and prefetches
+    // their hash table entries, and then (about one pair ahead of align()) continuePrefetch() does the lookups, which
+    // should now hit in cache, and prefetches the genome at the hits.  Pairs in flight are kept in a small FIFO of
+    // resumable states, so the DRAM latency for pair i+1 overlaps the computation on pair i.  This only warms the
+    // cache: align() does all of its own work, so results are the same with or without it.
+    //
+    static const int MaxPrefetchDepth = 8;
+
+    void beginPrefetch(Read *read0, Read *read1);
+    void continuePrefetch(Read *read0, Read *read1);
+
 
 private:
 
@@ -133,6 +169,7 @@ private:
     unsigned        minSpacing;
     unsigned        maxSpacing;
     unsigned        seedLen;
+    double          seedMatchProbability;   // The chance that seedLen bases have no mutations, which the seed hit doesn't score
     bool            doesGenomeIndexHave64BitLocations;
     bool            doesGenomeIndexHaveAlts;
     _int64          nLocationsScored;
@@ -235,7 +272,17 @@ private:
         //
         bool    getFirstHit(GenomeLocation *genomeLocation, unsigned *seedOffsetFound, GenomeLocation *unliftedGenomeLocation);
 
-		unsigned computeBestPossibleScoreForCurrentHit();
+        unsigned computeBestPossibleScoreForCurrentHit();
+
+        //
+        // Walk the hits in the set (all of them, or just those whose read location is in a range), returning the
+        // location of the start of the read and the seed offset.  *io_lookup and *io_hit start at 0 and are moved past
+        // each hit returned.  Unlike the calls above, these don't disturb the iteration, so they can be used while
+        // lookups are still being recorded.
+        //
+        bool    getNextHit(unsigned *io_lookup, _int64 *io_hit, GenomeLocation *o_location, unsigned *o_seedOffset);
+        bool    getNextHitWithin(_int64 minGenomeLocation, _int64 maxGenomeLocation, unsigned *io_lookup, _int64 *io_hit,
+                    GenomeLocation *o_location, unsigned *o_seedOffset);
 
         //
         // This is bit of storage that the 64 bit lookup needs in order to extend singleton hits into 64 bits, since they may be
@@ -243,6 +290,7 @@ private:
         //
         GenomeLocation *getNextSingletonLocation()
         {
+            lookups64.ensure(nLookupsUsed + 1);
             return &lookups64[nLookupsUsed].singletonGenomeLocation[1];
         }
 
@@ -254,9 +302,12 @@ private:
         };
 
         int                                 currentDisjointHitSet;
-        DisjointHitSet  *                   disjointHitSets;
-        HashTableLookup<unsigned> *         lookups32;
-        HashTableLookup<GenomeLocation> *   lookups64;
+        //
+        // These are sized for maxSeeds, but most reads use only a few lookups, so they're committed as they're used.
+        //
+        GrowingBigArray<DisjointHitSet>                     disjointHitSets;
+        GrowingBigArray<HashTableLookup<unsigned> >         lookups32;
+        GrowingBigArray<HashTableLookup<GenomeLocation> >   lookups64;
         HashTableLookup<unsigned>           lookupListHead32[1];
         HashTableLookup<GenomeLocation>     lookupListHead64[1];
         unsigned                            maxSeeds;
@@ -313,22 +364,79 @@ private:
 
     char *reversedRead[NUM_READS_PER_PAIR][NUM_DIRECTIONS]; // The reversed data for each read for forward and RC.  This is used in the backwards LV
 
+    //
+    // Scores of recently scored (read, location) pairs, so repetitive loci that many pairs (or one pair, many times)
+    // come back to don't need the LVs rerun.  readCacheKey identifies the read's content, and the direction is folded in
+    // when it's used.
+    //
+    LVResultCache lvResultCache;
+    _uint64 readCacheKey[NUM_READS_PER_PAIR];
+
     LandauVishkin<> *landauVishkin;
     LandauVishkin<-1> *reverseLandauVishkin;
 
     char rcTranslationTable[256];
-    unsigned nTable[256];
 
-    BYTE *seedUsed;
+    BYTE *seedUsed[NUM_READS_PER_PAIR];
 
-    inline bool IsSeedUsed(_int64 indexInRead) const {
-        return (seedUsed[indexInRead / 8] & (1 << (indexInRead % 8))) != 0;
+    inline bool IsSeedUsed(unsigned whichRead, _int64 indexInRead) const {
+        return (seedUsed[whichRead][indexInRead / 8] & (1 << (indexInRead % 8))) != 0;
     }
 
-    inline void SetSeedUsed(_int64 indexInRead) {
-        seedUsed[indexInRead / 8] |= (1 << (indexInRead % 8));
+    inline void SetSeedUsed(unsigned whichRead, _int64 indexInRead) {
+        seedUsed[whichRead][indexInRead / 8] |= (1 << (indexInRead % 8));
     }
 
+    //
+    // Where each read is in its seed schedule in phase 1 of align().  The reads' lookups can be interleaved, so this
+    // is kept per read rather than in locals.
+    //
+    struct SeedSchedule {
+        int         nextSeedToTest;
+        unsigned    wrapCount;
+        int         nPossibleSeeds;
+        bool        beginsDisjointHitSet[NUM_DIRECTIONS];
+    };
+
+    SeedSchedule    seedSchedules[NUM_READS_PER_PAIR];
+
+    //
+    // Do the read's next hash table lookup and record it in the hit sets.  Returns false if the read has no more seeds
+    // to look up.
+    //
+    bool lookupNextSeed(unsigned whichRead, int maxSeeds, unsigned *popularSeedsSkipped);
+
+    //
+    // The adaptive seed schedule.  It's only worth deciding once both reads have had a few lookups, and only stops a read
+    // with many times the hits of the other one.
+    //
+    static const int MinSeedsBeforeStopping = 3;
+    static const int ManyHitsFactor = 8;
+
+    bool            adaptiveSeedSchedule;
+    _int64          seedLookupsSkipped;
+
+    bool canStopSeeding(const unsigned *popularSeedsSkipped, unsigned *o_readToStop);
+
+    //
+    // A pair that's in the prefetch pipeline, between beginPrefetch() and continuePrefetch().
+    //
+    static const int MaxPrefetchSeedsPerRead = 32;
+    static const int MaxHitsToPrefetch = 4;    // Don't chase the genome for popular seeds; align() won't look at most of them
+
+    struct PrefetchState {
+        Read       *read[NUM_READS_PER_PAIR];
+        int         nSeeds[NUM_READS_PER_PAIR];
+        Seed        seeds[NUM_READS_PER_PAIR][MaxPrefetchSeedsPerRead];
+        unsigned    seedOffsets[NUM_READS_PER_PAIR][MaxPrefetchSeedsPerRead];
+    };
+
+    PrefetchState   prefetchStates[MaxPrefetchDepth];
+    int             firstPrefetchState;     // The oldest pair in flight
+    int             nPrefetchStates;
+
+    void prefetchGenomeAtHits(_int64 nHits, const GenomeLocation *hits, const unsigned *hits32, unsigned offsetInRead);
+
     //
     // "Local probability" means the probability that each end is correct given that the pair itself is correct.
     // Consider the example where there's exactly one decent match for one read, but the other one has several
@@ -458,9 +566,10 @@ private:
     // A pool of scoring candidates.  For each alignment call, we free them all by resetting lowestFreeScoringCandidatePoolEntry to 0,
     // and then fill in the content when they're initialized.  This means that for alignments with few candidates we'll be using the same
     // entries over and over, so they're likely to be in the cache.  We have maxK * maxSeeds * 2 of these in the pool, so we can't possibly run
-    // out.  We rely on their being allocated in descending genome order within a set pair.
+    // out.  We rely on their being allocated in descending genome order within a set pair.  The pool is only reserved up front, and
+    // committed as it's used, since all but the most repetitive reads use a tiny fraction of it.  The same goes for the mates and anchors.
     //
-    ScoringCandidate *scoringCandidatePool;
+    GrowingBigArray<ScoringCandidate> scoringCandidatePool;
     unsigned scoringCandidatePoolSize;
     unsigned lowestFreeScoringCandidatePoolEntry;
 
@@ -473,13 +582,13 @@ private:
     //
     // The scoring mates.  The each set scoringCandidatePoolSize / 2.
     //
-    ScoringMateCandidate * scoringMateCandidates[NUM_SET_PAIRS];
+    GrowingBigArray<ScoringMateCandidate> scoringMateCandidates[NUM_SET_PAIRS];
     unsigned lowestFreeScoringMateCandidate[NUM_SET_PAIRS];
 
     //
     // Merge anchors.  Again, we allocate an upper bound number of them, which is the same as the number of scoring candidates.
     //
-    MergeAnchor *mergeAnchorPool;
+    GrowingBigArray<MergeAnchor> mergeAnchorPool;
     unsigned firstFreeMergeAnchor;
     unsigned mergeAnchorPoolSize;
 
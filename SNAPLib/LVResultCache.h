@@ -0,0 +1,150 @@
+/*++
+
+Module Name:
+
+    LVResultCache.h
+
+Abstract:
+
+    A small per-thread cache of paired-end location scores, so that scoring the same read at the same place
+    in the genome again doesn't redo the Landau-Vishkin computations or touch the genome.
+
+Environment:
+
+    User mode service.
+
+Revision History:
+
+--*/
+
+#pragma once
+
+#include "Compat.h"
+#include "BigAlloc.h"
+#include "Genome.h"
+#include "HashTable.h"
+
+//
+// The cache is keyed on the content of the read (data and quality, reduced to a 64 bit hash), the direction it's
+// being scored in, where in the genome and which seed offset it's anchored at.  That's everything the result of
+// IntersectingPairedEndAligner::scoreLocation depends on other than the score limit.  The score limit is handled
+// by noting that LV finds the cheapest alignment if there's one within the limit, so a score of s found with any
+// limit is the answer for every limit >= s, and a miss (-1) at limit L is the answer for every limit <= L.
+//
+// It's direct mapped and just overwrites on collision.  Repetitive loci (satellites, centromeres, duplicated
+// reads) keep coming back to the same entries, which is where it helps; everything else just falls through to LV.
+//
+class LVResultCache
+{
+public:
+
+    static const unsigned DefaultEntries = 4096;    // suggested size for -lvc: 32 bytes each, so 128KB, which fits in a per-core L2
+
+    LVResultCache() : entries(NULL), mask(0), nLookups(0), nHits(0) {}
+
+    static size_t getBigAllocatorReservation(unsigned nEntries) {
+        return sizeof(Entry) * nEntries;
+    }
+
+    //
+    // nEntries must be 0 (which turns the cache off) or a power of 2.
+    //
+    void init(BigAllocator *allocator, unsigned nEntries) {
+        _ASSERT(0 == (nEntries & (nEntries - 1)));
+        if (0 == nEntries) {
+            entries = NULL;
+            mask = 0;
+            return;
+        }
+        entries = (Entry *)allocator->allocate(sizeof(Entry) * nEntries);
+        memset(entries, 0, sizeof(Entry) * nEntries);   // readKey 0 is never used, so these are all empty
+        mask = nEntries - 1;
+    }
+
+    bool isEnabled() const {
+        return NULL != entries;
+    }
+
+    //
+    // Reduce a read to the part of the cache key that identifies it.  Never returns 0.
+    //
+    static _uint64 hashRead(const char *data, const char *quality, unsigned length) {
+        _uint64 hash = length;
+        unsigned i;
+        for (i = 0; i + 8 <= length; i += 8) {
+            _uint64 dataWord, qualityWord;
+            memcpy(&dataWord, data + i, 8);
+            memcpy(&qualityWord, quality + i, 8);
+            hash = SNAPHashTable::hash(hash ^ dataWord) ^ qualityWord;
+        }
+        _uint64 dataTail = 0, qualityTail = 0;
+        memcpy(&dataTail, data + i, length - i);
+        memcpy(&qualityTail, quality + i, length - i);
+        hash = SNAPHashTable::hash(SNAPHashTable::hash(hash ^ dataTail) ^ qualityTail);
+
+        return hash | 1;
+    }
+
+    inline bool lookup(_uint64 readKey, GenomeLocation location, unsigned seedOffset, unsigned scoreLimit,
+                       unsigned *score, double *matchProbability, int *genomeLocationOffset) {
+        nLookups++;
+        Entry *entry = &entries[slot(readKey, location, seedOffset)];
+        if (entry->readKey != readKey || entry->location != GenomeLocationAsInt64(location) || entry->seedOffset != seedOffset) {
+            return false;
+        }
+
+        if (-1 == entry->score) {
+            if (scoreLimit > entry->scoreLimit) {
+                return false;   // It might be found with the bigger limit
+            }
+            *score = -1;
+            *matchProbability = 0;
+        } else if ((unsigned)entry->score > scoreLimit) {
+            *score = -1;        // The best there is doesn't fit under this limit
+            *matchProbability = 0;
+        } else {
+            *score = entry->score;
+            *matchProbability = entry->matchProbability;
+            *genomeLocationOffset = entry->genomeLocationOffset;
+        }
+
+        nHits++;
+        return true;
+    }
+
+    inline void insert(_uint64 readKey, GenomeLocation location, unsigned seedOffset, unsigned scoreLimit,
+                       unsigned score, double matchProbability, int genomeLocationOffset) {
+        Entry *entry = &entries[slot(readKey, location, seedOffset)];
+        entry->readKey = readKey;
+        entry->location = GenomeLocationAsInt64(location);
+        entry->seedOffset = seedOffset;
+        entry->scoreLimit = (_uint8)__min(scoreLimit, 0xff);
+        entry->score = (signed char)(int)score;
+        entry->genomeLocationOffset = (signed char)genomeLocationOffset;
+        entry->matchProbability = matchProbability;
+    }
+
+    _int64 getLookups() const {return nLookups;}
+    _int64 getHits() const {return nHits;}
+
+private:
+
+    struct Entry {
+        _uint64     readKey;
+        _int64      location;
+        unsigned    seedOffset;
+        _uint8      scoreLimit;             // Clamped, which only makes a cached -1 more conservative
+        signed char score;                  // Scores and offsets are bounded by MAX_K
+        signed char genomeLocationOffset;
+        double      matchProbability;
+    };
+
+    inline unsigned slot(_uint64 readKey, GenomeLocation location, unsigned seedOffset) const {
+        return (unsigned)(SNAPHashTable::hash(readKey ^ ((_uint64)GenomeLocationAsInt64(location) << 16) ^ seedOffset) & mask);
+    }
+
+    Entry      *entries;
+    unsigned    mask;
+    _int64      nLookups;
+    _int64      nHits;
+};
@@ -0,0 +1,436 @@
+/*++
+
+Module Name:
+
+    OrderedDataWriter.cpp
+
+Abstract:
+
+    File writer that puts the output of multiple threads back into input order.
+
+    Each thread's output is held per input unit (a queue element or file range, as numbered by
+    the read supplier) until all earlier units have been written, and is then copied into a single
+    shared writer, so that the file is the same as if one thread had written it.
+
+Environment:
+
+    User mode service.
+
+    Thread safe.
+
+--*/
+
+#include "stdafx.h"
+#include "Compat.h"
+#include "DataWriter.h"
+#include "VariableSizeVector.h"
+#include "exit.h"
+#include "Error.h"
+
+using std::max;
+using std::pair;
+
+// one chunk of data written by SimpleReadWriter with a single advance
+struct OrderedRecord
+{
+    char*           data;
+    GenomeDistance  bytes;
+    GenomeLocation  location;
+    bool            groupStart; // first record written into a buffer from getBuffer; group must stay in one batch
+};
+
+// output for one input unit
+struct OrderedUnit
+{
+    OrderedUnit() : sequence(-1), used(0) {}
+
+    ~OrderedUnit()
+    {
+        for (int i = 0; i < buffers.size(); i++) {
+            delete [] buffers[i];
+        }
+    }
+
+    _int64                              sequence;
+    VariableSizeVector<char*>           buffers;    // each of bufferSize bytes
+    size_t                              used;       // in last buffer
+    VariableSizeVector<OrderedRecord>   records;
+};
+
+class OrderedDataWriterSupplier;
+
+class OrderedDataWriter : public DataWriter, public InputOrderListener
+{
+public:
+    OrderedDataWriter(OrderedDataWriterSupplier* i_supplier);
+
+    virtual ~OrderedDataWriter();
+
+    virtual void inHeader(bool flag);
+
+    virtual bool getBuffer(char** o_buffer, size_t* o_size);
+
+    virtual void advance(GenomeDistance bytes, GenomeLocation location = 0);
+
+    virtual bool getBatch(int relative, char** o_buffer, size_t* o_size = NULL, size_t* o_used = NULL, size_t* o_offset = NULL, size_t* o_logicalUsed = 0, size_t* o_logicalOffset = NULL);
+
+    virtual bool nextBatch();
+
+    virtual void close();
+
+    virtual InputOrderListener* getInputOrderListener()
+    { return this; }
+
+    virtual void beginInputUnit(_int64 sequence);
+
+private:
+    OrderedDataWriterSupplier*  supplier;
+    OrderedUnit*                unit;       // NULL until the first input unit; until then data goes directly to the file (i.e. the header)
+    bool                        groupStart;
+    bool                        directPending;
+    SingleWaiterObject          ready;      // signalled when our unit may start
+
+    friend class OrderedDataWriterSupplier;
+};
+
+class OrderedDataWriterSupplier : public DataWriterSupplier
+{
+public:
+    OrderedDataWriterSupplier(DataWriterSupplier* i_inner, size_t i_bufferSize, int i_window);
+
+    virtual ~OrderedDataWriterSupplier();
+
+    virtual DataWriter* getWriter();
+
+    virtual void close();
+
+private:
+    friend class OrderedDataWriter;
+
+    // waits until sequence is within the window, then returns an empty unit for it
+    OrderedUnit* beginUnit(_int64 sequence, OrderedDataWriter* writer);
+
+    // unit is complete; writes it and any following complete units if it's next in order
+    void completeUnit(OrderedUnit* unit);
+
+    // copy unit into the shared writer, keeping groups in a single batch
+    void emit(OrderedUnit* unit);
+
+    DataWriterSupplier*                 inner;
+    DataWriter*                         writer;     // single shared writer for inner
+    const size_t                        bufferSize;
+    const int                           window;
+
+    ExclusiveLock                       lock;       // protects everything below
+    _int64                              nextToEmit;
+    OrderedUnit**                       pending;    // complete units waiting for earlier ones, indexed by sequence % window
+    int                                 nPending;
+    bool                                draining;   // a thread is copying units into the shared writer
+    VariableSizeVector<OrderedUnit*>    freeUnits;
+    VariableSizeVector< pair<_int64,OrderedDataWriter*> > waiters;
+
+    // stats
+    _int64                              stallTime;
+    int                                 maxPending;
+};
+
+OrderedDataWriter::OrderedDataWriter(
+    OrderedDataWriterSupplier* i_supplier)
+    :
+    DataWriter(NULL),
+    supplier(i_supplier),
+    unit(NULL),
+    groupStart(true),
+    directPending(false)
+{
+    CreateSingleWaiterObject(&ready);
+}
+
+OrderedDataWriter::~OrderedDataWriter()
+{
+    _ASSERT(unit == NULL);
+    DestroySingleWaiterObject(&ready);
+}
+
+    void
+OrderedDataWriter::inHeader(
+    bool flag)
+{
+    if (unit == NULL) {
+        supplier->writer->inHeader(flag);
+    }
+}
+
+    bool
+OrderedDataWriter::getBuffer(
+    char** o_buffer,
+    size_t* o_size)
+{
+    if (unit == NULL) {
+        directPending = true;
+        return supplier->writer->getBuffer(o_buffer, o_size);
+    }
+    if (unit->buffers.size() == 0) {
+        unit->buffers.push_back(new char[supplier->bufferSize]);
+        unit->used = 0;
+    }
+    *o_buffer = unit->buffers[unit->buffers.size() - 1] + unit->used;
+    *o_size = supplier->bufferSize - unit->used;
+    groupStart = true;
+    return true;
+}
+
+    void
+OrderedDataWriter::advance(
+    GenomeDistance bytes,
+    GenomeLocation location)
+{
+    if (unit == NULL) {
+        supplier->writer->advance(bytes, location);
+        return;
+    }
+    _ASSERT(unit->buffers.size() > 0 && unit->used + bytes <= supplier->bufferSize);
+    OrderedRecord record;
+    record.data = unit->buffers[unit->buffers.size() - 1] + unit->used;
+    record.bytes = bytes;
+    record.location = location;
+    record.groupStart = groupStart;
+    unit->records.push_back(record);
+    unit->used += bytes;
+    groupStart = false;
+}
+
+    bool
+OrderedDataWriter::getBatch(
+    int relative,
+    char** o_buffer,
+    size_t* o_size,
+    size_t* o_used,
+    size_t* o_offset,
+    size_t* o_logicalUsed,
+    size_t* o_logicalOffset)
+{
+    // no filters on this writer, so nobody should be looking at batches
+    _ASSERT(false);
+    return false;
+}
+
+    bool
+OrderedDataWriter::nextBatch()
+{
+    if (unit == NULL) {
+        directPending = false;
+        return supplier->writer->nextBatch();
+    }
+    // caller wants a fresh buffer; batch boundaries in the file are decided at emit time
+    unit->buffers.push_back(new char[supplier->bufferSize]);
+    unit->used = 0;
+    return true;
+}
+
+    void
+OrderedDataWriter::close()
+{
+    if (unit != NULL) {
+        supplier->completeUnit(unit);
+        unit = NULL;
+    } else if (directPending) {
+        supplier->writer->nextBatch();
+        directPending = false;
+    }
+}
+
+    void
+OrderedDataWriter::beginInputUnit(
+    _int64 sequence)
+{
+    // finish the previous unit first, it may be the one everyone else is waiting for
+    if (unit != NULL) {
+        supplier->completeUnit(unit);
+    }
+    unit = supplier->beginUnit(sequence, this);
+}
+
+OrderedDataWriterSupplier::OrderedDataWriterSupplier(
+    DataWriterSupplier* i_inner,
+    size_t i_bufferSize,
+    int i_window)
+    :
+    inner(i_inner),
+    bufferSize(i_bufferSize),
+    window(i_window),
+    nextToEmit(0),
+    nPending(0),
+    draining(false),
+    stallTime(0),
+    maxPending(0)
+{
+    writer = inner->getWriter();
+    pending = new OrderedUnit*[window];
+    memset(pending, 0, window * sizeof(OrderedUnit*));
+    InitializeExclusiveLock(&lock);
+}
+
+OrderedDataWriterSupplier::~OrderedDataWriterSupplier()
+{
+    for (int i = 0; i < freeUnits.size(); i++) {
+        delete freeUnits[i];
+    }
+    delete [] pending;
+    delete inner;
+    DestroyExclusiveLock(&lock);
+}
+
+    DataWriter*
+OrderedDataWriterSupplier::getWriter()
+{
+    return new OrderedDataWriter(this);
+}
+
+    void
+OrderedDataWriterSupplier::close()
+{
+    // all threads are done, so every unit handed out has been completed and written
+    _ASSERT(! draining && waiters.size() == 0);
+    if (nPending != 0) {
+        WriteErrorMessage("OrderedDataWriterSupplier: input unit %lld never completed, %d later units left unwritten\n",
+            nextToEmit, nPending);
+        soft_exit(1);
+    }
+#ifdef  _DEBUG
+    WriteErrorMessage("ordered output: %lld units, max %d pending, %lld ms stalled\n", nextToEmit, maxPending, stallTime);
+#endif
+    writer->close();
+    delete writer;
+    writer = NULL;
+    inner->close();
+}
+
+    OrderedUnit*
+OrderedDataWriterSupplier::beginUnit(
+    _int64 sequence,
+    OrderedDataWriter* unitWriter)
+{
+    AcquireExclusiveLock(&lock);
+    if (sequence >= nextToEmit + window) {
+        //
+        // Too far ahead of the oldest unit still being worked on; wait for it to be written rather than
+        // buffering without limit.  The thread with that unit is never waiting here itself.
+        //
+        _int64 start = timeInMillis();
+        ResetSingleWaiterObject(&unitWriter->ready);
+        waiters.push_back(pair<_int64,OrderedDataWriter*>(sequence, unitWriter));
+        ReleaseExclusiveLock(&lock);
+        WaitForSingleWaiterObject(&unitWriter->ready);
+        AcquireExclusiveLock(&lock);
+        _ASSERT(sequence < nextToEmit + window);
+        stallTime += timeInMillis() - start;
+    }
+    OrderedUnit* result;
+    if (freeUnits.size() > 0) {
+        result = freeUnits[freeUnits.size() - 1];
+        freeUnits.truncate((int) freeUnits.size() - 1);
+    } else {
+        result = new OrderedUnit();
+    }
+    ReleaseExclusiveLock(&lock);
+
+    result->sequence = sequence;
+    return result;
+}
+
+    void
+OrderedDataWriterSupplier::completeUnit(
+    OrderedUnit* unit)
+{
+    AcquireExclusiveLock(&lock);
+    _ASSERT(unit->sequence >= nextToEmit && unit->sequence < nextToEmit + window);
+    _ASSERT(pending[unit->sequence % window] == NULL);
+    pending[unit->sequence % window] = unit;
+    nPending++;
+    maxPending = max(maxPending, nPending);
+    if (draining) {
+        // whoever is draining will pick it up if it's next
+        ReleaseExclusiveLock(&lock);
+        return;
+    }
+
+    draining = true;
+    OrderedUnit* next;
+    while (NULL != (next = pending[nextToEmit % window])) {
+        _ASSERT(next->sequence == nextToEmit);
+        pending[nextToEmit % window] = NULL;
+        nPending--;
+        ReleaseExclusiveLock(&lock);
+
+        emit(next);
+
+        AcquireExclusiveLock(&lock);
+        nextToEmit++;
+        // keep the first buffer, it's likely big enough for the next unit
+        for (int i = 1; i < next->buffers.size(); i++) {
+            delete [] next->buffers[i];
+        }
+        next->buffers.truncate(__min((int) next->buffers.size(), 1));
+        next->records.clear();
+        next->used = 0;
+        freeUnits.push_back(next);
+
+        for (int i = 0; i < waiters.size(); ) {
+            if (waiters[i].first < nextToEmit + window) {
+                SignalSingleWaiterObject(&waiters[i].second->ready);
+                waiters.erase(i);
+            } else {
+                i++;
+            }
+        }
+    }
+    draining = false;
+    ReleaseExclusiveLock(&lock);
+}
+
+    void
+OrderedDataWriterSupplier::emit(
+    OrderedUnit* unit)
+{
+    //
+    // Mirror what SimpleReadWriter does with a single thread: each group of records goes into the
+    // current batch if it fits, else into a fresh one.
+    //
+    int nRecords = (int) unit->records.size();
+    for (int i = 0; i < nRecords; ) {
+        _ASSERT(unit->records[i].groupStart);
+        int end = i + 1;
+        size_t groupBytes = unit->records[i].bytes;
+        while (end < nRecords && ! unit->records[end].groupStart) {
+            _ASSERT(unit->records[end].data == unit->records[end - 1].data + unit->records[end - 1].bytes);
+            groupBytes += unit->records[end].bytes;
+            end++;
+        }
+        char* buffer;
+        size_t size;
+        if (! writer->getBuffer(&buffer, &size)) {
+            WriteErrorMessage("OrderedDataWriterSupplier: unable to get write buffer\n");
+            soft_exit(1);
+        }
+        if (size < groupBytes) {
+            if (! (writer->nextBatch() && writer->getBuffer(&buffer, &size) && size >= groupBytes)) {
+                WriteErrorMessage("Failed to write into fresh buffer; trying providing the -wbs switch with a larger value\n");
+                soft_exit(1);
+            }
+        }
+        memcpy(buffer, unit->records[i].data, groupBytes);
+        for (; i < end; i++) {
+            writer->advance(unit->records[i].bytes, unit->records[i].location);
+        }
+    }
+}
+
+    DataWriterSupplier*
+DataWriterSupplier::ordered(
+    DataWriterSupplier* inner,
+    size_t bufferSize,
+    int window)
+{
+    return new OrderedDataWriterSupplier(inner, bufferSize, window);
+}
@@ -47,6 +47,7 @@ Revision History:
 #include "IntersectingPairedEndAligner.h"
 #include "exit.h"
 #include "Error.h"
+#include "Tracer.h"
 
 using namespace std;
 
@@ -54,6 +55,8 @@ using util::stringEndsWith;
 
 static const int DEFAULT_MIN_SPACING = 50;
 static const int DEFAULT_MAX_SPACING = 1000;
+static const int DEFAULT_PREFETCH_DEPTH = 2;
+static const unsigned DEFAULT_LV_CACHE_ENTRIES = 0;
 
 struct PairedAlignerStats : public AlignerStats
 {
@@ -231,7 +234,10 @@ PairedAlignerOptions::PairedAlignerOptions(const char* i_commandLine)
     forceSpacing(false),
     intersectingAlignerMaxHits(DEFAULT_INTERSECTING_ALIGNER_MAX_HITS),
     maxCandidatePoolSize(DEFAULT_MAX_CANDIDATE_POOL_SIZE),
-    quicklyDropUnpairedReads(true)
+    quicklyDropUnpairedReads(true),
+    prefetchDepth(DEFAULT_PREFETCH_DEPTH),
+    lvCacheEntries(DEFAULT_LV_CACHE_ENTRIES),
+    adaptiveSeedSchedule(false)
 {
 }
 
@@ -253,11 +259,24 @@ void PairedAlignerOptions::usageMessage()
         "       discard it.  Specifying this flag may cause large memory usage for some input files,\n"
         "       but may be necessary for some strangely formatted input files.  You'll also need to specify this\n"
         "       flag for SAM/BAM files that were aligned by a single-end aligner.\n"
+        "  -tpe trim adapter read through from both mates when they overlap by at least 30 bases showing that the\n"
+        "       fragment is shorter than the reads.  This doesn't need the adapter sequence, and can be used with -ta\n"
+        "  -pd  how many pairs ahead of the one being aligned to start prefetching seed lookups and genome data, so that\n"
+        "       memory latency overlaps the work on earlier pairs.  0 turns this off; it's also off with -P (default: %d)\n"
+        "  -lvc number of entries in each thread's cache of recent location scores, which saves rescoring the same read\n"
+        "       at the same place (duplicate reads, repetitive loci).  Must be a power of 2 (%d is a good size), or 0 for\n"
+        "       no cache (default: %d)\n"
+        "  -as  use the adaptive seed schedule, which alternates seed lookups between the mates and stops looking up\n"
+        "       seeds for a mate with many hits once the other mate is nearly unique and a pair has been found that's\n"
+        "       better than any the remaining seeds could find.  This is faster on repetitive genomes\n"
         ,
         DEFAULT_MIN_SPACING,
         DEFAULT_MAX_SPACING,
         DEFAULT_INTERSECTING_ALIGNER_MAX_HITS,
-        DEFAULT_MAX_CANDIDATE_POOL_SIZE);
+        DEFAULT_MAX_CANDIDATE_POOL_SIZE,
+        DEFAULT_PREFETCH_DEPTH,
+        LVResultCache::DefaultEntries,
+        DEFAULT_LV_CACHE_ENTRIES);
 }
 
 bool PairedAlignerOptions::parse(const char** argv, int argc, int& n, bool *done)
@@ -285,6 +304,9 @@ bool PairedAlignerOptions::parse(const char** argv, int argc, int& n, bool *done
     } else if (strcmp(argv[n], "-ku") == 0) {
         quicklyDropUnpairedReads = false;
         return true;
+    } else if (strcmp(argv[n], "-tpe") == 0) {
+        trimPairOverlap = true;
+        return true;
     } else if (strcmp(argv[n], "-mcp") == 0) {
         if (n + 1 < argc) {
             maxCandidatePoolSize = atoi(argv[n+1]);
@@ -292,6 +314,32 @@ bool PairedAlignerOptions::parse(const char** argv, int argc, int& n, bool *done
             return true;
         } 
         return false;
+    } else if (strcmp(argv[n], "-pd") == 0) {
+        if (n + 1 < argc) {
+            prefetchDepth = atoi(argv[n+1]);
+            if (prefetchDepth < 0 || prefetchDepth > IntersectingPairedEndAligner::MaxPrefetchDepth) {
+                WriteErrorMessage("-pd must be between 0 and %d\n", IntersectingPairedEndAligner::MaxPrefetchDepth);
+                soft_exit(1);
+            }
+            n += 1;
+            return true;
+        }
+        return false;
+    } else if (strcmp(argv[n], "-lvc") == 0) {
+        if (n + 1 < argc) {
+            int entries = atoi(argv[n+1]);
+            if (entries < 0 || 0 != (entries & (entries - 1))) {
+                WriteErrorMessage("-lvc must be 0 or a power of 2\n");
+                soft_exit(1);
+            }
+            lvCacheEntries = (unsigned)entries;
+            n += 1;
+            return true;
+        }
+        return false;
+    } else if (strcmp(argv[n], "-as") == 0) {
+        adaptiveSeedSchedule = true;
+        return true;
     } else if (strcmp(argv[n], "-F") == 0 && n + 1 < argc && strcmp(argv[n + 1],"b") == 0) {
         filterFlags |= FilterBothMatesMatch;
         n += 1;
@@ -316,6 +364,9 @@ bool PairedAlignerContext::initialize()
     intersectingAlignerMaxHits = options2->intersectingAlignerMaxHits;
     ignoreMismatchedIDs = options2->ignoreMismatchedIDs;
     quicklyDropUnpairedReads = options2->quicklyDropUnpairedReads;
+    prefetchDepth = doAlignerPrefetch ? options2->prefetchDepth : 0;
+    lvCacheEntries = options2->lvCacheEntries;
+    adaptiveSeedSchedule = options2->adaptiveSeedSchedule;
     noUkkonen = options->noUkkonen;
     noOrderedEvaluation = options->noOrderedEvaluation;
 
@@ -346,6 +397,10 @@ void PairedAlignerContext::runIterationThread()
         //
         return;
     }
+    if (NULL != readWriter) {
+        // for ordered output, tell the writer which input unit each read came from
+        supplier->setInputOrderListener(readWriter->getInputOrderListener());
+    }
 
 	if (extension->runIterationThread(supplier, this)) {
         delete supplier;
@@ -400,6 +455,8 @@ void PairedAlignerContext::runIterationThread()
     memoryPoolSize += ChimericPairedEndAligner::getBigAllocatorReservation(index, maxReadSize, maxHits, index->getSeedLength(), numSeedsFromCommandLine, seedCoverage, maxDist,
         extraSearchDepth, maxCandidatePoolSize, maxSecondaryAlignmentsPerContig);
 
+    memoryPoolSize += LVResultCache::getBigAllocatorReservation(lvCacheEntries);
+
     unsigned maxPairedSecondaryHits;
     unsigned maxSingleSecondaryHits;
 
@@ -411,7 +468,11 @@ void PairedAlignerContext::runIterationThread()
         maxSingleSecondaryHits = ChimericPairedEndAligner::getMaxSingleEndSecondaryResults(numSeedsFromCommandLine, seedCoverage, maxReadSize, maxHits, index->getSeedLength());
     }
 
-    memoryPoolSize += (1 + maxPairedSecondaryHits) * sizeof(PairedAlignmentResult) + maxSingleSecondaryHits * sizeof(SingleAlignmentResult);
+    //
+    // The secondary result buffers start small and are grown when the aligner runs out of room, up to the worst case.
+    //
+    unsigned pairedSecondaryBufferCount = min(maxPairedSecondaryHits, BaseAligner::InitialSecondaryResultBufferCount);
+    unsigned singleSecondaryBufferCount = min(maxSingleSecondaryHits, BaseAligner::InitialSecondaryResultBufferCount);
 
     BigAllocator *allocator = new BigAllocator(memoryPoolSize);
     
@@ -419,6 +480,9 @@ void PairedAlignerContext::runIterationThread()
                                                                 seedCoverage, minSpacing, maxSpacing, intersectingAlignerMaxHits, extraSearchDepth, 
                                                                 maxCandidatePoolSize, maxSecondaryAlignmentsPerContig ,allocator, noUkkonen, noOrderedEvaluation, noTruncation);
 
+    intersectingAligner->setLVResultCache(allocator, lvCacheEntries);
+    intersectingAligner->setAdaptiveSeedSchedule(adaptiveSeedSchedule);
+
 
     ChimericPairedEndAligner *aligner = new (allocator) ChimericPairedEndAligner(
         index,
@@ -438,10 +502,12 @@ void PairedAlignerContext::runIterationThread()
         maxSecondaryAlignmentsPerContig,
         allocator);
 
+    aligner->setUseHints(options->useHints, options->hintValidationInterval, minSpacing, maxSpacing);
+
     allocator->checkCanaries();
 
-    PairedAlignmentResult *results = (PairedAlignmentResult *)allocator->allocate((1 + maxPairedSecondaryHits) * sizeof(*results)); // 1 + is for the primary result
-    SingleAlignmentResult *singleSecondaryResults = (SingleAlignmentResult *)allocator->allocate(maxSingleSecondaryHits * sizeof(*singleSecondaryResults));
+    PairedAlignmentResult *results = (PairedAlignmentResult *)BigAlloc((1 + pairedSecondaryBufferCount) * sizeof(*results)); // 1 + is for the primary result
+    SingleAlignmentResult *singleSecondaryResults = (SingleAlignmentResult *)BigAlloc(max(singleSecondaryBufferCount, 1u) * sizeof(*singleSecondaryResults));
 
     ReadWriter *readWriter = this->readWriter;
 
@@ -459,7 +525,29 @@ void PairedAlignerContext::runIterationThread()
     _uint64 lastReportTime = timeInMillis();
     _uint64 readsWhenLastReported = 0;
 
-    while (supplier->getNextReadPair(&reads[0], &reads[1])) {
+    TraceBatcher alignTrace(TraceAlign, AlignTraceBatchSize);
+    for (;;) {
+        alignTrace.end();   // before waiting for the next pair, so the wait isn't counted as aligning
+        if (! supplier->getNextReadPair(&reads[0], &reads[1])) {
+            break;
+        }
+        alignTrace.begin();
+
+        //
+        // Move the pairs behind this one along the prefetch pipeline: start the hash table loads for the pair
+        // prefetchDepth ahead, and finish the lookups and start the genome loads for the very next one.  With a
+        // depth of 1 those are the same pair, so it goes through both stages at once.
+        //
+        if (prefetchDepth > 0) {
+            Read *aheadReads[NUM_READS_PER_PAIR];
+            if (supplier->peekReadPair(prefetchDepth, &aheadReads[0], &aheadReads[1])) {
+                intersectingAligner->beginPrefetch(aheadReads[0], aheadReads[1]);
+            }
+            if (supplier->peekReadPair(1, &aheadReads[0], &aheadReads[1])) {
+                intersectingAligner->continuePrefetch(aheadReads[0], aheadReads[1]);
+            }
+        }
+
         // Check that the two IDs form a pair; they will usually be foo/1 and foo/2 for some foo.
         if (!ignoreMismatchedIDs) {
             Read::checkIdMatch(reads[0], reads[1]);
@@ -513,8 +601,22 @@ void PairedAlignerContext::runIterationThread()
         int nSecondaryResults;
         int nSingleSecondaryResults[2];
 
-        aligner->align(reads[0], reads[1], results, maxSecondaryAlignmentAdditionalEditDistance, maxPairedSecondaryHits, &nSecondaryResults, results + 1,
-            maxSingleSecondaryHits, maxSecondaryAlignments, &nSingleSecondaryResults[0], &nSingleSecondaryResults[1], singleSecondaryResults);
+        while (!aligner->align(reads[0], reads[1], results, maxSecondaryAlignmentAdditionalEditDistance, pairedSecondaryBufferCount, &nSecondaryResults, results + 1,
+                singleSecondaryBufferCount, maxSecondaryAlignments, &nSingleSecondaryResults[0], &nSingleSecondaryResults[1], singleSecondaryResults)) {
+            //
+            // We don't know which of the buffers overflowed, so grow both.
+            //
+            if (pairedSecondaryBufferCount >= maxPairedSecondaryHits && singleSecondaryBufferCount >= maxSingleSecondaryHits) {
+                WriteErrorMessage("Out of secondary result buffer aligning read %.*s, which shouldn't be possible\n", reads[0]->getIdLength(), reads[0]->getId());
+                soft_exit(1);
+            }
+            pairedSecondaryBufferCount = min(maxPairedSecondaryHits, 2 * pairedSecondaryBufferCount);
+            singleSecondaryBufferCount = min(maxSingleSecondaryHits, 2 * singleSecondaryBufferCount);
+            BigDealloc(results);
+            BigDealloc(singleSecondaryResults);
+            results = (PairedAlignmentResult *)BigAlloc((1 + pairedSecondaryBufferCount) * sizeof(*results));
+            singleSecondaryResults = (SingleAlignmentResult *)BigAlloc(max(singleSecondaryBufferCount, 1u) * sizeof(*singleSecondaryResults));
+        }
 
 #if     TIME_HISTOGRAM
         _int64 runTime = timeInNanos() - startTime;
@@ -579,10 +681,21 @@ void PairedAlignerContext::runIterationThread()
 
     allocator->checkCanaries();
 
+    size_t resultBufferBytes = (1 + pairedSecondaryBufferCount) * sizeof(*results) + max(singleSecondaryBufferCount, 1u) * sizeof(*singleSecondaryResults);
+    stats->recordThreadMemory(allocator->getMemoryCommitted() + resultBufferBytes, allocator->getMemoryReserved() + resultBufferBytes);
+    stats->hintedReads += NUM_READS_PER_PAIR * aligner->getNHintsUsed();
+    stats->hintValidations += NUM_READS_PER_PAIR * aligner->getNHintsValidated();
+    stats->hintDisagreements += NUM_READS_PER_PAIR * aligner->getNHintsDisagreed();
+    stats->lvCacheLookups += intersectingAligner->getLVCacheLookups();
+    stats->lvCacheHits += intersectingAligner->getLVCacheHits();
+    stats->seedLookupsSkipped += intersectingAligner->getSeedLookupsSkipped();
+
     aligner->~ChimericPairedEndAligner();
     delete supplier;
 
     intersectingAligner->~IntersectingPairedEndAligner();
+    BigDealloc(results);
+    BigDealloc(singleSecondaryResults);
     delete allocator;
 }
 
@@ -68,6 +68,9 @@ protected:
     const char         *fastqFile1;
     bool                ignoreMismatchedIDs;
     bool                quicklyDropUnpairedReads;
+    int                 prefetchDepth;
+    unsigned            lvCacheEntries;
+    bool                adaptiveSeedSchedule;
 
 	friend class AlignerContext2;
 };
@@ -88,4 +91,7 @@ struct PairedAlignerOptions : public AlignerOptions
     unsigned    intersectingAlignerMaxHits;
     unsigned    maxCandidatePoolSize;
     bool        quicklyDropUnpairedReads;
+    int         prefetchDepth;      // How many pairs ahead to start seed prefetches, 0 for none
+    unsigned    lvCacheEntries;     // Size of the per-thread LV result cache, 0 for none
+    bool        adaptiveSeedSchedule;   // Stop seeding a read with many hits once its mate is nearly unique (heuristic, off by default)
 };
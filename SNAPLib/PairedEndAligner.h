@@ -37,7 +37,10 @@ class PairedEndAligner
 public:
     virtual ~PairedEndAligner() {}
     
-    virtual void align(
+    //
+    // Returns false if the secondary result buffers weren't big enough, in which case the caller should retry with bigger ones.
+    //
+    virtual bool align(
         Read                  *read0,
         Read                  *read1,
         PairedAlignmentResult *result,
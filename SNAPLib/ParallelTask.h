@@ -154,11 +154,15 @@ ParallelTask<TContext>::run()
     DestroyEventObject(&memoryAllocationCompleteBarrier);
 #endif  // _MSC_VER
 
-    for (int i = 0; i < common->totalThreads; i++) {
-        contexts[i].finishThread(common);
-    }
-
     common->time = timeInMillis() - start;
+
+    // the last finishThread may let the owner delete this task (e.g. ParallelCoworker::stop), so use locals
+    TContext* finishing = contexts;
+    TContext* finalCommon = common;
+    int totalThreads = common->totalThreads;
+    for (int i = 0; i < totalThreads; i++) {
+        finishing[i].finishThread(finalCommon);
+    }
 }
 
     template <class TContext>
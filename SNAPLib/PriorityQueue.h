@@ -80,6 +80,43 @@ public:
         return frontItem.value;
     }
 
+    // remove an element wherever it is in the queue; false if it isn't there
+    bool remove(V value)
+    {
+        _int64 i = 0;
+        while (i < queue.size() && !(queue[i].value == value)) {
+            i++;
+        }
+        if (i == queue.size()) {
+            return false;
+        }
+        _int64 li = queue.size() - 1;
+        queue[i] = queue[li];
+        queue.erase(li);
+        --li;
+        // the last element may belong above or below where it landed
+        while (i > 0 && queue[i].priority < queue[(i - 1) / 2].priority) {
+            Entry tmp = queue[i]; queue[i] = queue[(i - 1) / 2]; queue[(i - 1) / 2] = tmp;
+            i = (i - 1) / 2;
+        }
+        while (true) {
+            _int64 ci = i * 2 + 1;
+            if (ci > li) {
+                break;
+            }
+            if (ci + 1 <= li && queue[ci + 1].priority < queue[ci].priority) {
+                ci++;
+            }
+            if (queue[i].priority <= queue[ci].priority) {
+                break;
+            }
+            Entry tmp = queue[i]; queue[i] = queue[ci]; queue[ci] = tmp;
+            i = ci;
+        }
+        check();
+        return true;
+    }
+
     V peek(P* o_priority = NULL) const
     {
         if (o_priority != NULL) {
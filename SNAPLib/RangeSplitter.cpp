@@ -28,12 +28,13 @@ Revision History:
 #include "RangeSplitter.h"
 #include "SAM.h"
 #include "FASTQ.h"
+#include "ReadTrimmer.h"
 
 using std::max;
 using std::min;
 
 
-RangeSplitter::RangeSplitter(_int64 rangeEnd_, int numThreads_, unsigned divisionSize_, _int64 rangeBegin_, unsigned minMillis_, unsigned minRangeSize_)
+RangeSplitter::RangeSplitter(_int64 rangeEnd_, int numThreads_, unsigned divisionSize_, _int64 rangeBegin_, unsigned minMillis_, unsigned minRangeSize_, _int64 maxRangeSize_)
 {
     numThreads = numThreads_;
     rangeEnd = rangeEnd_;
@@ -43,15 +44,35 @@ RangeSplitter::RangeSplitter(_int64 rangeEnd_, int numThreads_, unsigned divisio
     divisionSize = divisionSize_;
     minMillis = minMillis_;
     minRangeSize = minRangeSize_;
+    maxRangeSize = maxRangeSize_;
+    nextSequence = 0;
+    InitializeExclusiveLock(&sequenceLock);
 }
 
+RangeSplitter::~RangeSplitter()
+{
+    DestroyExclusiveLock(&sequenceLock);
+}
 
-bool RangeSplitter::getNextRange(_int64 *rangeStart, _int64 *rangeLength)
+bool RangeSplitter::getNextRange(_int64 *rangeStart, _int64 *rangeLength, _int64 *o_sequence)
 {
     // If there are multiple threads, start each of them off with (rangeEnd / divionSize / numThreads),
     // and then keep giving everyone 1 / (divisionSize * numThreads) of the remaining data or the amount
     // of units processed per thread in minMillis ms, whichever is bigger.
     // If there's just one thread, we give it the whole range at the beginning.
+    // Either way, no range is bigger than maxRangeSize if it's set.
+    //
+    // Sequence numbers have to follow range order, so when they're wanted the position and the
+    // number are taken together under a lock.  It's only per range, so contention doesn't matter.
+    if (o_sequence != NULL) {
+        AcquireExclusiveLock(&sequenceLock);
+        bool result = getNextRange(rangeStart, rangeLength, NULL);
+        if (result) {
+            *o_sequence = nextSequence++;
+        }
+        ReleaseExclusiveLock(&sequenceLock);
+        return result;
+    }
 
     if (startTime == 0) {
         // There's a possible "race" here if multiple threads start at the same time, but that's
@@ -80,6 +101,9 @@ bool RangeSplitter::getNextRange(_int64 *rangeStart, _int64 *rangeLength)
         amountToTake = max(amountLeft / divisionSize / numThreads, unitsInMinms);
         amountToTake = max(amountToTake, (_int64) minRangeSize);  // Avoid getting really tiny amounts at the end.
     }
+    if (maxRangeSize > 0) {
+        amountToTake = min(amountToTake, maxRangeSize);
+    }
 
     _ASSERT(amountToTake > 0);
 	_int64 oldPosition = position; // for debugging
@@ -130,14 +154,15 @@ RangeSplittingReadSupplierGenerator::RangeSplittingReadSupplierGenerator(
 		headerSize = 0;
 	}
 
-	splitter = new RangeSplitter(QueryFileSize(fileName), numThreads, 5, headerSize, 200, 10 * MAX_READ_LENGTH);
+	splitter = new RangeSplitter(QueryFileSize(fileName), numThreads, 5, headerSize, 200, 10 * MAX_READ_LENGTH,
+        context.orderedOutput ? RangeSplitter::OrderedMaxRangeSize : 0);
 }
 
 ReadSupplier *
 RangeSplittingReadSupplierGenerator::generateNewReadSupplier()
 {
-    _int64 rangeStart, rangeLength;
-    if (!splitter->getNextRange(&rangeStart, &rangeLength)) {
+    _int64 rangeStart, rangeLength, sequence = -1;
+    if (!splitter->getNextRange(&rangeStart, &rangeLength, context.orderedOutput ? &sequence : NULL)) {
         return NULL;
     }
 
@@ -148,13 +173,23 @@ RangeSplittingReadSupplierGenerator::generateNewReadSupplier()
     } else {
         underlyingReader = FASTQReader::create(DataSupplier::Default, fileName, 2, rangeStart, rangeLength, context);
     }
-    return new RangeSplittingReadSupplier(splitter,underlyingReader);
+    return new RangeSplittingReadSupplier(splitter,underlyingReader,sequence);
 }
 
 RangeSplittingReadSupplier::~RangeSplittingReadSupplier()
 {
 }
 
+    void
+RangeSplittingReadSupplier::setInputOrderListener(
+    InputOrderListener* listener)
+{
+    orderListener = listener;
+    if (orderListener != NULL && sequence >= 0) {
+        // the first range was taken when we were created
+        orderListener->beginInputUnit(sequence);
+    }
+}
 
     Read * 
 RangeSplittingReadSupplier::getNextRead()
@@ -164,9 +199,12 @@ RangeSplittingReadSupplier::getNextRead()
     }
 
     _int64 rangeStart, rangeLength;
-    if (!splitter->getNextRange(&rangeStart, &rangeLength)) {
+    if (!splitter->getNextRange(&rangeStart, &rangeLength, sequence >= 0 ? &sequence : NULL)) {
         return NULL;
     }
+    if (orderListener != NULL) {
+        orderListener->beginInputUnit(sequence);
+    }
     underlyingReader->reinit(rangeStart,rangeLength);
     if (!underlyingReader->getNextRead(&read)) {
         return NULL;
@@ -178,12 +216,26 @@ RangeSplittingPairedReadSupplier::~RangeSplittingPairedReadSupplier()
 {
 }
 
+    void
+RangeSplittingPairedReadSupplier::setInputOrderListener(
+    InputOrderListener* listener)
+{
+    orderListener = listener;
+    if (orderListener != NULL && sequence >= 0) {
+        orderListener->beginInputUnit(sequence);
+    }
+}
+
     bool 
 RangeSplittingPairedReadSupplier::getNextReadPair(Read **read1, Read **read2)
 {
     *read1 = &internalRead1;
     *read2 = &internalRead2;
+    const ReadTrimmer *trimmer = underlyingReader->getContext()->trimmer;
     if (underlyingReader->getNextReadPair(&internalRead1,&internalRead2)) {
+        if (NULL != trimmer && trimmer->trimsPairs()) {
+            trimmer->trimPair(&internalRead1, &internalRead2);
+        }
         return true;
     }
 
@@ -194,12 +246,21 @@ RangeSplittingPairedReadSupplier::getNextReadPair(Read **read1, Read **read2)
     //
 
     _int64 rangeStart, rangeLength;
-    if (!splitter->getNextRange(&rangeStart, &rangeLength)) {
+    if (!splitter->getNextRange(&rangeStart, &rangeLength, sequence >= 0 ? &sequence : NULL)) {
         return false;
     }
+    if (orderListener != NULL) {
+        orderListener->beginInputUnit(sequence);
+    }
  
     underlyingReader->reinit(rangeStart,rangeLength);
-    return underlyingReader->getNextReadPair(&internalRead1, &internalRead2);
+    if (!underlyingReader->getNextReadPair(&internalRead1, &internalRead2)) {
+        return false;
+    }
+    if (NULL != trimmer && trimmer->trimsPairs()) {
+        trimmer->trimPair(&internalRead1, &internalRead2);
+    }
+    return true;
 }
 
 RangeSplittingPairedReadSupplierGenerator::RangeSplittingPairedReadSupplierGenerator(
@@ -218,7 +279,8 @@ RangeSplittingPairedReadSupplierGenerator::RangeSplittingPairedReadSupplierGener
         fileName2 = NULL;
     }
 
-    splitter = new RangeSplitter(QueryFileSize(fileName1),numThreads);
+    splitter = new RangeSplitter(QueryFileSize(fileName1), numThreads, 5, 0, 200, 32768,
+        context.orderedOutput ? RangeSplitter::OrderedMaxRangeSize : 0);
 }
 
 RangeSplittingPairedReadSupplierGenerator::~RangeSplittingPairedReadSupplierGenerator()
@@ -231,8 +293,8 @@ RangeSplittingPairedReadSupplierGenerator::~RangeSplittingPairedReadSupplierGene
     PairedReadSupplier *
 RangeSplittingPairedReadSupplierGenerator::generateNewPairedReadSupplier()
 {
-    _int64 rangeStart, rangeLength;
-    if (!splitter->getNextRange(&rangeStart, &rangeLength)) {
+    _int64 rangeStart, rangeLength, sequence = -1;
+    if (!splitter->getNextRange(&rangeStart, &rangeLength, context.orderedOutput ? &sequence : NULL)) {
         return NULL;
     }
 
@@ -255,6 +317,6 @@ RangeSplittingPairedReadSupplierGenerator::generateNewPairedReadSupplier()
         soft_exit(1);
     }
  
-    return new RangeSplittingPairedReadSupplier(splitter,underlyingReader);
+    return new RangeSplittingPairedReadSupplier(splitter,underlyingReader,sequence);
 }
 
@@ -38,10 +38,16 @@ Revision History:
 class RangeSplitter
 {
 public:
-    RangeSplitter(_int64 rangeEnd_, int numThreads_, unsigned divisonSize_ = 5, _int64 rangeBegin_ = 0, unsigned minMillis_ = 200, unsigned minRangeSize_ = 32768);
+    RangeSplitter(_int64 rangeEnd_, int numThreads_, unsigned divisonSize_ = 5, _int64 rangeBegin_ = 0, unsigned minMillis_ = 200, unsigned minRangeSize_ = 32768, _int64 maxRangeSize_ = 0);
+
+    ~RangeSplitter();
 
     // Get the next range for a thread to process, or return false if the whole range is done.
-    bool getNextRange(_int64 *rangeStart, _int64 *rangeLength);
+    // If o_sequence is given, ranges are numbered densely in range order (all callers must then ask for it).
+    bool getNextRange(_int64 *rangeStart, _int64 *rangeLength, _int64 *o_sequence = NULL);
+
+    // range size limit for ordered output, so that the output of one range can be held in memory
+    static const _int64 OrderedMaxRangeSize = 4 * 1024 * 1024;
 
 private:
     int numThreads;
@@ -50,14 +56,17 @@ private:
     unsigned divisionSize;
     unsigned minMillis;
     unsigned minRangeSize;
+    _int64 maxRangeSize;    // 0 means no limit
     volatile _int64 position;
     volatile _int64 startTime;
+    ExclusiveLock sequenceLock;
+    _int64 nextSequence;
 };
 
 class RangeSplittingReadSupplier : public ReadSupplier {
 public:
-    RangeSplittingReadSupplier(RangeSplitter *i_splitter, ReadReader *i_underlyingReader) : 
-      splitter(i_splitter), underlyingReader(i_underlyingReader), read() {}
+    RangeSplittingReadSupplier(RangeSplitter *i_splitter, ReadReader *i_underlyingReader, _int64 i_sequence = -1) : 
+      splitter(i_splitter), underlyingReader(i_underlyingReader), read(), sequence(i_sequence), orderListener(NULL) {}
 
     virtual ~RangeSplittingReadSupplier();
 
@@ -69,10 +78,14 @@ public:
     virtual bool releaseBatch(DataBatch batch)
     { return underlyingReader->releaseBatch(batch); }
 
+    virtual void setInputOrderListener(InputOrderListener* listener);
+
 private:
     RangeSplitter *splitter;
     ReadReader *underlyingReader;
     Read read;
+    _int64 sequence;    // of the current range, -1 if not numbering ranges
+    InputOrderListener *orderListener;
 };
 
 class RangeSplittingReadSupplierGenerator: public ReadSupplierGenerator {
@@ -94,7 +107,8 @@ private:
 
 class RangeSplittingPairedReadSupplier : public PairedReadSupplier {
 public:
-    RangeSplittingPairedReadSupplier(RangeSplitter *i_splitter, PairedReadReader *i_underlyingReader) : splitter(i_splitter), underlyingReader(i_underlyingReader) {}
+    RangeSplittingPairedReadSupplier(RangeSplitter *i_splitter, PairedReadReader *i_underlyingReader, _int64 i_sequence = -1) :
+        splitter(i_splitter), underlyingReader(i_underlyingReader), sequence(i_sequence), orderListener(NULL) {}
     virtual ~RangeSplittingPairedReadSupplier();
 
     virtual bool getNextReadPair(Read **read1, Read **read2);
@@ -105,11 +119,15 @@ public:
     virtual bool releaseBatch(DataBatch batch)
     { return underlyingReader->releaseBatch(batch); }
 
+    virtual void setInputOrderListener(InputOrderListener* listener);
+
  private:
     PairedReadReader *underlyingReader;
     RangeSplitter *splitter;
     Read internalRead1;
     Read internalRead2;
+    _int64 sequence;
+    InputOrderListener *orderListener;
  };
 
 class RangeSplittingPairedReadSupplierGenerator: public PairedReadSupplierGenerator {
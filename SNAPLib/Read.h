@@ -33,6 +33,7 @@ Revision History:
 #include "Error.h"
 #include "Genome.h"
 #include "AlignmentResult.h"
+#include "SequenceCodec.h"
 
 class FileFormat;
 
@@ -84,6 +85,7 @@ struct PairedAlignmentResult;
 const int MaxReadLength = MAX_READ_LENGTH;
 
 class Read;
+class ReadTrimmer;
 
 enum ReadClippingType {NoClipping, ClipFront, ClipBack, ClipFrontAndBack};
 
@@ -101,6 +103,8 @@ struct ReaderContext
     size_t              headerLength; // length of string
     size_t              headerBytes; // bytes used for header in file
     bool                headerMatchesIndex; // header refseq matches current index
+    bool                orderedOutput;      // output must follow input order, so hand out input in bounded units
+    const ReadTrimmer*  trimmer;            // adapter & quality trimming applied as reads are read, or NULL
 };
 
 class ReadReader {
@@ -146,6 +150,19 @@ public:
     static const int MatchBuffers = 2;
 };
 
+//
+// Told by a supplier each time it starts handing out reads from a new unit of input (a queue element or
+// a file range).  Units are numbered densely from 0 in input order, so a consumer that knows which unit
+// its output came from can put the output back into input order.
+//
+class InputOrderListener {
+public:
+    virtual ~InputOrderListener() {}
+
+    // everything written after this call (until the next one) came from input unit #sequence
+    virtual void beginInputUnit(_int64 sequence) = 0;
+};
+
 class ReadSupplier {
 public:
     virtual Read *getNextRead() = 0;    // This read is valid until you call getNextRead, then it's done.  Don't worry about deallocating it.
@@ -153,6 +170,9 @@ public:
 
     virtual void holdBatch(DataBatch batch) = 0;
     virtual bool releaseBatch(DataBatch batch) = 0;
+
+    // suppliers that can number their input units override this; default does not report order
+    virtual void setInputOrderListener(InputOrderListener* listener) {}
 };
 
 class PairedReadSupplier {
@@ -161,8 +181,18 @@ public:
     virtual bool getNextReadPair(Read **read0, Read **read1) = 0;
     virtual ~PairedReadSupplier() {}
 
+    //
+    // Look at the pair that the ahead'th next call to getNextReadPair will return (ahead == 1 is the very next one)
+    // without consuming anything, so the caller can start prefetching for it.  The reads are only good until the
+    // call to getNextReadPair that returns them, and may not have been trimmed yet.  Suppliers that can't see that
+    // far (or at all) return false.
+    //
+    virtual bool peekReadPair(int ahead, Read **read0, Read **read1) { return false; }
+
     virtual void holdBatch(DataBatch batch) = 0;
     virtual bool releaseBatch(DataBatch batch) = 0;
+
+    virtual void setInputOrderListener(InputOrderListener* listener) {}
 };
 
 class ReadSupplierGenerator {
@@ -203,6 +233,9 @@ public:
 
     // close out this thread
     virtual void close() = 0;
+
+    // non-NULL if output must be told which input unit it came from (ordered output)
+    virtual InputOrderListener* getInputOrderListener() { return NULL; }
 };
 
 class DataWriterSupplier;
@@ -218,6 +251,10 @@ public:
         const Genome* genome);
 };
 
+//
+// The read group is the RG tag in the auxiliary data if there is one, otherwise the default.  Readers don't parse the
+// auxiliary data, so this is resolved by the writers, which are the only ones that need it.
+//
 #define READ_GROUP_FROM_AUX     ((const char*) -1)
     
 class Read {
@@ -229,7 +266,8 @@ public:
             upcaseForwardRead(NULL), auxiliaryData(NULL), auxiliaryDataLength(0),
             readGroup(NULL), originalAlignedLocation(-1), originalMAPQ(-1), originalSAMFlags(0),
             originalFrontClipping(0), originalBackClipping(0), originalFrontHardClipping(0), originalBackHardClipping(0),
-            originalRNEXT(NULL), originalRNEXTLength(0), originalPNEXT(0), additionalFrontClipping(0)
+            originalRNEXT(NULL), originalRNEXTLength(0), originalPNEXT(0), additionalFrontClipping(0),
+            softTrimmedFront(0), softTrimmedBack(0)
         {}
 
         Read(const Read& other) :  localBufferAllocationOffset(0)
@@ -352,6 +390,8 @@ public:
             originalRNEXTLength = other.originalRNEXTLength;
             originalPNEXT = other.originalPNEXT;
             additionalFrontClipping = other.additionalFrontClipping;
+            softTrimmedFront = other.softTrimmedFront;
+            softTrimmedBack = other.softTrimmedBack;
         }
 
         //
@@ -399,6 +439,7 @@ public:
             frontClippedLength = 0;
             clippingState = NoClipping;
             additionalFrontClipping = 0;
+            softTrimmedFront = softTrimmedBack = 0;
             originalAlignedLocation = i_originalAlignedLocation;
             originalMAPQ = i_originalMAPQ;
             originalSAMFlags = i_originalSAMFlags;
@@ -515,6 +556,13 @@ public:
                 }
             }
 
+            //
+            // Soft trimming applies regardless of the clipping type.
+            //
+            if (unclippedLength - dataLength < softTrimmedBack) {
+                dataLength = unclippedLength - softTrimmedBack;
+            }
+
             //
             // Then clip from the beginning.
             //
@@ -529,6 +577,8 @@ public:
                 }
             }
 
+            frontClippedLength = min(max(frontClippedLength, softTrimmedFront), dataLength);
+
             _ASSERT(frontClippedLength <= dataLength);
 
             dataLength -= frontClippedLength;
@@ -547,17 +597,20 @@ public:
         }
 
         unsigned countOfNs() const {
-            unsigned count = 0;
-            for (unsigned i = 0; i < dataLength; i++) {
-                count += IS_N[data[i]];
-            }
-            return count;
+            return SequenceCodec::countNs(data, dataLength);
         }
 
         void computeReverseCompliment(char *outputBuffer) { // Caller guarantees that outputBuffer is at least getDataLength() bytes
-            for (unsigned i = 0; i < dataLength; i++) {
-                outputBuffer[i] = COMPLEMENT[data[dataLength - i - 1]];
-            }
+            SequenceCodec::reverseComplement(outputBuffer, data, dataLength, COMPLEMENT);
+        }
+
+        //
+        // The reverse complement, reversed quality, reversed bases and complemented bases of the (clipped) read that the
+        // aligners seed and score with, built in one pass (see SequenceCodec::prepareRead).  Each buffer must be at least
+        // getDataLength() bytes.  Returns the number of Ns.
+        //
+        unsigned prepareForAlignment(char *o_rc, char *o_rcQuality, char *o_reversed, char *o_complement, const char *complement) const {
+            return SequenceCodec::prepareRead(o_rc, o_rcQuality, o_reversed, o_complement, data, quality, dataLength, complement);
         }
 
         void becomeRC()
@@ -591,10 +644,8 @@ public:
 
                     _ASSERT(localBufferAllocationOffset <= localBufferLength);
 
-                    for (unsigned i = 0; i < unclippedLength; i++) {
-                        rcData[i] = COMPLEMENT[unclippedData[unclippedLength - i - 1]];
-                        rcQuality[unclippedLength-i-1] = unclippedQuality[i];
-                    }
+                    SequenceCodec::reverseComplement(rcData, unclippedData, unclippedLength, COMPLEMENT);
+                    SequenceCodec::reverse(rcQuality, unclippedQuality, unclippedLength);
 
                     unclippedData = rcData;
                     unclippedQuality = rcQuality;
@@ -616,6 +667,77 @@ public:
             temp = originalFrontHardClipping;
             originalFrontHardClipping = originalBackHardClipping;
             originalBackHardClipping = temp;
+            temp = softTrimmedFront;
+            softTrimmedFront = softTrimmedBack;
+            softTrimmedBack = temp;
+        }
+
+        //
+        // Trim bases from the front and back of the (clipped) read.  Soft trimming just extends the clipping, so
+        // the bases are still written out as soft clipped, and clip() keeps them clipped.  Hard trimming drops the
+        // bases, along with anything already clipped on that end, and records them as hard clipping.
+        //
+        void trim(unsigned front, unsigned back, bool hard)
+        {
+            _ASSERT(front + back <= dataLength);
+            unsigned backClippedLength = unclippedLength - dataLength - frontClippedLength;
+
+            data += front;
+            quality += front;
+            dataLength -= front + back;
+
+            if (!hard) {
+                frontClippedLength += front;
+                if (front > 0) {
+                    softTrimmedFront = frontClippedLength;
+                }
+                if (back > 0) {
+                    softTrimmedBack = backClippedLength + back;
+                }
+                return;
+            }
+
+            unsigned dropFront = front > 0 ? frontClippedLength + front : 0;
+            unsigned dropBack = back > 0 ? backClippedLength + back : 0;
+
+            //
+            // The unclipped buffer for the other direction loses the opposite end.
+            //
+            unsigned dropForward = FORWARD == currentReadDirection ? dropFront : dropBack;
+            unsigned dropRC = FORWARD == currentReadDirection ? dropBack : dropFront;
+            externalData += dropForward;
+            externalQuality += dropForward;
+            if (NULL != upcaseForwardRead) {
+                upcaseForwardRead += dropForward;
+            }
+            if (NULL != rcData) {
+                rcData += dropRC;
+                rcQuality += dropRC;
+            }
+
+            unclippedData += dropFront;
+            unclippedQuality += dropFront;
+            unclippedLength -= dropFront + dropBack;
+            if (front > 0) {
+                frontClippedLength = 0;
+                softTrimmedFront = 0;
+            }
+            if (back > 0) {
+                softTrimmedBack = 0;
+            }
+            originalFrontHardClipping += dropFront;
+            originalBackHardClipping += dropBack;
+        }
+
+        //
+        // Carry another read's trimming over to a freshly initialized copy of its unclipped data.
+        //
+        void copyTrimming(const Read& other)
+        {
+            _ASSERT(NoClipping == clippingState && unclippedLength == other.unclippedLength);
+            originalFrontHardClipping = other.originalFrontHardClipping;
+            originalBackHardClipping = other.originalBackHardClipping;
+            trim(other.softTrimmedFront, other.softTrimmedBack, false);
         }
 
 
@@ -680,6 +802,11 @@ private:
         unsigned originalRNEXTLength;
         unsigned originalPNEXT;
 
+        //
+        // Bases soft clipped by trimming, counted from the unclipped ends of the read in its current direction.
+        //
+        unsigned softTrimmedFront;
+        unsigned softTrimmedBack;
 
         //
         // Memory that's local to this read and that is used to contain an upcased version of the read as well as 
@@ -835,6 +962,7 @@ private:
         qualityBuffer[baseRead.getUnclippedLength()] = '\0';
     
         init(idBuffer,baseRead.getIdLength(),dataBuffer,qualityBuffer,baseRead.getUnclippedLength());
+        copyTrimming(baseRead);
 		clip(baseRead.getClippingState());
 
         setReadGroup(baseRead.getReadGroup());
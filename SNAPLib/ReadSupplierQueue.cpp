@@ -27,6 +27,8 @@ Revision History:
 #include "ReadSupplierQueue.h"
 #include "exit.h"
 #include "SAM.h"
+#include "ReadTrimmer.h"
+#include "Tracer.h"
 
 //#define PAIR_MATCH_DEBUG
 
@@ -60,6 +62,7 @@ ReadSupplierQueue::commonInit()
     nReadersRunning = 0;
     nSuppliersRunning = 0;
     allReadsQueued = false;
+    nextSequence = 0;
 
     balance = 0;
 
@@ -207,7 +210,10 @@ ReadSupplierQueue::getElement()
             return NULL;
         }
         //WriteErrorMessage("Thread %u: getElement loop wait readsReady\n", GetThreadId());
-        WaitForEvent(&readsReady);
+        {
+            TraceScope trace(TraceQueueWait);
+            WaitForEvent(&readsReady);
+        }
         //WriteErrorMessage("Thread %u: getElement loop wait acquire lock\n", GetThreadId());
         AcquireExclusiveLock(&lock);
         //WriteErrorMessage("Thread %u: getElement loop acquired lock\n", GetThreadId());
@@ -216,6 +222,7 @@ ReadSupplierQueue::getElement()
     ReadQueueElement *element = readyQueue[0].next;
     _ASSERT(element != &readyQueue[0]);
     element->removeFromQueue();
+    element->sequence = nextSequence++;
 
     if (!areAnyReadsReady() && !allReadsQueued) {
         //WriteErrorMessage("Thread %u: getElement block readsReady\n", GetThreadId());
@@ -247,7 +254,10 @@ ReadSupplierQueue::getElements(ReadQueueElement **element1, ReadQueueElement **e
             return NULL;
         }
         //WriteErrorMessage("Thread %u: getElements loop wait readsReady\n", GetThreadId());
-        WaitForEvent(&readsReady);
+        {
+            TraceScope trace(TraceQueueWait);
+            WaitForEvent(&readsReady);
+        }
         //WriteErrorMessage("Thread %u: getElements loop wait acquire lock\n", GetThreadId());
         AcquireExclusiveLock(&lock);
         //WriteErrorMessage("Thread %u: getElements loop acquired lock\n", GetThreadId());
@@ -297,6 +307,7 @@ ReadSupplierQueue::getElements(ReadQueueElement **element1, ReadQueueElement **e
         }
         //WriteErrorMessage("Thread %u: balanced sizes %d %d\n", GetThreadId(), sizes[0], sizes[1]);
     }
+    (*element1)->sequence = (*element2)->sequence = nextSequence++;
     //fprintf(stderr,"getElements %x/%x with %d/%d reads\n", (int) (*element1), (int) (*element2), (*element1)->totalReads, (*element2)->totalReads);
 
     if (!areAnyReadsReady() && !allReadsQueued) {
@@ -402,7 +413,10 @@ ReadSupplierQueue::getEmptyElement()
         //WriteErrorMessage("Thread %u: getEmptyElement releasing lock\n", GetThreadId());
         ReleaseExclusiveLock(&lock);
         //WriteErrorMessage("Thread %u: getEmptyElement released lock\n", GetThreadId());
-        WaitForEvent(&emptyBuffersAvailable);
+        {
+            TraceScope trace(TraceQueueWait);
+            WaitForEvent(&emptyBuffersAvailable);
+        }
         //WriteErrorMessage("Thread %u: getEmptyElement acquiring lock\n", GetThreadId());
         AcquireExclusiveLock(&lock);
         //WriteErrorMessage("Thread %u: getEmptyElement acquired lock\n", GetThreadId());
@@ -420,6 +434,7 @@ ReadSupplierQueue::getEmptyElement()
     void
 ReadSupplierQueue::ReaderThread(ReaderThreadParams *params)
 {
+    Tracer::NameThread("reader");
     AcquireExclusiveLock(&lock);
     bool done = false;
     ReadReader *reader;
@@ -453,7 +468,10 @@ ReadSupplierQueue::ReaderThread(ReaderThreadParams *params)
             processingTime += now - startTime;
             startTime = now;
 
-            WaitForEvent(&throttle[firstOrSecond]);
+            {
+                TraceScope trace(TraceQueueWait);
+                WaitForEvent(&throttle[firstOrSecond]);
+            }
 
             now = timeInNanos();
             balanceTime += now - startTime;
@@ -615,7 +633,8 @@ ReadSupplierFromQueue::ReadSupplierFromQueue(
     outOfReads(false),
     currentElement(NULL),
     nextReadIndex(0),
-    done(false)
+    done(false),
+    orderListener(NULL)
 {
 }
 
@@ -643,6 +662,9 @@ ReadSupplierFromQueue::getNextRead()
             return NULL;
         }
         nextReadIndex = 0;
+        if (orderListener != NULL) {
+            orderListener->beginInputUnit(currentElement->sequence);
+        }
     }
 
     return &currentElement->reads[nextReadIndex++]; // Note the post increment.
@@ -650,7 +672,13 @@ ReadSupplierFromQueue::getNextRead()
 
 PairedReadSupplierFromQueue::PairedReadSupplierFromQueue(ReadSupplierQueue *i_queue, bool i_twoFiles) :
     queue(i_queue), twoFiles(i_twoFiles), done(false), 
-    currentElement(NULL), currentSecondElement(NULL), nextReadIndex(0) {}
+    currentElement(NULL), currentSecondElement(NULL), nextReadIndex(0), orderListener(NULL)
+{
+    trimmer = queue->getContext()->trimmer;
+    if (NULL != trimmer && !trimmer->trimsPairs()) {
+        trimmer = NULL;
+    }
+}
 
 PairedReadSupplierFromQueue::~PairedReadSupplierFromQueue()
 {}
@@ -687,6 +715,9 @@ PairedReadSupplierFromQueue::getNextReadPair(Read **read0, Read **read1)
             return false;
         }
 		nextReadIndex = 0;
+        if (orderListener != NULL) {
+            orderListener->beginInputUnit(currentElement->sequence);
+        }
     }
     if (twoFiles) {
         // Assert that both elements match.
@@ -724,6 +755,37 @@ PairedReadSupplierFromQueue::getNextReadPair(Read **read0, Read **read1)
         nextReadIndex += 2;
     }
 
+    if (NULL != trimmer) {
+        trimmer->trimPair(*read0, *read1);
+    }
+
     return true;
 }
     
+
+    bool
+PairedReadSupplierFromQueue::peekReadPair(int ahead, Read **read0, Read **read1)
+{
+    //
+    // Only look within the current element(s); the next ones may not have been read yet, and getting them
+    // would change which thread processes them.
+    //
+    if (done || NULL == currentElement || ahead < 1) {
+        return false;
+    }
+
+    int index = nextReadIndex + (twoFiles ? ahead - 1 : 2 * (ahead - 1));
+    if (index + (twoFiles ? 0 : 1) >= currentElement->totalReads) {
+        return false;
+    }
+
+    if (twoFiles) {
+        *read0 = &currentElement->reads[index];
+        *read1 = &currentSecondElement->reads[index];
+    } else {
+        *read0 = &currentElement->reads[index];
+        *read1 = &currentElement->reads[index + 1];
+    }
+
+    return true;
+}
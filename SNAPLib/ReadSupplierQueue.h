@@ -58,6 +58,7 @@ struct ReadQueueElement {
     int                 totalReads;
     Read*               reads;
     BatchVector         batches;
+    _int64              sequence;   // input order, assigned as the element is handed to a supplier
 
     void addToTail(ReadQueueElement *queueHead) {
         next = queueHead;
@@ -145,6 +146,7 @@ private:
     int                 nReadersRunning;
     int                 nSuppliersRunning;
     volatile bool       allReadsQueued;
+    _int64              nextSequence;       // sequence number of the next element handed out
 
     ReadQueueElement* getEmptyElement(); // must hold the lock to call this
 
@@ -190,12 +192,16 @@ public:
     virtual bool releaseBatch(DataBatch batch)
     { return queue->releaseBatch(batch); }
 
+    virtual void setInputOrderListener(InputOrderListener* listener)
+    { orderListener = listener; }
+
 private:
     bool                done;
     ReadSupplierQueue   *queue;
     bool                outOfReads;
     ReadQueueElement    *currentElement;
     int                 nextReadIndex;          
+    InputOrderListener  *orderListener;
 };
 
 class PairedReadSupplierFromQueue: public PairedReadSupplier {
@@ -205,12 +211,17 @@ public:
 
     bool getNextReadPair(Read **read0, Read **read1);
 
+    bool peekReadPair(int ahead, Read **read0, Read **read1);
+
     virtual void holdBatch(DataBatch batch)
     { queue->holdBatch(batch); }
 
     virtual bool releaseBatch(DataBatch batch)
     { return queue->releaseBatch(batch); }
 
+    virtual void setInputOrderListener(InputOrderListener* listener)
+    { orderListener = listener; }
+
 private:
     ReadSupplierQueue   *queue;
     bool                done;
@@ -218,4 +229,6 @@ private:
     ReadQueueElement    *currentElement;
     ReadQueueElement    *currentSecondElement;
     int                 nextReadIndex;          
+    InputOrderListener  *orderListener;
+    const ReadTrimmer   *trimmer;               // Trims adapter found by mate overlap, or NULL
 };
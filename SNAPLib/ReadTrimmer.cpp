@@ -0,0 +1,249 @@
+/*++
+
+Module Name:
+
+    ReadTrimmer.cpp
+
+Abstract:
+
+    Adapter and quality trimming of reads as they come out of the readers.
+
+    Adapters are found by comparing a k-mer from the start of the adapter against each position
+    in the read, 16 bases at a time with SSE2, and then checking the rest of the overlap with the
+    adapter for a low enough error rate.  Adapter prefixes too short for the k-mer are checked at the
+    very end of the read.  For pairs, a fragment shorter than the reads shows up as the first read
+    overlapping the start of the reverse complement of the second; anything past the end of the
+    fragment in either read is adapter, whether or not it matches the adapter sequence.
+
+    Quality trimming uses a sliding window, cutting the read where the mean quality in the window
+    first drops below the threshold.
+
+Environment:
+
+    User mode service.
+
+Revision History:
+
+
+--*/
+
+#include "stdafx.h"
+#include "ReadTrimmer.h"
+
+#if (defined(__SSE2__) || defined(_M_X64)) && !defined(__APPLE__)
+#include <emmintrin.h>
+#define TRIM_USE_SSE2
+#endif
+
+using std::min;
+
+    static inline unsigned
+CountBits16(
+    unsigned x)
+{
+    x = x - ((x >> 1) & 0x5555);
+    x = (x & 0x3333) + ((x >> 2) & 0x3333);
+    x = (x + (x >> 4)) & 0x0f0f;
+    return (x + (x >> 8)) & 0x1f;
+}
+
+ReadTrimmer::ReadTrimmer(
+    const char      *i_adapter,
+    unsigned        i_qualityWindow,
+    unsigned        i_qualityThreshold,
+    bool            i_pairedOverlap,
+    bool            i_hardTrim)
+    : qualityWindow(i_qualityWindow), qualityThreshold(i_qualityThreshold), pairedOverlap(i_pairedOverlap), hardTrim(i_hardTrim)
+{
+    if (NULL == i_adapter) {
+        adapter = NULL;
+        adapterLength = kmerLength = 0;
+    } else {
+        adapterLength = (unsigned)strlen(i_adapter);
+        kmerLength = min(adapterLength, 16u);
+
+        //
+        // Pad with 16 zeroes so that the k-mer can always be loaded as a whole vector.
+        //
+        adapter = new char[adapterLength + 16];
+        memset(adapter, 0, adapterLength + 16);
+        for (unsigned i = 0; i < adapterLength; i++) {
+            adapter[i] = TO_UPPER_CASE_DOT_TO_N[(unsigned char)i_adapter[i]];
+        }
+    }
+}
+
+ReadTrimmer::~ReadTrimmer()
+{
+    delete [] adapter;
+}
+
+    unsigned
+ReadTrimmer::countMismatches(
+    const char      *a,
+    const char      *b,
+    unsigned        length,
+    unsigned        limit)
+{
+    unsigned mismatches = 0;
+    unsigned i = 0;
+#ifdef TRIM_USE_SSE2
+    for (; i + 16 <= length; i += 16) {
+        __m128i equal = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i)), _mm_loadu_si128((const __m128i *)(b + i)));
+        mismatches += CountBits16(~_mm_movemask_epi8(equal) & 0xffff);
+        if (mismatches > limit) {
+            return mismatches;
+        }
+    }
+#endif
+    for (; i < length; i++) {
+        mismatches += a[i] != b[i];
+    }
+    return mismatches;
+}
+
+    unsigned
+ReadTrimmer::findAdapter(
+    const char      *data,
+    unsigned        length) const
+{
+    unsigned maxKmerMismatches = kmerLength >= 8 ? 1 : 0;
+    unsigned pos = 0;
+
+#ifdef TRIM_USE_SSE2
+    __m128i kmer = _mm_loadu_si128((const __m128i *)adapter);
+    unsigned kmerMask = (1u << kmerLength) - 1;
+    for (; pos + 16 <= length; pos++) {
+        __m128i equal = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(data + pos)), kmer);
+        if (CountBits16(~_mm_movemask_epi8(equal) & kmerMask) <= maxKmerMismatches) {
+            unsigned overlap = min(adapterLength, length - pos);
+            unsigned allowed = overlap * MaxErrorRatePercent / 100;
+            if (countMismatches(data + pos, adapter, overlap, allowed) <= allowed) {
+                return pos;
+            }
+        }
+    }
+#endif
+
+    for (; pos + kmerLength <= length; pos++) {
+        if (countMismatches(data + pos, adapter, kmerLength, maxKmerMismatches) <= maxKmerMismatches) {
+            unsigned overlap = min(adapterLength, length - pos);
+            unsigned allowed = overlap * MaxErrorRatePercent / 100;
+            if (countMismatches(data + pos, adapter, overlap, allowed) <= allowed) {
+                return pos;
+            }
+        }
+    }
+
+    //
+    // The read may end with a prefix of the adapter that's shorter than the k-mer.
+    //
+    for (; pos + MinAdapterOverlap <= length; pos++) {
+        unsigned overlap = length - pos;
+        unsigned allowed = overlap * MaxErrorRatePercent / 100;
+        if (countMismatches(data + pos, adapter, overlap, allowed) <= allowed) {
+            return pos;
+        }
+    }
+
+    return length;
+}
+
+    unsigned
+ReadTrimmer::findQualityCut(
+    const char      *quality,
+    unsigned        length) const
+{
+    if (0 == length) {
+        return 0;
+    }
+
+    unsigned window = min(qualityWindow, length);
+    unsigned required = (qualityThreshold + 33) * window;
+    unsigned sum = 0;
+    for (unsigned i = 0; i < window; i++) {
+        sum += (unsigned char)quality[i];
+    }
+
+    for (unsigned start = 0; ; start++) {
+        if (sum < required) {
+            //
+            // Keep any good bases at the start of the failing window.
+            //
+            unsigned cut = start;
+            while (cut < length && (unsigned char)quality[cut] >= qualityThreshold + 33) {
+                cut++;
+            }
+            return cut;
+        }
+        if (start + window >= length) {
+            return length;
+        }
+        sum += (unsigned char)quality[start + window];
+        sum -= (unsigned char)quality[start];
+    }
+}
+
+    void
+ReadTrimmer::trim(
+    Read            *read) const
+{
+    unsigned length = read->getDataLength();
+    unsigned keep = length;
+
+    if (NULL != adapter) {
+        keep = findAdapter(read->getData(), length);
+    }
+
+    if (0 != qualityWindow) {
+        keep = findQualityCut(read->getQuality(), keep);
+    }
+
+    if (keep < length) {
+        read->trim(0, length - keep, hardTrim);
+    }
+}
+
+    void
+ReadTrimmer::trimPair(
+    Read            *read0,
+    Read            *read1) const
+{
+    if (!pairedOverlap) {
+        return;
+    }
+
+    unsigned length0 = read0->getDataLength();
+    unsigned length1 = read1->getDataLength();
+    if (length0 < MinPairOverlap || length1 < MinPairOverlap) {
+        return;
+    }
+
+    //
+    // The fragment is the end of the reverse complement of read1, starting at offset, and the start of read0.
+    // Take the first (i.e., longest) fragment that fits.
+    //
+    read1->becomeRC();
+    const char *mate = read1->getData();
+    unsigned fragmentLength = 0;
+    for (unsigned offset = 0; offset + MinPairOverlap <= length1; offset++) {
+        unsigned overlap = min(length0, length1 - offset);
+        unsigned allowed = overlap * MaxErrorRatePercent / 100;
+        if (countMismatches(read0->getData(), mate + offset, overlap, allowed) <= allowed) {
+            fragmentLength = length1 - offset;
+            break;
+        }
+    }
+    read1->becomeRC();
+
+    if (0 == fragmentLength) {
+        return;
+    }
+
+    if (length0 > fragmentLength) {
+        read0->trim(0, length0 - fragmentLength, hardTrim);
+    }
+    if (length1 > fragmentLength) {
+        read1->trim(0, length1 - fragmentLength, hardTrim);
+    }
+}
@@ -0,0 +1,68 @@
+/*++
+
+Module Name:
+
+    ReadTrimmer.h
+
+Abstract:
+
+    Adapter and quality trimming of reads as they come out of the readers, so that
+    a separate trimming pass over the input isn't needed.
+
+Environment:
+
+    User mode service.
+
+Revision History:
+
+
+--*/
+
+#pragma once
+#include "Compat.h"
+#include "Read.h"
+
+class ReadTrimmer {
+public:
+
+    //
+    // adapter may be NULL for no adapter trimming, and qualityWindow 0 for no quality trimming.
+    // qualityThreshold is a phred score (not offset by 33).
+    //
+    ReadTrimmer(const char *i_adapter, unsigned i_qualityWindow, unsigned i_qualityThreshold, bool i_pairedOverlap, bool i_hardTrim);
+    ~ReadTrimmer();
+
+    //
+    // Trim adapter and low quality bases from the 3' end of a single read.
+    //
+    void trim(Read *read) const;
+
+    //
+    // Detect short fragments by overlapping the mates, and trim the adapter read through from both ends.
+    //
+    void trimPair(Read *read0, Read *read1) const;
+
+    bool trimsPairs() const {return pairedOverlap;}
+
+    //
+    // Count mismatching bytes, stopping early once there are more than limit.  Uses SSE2 when available.
+    //
+    static unsigned countMismatches(const char *a, const char *b, unsigned length, unsigned limit);
+
+private:
+
+    unsigned findAdapter(const char *data, unsigned length) const;
+    unsigned findQualityCut(const char *quality, unsigned length) const;
+
+    char                *adapter;
+    unsigned            adapterLength;
+    unsigned            kmerLength;         // the prefix of the adapter used to find candidates, at most 16
+    unsigned            qualityWindow;
+    unsigned            qualityThreshold;
+    bool                pairedOverlap;
+    bool                hardTrim;
+
+    static const unsigned MinAdapterOverlap = 3;        // shortest adapter prefix trimmed at the very end of a read
+    static const unsigned MaxErrorRatePercent = 10;     // mismatches allowed in an adapter or mate overlap
+    static const unsigned MinPairOverlap = 30;          // shortest mate overlap believed
+};
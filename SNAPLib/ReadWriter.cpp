@@ -35,12 +35,16 @@ class SimpleReadWriter : public ReadWriter
 {
 public:
     SimpleReadWriter(const FileFormat* i_format, DataWriter* i_writer, const Genome* i_genome)
-        : format(i_format), writer(i_writer), genome(i_genome)
-    {}
+        : format(i_format), writer(i_writer), genome(i_genome), resultCapacity(0), resultBytes(NULL), resultLocations(NULL)
+    {
+        reserveResults(InitialResultCapacity);
+    }
 
     virtual ~SimpleReadWriter()
     {
         delete writer;
+        delete[] resultBytes;
+        delete[] resultLocations;
     }
 
 	virtual bool writeHeader(const ReaderContext& context, bool sorted, int argc, const char **argv, const char *version, const char *rgLine, bool omitSQLines);
@@ -52,13 +56,43 @@ public:
 
     virtual void close();
 
+    virtual InputOrderListener* getInputOrderListener()
+    { return writer->getInputOrderListener(); }
+
 private:
+    // make room for at least n alignments in resultBytes & resultLocations
+    void reserveResults(int n);
+
+    static const int InitialResultCapacity = 4000;
+
     const FileFormat* format;
     DataWriter* writer;
     const Genome* genome;
     LandauVishkinWithCigar lvc;
+
+    //
+    // The size and final location of each alignment being written, kept until they all fit and can be committed.
+    // These only grow, to the largest set of alignments this thread has written, so writing doesn't allocate.
+    //
+    int resultCapacity;
+    size_t* resultBytes;
+    GenomeLocation* resultLocations;
 };
 
+    void
+SimpleReadWriter::reserveResults(
+    int n)
+{
+    if (n <= resultCapacity) {
+        return;
+    }
+    resultCapacity = __max(n, 2 * resultCapacity);
+    delete[] resultBytes;
+    delete[] resultLocations;
+    resultBytes = new size_t[resultCapacity];
+    resultLocations = new GenomeLocation[resultCapacity];
+}
+
     bool
 SimpleReadWriter::writeHeader(
     const ReaderContext& context,
@@ -136,27 +170,11 @@ SimpleReadWriter::writeReads(
     }
 
     //
-    // We need to keep track of the offsets of all of the alignments in the output buffer so we can commit them.  However,
-    // we want to avoid dynamic memory allocation as much as possible.  So, we have a static buffer on the stack that's big enough
-    // for the great majority of cases, and then allocate dynamically if that's too small.  Makes for annoying, but efficient
-    // code.
+    // We need to keep track of the offsets of all of the alignments in the output buffer so we can commit them.
     //
-
-    const int staticUsedBufferSize = 2000;
-    size_t staticUsedBuffer[staticUsedBufferSize];
-
-    GenomeLocation staticFinalLocationsBuffer[staticUsedBufferSize];
-
-    size_t *usedBuffer;
-    GenomeLocation *finalLocations;
-    if (nResults <= staticUsedBufferSize) {
-        usedBuffer = staticUsedBuffer;
-        finalLocations = staticFinalLocationsBuffer;
-    } else {
-        usedBuffer = new size_t[nResults];
-        finalLocations = new GenomeLocation[nResults];
-    }
-
+    reserveResults(nResults);
+    size_t *usedBuffer = resultBytes;
+    GenomeLocation *finalLocations = resultLocations;
 
     for (int pass = 0; pass < 2; pass++) { // Make two passes, one with whatever buffer space is left and one with a clean buffer.
         bool blewBuffer = false;
@@ -242,14 +260,6 @@ SimpleReadWriter::writeReads(
     } // for each pass (i.e., not empty, empty buffer)
     
 done:
-    if (usedBuffer != staticUsedBuffer) {
-        delete[] usedBuffer;
-        usedBuffer = NULL;
-
-        delete[] finalLocations;
-        finalLocations = NULL;
-    }
-
     read->setAdditionalFrontClipping(0);
 
     return result;
@@ -272,23 +282,13 @@ SimpleReadWriter::writePairs(
     // existing buffer, and then into a clean one.  If that doesn't work, abort the alignment
     // run and ask for a bigger write buffer.
     //
-    const int staticUsedBufferSize = 2000;
-    size_t staticUsedBuffer[NUM_READS_PER_PAIR][staticUsedBufferSize];
-    GenomeLocation staticLocationBuffer[NUM_READS_PER_PAIR][staticUsedBufferSize];
-
+    reserveResults(nResults * NUM_READS_PER_PAIR + nSingleResults[0] + nSingleResults[1]);
     GenomeLocation *finalLocations[NUM_READS_PER_PAIR];
     size_t *usedBuffer[NUM_READS_PER_PAIR];
-    if (nResults + nSingleResults[0] <= staticUsedBufferSize && nResults + nSingleResults[1] <= staticUsedBufferSize) {
-        usedBuffer[0] = staticUsedBuffer[0];
-        usedBuffer[1] = staticUsedBuffer[1];
-        finalLocations[0] = staticLocationBuffer[0];
-        finalLocations[1] = staticLocationBuffer[1];
-    } else {
-        usedBuffer[0] = new size_t[nResults * NUM_READS_PER_PAIR + nSingleResults[0] + nSingleResults[1]];
-        usedBuffer[1] = usedBuffer[0] + nResults + nSingleResults[0];
-        finalLocations[0] = new GenomeLocation[nResults * NUM_READS_PER_PAIR + nSingleResults[0] + nSingleResults[1]];
-        finalLocations[1] = finalLocations[0] + nResults + nSingleResults[0];
-    }
+    usedBuffer[0] = resultBytes;
+    usedBuffer[1] = usedBuffer[0] + nResults + nSingleResults[0];
+    finalLocations[0] = resultLocations;
+    finalLocations[1] = finalLocations[0] + nResults + nSingleResults[0];
 
 
     //
@@ -491,14 +491,6 @@ blownBuffer:
 
 
 done:
-    if (usedBuffer[0] != staticUsedBuffer[0]) {
-        delete[] usedBuffer[0];
-        usedBuffer[0] = usedBuffer[1] = NULL;
-
-        delete[] finalLocations[0];
-        finalLocations[0] = finalLocations[1] = NULL;
-    }
-
     reads[0]->setAdditionalFrontClipping(0);
     reads[1]->setAdditionalFrontClipping(0);
 
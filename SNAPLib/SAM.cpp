@@ -31,6 +31,12 @@ Environment:
 #include "AlignerOptions.h"
 #include "directions.h"
 #include "exit.h"
+#include "ReadTrimmer.h"
+
+#if (defined(__SSE2__) || defined(_M_X64)) && !defined(__APPLE__)
+#include <emmintrin.h>
+#define SAM_USE_SSE2
+#endif
 
 using std::max;
 using std::min;
@@ -111,6 +117,57 @@ SAMReader::skipToBeyondNextFieldSeparator(char *str, const char *endOfBuffer, si
 }
 
 
+    char *
+SAMReader::findAuxField(
+    char *aux,
+    size_t auxLen,
+    const char *tag,
+    size_t *o_fieldLength)
+{
+    //
+    // A field starts at the beginning or after a tab, and is TG:
+    //
+    char *field = NULL;
+    if (auxLen >= 3 && aux[0] == tag[0] && aux[1] == tag[1] && aux[2] == ':') {
+        field = aux;
+    } else {
+        size_t i = 1;
+#ifdef SAM_USE_SSE2
+        //
+        // Check 16 positions at a time for tab, tag[0], tag[1], ':'.  OQ, BQ and MD fields can be longer than the read,
+        // so this is most of the work.
+        //
+        __m128i tab = _mm_set1_epi8('\t');
+        __m128i tag0 = _mm_set1_epi8(tag[0]);
+        __m128i tag1 = _mm_set1_epi8(tag[1]);
+        __m128i colon = _mm_set1_epi8(':');
+        for (; i + 18 <= auxLen; i += 16) {
+            __m128i match = _mm_and_si128(
+                _mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(aux + i - 1)), tab), _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(aux + i)), tag0)),
+                _mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(aux + i + 1)), tag1), _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(aux + i + 2)), colon)));
+            unsigned mask = _mm_movemask_epi8(match);
+            if (mask != 0) {
+                unsigned long offset;
+                CountTrailingZeroes((_uint64)mask, offset);
+                field = aux + i + offset;
+                break;
+            }
+        }
+#endif  // SAM_USE_SSE2
+        for (; NULL == field && i + 3 <= auxLen; i++) {
+            if (aux[i - 1] == '\t' && aux[i] == tag[0] && aux[i + 1] == tag[1] && aux[i + 2] == ':') {
+                field = aux + i;
+            }
+        }
+    }
+
+    if (NULL != field && NULL != o_fieldLength) {
+        const char *end = (const char *)memchr(field, '\t', aux + auxLen - field);
+        *o_fieldLength = (NULL == end ? aux + auxLen : end) - field;
+    }
+    return field;
+}
+
     SAMReader *
 SAMReader::create(
     DataSupplier* supplier,
@@ -250,6 +307,7 @@ SAMReader::parseHeader(
                 }
                 if (snStart[3+i] == ' ' || snStart[3+i] == '\t' || snStart[3+i] == '\n' || snStart[3+i] == 0) {
                     contigName[i] = '\0';
+                    break;  // Otherwise this copies the whole rest of the header for every @SQ line
                 } else {
                     contigName[i] = snStart[3+i];
                 }
@@ -428,11 +486,8 @@ SAMReader::getReadFromLine(
                 n--;
             }
             read->setAuxiliaryData(field[OPT], n);
-            for (char* p = field[OPT]; p != NULL && p < field[OPT] + fieldLength[OPT]; p = SAMReader::skipToBeyondNextFieldSeparator(p, field[OPT] + fieldLength[OPT])) {
-                if (strncmp(p, "RG:Z:", 5) == 0) {
-                    read->setReadGroup(READ_GROUP_FROM_AUX);
-                    break;
-                }
+            if (n > 0) {
+                read->setReadGroup(READ_GROUP_FROM_AUX);
             }
         }
     }
@@ -629,6 +684,9 @@ SAMReader::getNextRead(
     } while ((context.ignoreSecondaryAlignments && ((*flag) & SAM_SECONDARY)) ||
              (context.ignoreSupplementaryAlignments && ((*flag) & SAM_SUPPLEMENTARY)));
 
+    if (NULL != context.trimmer) {
+        context.trimmer->trim(read);
+    }
     return true;
 }
 
@@ -639,17 +697,17 @@ SAMReader::createReadSupplierGenerator(
     const ReaderContext& context)
 {
     //
-    // single-ended SAM files always can be read with the range splitter, unless reading from stdin, which needs a queue
+    // single-ended SAM files always can be read with the range splitter, unless reading from stdin or a pipe, which needs a queue
     //
-    if (!strcmp(fileName, "-")) {
+    if (IsStreamingInput(fileName)) {
         //
-        // Stdin must run from a queue, not range splitter.
+        // Stdin and pipes must run from a queue, not range splitter.
         //
         ReadReader* reader;
         //
         // Because we can only have one stdin reader, we need to use a queue if we're reading from stdin
         //
-        reader = SAMReader::create(DataSupplier::Stdio, "-", ReadSupplierQueue::BufferCount(numThreads), context, 0, 0);
+        reader = SAMReader::create(DataSupplier::Stdio, fileName, ReadSupplierQueue::BufferCount(numThreads), context, 0, 0);
    
         if (reader == NULL) {
             return NULL;
@@ -674,7 +732,7 @@ SAMReader::createPairedReader(
     const ReaderContext& context)
 {
     DataSupplier *data;
-    if (!strcmp("-", fileName)) {
+    if (IsStreamingInput(fileName)) {
         data = DataSupplier::Stdio;
     } else {
         data = DataSupplier::Default;
@@ -878,11 +936,16 @@ SAMFormat::getWriterSupplier(
         char* tempFileName = (char*) malloc(5 + len);
         strcpy(tempFileName, options->outputFile.fileName);
         strcpy(tempFileName + len, ".tmp");
+        // ordered output has a single writer into the sorter, so size its buffers as for one thread
         dataSupplier = DataWriterSupplier::sorted(this, genome, tempFileName, options->sortMemory * (1ULL << 30),
-            options->numThreads, options->outputFile.fileName, NULL, options->writeBufferSize);
+            options->orderedOutput ? 1 : options->numThreads, options->outputFile.fileName, NULL, options->writeBufferSize,
+            options->sortSpillDirectories);
     } else {
         dataSupplier = DataWriterSupplier::create(options->outputFile.fileName, options->writeBufferSize);
     }
+    if (options->orderedOutput) {
+        dataSupplier = DataWriterSupplier::ordered(dataSupplier, options->writeBufferSize, 2 * options->numThreads + 2);
+    }
     return ReadWriterSupplier::create(this, dataSupplier, genome);
 }
 
@@ -1270,26 +1333,29 @@ SAMFormat::writeRead(
     static bool warningPrinted = false;
     const char* readGroupSeparator = "";
     const char* readGroupString = "";
+    const char* readGroup = read->getReadGroup();
     if (aux != NULL && (! auxSAM)) {
         if (! warningPrinted) {
             WriteErrorMessage( "warning: translating optional fields from BAM->SAM not yet implemented, optional fields will not be included in output\n");
             warningPrinted = true;
         }
-        if (read->getReadGroup() == READ_GROUP_FROM_AUX) {
-            for (BAMAlignAux* bamAux = (BAMAlignAux*) aux; (char*) bamAux < aux + auxLen; bamAux = bamAux->next()) {
-                if (bamAux->tag[0] == 'R' && bamAux->tag[1] == 'G' && bamAux->val_type == 'Z') {
-                    readGroupSeparator = "\tRG:Z:";
-                    readGroupString = (char*) bamAux->value();
-                    break;
-                }
+        if (readGroup == READ_GROUP_FROM_AUX) {
+            BAMAlignAux* bamAux = BAMAlignAux::find(aux, auxLen, "RG", STRING_VAL_TYPE);
+            if (bamAux != NULL) {
+                readGroupSeparator = "\tRG:Z:";
+                readGroupString = (char*) bamAux->value();
+            } else {
+                readGroup = context.defaultReadGroup;
             }
         }
         aux = NULL;
         auxLen = 0;
+    } else if (readGroup == READ_GROUP_FROM_AUX && (aux == NULL || NULL == SAMReader::findAuxField(aux, auxLen, "RG"))) {
+        readGroup = context.defaultReadGroup;
     }
     const char* rglineAux = "";
     int rglineAuxLen = 0;
-    if (read->getReadGroup() != NULL && read->getReadGroup() != READ_GROUP_FROM_AUX) {
+    if (readGroup != NULL && readGroup != READ_GROUP_FROM_AUX) {
         if (*readGroupString == 0 || strcmp(readGroupString, context.defaultReadGroup) == 0) {
             readGroupSeparator = "";
             readGroupString = "";
@@ -1297,7 +1363,7 @@ SAMFormat::writeRead(
             rglineAuxLen = context.defaultReadGroupAuxLen;
         } else {
             readGroupSeparator = "\tRG:Z:";
-            readGroupString = read->getReadGroup();
+            readGroupString = readGroup;
         }
     }
     int charsInString = snprintf(buffer, bufferSpace, "%.*s\t%d\t%s\t%u\t%d\t%s\t%s\t%u\t%lld\t%.*s\t%.*s%s%.*s%s%s\tPG:Z:SNAP%s%.*s\n",
@@ -90,6 +90,13 @@ public:
         
         static char* skipToBeyondNextFieldSeparator(char *str, const char *endOfBuffer, size_t *o_charsUntilFirstSeparator = NULL);
 
+        //
+        // Find the optional field with the given two character tag (e.g., "RG") in tab-separated SAM optional fields,
+        // returning a pointer to its start ("RG:Z:...") and its length, or NULL.  Readers just record where the optional
+        // fields are, and consumers look up the tags they need with this.
+        //
+        static char* findAuxField(char *aux, size_t auxLen, const char *tag, size_t *o_fieldLength = NULL);
+
 
 protected:
 
@@ -218,13 +225,14 @@ public:
         GenomeDistance *o_extraBasesClippedAfter, 
         GenomeLocation genomeLocation, bool useM, int * o_editDistance, int *o_cigarBufUsed, int * o_addFrontClipping);
 
-private:
+    // CIGAR as it's written in the SAM line, with clipping; also used by BatchAligner
     static const char * computeCigarString(const Genome * genome, LandauVishkinWithCigar * lv,
         char * cigarBuf, int cigarBufLen, char * cigarBufWithClipping, int cigarBufWithClippingLen,
         const char * data, GenomeDistance dataLength, unsigned basesClippedBefore, GenomeDistance extraBasesClippedBefore, unsigned basesClippedAfter, 
         unsigned frontHardClipped, unsigned backHardClipped,
         GenomeLocation genomeLocation, Direction direction, bool useM, int * o_editDistance, int * o_addFrontClipping);
 
+private:
 #ifdef _DEBUG
 	static void validateCigarString(const Genome *genome, const char * cigarBuf, int cigarBufLen, const char *data, GenomeDistance dataLength, GenomeLocation genomeLocation, Direction direction, bool useM);
 #else	// DEBUG
@@ -28,6 +28,9 @@ static SeedSequencer *Sequencers[LargestSeedSize + 1];
 
 void InitializeSeedSequencers()
 {
+    if (NULL != Sequencers[1]) {
+        return; // Already done, e.g., by the program embedding a BatchAligner
+    }
     for (unsigned i = 1; i <= LargestSeedSize; i++) {
         Sequencers[i] = new SeedSequencer(i);
     }
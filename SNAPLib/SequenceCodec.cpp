@@ -0,0 +1,490 @@
+/*++
+
+Module Name:
+
+    SequenceCodec.cpp
+
+Abstract:
+
+    Vectorized base packing, reverse complement and quality conversion kernels.
+
+Environment:
+
+    User mode service.
+
+Revision History:
+
+
+--*/
+
+#include "stdafx.h"
+#include "SequenceCodec.h"
+
+//
+// pshufb is SSSE3, which isn't in the x86-64 baseline, so compile the kernels for it explicitly
+// and check for it at run time.
+//
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#include <tmmintrin.h>
+#define CODEC_USE_SSSE3
+#define CODEC_TARGET
+    static bool
+ProcessorHasSSSE3()
+{
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 9)) != 0;
+}
+#elif (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && !defined(__APPLE__)
+#include <tmmintrin.h>
+#define CODEC_USE_SSSE3
+#define CODEC_TARGET __attribute__((target("ssse3")))
+    static bool
+ProcessorHasSSSE3()
+{
+    __builtin_cpu_init();   // we can run before main
+    return __builtin_cpu_supports("ssse3") != 0;
+}
+#else
+    static bool
+ProcessorHasSSSE3()
+{
+    return false;
+}
+#endif
+
+static const char *CodeToBase =   "=ACMGRSVTWYHKDBN";
+static const char *CodeToBaseRC = "NTGKCYWBASRDMHVN";
+
+static _uint8 BaseToCode[256];
+
+static bool
+InitBaseToCode()
+{
+    memset(BaseToCode, 0, sizeof(BaseToCode));
+    for (int i = 1; i < 16; i++) {
+        BaseToCode[(_uint8)CodeToBase[i]] = i;
+    }
+    return true;
+}
+
+static bool BaseToCodeInitialized = InitBaseToCode();
+
+bool SequenceCodec::useVector = ProcessorHasSSSE3();
+
+    void
+SequenceCodec::setVectorized(
+    bool value)
+{
+    useVector = value && ProcessorHasSSSE3();
+}
+
+#ifdef CODEC_USE_SSSE3
+
+//
+// ACGTN all have distinct low nibbles (A=1, C=3, T=4, G=7, N=e), so one pshufb on the low nibble can both
+// translate them and, by translating back and comparing, tell whether a block has anything else in it.
+// Entries for other nibbles are chosen so that they can never compare equal to the input byte.
+//
+#define X(i) ((char)(0x80 | (((i) + 1) & 0xf)))
+static const char LowNibbleToBase[16] =   {X(0), 'A', X(2), 'C', 'T', X(5), X(6), 'G', X(8), X(9), X(10), X(11), X(12), X(13), 'N', X(15)};
+static const char LowNibbleToComplement[16] = {0,  'T', 0,    'G', 'A', 0,    0,    'C', 0,    0,    0,     0,     0,     0,     'N', 0};
+static const char LowNibbleToCode[16] =   {0,   1,   0,    2,   8,   0,    0,    4,   0,    0,    0,     0,     0,     0,     15,  0};
+#undef X
+
+static const char ReverseBytes[16] = {15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0};
+
+    static inline CODEC_TARGET bool
+AllACGTN(__m128i bases, __m128i lowNibbles)
+{
+    __m128i check = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)LowNibbleToBase), lowNibbles);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(check, bases)) == 0xffff;
+}
+
+    static CODEC_TARGET int
+PackBasesSSSE3(_uint8 *o_nibbles, const char *bases, int length)
+{
+    __m128i lowMask = _mm_set1_epi8(0x0f);
+    __m128i evenMask = _mm_set1_epi16(0x00ff);
+    __m128i toCode = _mm_loadu_si128((const __m128i *)LowNibbleToCode);
+    int i;
+    for (i = 0; i + 16 <= length; i += 16) {
+        __m128i in = _mm_loadu_si128((const __m128i *)(bases + i));
+        __m128i low = _mm_and_si128(in, lowMask);
+        if (! AllACGTN(in, low)) {
+            for (int j = i; j < i + 16; j += 2) {
+                o_nibbles[j / 2] = (BaseToCode[(_uint8)bases[j]] << 4) | BaseToCode[(_uint8)bases[j + 1]];
+            }
+            continue;
+        }
+        __m128i codes = _mm_shuffle_epi8(toCode, low);
+        // Each 16 bit lane has the first base of a pair in its low byte (little endian), which goes in the high nibble.
+        __m128i pairs = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(codes, evenMask), 4), _mm_srli_epi16(codes, 8));
+        _mm_storel_epi64((__m128i *)(o_nibbles + i / 2), _mm_packus_epi16(pairs, pairs));
+    }
+    return i;
+}
+
+    static CODEC_TARGET int
+UnpackBasesSSSE3(char *o_bases, const _uint8 *nibbles, int length)
+{
+    __m128i lowMask = _mm_set1_epi8(0x0f);
+    __m128i table = _mm_loadu_si128((const __m128i *)CodeToBase);
+    int i;
+    for (i = 0; i + 32 <= length; i += 32) {
+        __m128i in = _mm_loadu_si128((const __m128i *)(nibbles + i / 2));
+        __m128i first = _mm_shuffle_epi8(table, _mm_and_si128(_mm_srli_epi16(in, 4), lowMask));
+        __m128i second = _mm_shuffle_epi8(table, _mm_and_si128(in, lowMask));
+        _mm_storeu_si128((__m128i *)(o_bases + i), _mm_unpacklo_epi8(first, second));
+        _mm_storeu_si128((__m128i *)(o_bases + i + 16), _mm_unpackhi_epi8(first, second));
+    }
+    return i;
+}
+
+    static CODEC_TARGET int
+UnpackBasesRCSSSE3(char *o_bases, const _uint8 *nibbles, int length)
+{
+    __m128i lowMask = _mm_set1_epi8(0x0f);
+    __m128i table = _mm_loadu_si128((const __m128i *)CodeToBaseRC);
+    __m128i reverseBytes = _mm_loadu_si128((const __m128i *)ReverseBytes);
+    int i;
+    for (i = 0; i + 32 <= length; i += 32) {
+        __m128i in = _mm_loadu_si128((const __m128i *)(nibbles + i / 2));
+        __m128i first = _mm_shuffle_epi8(table, _mm_and_si128(_mm_srli_epi16(in, 4), lowMask));
+        __m128i second = _mm_shuffle_epi8(table, _mm_and_si128(in, lowMask));
+        _mm_storeu_si128((__m128i *)(o_bases + length - i - 16), _mm_shuffle_epi8(_mm_unpacklo_epi8(first, second), reverseBytes));
+        _mm_storeu_si128((__m128i *)(o_bases + length - i - 32), _mm_shuffle_epi8(_mm_unpackhi_epi8(first, second), reverseBytes));
+    }
+    return i;
+}
+
+    static CODEC_TARGET unsigned
+ReverseComplementSSSE3(char *o_rc, const char *bases, unsigned length, const char *complement)
+{
+    __m128i lowMask = _mm_set1_epi8(0x0f);
+    __m128i toComplement = _mm_loadu_si128((const __m128i *)LowNibbleToComplement);
+    __m128i reverseBytes = _mm_loadu_si128((const __m128i *)ReverseBytes);
+    unsigned i;
+    for (i = 0; i + 16 <= length; i += 16) {
+        const char *from = bases + length - i - 16;
+        __m128i in = _mm_loadu_si128((const __m128i *)from);
+        __m128i low = _mm_and_si128(in, lowMask);
+        if (! AllACGTN(in, low)) {
+            for (unsigned j = 0; j < 16; j++) {
+                o_rc[i + j] = complement[(_uint8)from[15 - j]];
+            }
+            continue;
+        }
+        _mm_storeu_si128((__m128i *)(o_rc + i), _mm_shuffle_epi8(_mm_shuffle_epi8(toComplement, low), reverseBytes));
+    }
+    return i;
+}
+
+    static CODEC_TARGET unsigned
+ReverseSSSE3(char *o_reversed, const char *data, unsigned length)
+{
+    __m128i reverseBytes = _mm_loadu_si128((const __m128i *)ReverseBytes);
+    unsigned i;
+    for (i = 0; i + 16 <= length; i += 16) {
+        __m128i in = _mm_loadu_si128((const __m128i *)(data + length - i - 16));
+        _mm_storeu_si128((__m128i *)(o_reversed + i), _mm_shuffle_epi8(in, reverseBytes));
+    }
+    return i;
+}
+
+    static inline CODEC_TARGET void
+ReverseStore(char *to, __m128i data, __m128i reverseBytes)
+{
+    _mm_storeu_si128((__m128i *)to, _mm_shuffle_epi8(data, reverseBytes));
+}
+
+    static CODEC_TARGET unsigned
+PrepareReadSSSE3(char *o_rc, char *o_rcQuality, char *o_reversed, char *o_complement,
+                 const char *bases, const char *quality, unsigned length, const char *complement, unsigned *o_nCount)
+{
+    __m128i lowMask = _mm_set1_epi8(0x0f);
+    __m128i toComplement = _mm_loadu_si128((const __m128i *)LowNibbleToComplement);
+    __m128i reverseBytes = _mm_loadu_si128((const __m128i *)ReverseBytes);
+    __m128i n = _mm_set1_epi8('N');
+    __m128i one = _mm_set1_epi8(1);
+    __m128i nCount = _mm_setzero_si128();   // two 64 bit counts
+    unsigned i;
+    for (i = 0; i + 16 <= length; i += 16) {
+        unsigned to = length - i - 16;
+        __m128i in = _mm_loadu_si128((const __m128i *)(bases + i));
+        __m128i low = _mm_and_si128(in, lowMask);
+        ReverseStore(o_rcQuality + to, _mm_loadu_si128((const __m128i *)(quality + i)), reverseBytes);
+        ReverseStore(o_reversed + to, in, reverseBytes);
+        nCount = _mm_add_epi64(nCount, _mm_sad_epu8(_mm_and_si128(_mm_cmpeq_epi8(in, n), one), _mm_setzero_si128()));
+        if (! AllACGTN(in, low)) {
+            for (unsigned j = 0; j < 16; j++) {
+                char c = complement[(_uint8)bases[i + j]];
+                o_complement[i + j] = c;
+                o_rc[to + 15 - j] = c;
+            }
+            continue;
+        }
+        __m128i complemented = _mm_shuffle_epi8(toComplement, low);
+        _mm_storeu_si128((__m128i *)(o_complement + i), complemented);
+        ReverseStore(o_rc + to, complemented, reverseBytes);
+    }
+    *o_nCount = (unsigned)(_mm_cvtsi128_si32(nCount) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(nCount, nCount)));
+    return i;
+}
+
+    static CODEC_TARGET unsigned
+CountNsSSSE3(const char *bases, unsigned length, unsigned *o_nCount)
+{
+    __m128i n = _mm_set1_epi8('N');
+    __m128i caseBit = _mm_set1_epi8(0x20);
+    __m128i one = _mm_set1_epi8(1);
+    __m128i nCount = _mm_setzero_si128();
+    unsigned i;
+    for (i = 0; i + 16 <= length; i += 16) {
+        __m128i upper = _mm_andnot_si128(caseBit, _mm_loadu_si128((const __m128i *)(bases + i)));   // 'n' -> 'N' (and nothing else -> 'N')
+        nCount = _mm_add_epi64(nCount, _mm_sad_epu8(_mm_and_si128(_mm_cmpeq_epi8(upper, n), one), _mm_setzero_si128()));
+    }
+    *o_nCount = (unsigned)(_mm_cvtsi128_si32(nCount) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(nCount, nCount)));
+    return i;
+}
+
+    static inline CODEC_TARGET __m128i
+QualityFromBAMBlock(__m128i in)
+{
+    // '!' + q for q <= '~' - '!', otherwise '!'
+    __m128i inRange = _mm_cmpeq_epi8(_mm_min_epu8(in, _mm_set1_epi8('~' - '!')), in);
+    return _mm_add_epi8(_mm_and_si128(inRange, in), _mm_set1_epi8('!'));
+}
+
+    static CODEC_TARGET int
+QualityFromBAMSSSE3(char *o_quality, const _uint8 *bamQuality, int length)
+{
+    int i;
+    for (i = 0; i + 16 <= length; i += 16) {
+        _mm_storeu_si128((__m128i *)(o_quality + i), QualityFromBAMBlock(_mm_loadu_si128((const __m128i *)(bamQuality + i))));
+    }
+    return i;
+}
+
+    static CODEC_TARGET int
+QualityFromBAMReversedSSSE3(char *o_quality, const _uint8 *bamQuality, int length)
+{
+    __m128i reverseBytes = _mm_loadu_si128((const __m128i *)ReverseBytes);
+    int i;
+    for (i = 0; i + 16 <= length; i += 16) {
+        __m128i in = _mm_loadu_si128((const __m128i *)(bamQuality + length - i - 16));
+        _mm_storeu_si128((__m128i *)(o_quality + i), _mm_shuffle_epi8(QualityFromBAMBlock(in), reverseBytes));
+    }
+    return i;
+}
+
+    static CODEC_TARGET int
+QualityToBAMSSSE3(char *quality, int length)
+{
+    __m128i offset = _mm_set1_epi8('!');
+    int i;
+    for (i = 0; i + 16 <= length; i += 16) {
+        __m128i in = _mm_loadu_si128((const __m128i *)(quality + i));
+        _mm_storeu_si128((__m128i *)(quality + i), _mm_sub_epi8(in, offset));
+    }
+    return i;
+}
+
+#endif // CODEC_USE_SSSE3
+
+    void
+SequenceCodec::packBases(
+    _uint8 *o_nibbles,
+    const char *bases,
+    int length)
+{
+    int i = 0;
+#ifdef CODEC_USE_SSSE3
+    if (useVector) {
+        i = PackBasesSSSE3(o_nibbles, bases, length);
+    }
+#endif
+    for (; i + 1 < length; i += 2) {
+        o_nibbles[i / 2] = (BaseToCode[(_uint8)bases[i]] << 4) | BaseToCode[(_uint8)bases[i + 1]];
+    }
+    if (i < length) {
+        o_nibbles[i / 2] = BaseToCode[(_uint8)bases[i]] << 4;
+    }
+}
+
+    void
+SequenceCodec::unpackBases(
+    char *o_bases,
+    const _uint8 *nibbles,
+    int length)
+{
+    int i = 0;
+#ifdef CODEC_USE_SSSE3
+    if (useVector) {
+        i = UnpackBasesSSSE3(o_bases, nibbles, length);
+    }
+#endif
+    for (; i + 1 < length; i += 2) {
+        o_bases[i] = CodeToBase[nibbles[i / 2] >> 4];
+        o_bases[i + 1] = CodeToBase[nibbles[i / 2] & 0xf];
+    }
+    if (i < length) {
+        o_bases[i] = CodeToBase[nibbles[i / 2] >> 4];
+    }
+}
+
+    void
+SequenceCodec::unpackBasesRC(
+    char *o_bases,
+    const _uint8 *nibbles,
+    int length)
+{
+    int i = 0;
+#ifdef CODEC_USE_SSSE3
+    if (useVector) {
+        i = UnpackBasesRCSSSE3(o_bases, nibbles, length);
+    }
+#endif
+    for (; i + 1 < length; i += 2) {
+        o_bases[length - i - 1] = CodeToBaseRC[nibbles[i / 2] >> 4];
+        o_bases[length - i - 2] = CodeToBaseRC[nibbles[i / 2] & 0xf];
+    }
+    if (i < length) {
+        o_bases[0] = CodeToBaseRC[nibbles[i / 2] >> 4];
+    }
+}
+
+    void
+SequenceCodec::reverseComplement(
+    char *o_rc,
+    const char *bases,
+    unsigned length,
+    const char *complement)
+{
+    unsigned i = 0;
+#ifdef CODEC_USE_SSSE3
+    if (useVector) {
+        i = ReverseComplementSSSE3(o_rc, bases, length, complement);
+    }
+#endif
+    for (; i < length; i++) {
+        o_rc[i] = complement[(_uint8)bases[length - i - 1]];
+    }
+}
+
+    void
+SequenceCodec::reverse(
+    char *o_reversed,
+    const char *data,
+    unsigned length)
+{
+    unsigned i = 0;
+#ifdef CODEC_USE_SSSE3
+    if (useVector) {
+        i = ReverseSSSE3(o_reversed, data, length);
+    }
+#endif
+    for (; i < length; i++) {
+        o_reversed[i] = data[length - i - 1];
+    }
+}
+
+    unsigned
+SequenceCodec::prepareRead(
+    char *o_rc,
+    char *o_rcQuality,
+    char *o_reversed,
+    char *o_complement,
+    const char *bases,
+    const char *quality,
+    unsigned length,
+    const char *complement)
+{
+    unsigned nCount = 0;
+    unsigned i = 0;
+#ifdef CODEC_USE_SSSE3
+    if (useVector) {
+        i = PrepareReadSSSE3(o_rc, o_rcQuality, o_reversed, o_complement, bases, quality, length, complement, &nCount);
+    }
+#endif
+    for (; i < length; i++) {
+        unsigned to = length - i - 1;
+        char c = complement[(_uint8)bases[i]];
+        o_complement[i] = c;
+        o_rc[to] = c;
+        o_reversed[to] = bases[i];
+        o_rcQuality[to] = quality[i];
+        nCount += bases[i] == 'N';
+    }
+    return nCount;
+}
+
+    unsigned
+SequenceCodec::countNs(
+    const char *bases,
+    unsigned length)
+{
+    unsigned nCount = 0;
+    unsigned i = 0;
+#ifdef CODEC_USE_SSSE3
+    if (useVector) {
+        i = CountNsSSSE3(bases, length, &nCount);
+    }
+#endif
+    for (; i < length; i++) {
+        nCount += bases[i] == 'N' || bases[i] == 'n';
+    }
+    return nCount;
+}
+
+    void
+SequenceCodec::qualityFromBAM(
+    char *o_quality,
+    const _uint8 *bamQuality,
+    int length)
+{
+    int i = 0;
+#ifdef CODEC_USE_SSSE3
+    if (useVector) {
+        i = QualityFromBAMSSSE3(o_quality, bamQuality, length);
+    }
+#endif
+    for (; i < length; i++) {
+        o_quality[i] = bamQuality[i] > '~' - '!' ? '!' : '!' + bamQuality[i];
+    }
+}
+
+    void
+SequenceCodec::qualityFromBAMReversed(
+    char *o_quality,
+    const _uint8 *bamQuality,
+    int length)
+{
+    int i = 0;
+#ifdef CODEC_USE_SSSE3
+    if (useVector) {
+        i = QualityFromBAMReversedSSSE3(o_quality, bamQuality, length);
+    }
+#endif
+    for (; i < length; i++) {
+        _uint8 q = bamQuality[length - i - 1];
+        o_quality[i] = q > '~' - '!' ? '!' : '!' + q;
+    }
+}
+
+    void
+SequenceCodec::qualityToBAM(
+    char *quality,
+    int length)
+{
+    int i = 0;
+#ifdef CODEC_USE_SSSE3
+    if (useVector) {
+        i = QualityToBAMSSSE3(quality, length);
+    }
+#endif
+    for (; i < length; i++) {
+        quality[i] -= '!';
+    }
+}
@@ -0,0 +1,90 @@
+/*++
+
+Module Name:
+
+    SequenceCodec.h
+
+Abstract:
+
+    Vectorized kernels for the per-base conversions that every read goes through: BAM 4-bit
+    base packing and unpacking, reverse complement, BAM <-> SAM quality offsets, and the
+    aligners' per-read setup.
+
+    Each has a scalar version with exactly the same results, which is used when the processor
+    doesn't have SSSE3 (for pshufb), for the ends of buffers, and for blocks containing bases other
+    than ACGTN.
+
+Environment:
+
+    User mode service.
+
+Revision History:
+
+
+--*/
+
+#pragma once
+#include "Compat.h"
+
+class SequenceCodec {
+public:
+
+    //
+    // Pack ASCII bases into BAM 4-bit codes, two per byte, high nibble first.  Bases that aren't
+    // in "=ACMGRSVTWYHKDBN" become 0 (=), as with BAMAlignment::SeqToCode.
+    //
+    static void packBases(_uint8 *o_nibbles, const char *bases, int length);
+
+    //
+    // Unpack BAM 4-bit codes into ASCII bases, optionally reverse complementing them.
+    //
+    static void unpackBases(char *o_bases, const _uint8 *nibbles, int length);
+    static void unpackBasesRC(char *o_bases, const _uint8 *nibbles, int length);
+
+    //
+    // o_rc[i] = complement[bases[length - i - 1]].  complement is a 256 entry translation table that
+    // must map ACGTN the usual way (e.g., COMPLEMENT or an aligner's rcTranslationTable); it's used for
+    // any other characters.  o_rc and bases must not overlap.
+    //
+    static void reverseComplement(char *o_rc, const char *bases, unsigned length, const char *complement);
+
+    //
+    // o_reversed[i] = data[length - i - 1], e.g. for qualities.  Must not overlap.
+    //
+    static void reverse(char *o_reversed, const char *data, unsigned length);
+
+    //
+    // Everything the aligners build from a read before seeding, in one pass over it: o_rc and o_rcQuality as from
+    // reverseComplement and reverse, o_reversed the bases reversed, and o_complement the bases complemented in their
+    // original order (which is o_rc reversed).  Returns the number of 'N's.  None of the outputs may overlap the input.
+    //
+    static unsigned prepareRead(char *o_rc, char *o_rcQuality, char *o_reversed, char *o_complement,
+                                const char *bases, const char *quality, unsigned length, const char *complement);
+
+    //
+    // The number of bases that are 'N' or 'n', as counted with IS_N.
+    //
+    static unsigned countNs(const char *bases, unsigned length);
+
+    //
+    // BAM binary qualities to SAM (phred + 33, with anything too big, including the 0xff "missing" value, as '!'),
+    // optionally reversed.  Same as CIGAR_QUAL_TO_SAM.
+    //
+    static void qualityFromBAM(char *o_quality, const _uint8 *bamQuality, int length);
+    static void qualityFromBAMReversed(char *o_quality, const _uint8 *bamQuality, int length);
+
+    //
+    // SAM qualities to BAM binary, in place (subtract 33).
+    //
+    static void qualityToBAM(char *quality, int length);
+
+    //
+    // Whether the vector versions are in use, and a switch to turn them off for testing and benchmarking.
+    //
+    static bool isVectorized() {return useVector;}
+    static void setVectorized(bool value);
+
+private:
+
+    static bool useVector;
+};
@@ -36,6 +36,7 @@ Revision History:
 #include "Util.h"
 #include "SingleAligner.h"
 #include "MultiInputReadSupplier.h"
+#include "Tracer.h"
 
 using namespace std;
 using util::stringEndsWith;
@@ -70,6 +71,10 @@ SingleAlignerContext::runIterationThread()
         // No work for this thread to do.
         //
         return;
+    }
+    if (NULL != readWriter) {
+        // for ordered output, tell the writer which input unit each read came from
+        supplier->setInputOrderListener(readWriter->getInputOrderListener());
     }
 	if (extension->runIterationThread(supplier, this)) {
 		delete supplier;
@@ -101,17 +106,20 @@ SingleAlignerContext::runIterationThread()
 
     int maxReadSize = MAX_READ_LENGTH;
 
+    //
+    // The secondary result buffer starts small and is grown when the aligner runs out of room, up to the worst case.
+    //
     SingleAlignmentResult *alignmentResults = NULL;
     unsigned alignmentResultBufferCount;
+    unsigned maxAlignmentResultBufferCount;
     if (maxSecondaryAlignmentAdditionalEditDistance < 0) {
-        alignmentResultBufferCount = 1; // For the primary alignment
+        maxAlignmentResultBufferCount = 1; // For the primary alignment
     } else {
-        alignmentResultBufferCount = BaseAligner::getMaxSecondaryResults(numSeedsFromCommandLine, seedCoverage, maxReadSize, maxHits, index->getSeedLength()) + 1; // +1 for the primary alignment
+        maxAlignmentResultBufferCount = BaseAligner::getMaxSecondaryResults(numSeedsFromCommandLine, seedCoverage, maxReadSize, maxHits, index->getSeedLength()) + 1; // +1 for the primary alignment
     }
-    size_t alignmentResultBufferSize = sizeof(*alignmentResults) * (alignmentResultBufferCount + 1); // +1 is for primary result
+    alignmentResultBufferCount = min(maxAlignmentResultBufferCount, BaseAligner::InitialSecondaryResultBufferCount + 1);
  
-    BigAllocator *allocator = new BigAllocator(BaseAligner::getBigAllocatorReservation(index, true, maxHits, maxReadSize, index->getSeedLength(), numSeedsFromCommandLine, seedCoverage, maxSecondaryAlignmentsPerContig) 
-        + alignmentResultBufferSize);
+    BigAllocator *allocator = new BigAllocator(BaseAligner::getBigAllocatorReservation(index, true, maxHits, maxReadSize, index->getSeedLength(), numSeedsFromCommandLine, seedCoverage, maxSecondaryAlignmentsPerContig));
    
     BaseAligner *aligner = new (allocator) BaseAligner(
             index,
@@ -131,12 +139,13 @@ SingleAlignerContext::runIterationThread()
             stats,
             allocator);
 
-    alignmentResults = (SingleAlignmentResult *)allocator->allocate(alignmentResultBufferSize);
+    alignmentResults = (SingleAlignmentResult *)BigAlloc(sizeof(*alignmentResults) * alignmentResultBufferCount);
  
     allocator->checkCanaries();
 
     aligner->setExplorePopularSeeds(options->explorePopularSeeds);
     aligner->setStopOnFirstHit(options->stopOnFirstHit);
+    aligner->setUseHints(options->useHints, options->hintValidationInterval);
 
 #ifdef  _MSC_VER
     if (options->useTimingBarrier) {
@@ -153,7 +162,13 @@ SingleAlignerContext::runIterationThread()
     _uint64 lastReportTime = timeInMillis();
     _uint64 readsWhenLastReported = 0;
 
-    while (NULL != (read = supplier->getNextRead())) {
+    TraceBatcher alignTrace(TraceAlign, AlignTraceBatchSize);
+    for (;;) {
+        alignTrace.end();   // before waiting for the next read, so the wait isn't counted as aligning
+        if (NULL == (read = supplier->getNextRead())) {
+            break;
+        }
+        alignTrace.begin();
         stats->totalReads++;
 
         if (AlignerOptions::useHadoopErrorMessages && stats->totalReads % 10000 == 0 && timeInMillis() - lastReportTime > 10000) {
@@ -193,7 +208,15 @@ SingleAlignerContext::runIterationThread()
         }
 #endif
 
-        aligner->AlignRead(read, alignmentResults, maxSecondaryAlignmentAdditionalEditDistance, alignmentResultBufferCount - 1, &nSecondaryResults, maxSecondaryAlignments, alignmentResults + 1);
+        while (!aligner->AlignRead(read, alignmentResults, maxSecondaryAlignmentAdditionalEditDistance, alignmentResultBufferCount - 1, &nSecondaryResults, maxSecondaryAlignments, alignmentResults + 1)) {
+            if (alignmentResultBufferCount >= maxAlignmentResultBufferCount) {
+                WriteErrorMessage("Out of secondary result buffer aligning read %.*s, which shouldn't be possible\n", read->getIdLength(), read->getId());
+                soft_exit(1);
+            }
+            alignmentResultBufferCount = min(maxAlignmentResultBufferCount, 2 * alignmentResultBufferCount);
+            BigDealloc(alignmentResults);
+            alignmentResults = (SingleAlignmentResult *)BigAlloc(sizeof(*alignmentResults) * alignmentResultBufferCount);
+        }
 #ifdef LONG_READS
         aligner->setMaxK(oldMaxK);
 #endif
@@ -244,12 +267,19 @@ SingleAlignerContext::runIterationThread()
 
     }
 
+    stats->recordThreadMemory(allocator->getMemoryCommitted() + sizeof(*alignmentResults) * alignmentResultBufferCount,
+        allocator->getMemoryReserved() + sizeof(*alignmentResults) * alignmentResultBufferCount);
+    stats->hintedReads += aligner->getNHintsUsed();
+    stats->hintValidations += aligner->getNHintsValidated();
+    stats->hintDisagreements += aligner->getNHintsDisagreed();
+
     aligner->~BaseAligner(); // This calls the destructor without calling operator delete, allocator owns the memory.
  
     if (supplier != NULL) {
         delete supplier;
     }
 
+    BigDealloc(alignmentResults);
     delete allocator;   // This is what actually frees the memory.
 }
 
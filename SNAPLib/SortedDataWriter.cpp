@@ -28,6 +28,7 @@ Environment:
 #include "exit.h"
 #include "Bam.h"
 #include "Error.h"
+#include "Tracer.h"
 
 #define USE_DEVTEAM_OPTIONS 1
 //#define VALIDATE_SORT 1
@@ -48,27 +49,42 @@ struct SortEntry
         return e1.location < e2.location;
     }
 };
+
+//
+// Sort key for one record, written in sorted order to a sidecar file alongside each spilled block so the merge
+// can treat the records themselves as opaque bytes rather than re-parsing the SAM or BAM it just wrote.
+//
+struct SortKey
+{
+    GenomeLocation              location;
+    _uint32                     length;
+};
 #pragma pack(pop)
 
 typedef VariableSizeVector<SortEntry,150,true> SortVector;
+typedef VariableSizeVector<SortKey,150,true> SortKeyVector;
 
 struct SortBlock
 {
 #ifdef VALIDATE_SORT
-    SortBlock() : start(0), bytes(0), location(0), length(0), reader(NULL), minLocation(0), maxLocation(0) {}
+    SortBlock() : file(0), start(0), bytes(0), keyStart(0), keyBytes(0), location(0), length(0), reader(NULL), keyReader(NULL), minLocation(0), maxLocation(0) {}
 #else
-    SortBlock() : start(0), bytes(0), location(0), length(0), reader(NULL) {}
+    SortBlock() : file(0), start(0), bytes(0), keyStart(0), keyBytes(0), location(0), length(0), reader(NULL), keyReader(NULL) {}
 #endif
 	SortBlock(const SortBlock& other) { *this = other; }
     void operator=(const SortBlock& other);
 
+    int         file; // which spill file
     size_t      start;
     size_t      bytes;
+    size_t      keyStart; // extent of this block's keys in the sidecar file
+    size_t      keyBytes;
 #ifdef VALIDATE_SORT
 	GenomeLocation	minLocation, maxLocation;
 #endif
     // for mergesort phase
-    DataReader* reader;
+    AlignedAsyncReader* reader;
+    DataReader* keyReader;
     GenomeLocation    location; // genome location of current read
     char*       data; // read data in read buffer
     GenomeDistance    length; // length in bytes
@@ -78,11 +94,15 @@ struct SortBlock
 SortBlock::operator=(
     const SortBlock& other)
 {
+    file = other.file;
     start = other.start;
     bytes = other.bytes;
+    keyStart = other.keyStart;
+    keyBytes = other.keyBytes;
     location = other.location;
     length = other.length;
     reader = other.reader;
+    keyReader = other.keyReader;
 #ifdef VALIDATE_SORT
 	minLocation = other.minLocation;
 	maxLocation = other.maxLocation;
@@ -96,21 +116,40 @@ class SortedDataFilterSupplier;
 class SortedDataFilter : public DataWriter::Filter
 {
 public:
-    SortedDataFilter(SortedDataFilterSupplier* i_parent)
-        : Filter(DataWriter::CopyFilter), parent(i_parent), locations(10000000)
-    {}
+    SortedDataFilter(SortedDataFilterSupplier* i_parent);
 
     virtual ~SortedDataFilter() {}
 
+	virtual void inHeader(bool flag)
+    { header = flag; }
+
     virtual void onAdvance(DataWriter* writer, size_t batchOffset, char* data, GenomeDistance bytes, GenomeLocation location);
 
     virtual size_t onNextBatch(DataWriter* writer, size_t offset, size_t bytes);
 
+    // the last block is written from the DataWriter's buffer, so it has to finish before that's freed
+    virtual void onClose(DataWriter* writer);
+
+    // wait for the last key writes & free the writers; called once all writers are done
+    void close();
+
 private:
     SortedDataFilterSupplier*   parent;
     SortVector                  locations;
+    bool                        header;
+    AsyncFile::Writer*          keyWriter;
+    SortKeyVector               keys; // buffer for the keys being written, reused once the write completes
+    // Spilled blocks are written by the filter itself rather than the DataWriter, so that successive blocks
+    // can go to different spill files.  Two writers per file, alternating by batch, so the previous block can
+    // finish while the next one is issued even if both go to the same file.
+    AsyncFile::Writer**         spillWriters; // [2 * nSpillFiles]
+    int                         parity;
+    AsyncFile::Writer*          pendingSpill;
+    int                         pendingFile;
 };
 
+typedef VariableSizeVector<SortedDataFilter*> SortedDataFilterVector;
+
 class SortedDataFilterSupplier : public DataWriter::FilterSupplier
 {
 public:
@@ -123,6 +162,7 @@ public:
         DataWriter::FilterSupplier* i_sortedFilterSupplier,
         size_t i_bufferSize,
         size_t i_bufferSpace,
+        const char* i_spillDirectories,
         FileEncoder* i_encoder = NULL)
         :
         format(i_fileFormat),
@@ -134,44 +174,94 @@ public:
         sortedFilterSupplier(i_sortedFilterSupplier),
         bufferSize(i_bufferSize),
         bufferSpace(i_bufferSpace),
-        blocks()
+        blocks(),
+        keyFileBytes(0),
+        headerSize(0),
+        maxRecordBytes(0),
+        nextSpillFile(0)
     {
         InitializeExclusiveLock(&lock);
+        openSpillFiles(i_spillDirectories);
+        size_t len = strlen(tempFileName);
+        keyFileName = new char[len + 6];
+        strcpy(keyFileName, tempFileName);
+        strcpy(keyFileName + len, ".keys");
+        keyFile = AsyncFile::open(keyFileName, true);
+        if (keyFile == NULL) {
+            WriteErrorMessage("failed to open %s for write\n", keyFileName);
+            soft_exit(1);
+        }
     }
 
     virtual ~SortedDataFilterSupplier()
     {
         DestroyExclusiveLock(&lock);
+        delete [] keyFileName;
+        for (int i = 0; i < nSpillFiles; i++) {
+            delete [] spillFiles[i].name;
+        }
+        delete [] spillFiles;
     }
 
     virtual DataWriter::Filter* getFilter();
 
-    virtual void onClosing(DataWriterSupplier* supplier) {}
+    virtual void onClosing(DataWriterSupplier* supplier);
     virtual void onClosed(DataWriterSupplier* supplier);
 
-    void setHeaderSize(size_t bytes)
-    { headerSize = bytes; }
+    // reserve space for a block in the next spill file in turn, or at the start of the first one for the header
+    size_t allocateSpill(size_t bytes, bool header, int* o_file);
+
+    // reserve space in the sidecar file for a block's keys
+    size_t allocateKeys(size_t bytes);
+
+    void addHeader(size_t bytes);
 
 #ifndef VALIDATE_SORT
-	void addBlock(size_t start, size_t bytes);
+	void addBlock(int file, size_t start, size_t bytes, size_t keyStart, size_t keyBytes, size_t maxRecord);
 #else
-    void addBlock(size_t start, size_t bytes, GenomeLocation minLocation, GenomeLocation maxLocation);
+    void addBlock(int file, size_t start, size_t bytes, size_t keyStart, size_t keyBytes, size_t maxRecord, GenomeLocation minLocation, GenomeLocation maxLocation);
 #endif
 
 private:
+    // one spill file in each of the comma-separated directories, or just the temp file if there are none
+    void openSpillFiles(const char* spillDirectories);
+
+    void deleteSpillFiles();
+
     bool mergeSort();
 
+    // read the next key for a block being merged into its location & length; false at the end of the block
+    static bool nextKey(SortBlock* block);
+
     const Genome*                   genome;
     const FileFormat*               format;
     const char*                     tempFileName;
+    char*                           keyFileName;
     const char*                     sortedFileName;
     DataWriter::FilterSupplier*     sortedFilterSupplier;
     FileEncoder*                    encoder;
     size_t                          headerSize;
+    size_t                          maxRecordBytes; // longest record in any block
     ExclusiveLock                   lock; // for adding blocks
     SortBlockVector                 blocks;
     size_t                          bufferSize;
     size_t                          bufferSpace;
+    AsyncFile*                      keyFile;
+    size_t                          keyFileBytes; // allocated so far in keyFile
+    SortedDataFilterVector          filters; // for closing their key & spill writers
+
+    struct SpillFile
+    {
+        char*           name;
+        AsyncFile*      file;
+        size_t          bytes;          // allocated so far
+        int             blocks;
+        volatile _int64 writeWaitTime;  // ns waiting for spill writes to complete
+        _int64          readWaitTime;   // ns waiting for merge reads
+    };
+    SpillFile*                      spillFiles;
+    int                             nSpillFiles;
+    int                             nextSpillFile; // round robin
 
 	friend class SortedDataFilter;
 };
@@ -196,14 +286,30 @@ SortedDataFilter::onAdvance(
     locations.push_back(entry);
 }
 
+SortedDataFilter::SortedDataFilter(
+    SortedDataFilterSupplier* i_parent)
+    : Filter(DataWriter::TransformFilter), parent(i_parent), locations(10000000), header(false), keys(10000000),
+    parity(0), pendingSpill(NULL), pendingFile(0)
+{
+    keyWriter = parent->keyFile->getWriter();
+    spillWriters = new AsyncFile::Writer*[2 * parent->nSpillFiles];
+    for (int i = 0; i < 2 * parent->nSpillFiles; i++) {
+        spillWriters[i] = parent->spillFiles[i % parent->nSpillFiles].file->getWriter();
+    }
+}
+
     size_t
 SortedDataFilter::onNextBatch(
     DataWriter* writer,
     size_t offset,
     size_t bytes)
 {
+    TraceScope trace(TraceSortSpill, offset);
+
     // sort buffered reads by location for later merge sort
-    std::stable_sort(locations.begin(), locations.end(), SortEntry::comparator);
+    if (! header) {
+        std::stable_sort(locations.begin(), locations.end(), SortEntry::comparator);
+    }
     
     // copy from previous buffer into current in sorted order
     char* fromBuffer;
@@ -216,11 +322,19 @@ SortedDataFilter::onNextBatch(
         WriteErrorMessage( "SortedDataFilter::onNextBatch getBatch failed\n");
         soft_exit(1);
     }
+    // the last block's keys must be out before the buffer is reused
+    if (! keyWriter->waitForCompletion()) {
+        WriteErrorMessage("SortedDataFilter::onNextBatch key file write failed\n");
+        soft_exit(1);
+    }
+    keys.clear();
+
     size_t target = 0;
+    size_t maxRecord = 0;
 	GenomeLocation previous = 0;
     for (VariableSizeVector<SortEntry>::iterator i = locations.begin(); i != locations.end(); i++) {
 #ifdef VALIDATE_SORT
-		if (locations.size() > 1) { // skip header block
+		if (! header) {
             GenomeLocation loc;
             GenomeDistance len;
 			parent->format->getSortInfo(parent->genome, fromBuffer + i->offset, i->length, &loc, &len);
@@ -230,43 +344,147 @@ SortedDataFilter::onNextBatch(
 #endif
         memcpy(toBuffer + target, fromBuffer + i->offset, i->length);
         target += i->length;
+        maxRecord = max(maxRecord, (size_t) i->length);
+        if (! header) {
+            SortKey key;
+            key.location = i->location;
+            key.length = (_uint32) i->length;
+            keys.push_back(key);
+        }
     }
-    
-    // remember block extent for later merge sort
-    SortBlock block;
-    // handle header specially
-    size_t header = offset > 0 ? 0 : locations[0].length;
-    if (header > 0) {
-        parent->setHeaderSize(header);
-    }
-	int first = offset == 0;
+
+    // write the sorted block to its spill file
+    int file;
+    size_t start = parent->allocateSpill(target, header, &file);
+    AsyncFile::Writer* spill = spillWriters[parity * parent->nSpillFiles + file];
+    parity = 1 - parity;
+    if (target > 0 && ! spill->beginWrite(toBuffer, target, start, NULL)) {
+        WriteErrorMessage("SortedDataFilter::onNextBatch spill write %lld bytes at offset %lld of %s failed\n", target, start, parent->spillFiles[file].name);
+        soft_exit(1);
+    }
+
+    // the previous block's buffer is about to be filled again, so its write has to be done
+    if (pendingSpill != NULL) {
+        _int64 waitStart = timeInNanos();
+        if (! pendingSpill->waitForCompletion()) {
+            WriteErrorMessage("SortedDataFilter::onNextBatch spill write to %s failed\n", parent->spillFiles[pendingFile].name);
+            soft_exit(1);
+        }
+        InterlockedAdd64AndReturnNewValue(&parent->spillFiles[pendingFile].writeWaitTime, timeInNanos() - waitStart);
+    }
+    pendingSpill = spill;
+    pendingFile = file;
+
+    if (header) {
+        parent->addHeader(target);
+    } else {
+        // remember block extent for later merge sort
+        size_t keyBytes = keys.size() * sizeof(SortKey);
+        size_t keyStart = parent->allocateKeys(keyBytes);
+        if (keyBytes > 0 && ! keyWriter->beginWrite(keys.begin(), keyBytes, keyStart, NULL)) {
+            WriteErrorMessage("SortedDataFilter::onNextBatch key file write %lld bytes at offset %lld failed\n", keyBytes, keyStart);
+            soft_exit(1);
+        }
 #ifdef VALIDATE_SORT
-	GenomeLocation minLocation = locations.size() > first ? locations[first].location : 0;
-    GenomeLocation maxLocation = locations.size() > first ? locations[locations.size() - 1].location : UINT32_MAX;
-    parent->addBlock(offset + header, bytes - header, minLocation, maxLocation);
+    	GenomeLocation minLocation = locations.size() > 0 ? locations[0].location : 0;
+        GenomeLocation maxLocation = locations.size() > 0 ? locations[locations.size() - 1].location : UINT32_MAX;
+        parent->addBlock(file, start, target, keyStart, keyBytes, maxRecord, minLocation, maxLocation);
 #else
-    parent->addBlock(offset + header, bytes - header);
+        parent->addBlock(file, start, target, keyStart, keyBytes, maxRecord);
 #endif
+    }
     locations.clear();
 
-    return target;
+    // the DataWriter has nothing left to write
+    return 0;
+}
+
+    void
+SortedDataFilter::onClose(
+    DataWriter* writer)
+{
+    if (pendingSpill != NULL) {
+        _int64 waitStart = timeInNanos();
+        if (! pendingSpill->waitForCompletion()) {
+            WriteErrorMessage("SortedDataFilter::onClose spill write to %s failed\n", parent->spillFiles[pendingFile].name);
+            soft_exit(1);
+        }
+        InterlockedAdd64AndReturnNewValue(&parent->spillFiles[pendingFile].writeWaitTime, timeInNanos() - waitStart);
+        pendingSpill = NULL;
+    }
+}
+
+    void
+SortedDataFilter::close()
+{
+    for (int i = 0; i < 2 * parent->nSpillFiles; i++) {
+        if (! spillWriters[i]->close()) {
+            WriteErrorMessage("SortedDataFilter: spill write to %s failed\n", parent->spillFiles[i % parent->nSpillFiles].name);
+            soft_exit(1);
+        }
+        delete spillWriters[i];
+    }
+    delete [] spillWriters;
+    spillWriters = NULL;
+    pendingSpill = NULL;
+
+    if (! keyWriter->close()) {
+        WriteErrorMessage("SortedDataFilter: key file write failed\n");
+        soft_exit(1);
+    }
+    delete keyWriter;
+    keyWriter = NULL;
 }
     
     DataWriter::Filter*
 SortedDataFilterSupplier::getFilter()
 {
-    return new SortedDataFilter(this);
+    AcquireExclusiveLock(&lock);
+    SortedDataFilter* filter = new SortedDataFilter(this);
+    filters.push_back(filter);
+    ReleaseExclusiveLock(&lock);
+    return filter;
+}
+
+    void
+SortedDataFilterSupplier::onClosing(
+    DataWriterSupplier* supplier)
+{
+    // all the writers are done by now, so this is the last of the blocks and keys
+    for (SortedDataFilterVector::iterator i = filters.begin(); i != filters.end(); i++) {
+        (*i)->close();
+    }
+    for (int i = 0; i < nSpillFiles; i++) {
+        if (! spillFiles[i].file->close()) {
+            WriteErrorMessage("unable to close spill file %s\n", spillFiles[i].name);
+            soft_exit(1);
+        }
+        delete spillFiles[i].file;
+        spillFiles[i].file = NULL;
+    }
+    if (! keyFile->close()) {
+        WriteErrorMessage("unable to close sort key file %s\n", keyFileName);
+        soft_exit(1);
+    }
+    delete keyFile;
+    keyFile = NULL;
 }
 
     void
 SortedDataFilterSupplier::onClosed(
     DataWriterSupplier* supplier)
 {
-    if (blocks.size() == 1 && sortedFilterSupplier == NULL) {
-        // just rename/move temp file to real file, we're done
+    // the temp writer itself only ever wrote to the null device
+    if (blocks.size() == 1 && sortedFilterSupplier == NULL && blocks[0].file == 0 && blocks[0].start == headerSize &&
+        spillFiles[0].bytes == headerSize + blocks[0].bytes) {
+        DeleteSingleFile(keyFileName);
+        for (int i = 1; i < nSpillFiles; i++) {
+            DeleteSingleFile(spillFiles[i].name);
+        }
+        // just rename/move the spill file to real file, we're done
         DeleteSingleFile(sortedFileName); // if it exists
-        if (! MoveSingleFile(tempFileName, sortedFileName)) {
-            WriteErrorMessage( "unable to move temp file %s to final sorted file %s\n", tempFileName, sortedFileName);
+        if (! MoveSingleFile(spillFiles[0].name, sortedFileName)) {
+            WriteErrorMessage( "unable to move temp file %s to final sorted file %s\n", spillFiles[0].name, sortedFileName);
             soft_exit(1);
         }
         return;
@@ -278,10 +496,109 @@ SortedDataFilterSupplier::onClosed(
     }
 }
 
+    void
+SortedDataFilterSupplier::openSpillFiles(
+    const char* spillDirectories)
+{
+    nSpillFiles = 1;
+    for (const char* p = spillDirectories; p != NULL && *p != '\0'; p++) {
+        nSpillFiles += *p == ',';
+    }
+    spillFiles = new SpillFile[nSpillFiles];
+
+    if (spillDirectories == NULL || *spillDirectories == '\0') {
+        nSpillFiles = 1;
+        spillFiles[0].name = new char[strlen(tempFileName) + 1];
+        strcpy(spillFiles[0].name, tempFileName);
+    } else {
+        const char* base = strrchr(tempFileName, PATH_SEP);
+        base = base != NULL ? base + 1 : tempFileName;
+        const char* dir = spillDirectories;
+        for (int i = 0; i < nSpillFiles; i++) {
+            const char* comma = strchr(dir, ',');
+            size_t dirLength = comma != NULL ? comma - dir : strlen(dir);
+            size_t size = dirLength + strlen(base) + 16;
+            spillFiles[i].name = new char[size];
+            snprintf(spillFiles[i].name, size, "%.*s%c%s.%d", (int)dirLength, dir, PATH_SEP, base, i);
+            dir = comma != NULL ? comma + 1 : dir + dirLength;
+        }
+    }
+
+    for (int i = 0; i < nSpillFiles; i++) {
+        spillFiles[i].file = AsyncFile::open(spillFiles[i].name, true);
+        if (spillFiles[i].file == NULL) {
+            WriteErrorMessage("failed to open spill file %s for write\n", spillFiles[i].name);
+            soft_exit(1);
+        }
+        spillFiles[i].bytes = 0;
+        spillFiles[i].blocks = 0;
+        spillFiles[i].writeWaitTime = 0;
+        spillFiles[i].readWaitTime = 0;
+    }
+}
+
+    void
+SortedDataFilterSupplier::deleteSpillFiles()
+{
+    for (int i = 0; i < nSpillFiles; i++) {
+        if (! DeleteSingleFile(spillFiles[i].name)) {
+            WriteErrorMessage( "warning: failure deleting temp file %s\n", spillFiles[i].name);
+        }
+    }
+    if (! DeleteSingleFile(keyFileName)) {
+        WriteErrorMessage( "warning: failure deleting temp file %s\n", keyFileName);
+    }
+}
+
+    size_t
+SortedDataFilterSupplier::allocateSpill(
+    size_t bytes,
+    bool header,
+    int* o_file)
+{
+    AcquireExclusiveLock(&lock);
+    int file = header ? 0 : nextSpillFile;
+    if (! header) {
+        nextSpillFile = (nextSpillFile + 1) % nSpillFiles;
+        spillFiles[file].blocks++;
+    }
+    size_t start = spillFiles[file].bytes;
+    spillFiles[file].bytes += bytes;
+    ReleaseExclusiveLock(&lock);
+    *o_file = file;
+    return start;
+}
+
+    void
+SortedDataFilterSupplier::addHeader(
+    size_t bytes)
+{
+    // the header is written alone before any reads, so it's contiguous at the start of the first spill file
+    AcquireExclusiveLock(&lock);
+    _ASSERT(blocks.size() == 0);
+    headerSize += bytes;
+    ReleaseExclusiveLock(&lock);
+}
+
+    size_t
+SortedDataFilterSupplier::allocateKeys(
+    size_t bytes)
+{
+    AcquireExclusiveLock(&lock);
+    size_t start = keyFileBytes;
+    keyFileBytes += bytes;
+    ReleaseExclusiveLock(&lock);
+    return start;
+}
+
     void
 SortedDataFilterSupplier::addBlock(
+    int file,
     size_t start,
-    size_t bytes
+    size_t bytes,
+    size_t keyStart,
+    size_t keyBytes,
+    size_t maxRecord
 #ifdef VALIDATE_SORT
 	, GenomeLocation minLocation
 	, GenomeLocation maxLocation
@@ -296,8 +613,12 @@ SortedDataFilterSupplier::addBlock(
 		}
 #endif
         SortBlock block;
+        block.file = file;
         block.start = start;
         block.bytes = bytes;
+        block.keyStart = keyStart;
+        block.keyBytes = keyBytes;
+        maxRecordBytes = max(maxRecordBytes, maxRecord);
 #if VALIDATE_SORT
 		block.minLocation = minLocation;
 		block.maxLocation = maxLocation;
@@ -307,13 +628,37 @@ SortedDataFilterSupplier::addBlock(
     }
 }
 
+    bool
+SortedDataFilterSupplier::nextKey(
+    SortBlock* block)
+{
+    char* data;
+    _int64 bytes;
+    if (! block->keyReader->getData(&data, &bytes)) {
+        block->keyReader->nextBatch();
+        if (! block->keyReader->getData(&data, &bytes)) {
+            _ASSERT(block->keyReader->isEOF());
+            return false;
+        }
+    }
+    _ASSERT(bytes >= (_int64) sizeof(SortKey));
+    SortKey key;
+    memcpy(&key, data, sizeof(SortKey));
+    block->location = key.location;
+    block->length = key.length;
+    block->keyReader->advance(sizeof(SortKey));
+    return true;
+}
+
     bool
 SortedDataFilterSupplier::mergeSort()
 {
+    TraceScope trace(TraceSortMerge);
+
     // merge sort from temp file into sorted file
-#if USE_DEVTEAM_OPTIONS
     WriteStatusMessage("sorting...");
     _int64 start = timeInMillis();
+#if USE_DEVTEAM_OPTIONS
     _int64 startReadWaitTime = DataReader::ReadWaitTime;
     _int64 startReleaseWaitTime = DataReader::ReleaseWaitTime;
     _int64 startWriteWaitTime = DataWriter::WaitTime;
@@ -333,11 +678,35 @@ SortedDataFilterSupplier::mergeSort()
     if (blocks.size() > 5000) {
         WriteErrorMessage("warning: merging %d blocks could be slow, try increasing sort memory with -sm option\n", blocks.size());
     }
+    // the blocks are read unbuffered, so that merging doesn't push everything else out of the page cache,
+    // into 128kB to 8MB of aligned buffer space per block
+    const size_t align = AsyncFile::UnbufferedAlignment;
+    const size_t pad = (maxRecordBytes + align - 1) / align * align;
+    size_t chunk = min(1UL << 22, max(1UL << 16, bufferSpace / (2 * blocks.size())));
+    chunk -= chunk % align;
+    const size_t blockBufferSize = 2 * (pad + chunk);
+    char* blockBuffers = (char*) BigAlloc(blocks.size() * blockBufferSize + align);
+    char* alignedBuffers = blockBuffers + (align - ((size_t) blockBuffers) % align) % align;
+    for (int i = 0; i < nSpillFiles; i++) {
+        spillFiles[i].file = AsyncFile::open(spillFiles[i].name, false, true);
+        if (spillFiles[i].file == NULL) {
+            WriteErrorMessage("unable to open spill file %s for read\n", spillFiles[i].name);
+            return false;
+        }
+    }
+    // read ahead on whichever blocks are lowest in the merge queue, since they'll run out first
+    ReadAheadScheduler scheduler(4 * nSpillFiles, 32 * nSpillFiles);
     for (SortBlockVector::iterator i = blocks.begin(); i != blocks.end(); i++) {
-        i->reader = readerSupplier->getDataReader(1, MAX_READ_LENGTH * 8, 0.0,
-            min(1UL << 23, max(1UL << 17, bufferSpace / blocks.size()))); // 128kB to 8MB buffer space per block
-        i->reader->init(tempFileName);
-        i->reader->reinit(i->start, i->bytes);
+        i->reader = new AlignedAsyncReader();
+        if (! i->reader->open(spillFiles[i->file].file, i->start, i->bytes,
+                alignedBuffers + (i - blocks.begin()) * blockBufferSize, chunk, pad, &scheduler)) {
+            return false;
+        }
+        // keys are a few percent of the record bytes, so they get correspondingly less buffer
+        i->keyReader = readerSupplier->getDataReader(1, sizeof(SortKey), 0.0,
+            min(1UL << 20, max(1UL << 14, bufferSpace / (16 * blocks.size()))));
+        i->keyReader->init(keyFileName);
+        i->keyReader->reinit(i->keyStart, i->keyBytes);
     }
 
     // write out header
@@ -346,16 +715,18 @@ SortedDataFilterSupplier::mergeSort()
         soft_exit(1);
     }
     if (headerSize > 0) {
-        blocks[0].reader->reinit(0, headerSize);
+        DataReader* headerReader = readerSupplier->getDataReader(1, 0, 0.0, 1UL << 20);
+        headerReader->init(spillFiles[0].name);
+        headerReader->reinit(0, headerSize);
 		writer->inHeader(true);
         char* rbuffer;
         _int64 rbytes;
         char* wbuffer;
         size_t wbytes;
 		for (size_t left = headerSize; left > 0; ) {
-			if ((! blocks[0].reader->getData(&rbuffer, &rbytes)) || rbytes == 0) {
-				blocks[0].reader->nextBatch();
-				if (! blocks[0].reader->getData(&rbuffer, &rbytes)) {
+			if ((! headerReader->getData(&rbuffer, &rbytes)) || rbytes == 0) {
+				headerReader->nextBatch();
+				if (! headerReader->getData(&rbuffer, &rbytes)) {
 					WriteErrorMessage( "read header failed\n");
 					soft_exit(1);
 				}
@@ -370,11 +741,11 @@ SortedDataFilterSupplier::mergeSort()
 			size_t xfer = min(left, min((size_t) rbytes, wbytes));
 			_ASSERT(xfer > 0 && xfer <= UINT32_MAX);
 			memcpy(wbuffer, rbuffer, xfer);
-			blocks[0].reader->advance(xfer);
+			headerReader->advance(xfer);
 			writer->advance((unsigned) xfer);
 			left -= xfer;
 		}
-        blocks[0].reader->reinit(blocks[0].start, blocks[0].bytes);
+        delete headerReader;
 		writer->nextBatch();
 		writer->inHeader(false);
     }
@@ -385,9 +756,15 @@ SortedDataFilterSupplier::mergeSort()
     typedef PriorityQueue<GenomeLocation, _int64> BlockQueue;
     BlockQueue queue;
     for (SortBlockVector::iterator b = blocks.begin(); b != blocks.end(); b++) {
-        _int64 bytes;
-        b->reader->getData(&b->data, &bytes);
-        format->getSortInfo(genome, b->data, bytes, &b->location, &b->length);
+        if (! nextKey(&*b)) {
+            WriteErrorMessage("mergeSort: no sort keys for block at %lld\n", b->start);
+            return false;
+        }
+        b->reader->setPriority(GenomeLocationAsInt64(b->location));
+        if (! b->reader->getData(b->length, &b->data)) {
+            WriteErrorMessage("mergeSort: unable to read block at %lld\n", b->start);
+            return false;
+        }
         queue.add((_uint32) (b - blocks.begin()), b->location); 
     }
     GenomeLocation current = 0; // current location for validation
@@ -445,19 +822,22 @@ SortedDataFilterSupplier::mergeSort()
             b->reader->advance(b->length);
             _ASSERT(b->location >= current);
             current = b->location;
-            _int64 readBytes;
-            if (! b->reader->getData(&b->data, &readBytes)) {
-                b->reader->nextBatch();
-                if (! b->reader->getData(&b->data, &readBytes)) {
-                    _ASSERT(b->reader->isEOF());
-                    delete b->reader;
-                    b->reader = NULL;
-                    break;
-                }
-            }
             GenomeLocation previous = b->location;
-            format->getSortInfo(genome, b->data, readBytes, &b->location, &b->length);
-            _ASSERT(b->length <= readBytes && b->location >= previous);
+            if (! nextKey(b)) {
+                delete b->keyReader;
+                b->keyReader = NULL;
+                spillFiles[b->file].readWaitTime += b->reader->getWaitTimeInNanos();
+                b->reader->close();
+                delete b->reader;
+                b->reader = NULL;
+                break;
+            }
+            b->reader->setPriority(GenomeLocationAsInt64(b->location));
+            if (! b->reader->getData(b->length, &b->data)) {
+                WriteErrorMessage("mergeSort: sort key past the end of its block at %lld\n", b->start);
+                return false;
+            }
+            _ASSERT(b->location >= previous);
         }
         if (b->reader != NULL) {
             queue.add(smallestIndex, b->location);
@@ -469,20 +849,40 @@ SortedDataFilterSupplier::mergeSort()
     delete writer;
     writerSupplier->close();
     delete writerSupplier;
-    if (! DeleteSingleFile(tempFileName)) {
-        WriteErrorMessage( "warning: failure deleting temp file %s\n", tempFileName);
+    for (int i = 0; i < nSpillFiles; i++) {
+        spillFiles[i].file->close();
+        delete spillFiles[i].file;
+        spillFiles[i].file = NULL;
     }
+    BigDealloc(blockBuffers);
+    deleteSpillFiles();
 
+    WriteStatusMessage("sorted %lld reads in %u blocks, %lld s\n", total, blocks.size(), (timeInMillis() - start)/1000);
 #if USE_DEVTEAM_OPTIONS
-    WriteStatusMessage("sorted %lld reads in %u blocks, %lld s\n"
-        "read wait align %.3f s + merge %.3f s, read release align %.3f s + merge %.3f s\n"
+    WriteStatusMessage("read wait align %.3f s + merge %.3f s, read release align %.3f s + merge %.3f s\n"
         "write wait %.3f s align + %.3f s merge, write filter %.3f s align + %.3f s merge\n",
-        total, blocks.size(), (timeInMillis() - start)/1000,
         startReadWaitTime * 1e-9, (DataReader::ReadWaitTime - startReadWaitTime) * 1e-9,
         startReleaseWaitTime * 1e-9, (DataReader::ReleaseWaitTime - startReleaseWaitTime) * 1e-9,
         startWriteWaitTime * 1e-9, (DataWriter::WaitTime - startWriteWaitTime) * 1e-9,
         startWriteFilterTime * 1e-9, (DataWriter::FilterTime - startWriteFilterTime) * 1e-9);
 #endif
+
+    //
+    // How the merge's reads of the spill files went, and how the work was spread across the spill directories.
+    //
+    _int64 blockReadWaitTime = 0;
+    for (int i = 0; i < nSpillFiles; i++) {
+        blockReadWaitTime += spillFiles[i].readWaitTime;
+    }
+    WriteStatusMessage("merge read-ahead %lld reads of %lld kB, %lld not ahead in time, %d in flight, block read wait %.3f s\n",
+        scheduler.getReads(), (_int64) (chunk >> 10), scheduler.getMisses(), scheduler.getInFlightLimit(), blockReadWaitTime * 1e-9);
+    if (nSpillFiles > 1) {
+        for (int i = 0; i < nSpillFiles; i++) {
+            WriteStatusMessage("spill %s: %d blocks, %lld MB, write wait %.3f s, merge read wait %.3f s\n",
+                spillFiles[i].name, spillFiles[i].blocks, spillFiles[i].bytes >> 20,
+                spillFiles[i].writeWaitTime * 1e-9, spillFiles[i].readWaitTime * 1e-9);
+        }
+    }
     return true;
 }
 
@@ -496,12 +896,15 @@ DataWriterSupplier::sorted(
     const char* sortedFileName,
     DataWriter::FilterSupplier* sortedFilterSuppler,
     size_t maxBufferSize,
+    const char* spillDirectories,
     FileEncoder* encoder)
 {
     const int bufferCount = 3;
     const size_t bufferSpace = tempBufferMemory > 0 ? tempBufferMemory : (numThreads * (size_t)1 << 30);
     const size_t bufferSize = bufferSpace / (bufferCount * numThreads);
     DataWriter::FilterSupplier* filterSupplier =
-        new SortedDataFilterSupplier(format, genome, tempFileName, sortedFileName, sortedFilterSuppler, bufferSize, bufferSpace, encoder);
-    return DataWriterSupplier::create(tempFileName, bufferSize, filterSupplier, NULL, bufferCount);
+        new SortedDataFilterSupplier(format, genome, tempFileName, sortedFileName, sortedFilterSuppler, bufferSize, bufferSpace,
+            spillDirectories, encoder);
+    // the filter writes the sorted blocks to the spill files itself
+    return DataWriterSupplier::create(NULL_DEVICE, bufferSize, filterSupplier, NULL, bufferCount);
 }
@@ -0,0 +1,159 @@
+/*++
+
+Module Name:
+
+    Tracer.cpp
+
+Abstract:
+
+    Opt-in timeline tracing of pipeline stages, written as Chrome trace format JSON.
+
+Environment:
+
+    User mode service.
+
+Revision History:
+
+
+--*/
+
+#include "stdafx.h"
+#include "Compat.h"
+#include "Tracer.h"
+#include "BigAlloc.h"
+#include "exit.h"
+#include "Error.h"
+
+static const char* StageNames[TraceStageCount] = {
+    "read data",
+    "decompress",
+    "queue wait",
+    "align",
+    "write batch",
+    "write filters",
+    "compress",
+    "write wait",
+    "sort spill",
+    "sort merge",
+};
+
+bool Tracer::enabled = false;
+FILE* Tracer::traceFile = NULL;
+_int64 Tracer::startTime = 0;
+ExclusiveLock Tracer::lock;
+Tracer::ThreadRing* Tracer::threads = NULL;
+int Tracer::nThreads = 0;
+
+static THREAD_LOCAL void* CurrentThreadRing = NULL;
+static THREAD_LOCAL const char* CurrentThreadName = NULL;
+
+    void
+Tracer::Start(
+    const char* fileName)
+{
+    if (enabled) {
+        return;
+    }
+    traceFile = fopen(fileName, "w");
+    if (NULL == traceFile) {
+        WriteErrorMessage("Unable to open trace file '%s'\n", fileName);
+        soft_exit(1);
+    }
+    if (0 == startTime) {
+        InitializeExclusiveLock(&lock);
+        SetExclusiveLockWholeProgramScope(&lock);
+    }
+    startTime = timeInNanos();
+    NameThread("main");
+    enabled = true;
+}
+
+    Tracer::ThreadRing*
+Tracer::RegisterThread()
+{
+    ThreadRing* ring = (ThreadRing*) BigAlloc(sizeof(ThreadRing));
+    ring->name = CurrentThreadName;
+    ring->nEvents = 0;
+    AcquireExclusiveLock(&lock);
+    ring->threadNumber = ++nThreads;
+    ring->next = threads;
+    threads = ring;
+    ReleaseExclusiveLock(&lock);
+    CurrentThreadRing = ring;
+    return ring;
+}
+
+    void
+Tracer::NameThread(
+    const char* name)
+{
+    CurrentThreadName = name;
+    if (NULL != CurrentThreadRing) {
+        ((ThreadRing*) CurrentThreadRing)->name = name;
+    }
+}
+
+    void
+Tracer::Record(
+    TraceStage stage,
+    _int64 batch,
+    _int64 startNanos,
+    _int64 endNanos)
+{
+    if (! enabled) {
+        return;
+    }
+    ThreadRing* ring = (ThreadRing*) CurrentThreadRing;
+    if (NULL == ring) {
+        ring = RegisterThread();
+    }
+    if (NULL == ring->name) {
+        ring->name = StageNames[stage];
+    }
+    Event* event = &ring->events[ring->nEvents % RingSize];
+    event->start = startNanos;
+    event->end = endNanos;
+    event->batch = batch;
+    event->stage = stage;
+    ring->nEvents++;    // publish after the event is filled in
+}
+
+    void
+Tracer::Stop()
+{
+    if (! enabled) {
+        return;
+    }
+    enabled = false;
+
+    AcquireExclusiveLock(&lock);
+    fprintf(traceFile, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(traceFile, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"snap\"}}");
+    bool wrapped = false;
+    for (ThreadRing* ring = threads; ring != NULL; ring = ring->next) {
+        fprintf(traceFile, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s %d\"}}",
+            ring->threadNumber, ring->name, ring->threadNumber);
+        _int64 n = ring->nEvents;
+        _int64 first = __max((_int64)0, n - (_int64)RingSize);
+        wrapped |= first > 0;
+        ring->nEvents = 0;  // the owning thread is done, so it's safe to start over for the next run
+        for (_int64 i = first; i < n; i++) {
+            Event* event = &ring->events[i % RingSize];
+            fprintf(traceFile, ",\n{\"name\":\"%s\",\"cat\":\"snap\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+                StageNames[event->stage], ring->threadNumber,
+                (event->start - startTime) / 1000.0, __max((_int64)0, event->end - event->start) / 1000.0);
+            if (event->batch >= 0) {
+                fprintf(traceFile, ",\"args\":{\"batch\":%lld}", event->batch);
+            }
+            fprintf(traceFile, "}");
+        }
+    }
+    fprintf(traceFile, "\n]}\n");
+    fclose(traceFile);
+    traceFile = NULL;
+    ReleaseExclusiveLock(&lock);
+
+    if (wrapped) {
+        WriteStatusMessage("Trace buffers wrapped; only the last %u events of each thread were kept\n", RingSize);
+    }
+}
@@ -0,0 +1,178 @@
+/*++
+
+Module Name:
+
+    Tracer.h
+
+Abstract:
+
+    Opt-in timeline tracing of the stages of the read/align/write pipeline, so that
+    stalls can be seen directly rather than inferred from aggregate timings.
+
+    Each thread records (start, end, stage, batch) events into its own ring buffer
+    without taking any locks.  The rings are written out as Chrome trace format JSON
+    (chrome://tracing, Perfetto) by Stop, once the threads that record events are done.
+
+Environment:
+
+    User mode service.
+
+Revision History:
+
+
+--*/
+
+#pragma once
+#include "Compat.h"
+
+enum TraceStage
+{
+    TraceReadData,      // DataReader::nextBatch
+    TraceDecompress,    // gzip/BAM input decompression
+    TraceQueueWait,     // ReadSupplierQueue waiting for reads or empty buffers
+    TraceAlign,         // a batch of reads through the aligner
+    TraceWriteBatch,    // DataWriter::nextBatch
+    TraceWriteFilter,   // writer filters onNextBatch
+    TraceCompress,      // gzip/BAM output compression
+    TraceWriteWait,     // waiting for a buffer to be written to the file or stdout
+    TraceSortSpill,     // sorting a batch into the temporary file
+    TraceSortMerge,     // merging the temporary file into the sorted output
+    TraceStageCount
+};
+
+class Tracer
+{
+public:
+
+    //
+    // Start tracing to fileName.  Calls while tracing is already on are ignored.
+    //
+    static void Start(const char* fileName);
+
+    //
+    // Write out the trace and stop tracing.  Call this only after the threads that record events
+    // have finished, since their rings are read without synchronization.
+    //
+    static void Stop();
+
+    static inline bool IsEnabled() { return enabled; }
+
+    //
+    // batch is an identifier for the unit of work (a batch ID or file offset), or -1 for none.
+    //
+    static void Record(TraceStage stage, _int64 batch, _int64 startNanos, _int64 endNanos);
+
+    //
+    // Name the calling thread in the trace.  Unnamed threads are named for the first stage they record.
+    //
+    static void NameThread(const char* name);
+
+private:
+
+    struct Event
+    {
+        _int64      start;
+        _int64      end;
+        _int64      batch;
+        TraceStage  stage;
+    };
+
+    static const unsigned RingSize = 1 << 15; // events kept per thread; older ones are overwritten
+
+    struct ThreadRing
+    {
+        int                 threadNumber;
+        const char*         name;
+        volatile _int64     nEvents;    // only written by the owning thread
+        ThreadRing*         next;
+        Event               events[RingSize];
+    };
+
+    static ThreadRing* RegisterThread();
+
+    static bool             enabled;
+    static FILE*            traceFile;
+    static _int64           startTime;
+    static ExclusiveLock    lock;       // protects threads & nThreads, only taken once per thread
+    static ThreadRing*      threads;
+    static int              nThreads;
+};
+
+//
+// Records an event for the lifetime of the object.
+//
+class TraceScope
+{
+public:
+    TraceScope(TraceStage i_stage, _int64 i_batch = -1)
+        : stage(i_stage), batch(i_batch), start(Tracer::IsEnabled() ? timeInNanos() : 0)
+    {}
+
+    ~TraceScope()
+    {
+        if (start != 0) {
+            Tracer::Record(stage, batch, start, timeInNanos());
+        }
+    }
+
+    void setBatch(_int64 i_batch) { batch = i_batch; }
+
+private:
+    TraceStage  stage;
+    _int64      batch;
+    _int64      start;
+};
+
+//
+// Groups a run of short operations (e.g. aligning single reads) into one event per batchSize of them.
+// Call begin() once the operation has its input (e.g. after the read is dequeued) and end() when it's
+// done, so that time spent waiting for input isn't counted.  A run is also cut short when there's a
+// noticeable wait between operations, so that the wait shows up as a gap.
+//
+class TraceBatcher
+{
+public:
+    TraceBatcher(TraceStage i_stage, int i_batchSize)
+        : stage(i_stage), batchSize(i_batchSize), count(0), batch(0), start(0), lastEnd(0)
+    {}
+
+    ~TraceBatcher()
+    {
+        if (count > 0) {
+            Tracer::Record(stage, batch, start, lastEnd);
+        }
+    }
+
+    inline void begin()
+    {
+        if (Tracer::IsEnabled()) {
+            _int64 now = timeInNanos();
+            if (count == batchSize || (count > 0 && now - lastEnd > MaxGapNanos)) {
+                Tracer::Record(stage, batch++, start, lastEnd);
+                count = 0;
+            }
+            if (count == 0) {
+                start = now;
+            }
+            count++;
+            lastEnd = now;
+        }
+    }
+
+    inline void end()
+    {
+        if (count > 0) {
+            lastEnd = timeInNanos();
+        }
+    }
+
+private:
+    static const _int64 MaxGapNanos = 10000;
+
+    TraceStage  stage;
+    int         batchSize;
+    int         count;
+    _int64      batch;
+    _int64      start;
+    _int64      lastEnd;
+};
@@ -28,6 +28,13 @@ Revision History:
 const int maxMAPQ = 70;
 
 static double mapqToProbabilityTable[maxMAPQ+1];
+static double mapqBoundaryTable[maxMAPQ+1];  // An error probability at or below mapqBoundaryTable[i] has MAPQ at least i
+
+//
+// How close (relatively) an error probability has to be to a boundary before we don't trust the table.  The
+// table entries and log10 are each good to an ulp or so, so this is very conservative and almost nothing hits it.
+//
+static const double mapqBoundarySlop = 1e-9;
 
 void initializeMapqTables()
 {
@@ -36,6 +43,9 @@ void initializeMapqTables()
         mapqToProbabilityTable[i] = 1- pow(10.0,((double)i) / -10.0);
     }
 
+    for (int i = 0; i <= maxMAPQ; i++) {
+        mapqBoundaryTable[i] = pow(10.0, ((double)i) / -10.0);
+    }
 }
 
 double mapqToProbability(int mapq)
@@ -43,3 +53,24 @@ double mapqToProbability(int mapq)
     _ASSERT(mapq >= 0 && mapq <= maxMAPQ);
     return mapqToProbabilityTable[mapq];
 }
+
+int mapqForErrorProbability(double errorProbability)
+{
+    //
+    // The table is decreasing, so find the largest i with errorProbability <= mapqBoundaryTable[i].  The steps
+    // are written to compile to conditional moves, since which way they go is unpredictable.
+    //
+    int low = 0;
+    for (int step = 64; step > 0; step /= 2) {
+        int probe = __min(low + step, maxMAPQ);
+        low = errorProbability <= mapqBoundaryTable[probe] ? probe : low;
+    }
+
+    if ((low > 0 && errorProbability >= mapqBoundaryTable[low] * (1 - mapqBoundarySlop)) ||
+        (low < maxMAPQ && errorProbability <= mapqBoundaryTable[low + 1] * (1 + mapqBoundarySlop)) ||
+        errorProbability > 1) {
+        return __min(maxMAPQ, (int)(-10 * log10(errorProbability)));
+    }
+
+    return low;
+}
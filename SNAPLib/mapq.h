@@ -29,6 +29,13 @@ void initializeMapqTables();
 
 double mapqToProbability(int mapq); // The probability of a match for the given MAPQ
 
+//
+// min(70, (int)(-10 * log10(errorProbability))), found by binary search in a table of the MAPQ boundaries rather
+// than with log10.  Values too close to a boundary for the table to be sure which side log10 would put them on
+// are sent to log10, so the answer is always the same.
+//
+int mapqForErrorProbability(double errorProbability);
+
 inline int computeMAPQ(
     double probabilityOfAllCandidates,
     double probabilityOfBestCandidate,
@@ -51,7 +58,7 @@ inline int computeMAPQ(
     if (correctnessProbability >= 1) {
         baseMAPQ =  70;
     } else {
-        baseMAPQ = __min(70, (int)(-10 * log10(1 - correctnessProbability)));
+        baseMAPQ = mapqForErrorProbability(1 - correctnessProbability);
     }
 
     //
@@ -33,6 +33,8 @@
 #include <wincrypt.h>
 #include <fcntl.h>
 #include <io.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #else // _MSC_VER
 
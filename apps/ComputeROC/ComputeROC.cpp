@@ -375,6 +375,8 @@ int main(int argc, char * argv[])
 	readerContext.header = NULL;
 	readerContext.headerLength = 0;
 	readerContext.headerBytes = 0;
+	readerContext.orderedOutput = false;
+	readerContext.trimmer = NULL;
 
     if (NULL != strrchr(inputFileName, '.') && !_stricmp(strrchr(inputFileName, '.'), ".bam")) {
         readSupplierGenerator = BAMReader::createReadSupplierGenerator(inputFileName, nThreads, readerContext);
@@ -2,11 +2,15 @@
 
 Module Name:
 
-    ComputeROC.cpp
+    ExtractReads.cpp
 
 Abstract:
 
-   Take a SAM file with simulated reads and compute a ROC curve from it.
+   Extract the reads overlapping a set of regions from a sorted, indexed BAM file into a new BAM file.
+
+   The .bai index (as written by SNAP with -so, or by samtools) is used to find the BGZF chunks that
+   can hold reads in the regions, so only those parts of the input are read.  The chunks are split into
+   tasks that are read and decompressed in parallel, and written out in file order so the output stays sorted.
 
 Authors:
 
@@ -18,92 +22,676 @@ Environment:
 
 Revision History:
 
-    
+    Rewritten to use BAI random access & parallel decoding, with region lists
+
 --*/
 
 #include "stdafx.h"
 #include "SAM.h"
-#include "BAM.h"
-#include "Genome.h"
-#include "Compat.h"
-#include "Read.h"
-#include "RangeSplitter.h"
 #include "BigAlloc.h"
+#include "Compat.h"
+#include "Bam.h"
+#include "DataWriter.h"
+#include "GzipDataWriter.h"
+#include "ParallelTask.h"
+#include "VariableSizeVector.h"
+#include "zlib.h"
+#include "exit.h"
+#include "Error.h"
+
+using std::max;
+using std::min;
 
 void usage()
 {
-    fprintf(stderr,"usage: ExtractReads genomeDirectory input.bam output.sam chromosome\n");
-  	exit(1);
+    fprintf(stderr,
+        "usage: ExtractReads [-t threads] [-L regions.bed] input.bam output.bam [region ...]\n"
+        "  Regions are contig, contig:start or contig:start-end, 1-based and inclusive as in samtools.\n"
+        "  -L reads regions from a BED file (0-based, half open).  input.bam must be sorted and have an index\n"
+        "  in input.bam.bai.\n");
+    soft_exit(1);
 }
 
+// growable byte buffer
+struct ByteBuffer
+{
+    ByteBuffer() : data(NULL), used(0), capacity(0) {}
+    ~ByteBuffer() { delete [] data; }
+
+    void ensure(size_t bytes)
+    {
+        if (bytes > capacity) {
+            size_t newCapacity = max(bytes, 2 * capacity);
+            char* newData = new char[newCapacity];
+            if (used > 0) {
+                memcpy(newData, data, used);
+            }
+            delete [] data;
+            data = newData;
+            capacity = newCapacity;
+        }
+    }
+
+    char*   data;
+    size_t  used;
+    size_t  capacity;
+};
+
+//
+// Reads whole BGZF blocks from a file, appending the decompressed data to a buffer.
+//
+class BgzfBlockReader
+{
+public:
+    BgzfBlockReader(const char* fileName)
+    {
+        file = fopen(fileName, "rb");
+        if (NULL == file) {
+            WriteErrorMessage("Unable to open '%s'\n", fileName);
+            soft_exit(1);
+        }
+        memset(&zstream, 0, sizeof(zstream));
+        if (inflateInit2(&zstream, -15) != Z_OK) { // raw deflate, we parse the gzip wrapper ourselves
+            WriteErrorMessage("inflateInit2 failed\n");
+            soft_exit(1);
+        }
+        compressed = new char[BAM_BLOCK];
+    }
+
+    ~BgzfBlockReader()
+    {
+        inflateEnd(&zstream);
+        fclose(file);
+        delete [] compressed;
+    }
+
+    void seek(_uint64 i_compressedOffset)
+    {
+        compressedOffset = i_compressedOffset;
+        if (0 != _fseek64bit(file, compressedOffset, SEEK_SET)) {
+            WriteErrorMessage("Unable to seek to %lld in BAM file\n", compressedOffset);
+            soft_exit(1);
+        }
+    }
+
+    // offset in the file of the next block to be read
+    _uint64 getCompressedOffset() { return compressedOffset; }
+
+    // returns false at end of file
+    bool readBlock(ByteBuffer* output)
+    {
+        const size_t fixed = sizeof(BgzfHeader);
+        size_t n = fread(compressed, 1, fixed, file);
+        if (n == 0) {
+            return false;
+        }
+        BgzfHeader* header = (BgzfHeader*) compressed;
+        if (n != fixed || header->ID1 != 0x1f || header->ID2 != 0x8b || fixed + header->XLEN > BAM_BLOCK ||
+            fread(compressed + fixed, 1, header->XLEN, file) != header->XLEN)
+        {
+            WriteErrorMessage("Corrupt BGZF block header at offset %lld\n", compressedOffset);
+            soft_exit(1);
+        }
+        size_t blockSize = (size_t) header->BSIZE() + 1;
+        if (blockSize <= fixed + header->XLEN + 8 || blockSize > BAM_BLOCK ||
+            fread(compressed + fixed + header->XLEN, 1, blockSize - fixed - header->XLEN, file) != blockSize - fixed - header->XLEN)
+        {
+            WriteErrorMessage("Corrupt or truncated BGZF block at offset %lld\n", compressedOffset);
+            soft_exit(1);
+        }
+        _uint32 isize = header->ISIZE();
+        output->ensure(output->used + isize);
+        inflateReset(&zstream);
+        zstream.next_in = (Bytef*) compressed + fixed + header->XLEN;
+        zstream.avail_in = (uInt) (blockSize - fixed - header->XLEN - 8);
+        zstream.next_out = (Bytef*) output->data + output->used;
+        zstream.avail_out = isize;
+        int status = inflate(&zstream, Z_FINISH);
+        if (status != Z_STREAM_END || zstream.avail_out != 0) {
+            WriteErrorMessage("Failed to decompress BGZF block at offset %lld\n", compressedOffset);
+            soft_exit(1);
+        }
+        output->used += isize;
+        compressedOffset += blockSize;
+        return true;
+    }
+
+private:
+    FILE*       file;
+    z_stream    zstream;
+    char*       compressed;
+    _uint64     compressedOffset;
+};
+
+// a region of a contig, 0-based half open
+struct Region
+{
+    Region() : start(0), end(0) {}
+    Region(int i_start, int i_end) : start(i_start), end(i_end) {}
+
+    int start, end;
+
+    static bool comparator(const Region& a, const Region& b)
+    { return a.start < b.start; }
+};
+
+typedef VariableSizeVector<Region> RegionVector;
+
+// a range of virtual file offsets to read & filter
+struct ExtractTask
+{
+    _uint64     start, end;
+    ByteBuffer  output;     // matching records
+    _int64      reads, matched;
+};
+
+struct Chunk
+{
+    _uint64 start, end;
+
+    static bool comparator(const Chunk& a, const Chunk& b)
+    { return a.start < b.start; }
+};
+
+typedef VariableSizeVector<Chunk> ChunkVector;
+
+// the parts of the BAI needed for queries
+struct BamIndex
+{
+    struct Bin
+    {
+        _uint32     bin;
+        ChunkVector chunks;
+    };
+    struct Ref
+    {
+        Ref() : bins(NULL), nBins(0), linear(NULL), nLinear(0) {}
+        Bin*        bins;
+        int         nBins;
+        _uint64*    linear;
+        int         nLinear;
+    };
+
+    Ref*    refs;
+    int     nRefs;
+
+    static BamIndex* load(const char* fileName);
+};
+
+static void
+ReadOrDie(void* buffer, size_t bytes, FILE* file, const char* fileName)
+{
+    if (fread(buffer, 1, bytes, file) != bytes) {
+        WriteErrorMessage("Unexpected end of index file '%s'\n", fileName);
+        soft_exit(1);
+    }
+}
+
+    BamIndex*
+BamIndex::load(
+    const char* fileName)
+{
+    FILE* file = fopen(fileName, "rb");
+    if (NULL == file) {
+        WriteErrorMessage("Unable to open BAM index '%s'; the input must be sorted and indexed\n", fileName);
+        soft_exit(1);
+    }
+    char magic[4];
+    ReadOrDie(magic, sizeof(magic), file, fileName);
+    if (memcmp(magic, "BAI\1", 4)) {
+        WriteErrorMessage("'%s' is not a BAM index\n", fileName);
+        soft_exit(1);
+    }
+    BamIndex* index = new BamIndex();
+    ReadOrDie(&index->nRefs, sizeof(_int32), file, fileName);
+    index->refs = new Ref[index->nRefs];
+    for (int i = 0; i < index->nRefs; i++) {
+        Ref* ref = &index->refs[i];
+        ReadOrDie(&ref->nBins, sizeof(_int32), file, fileName);
+        ref->bins = new Bin[ref->nBins];
+        for (int j = 0; j < ref->nBins; j++) {
+            _int32 nChunks;
+            ReadOrDie(&ref->bins[j].bin, sizeof(_uint32), file, fileName);
+            ReadOrDie(&nChunks, sizeof(_int32), file, fileName);
+            for (int k = 0; k < nChunks; k++) {
+                Chunk chunk;
+                ReadOrDie(&chunk.start, sizeof(_uint64), file, fileName);
+                ReadOrDie(&chunk.end, sizeof(_uint64), file, fileName);
+                ref->bins[j].chunks.push_back(chunk);
+            }
+        }
+        ReadOrDie(&ref->nLinear, sizeof(_int32), file, fileName);
+        ref->linear = new _uint64[max(ref->nLinear, 1)];
+        ReadOrDie(ref->linear, ref->nLinear * sizeof(_uint64), file, fileName);
+    }
+    fclose(file);
+    return index;
+}
+
+//
+// Each thread takes tasks in turn, reads the BGZF blocks they cover and copies out the records that overlap a region.
+//
+struct ExtractContext : public TaskContextBase
+{
+    const char*     inputFileName;
+    RegionVector*   regions;    // per reference, sorted & disjoint
+    int             nRefs;
+    ExtractTask*    tasks;
+    int             nTasks;
+    volatile int*   nextTask;
+
+    void initializeThread() {}
+
+    void runThread();
+
+    void finishThread(ExtractContext* common) {}
+
+    bool overlaps(BAMAlignment* bam);
+
+    void runTask(BgzfBlockReader* reader, ExtractTask* task, ByteBuffer* decompressed);
+};
+
+    bool
+ExtractContext::overlaps(
+    BAMAlignment* bam)
+{
+    if (bam->refID < 0 || bam->refID >= nRefs) {
+        return false;
+    }
+    RegionVector* r = &regions[bam->refID];
+    int end = bam->pos + max(1, bam->l_ref());
+    // first region ending after the start of the read
+    int low = 0, high = (int) r->size();
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if ((*r)[mid].end <= bam->pos) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low < r->size() && (*r)[low].start < end;
+}
+
+    void
+ExtractContext::runTask(
+    BgzfBlockReader* reader,
+    ExtractTask* task,
+    ByteBuffer* decompressed)
+{
+    _uint64 endBlock = task->end >> 16;
+    _uint32 endOffset = (_uint32) (task->end & 0xffff);
+    decompressed->used = 0;
+    size_t end = 0;
+    reader->seek(task->start >> 16);
+    while (reader->getCompressedOffset() < endBlock || (reader->getCompressedOffset() == endBlock && endOffset > 0)) {
+        size_t blockStart = decompressed->used;
+        bool isEndBlock = reader->getCompressedOffset() == endBlock;
+        if (! reader->readBlock(decompressed)) {
+            break;
+        }
+        end = isEndBlock ? blockStart + endOffset : decompressed->used;
+    }
+
+    task->reads = task->matched = 0;
+    task->output.used = 0;
+    size_t offset = task->start & 0xffff;
+    while (offset + sizeof(_int32) <= end) {
+        BAMAlignment* bam = (BAMAlignment*) (decompressed->data + offset);
+        size_t size = bam->size();
+        if (offset + size > decompressed->used) {
+            WriteErrorMessage("Truncated BAM record in chunk %llx-%llx\n", task->start, task->end);
+            soft_exit(1);
+        }
+        task->reads++;
+        if (overlaps(bam)) {
+            task->matched++;
+            task->output.ensure(task->output.used + size);
+            memcpy(task->output.data + task->output.used, bam, size);
+            task->output.used += size;
+        }
+        offset += size;
+    }
+}
+
+    void
+ExtractContext::runThread()
+{
+    BgzfBlockReader reader(inputFileName);
+    ByteBuffer decompressed;
+    int i;
+    while ((i = InterlockedIncrementAndReturnNewValue(nextTask) - 1) < nTasks) {
+        runTask(&reader, &tasks[i], &decompressed);
+    }
+}
+
+// parse contig[:start[-end]], 1-based inclusive
+static bool
+ParseRegion(
+    const char* text,
+    BAMHeader* header,
+    RegionVector* regions)
+{
+    const char* colon = strrchr(text, ':');
+    size_t nameLength = colon != NULL ? colon - text : strlen(text);
+    BAMHeaderRefSeq* ref = header->firstRefSeq();
+    for (int i = 0; i < header->n_ref(); i++, ref = ref->next()) {
+        if (strlen(ref->name()) != nameLength || strncmp(ref->name(), text, nameLength)) {
+            continue;
+        }
+        _int64 start = 1, end = ref->l_ref();
+        if (colon != NULL) {
+            // allow 1,000,000 style numbers
+            char digits[64];
+            int n = 0;
+            for (const char* p = colon + 1; *p && n < (int) sizeof(digits) - 1; p++) {
+                if (*p != ',') {
+                    digits[n++] = *p;
+                }
+            }
+            digits[n] = 0;
+            if (sscanf(digits, "%lld-%lld", &start, &end) < 1) {
+                return false;
+            }
+        }
+        start = max(start, (_int64) 1);
+        end = min(end, (_int64) ref->l_ref());
+        if (start <= end) {
+            regions[i].push_back(Region((int) (start - 1), (int) end));
+        }
+        return true;
+    }
+    return false;
+}
+
+static void
+ReadBedFile(
+    const char* fileName,
+    BAMHeader* header,
+    RegionVector* regions)
+{
+    FILE* file = fopen(fileName, "r");
+    if (NULL == file) {
+        WriteErrorMessage("Unable to open region file '%s'\n", fileName);
+        soft_exit(1);
+    }
+    char line[4096];
+    while (NULL != fgets(line, sizeof(line), file)) {
+        char contig[1024];
+        _int64 start, end;
+        if (line[0] == '#' || !strncmp(line, "track", 5) || !strncmp(line, "browser", 7) ||
+            sscanf(line, "%1023s %lld %lld", contig, &start, &end) != 3)
+        {
+            continue;
+        }
+        char region[1100];
+        snprintf(region, sizeof(region), "%s:%lld-%lld", contig, start + 1, end);
+        if (! ParseRegion(region, header, regions)) {
+            WriteErrorMessage("Contig '%s' in region file '%s' isn't in the BAM header\n", contig, fileName);
+            soft_exit(1);
+        }
+    }
+    fclose(file);
+}
+
+// sort & merge overlapping regions, so each read is matched once
+static void
+NormalizeRegions(
+    RegionVector* regions)
+{
+    if (regions->size() == 0) {
+        return;
+    }
+    std::sort(regions->begin(), regions->end(), Region::comparator);
+    int n = 0;
+    for (int i = 1; i < regions->size(); i++) {
+        if ((*regions)[i].start <= (*regions)[n].end) {
+            (*regions)[n].end = max((*regions)[n].end, (*regions)[i].end);
+        } else {
+            (*regions)[++n] = (*regions)[i];
+        }
+    }
+    regions->truncate(n + 1);
+}
+
+static const _uint64 MaxTaskBytes = 4 * 1024 * 1024; // compressed bytes per task
 
 int main(int argc, char * argv[])
 {
     BigAllocUseHugePages = false;
 
-    if (argc != 5) usage();
-
-    static const char *genomeSuffix = "Genome";
-	size_t filenameLen = strlen(argv[1]) + 1 + strlen(genomeSuffix) + 1;
-	char *fileName = new char[strlen(argv[1]) + 1 + strlen(genomeSuffix) + 1];
-	snprintf(fileName,filenameLen,"%s%c%s",argv[1],PATH_SEP,genomeSuffix);
-	const Genome *genome = Genome::loadFromFile(fileName, 0);
-	if (NULL == genome) {
-		fprintf(stderr,"Unable to load genome from file '%s'\n",fileName);
-		return -1;
-	}
-	delete [] fileName;
-	fileName = NULL;
-
-    ReaderContext readerContext;
-    readerContext.header = NULL;
-    readerContext.genome = genome;
-    readerContext.clipping = NoClipping;
-    readerContext.paired = false;
-    readerContext.ignoreSecondaryAlignments = true;
-    readerContext.ignoreSupplementaryAlignments = true;
-    readerContext.defaultReadGroup = "";
-
-    ReadSupplierGenerator *readSupplierGenerator = BAMReader::createReadSupplierGenerator(fileName,1, readerContext);
-    ReadSupplier *readSupplier = readSupplierGenerator->generateNewReadSupplier();
-
-    AlignerOptions options("");
-    options.outputFileTemplate = argv[4];
-    options.sortOutput = false;
-    
-    const FileFormat* format = 
-    FileFormat::SAM[0]->isFormatOf(argv[3]) ? FileFormat::SAM[false] :
-    FileFormat::BAM[0]->isFormatOf(argv[3]) ? FileFormat::BAM[false] :
-    NULL;
-
-    if (NULL == format) {
-        fprintf(stderr,"Can't determine format for output file (does it end in .sam or .bam?)\n");
-        return 0;
-    }
-
-    ReadWriterSupplier *writerSupplier = format->getWriterSupplier(&options, readerContext.genome);
-    ReadWriter* writer = writerSupplier->getWriter();
-    writer->writeHeader(readerContext, options.sortOutput, argc, (const char **)argv, "", "");
-
-    Read *read;
-    AlignmentResult alignmentResult;
-    unsigned genomeLocation;
-    bool isRC;
-    unsigned mapQ;
-    _int64 totalReads = 0;
-    _int64 emittedReads = 0;
-    while (readSupplier->getNextRead()) {
-        totalReads++;
-        const Genome::Contig *contig = genome->getContigAtLocation(genomeLocation);
-        if (NULL != contig && !strcmp(contig->name, argv[4])) {
-            emittedReads++;
-            writer->writeRead(read, alignmentResult, mapQ, genomeLocation, isRC ? RC : FORWARD);
+    int numThreads = GetNumberOfProcessors();
+    const char* bedFileName = NULL;
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-' && argv[arg][1] != 0; arg++) {
+        if (!strcmp(argv[arg], "-t") && arg + 1 < argc) {
+            numThreads = max(1, atoi(argv[++arg]));
+        } else if (!strcmp(argv[arg], "-L") && arg + 1 < argc) {
+            bedFileName = argv[++arg];
+        } else {
+            usage();
+        }
+    }
+    if (argc - arg < 2 || (argc - arg < 3 && NULL == bedFileName)) {
+        usage();
+    }
+    const char* inputFileName = argv[arg];
+    const char* outputFileName = argv[arg + 1];
+
+    //
+    // Read the header, which may span several blocks.
+    //
+    ByteBuffer headerBuffer;
+    BgzfBlockReader headerReader(inputFileName);
+    headerReader.seek(0);
+    size_t headerSize = 0;
+    while (true) {
+        BAMHeader* header = (BAMHeader*) headerBuffer.data;
+        if (headerBuffer.used >= BAMHeader::size(0) && header->magic != BAMHeader::BAM_MAGIC) {
+            WriteErrorMessage("'%s' is not a BAM file\n", inputFileName);
+            soft_exit(1);
+        }
+        if (headerBuffer.used >= BAMHeader::size(0) && headerBuffer.used >= header->size()) {
+            size_t size = header->size();
+            BAMHeaderRefSeq* ref = header->firstRefSeq();
+            int i;
+            for (i = 0; i < header->n_ref() && size + sizeof(_int32) <= headerBuffer.used; i++) {
+                size += BAMHeaderRefSeq::size(ref->l_name);
+                if (size > headerBuffer.used) {
+                    break;
+                }
+                ref = ref->next();
+            }
+            if (i == header->n_ref() && size <= headerBuffer.used) {
+                headerSize = size;
+                break;
+            }
+        }
+        if (! headerReader.readBlock(&headerBuffer)) {
+            WriteErrorMessage("Truncated header in BAM file '%s'\n", inputFileName);
+            soft_exit(1);
+        }
+    }
+    BAMHeader* header = (BAMHeader*) headerBuffer.data;
+    int nRefs = header->n_ref();
+
+    RegionVector* regions = new RegionVector[max(nRefs, 1)];
+    for (int i = arg + 2; i < argc; i++) {
+        if (! ParseRegion(argv[i], header, regions)) {
+            WriteErrorMessage("Can't parse region '%s', or its contig isn't in the BAM header\n", argv[i]);
+            soft_exit(1);
+        }
+    }
+    if (NULL != bedFileName) {
+        ReadBedFile(bedFileName, header, regions);
+    }
+
+    //
+    // Find the chunks that can hold reads in the regions.
+    //
+    size_t len = strlen(inputFileName);
+    char* indexFileName = new char[len + 5];
+    strcpy(indexFileName, inputFileName);
+    strcpy(indexFileName + len, ".bai");
+    BamIndex* index = BamIndex::load(indexFileName);
+    if (index->nRefs != nRefs) {
+        WriteErrorMessage("Index '%s' doesn't match the BAM header\n", indexFileName);
+        soft_exit(1);
+    }
+
+    ChunkVector chunks;
+    VariableSizeVector<_uint64> splitPoints;
+    _uint16* bins = new _uint16[BAMAlignment::MAX_BIN];
+    for (int r = 0; r < nRefs; r++) {
+        NormalizeRegions(&regions[r]);
+        BamIndex::Ref* ref = &index->refs[r];
+        if (regions[r].size() > 0) {
+            for (int i = 0; i < ref->nLinear; i++) {
+                if (ref->linear[i] != 0) {
+                    splitPoints.push_back(ref->linear[i]);
+                }
+            }
+        }
+        for (int i = 0; i < regions[r].size(); i++) {
+            Region region = regions[r][i];
+            // reads before this offset can't reach the region
+            int window = region.start >> 14;
+            _uint64 minOffset = window < ref->nLinear ? ref->linear[window] : 0;
+            int nBins = BAMAlignment::reg2bins(region.start, region.end, bins);
+            for (int b = 0; b < ref->nBins; b++) {
+                if (ref->bins[b].bin == BAMAlignment::BAM_EXTRA_BIN) {
+                    continue;
+                }
+                bool wanted = false;
+                for (int k = 0; k < nBins && !wanted; k++) {
+                    wanted = bins[k] == ref->bins[b].bin;
+                }
+                if (! wanted) {
+                    continue;
+                }
+                for (int c = 0; c < ref->bins[b].chunks.size(); c++) {
+                    Chunk chunk = ref->bins[b].chunks[c];
+                    if (chunk.end > minOffset) {
+                        chunk.start = max(chunk.start, minOffset);
+                        chunks.push_back(chunk);
+                    }
+                }
+            }
         }
     }
+    delete [] bins;
+
+    // merge overlapping chunks
+    std::sort(chunks.begin(), chunks.end(), Chunk::comparator);
+    int nChunks = 0;
+    for (int i = 0; i < chunks.size(); i++) {
+        if (nChunks > 0 && chunks[i].start <= chunks[nChunks - 1].end) {
+            chunks[nChunks - 1].end = max(chunks[nChunks - 1].end, chunks[i].end);
+        } else {
+            chunks[nChunks++] = chunks[i];
+        }
+    }
+    chunks.truncate(nChunks);
+
+    //
+    // Split big chunks at read boundaries from the linear index, so they can be decoded in parallel.
+    //
+    std::sort(splitPoints.begin(), splitPoints.end());
+    ChunkVector tasks;
+    _uint64 totalCompressed = 0;
+    int s = 0;
+    for (int i = 0; i < nChunks; i++) {
+        _uint64 start = chunks[i].start;
+        totalCompressed += (chunks[i].end >> 16) - (chunks[i].start >> 16);
+        while (s < splitPoints.size() && splitPoints[s] <= start) {
+            s++;
+        }
+        for (; s < splitPoints.size() && splitPoints[s] < chunks[i].end; s++) {
+            if ((splitPoints[s] >> 16) - (start >> 16) >= MaxTaskBytes) {
+                Chunk task = {start, splitPoints[s]};
+                tasks.push_back(task);
+                start = splitPoints[s];
+            }
+        }
+        Chunk task = {start, chunks[i].end};
+        tasks.push_back(task);
+    }
+
+    //
+    // Write the header, then run the tasks a window at a time, writing each window's output in order.
+    //
+    GzipWriterFilterSupplier* gzipSupplier = DataWriterSupplier::gzip(true, BAM_BLOCK, numThreads, false, false);
+    DataWriterSupplier* writerSupplier = DataWriterSupplier::create(outputFileName, 16 * 1024 * 1024, gzipSupplier);
+    DataWriter* writer = writerSupplier->getWriter();
+    char* buffer;
+    size_t bytes;
+    writer->inHeader(true);
+    for (size_t written = 0; written < headerSize; ) {
+        if (! writer->getBuffer(&buffer, &bytes)) {
+            WriteErrorMessage("Unable to write output file '%s'\n", outputFileName);
+            soft_exit(1);
+        }
+        size_t n = min(bytes, headerSize - written);
+        memcpy(buffer, headerBuffer.data + written, n);
+        writer->advance(n);
+        writer->nextBatch();
+        written += n;
+    }
+    writer->inHeader(false);
+
+    _int64 start = timeInMillis();
+    _int64 totalReads = 0, emittedReads = 0;
+    const int window = 4 * numThreads;
+    for (int first = 0; first < tasks.size(); first += window) {
+        int n = min(window, (int) tasks.size() - first);
+        ExtractTask* windowTasks = new ExtractTask[n];
+        for (int i = 0; i < n; i++) {
+            windowTasks[i].start = tasks[first + i].start;
+            windowTasks[i].end = tasks[first + i].end;
+        }
+        volatile int nextTask = 0;
+        ExtractContext context;
+        context.totalThreads = min(numThreads, n);
+        context.bindToProcessors = false;
+#ifdef  _MSC_VER
+        context.useTimingBarrier = false;
+#endif  // _MSC_VER
+        context.inputFileName = inputFileName;
+        context.regions = regions;
+        context.nRefs = nRefs;
+        context.tasks = windowTasks;
+        context.nTasks = n;
+        context.nextTask = &nextTask;
+        ParallelTask<ExtractContext> task(&context);
+        task.run();
+
+        for (int i = 0; i < n; i++) {
+            totalReads += windowTasks[i].reads;
+            emittedReads += windowTasks[i].matched;
+            for (size_t offset = 0; offset < windowTasks[i].output.used; ) {
+                BAMAlignment* bam = (BAMAlignment*) (windowTasks[i].output.data + offset);
+                size_t size = bam->size();
+                if (! writer->getBuffer(&buffer, &bytes) || bytes < size) {
+                    writer->nextBatch();
+                    if (! writer->getBuffer(&buffer, &bytes) || bytes < size) {
+                        WriteErrorMessage("Unable to write output file '%s'\n", outputFileName);
+                        soft_exit(1);
+                    }
+                }
+                memcpy(buffer, bam, size);
+                writer->advance(size);
+                offset += size;
+            }
+        }
+        delete [] windowTasks;
+    }
     writer->close();
+    delete writer;
+    writerSupplier->close();
+    delete writerSupplier;
 
-    printf("Processed %lld reads, of which %lld were emitted\n", totalReads, emittedReads);
+    printf("Read %lld MB of %lld chunks in %lld tasks, %lld reads of which %lld were emitted, in %llds\n",
+        totalCompressed >> 20, (_int64) nChunks, (_int64) tasks.size(), totalReads, emittedReads, (timeInMillis() - start + 500) / 1000);
 
-	return 0;
+    return 0;
 }
-
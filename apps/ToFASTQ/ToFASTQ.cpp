@@ -8,6 +8,18 @@ Abstract:
 
    Take a set of reads in SAM or BAM format and convert them to FASTQ
 
+   Every thread pulls reads from the (parallel decoding) SAM/BAM reader, formats them into its own
+   buffers, compresses those into BGZF blocks if the output is .gz, and appends them to the output
+   files under a lock, so that the files are written at close to disk speed.
+
+   For paired output, reads are re-paired by name through a set of shards, each holding the reads
+   still waiting for their mates.  Coordinate-sorted input leaves many reads waiting for a long time,
+   so when a shard outgrows its share of the memory limit its waiting reads are spilled to a temporary
+   file, and the spill files are paired up one shard at a time once all the input has been read.  A
+   spill file too big for the shard's share is first split by more bits of the name hash into smaller
+   ones, which are paired one at a time, so the limit holds for the final pass too.
+   Both ends of a pair are always appended together, so the two output files stay in step.
+
 Authors:
 
     Bill Bolosky, January, 2014
@@ -18,7 +30,8 @@ Environment:
 
 Revision History:
 
-    
+    Rewritten to run multi-threaded, with sharded re-pairing that spills to disk and BGZF output
+
 --*/
 
 #include "stdafx.h"
@@ -27,105 +40,672 @@ Revision History:
 #include "Genome.h"
 #include "Compat.h"
 #include "Read.h"
-#include "RangeSplitter.h"
 #include "BigAlloc.h"
-#include "FASTQ.h"
+#include "ParallelTask.h"
+#include "VariableSizeMap.h"
+#include "Util.h"
+#include "zlib.h"
+#include "exit.h"
+#include "Error.h"
+
+using std::max;
+using std::min;
 
 void usage()
 {
-    fprintf(stderr,"usage: ToFASTQ genomeIndex inputFile outputFile {outputFile2}\n");
+    fprintf(stderr,"usage: ToFASTQ [-t threads] [-m pairingMemoryMB] genomeIndex inputFile outputFile {outputFile2}\n");
     fprintf(stderr,"       Specifying two output files means that the input is paired.  If you specify only one output file, then\n");
     fprintf(stderr,"       ToFASTQ will generate a single-ended FASTQ even for a paired input.\n");
     fprintf(stderr,"       The genomeIndex must contain the same set of contigs used to align the input file.\n");
     fprintf(stderr,"       To produce interleaved paired-end FASTQ, specify outputFile2 as '-i'.\n");
+    fprintf(stderr,"       Output files ending in .gz are written BGZF compressed.\n");
+    fprintf(stderr,"  -t   number of threads (default all cores)\n");
+    fprintf(stderr,"  -m   memory for reads waiting for their mates, beyond which they are spilled to disk (default 4096)\n");
   	soft_exit(1);
 }
 
-ReadSupplierGenerator *readSupplierGenerator = NULL;
+static const size_t FlushBytes = 4 * 1024 * 1024;  // FASTQ text buffered per end by each thread before writing
+static const size_t BgzfInputBlock = 0xff00;        // uncompressed bytes per BGZF block, as in bgzip
+static const size_t BgzfHeaderSize = 18;
+static const size_t BgzfFooterSize = 8;
+static const int ShardsPerThread = 16;
+static const int SpillSplitBits = 4;                // an oversize spill file is split 16 ways...
+static const int MaxSpillSplitDepth = 8;            // ...on the low 32 bits of the hash, which don't choose the shard
+
+static const unsigned char BgzfHeader[BgzfHeaderSize] =
+    { 0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff, 6, 0, 'B', 'C', 2, 0, 0, 0 };
+
+static const unsigned char BgzfEof[28] =
+    { 0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff, 6, 0, 'B', 'C', 2, 0, 0x1b, 0, 3, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+// growable byte buffer
+struct ByteBuffer
+{
+    ByteBuffer() : data(NULL), used(0), capacity(0) {}
+    ~ByteBuffer() { delete [] data; }
+
+    void ensure(size_t bytes)
+    {
+        if (bytes > capacity) {
+            size_t newCapacity = max(bytes, 2 * capacity);
+            char* newData = new char[newCapacity];
+            if (used > 0) {
+                memcpy(newData, data, used);
+            }
+            delete [] data;
+            data = newData;
+            capacity = newCapacity;
+        }
+    }
+
+    char*   data;
+    size_t  used;
+    size_t  capacity;
+};
+
+//
+// The output files, shared by all threads.
+//
+struct FastqOutput
+{
+    FILE*           files[2];       // files[1] is NULL for single-end or interleaved output
+    const char*     fileNames[2];
+    bool            gzip;
+    bool            interleaved;
+    ExclusiveLock   lock;
+    _int64          bytesWritten;
+
+    void open(const char* fileName0, const char* fileName1);
+
+    // write the buffers for both ends together, so paired files stay in step
+    void write(ByteBuffer* buffers);
+
+    void close();
+};
+
+    void
+FastqOutput::open(
+    const char* fileName0,
+    const char* fileName1)
+{
+    interleaved = fileName1 != NULL && !strcmp(fileName1, "-i");
+    fileNames[0] = fileName0;
+    fileNames[1] = interleaved ? NULL : fileName1;
+    size_t len = strlen(fileName0);
+    gzip = len > 3 && !_stricmp(fileName0 + len - 3, ".gz");
+    for (int i = 0; i < 2; i++) {
+        files[i] = NULL;
+        if (NULL != fileNames[i]) {
+            files[i] = fopen(fileNames[i], "wb");
+            if (NULL == files[i]) {
+                WriteErrorMessage("Unable to open output file '%s'\n", fileNames[i]);
+                soft_exit(1);
+            }
+        }
+    }
+    InitializeExclusiveLock(&lock);
+    bytesWritten = 0;
+}
+
+    void
+FastqOutput::write(
+    ByteBuffer* buffers)
+{
+    AcquireExclusiveLock(&lock);
+    for (int i = 0; i < 2; i++) {
+        if (buffers[i].used > 0) {
+            if (NULL == files[i] || 1 != fwrite(buffers[i].data, buffers[i].used, 1, files[i])) {
+                WriteErrorMessage("Error writing output file '%s'\n", fileNames[i]);
+                soft_exit(1);
+            }
+            bytesWritten += buffers[i].used;
+            buffers[i].used = 0;
+        }
+    }
+    ReleaseExclusiveLock(&lock);
+}
+
+    void
+FastqOutput::close()
+{
+    for (int i = 0; i < 2; i++) {
+        if (NULL != files[i]) {
+            if (gzip && 1 != fwrite(BgzfEof, sizeof(BgzfEof), 1, files[i])) {
+                WriteErrorMessage("Error writing output file '%s'\n", fileNames[i]);
+                soft_exit(1);
+            }
+            fclose(files[i]);
+            files[i] = NULL;
+        }
+    }
+    DestroyExclusiveLock(&lock);
+}
 
-volatile _int64 nRunningThreads;
-SingleWaiterObject allThreadsDone;
-const char *inputFileName;
-const Genome *genome;
-FASTQWriter *fastqWriter[2] = {NULL, NULL};
+//
+// Per-thread FASTQ formatting & compression.
+//
+class FastqBuffer
+{
+public:
+    FastqBuffer(FastqOutput* i_output);
 
-struct ThreadContext {
-    unsigned    whichThread;
+    ~FastqBuffer();
 
-    _int64 totalReads;
+    // suffix is 1 or 2 to append /1 or /2 to the ID, or 0 for none
+    void add(int end, const char* id, unsigned idLength, int suffix, const char* data, const char* quality, unsigned length);
 
-    ThreadContext() {
-        totalReads = 0;
+    // call after each read or pair, so a pair is never split across writes
+    inline void endRecord()
+    {
+        if (text[0].used >= FlushBytes || text[1].used >= FlushBytes) {
+            flush();
+        }
     }
+
+    void flush();
+
+private:
+
+    void compress(ByteBuffer* from, ByteBuffer* to);
+
+    FastqOutput*    output;
+    ByteBuffer      text[2];
+    ByteBuffer      compressed[2];
+    z_stream        zstream;
 };
 
-bool inline isADigit(char x) {
-    return x >= '0' && x <= '9';
+FastqBuffer::FastqBuffer(
+    FastqOutput* i_output)
+    : output(i_output)
+{
+    for (int i = 0; i < 2; i++) {
+        text[i].ensure(FlushBytes + 4096);
+    }
+    memset(&zstream, 0, sizeof(zstream));
+    if (output->gzip && Z_OK != deflateInit2(&zstream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY)) {
+        WriteErrorMessage("deflateInit2 failed\n");
+        soft_exit(1);
+    }
+}
+
+FastqBuffer::~FastqBuffer()
+{
+    flush();
+    if (output->gzip) {
+        deflateEnd(&zstream);
+    }
+}
+
+    void
+FastqBuffer::add(
+    int end,
+    const char* id,
+    unsigned idLength,
+    int suffix,
+    const char* data,
+    const char* quality,
+    unsigned length)
+{
+    ByteBuffer* buffer = &text[output->interleaved ? 0 : end];
+    buffer->ensure(buffer->used + idLength + 2 * length + 8);
+    char* p = buffer->data + buffer->used;
+    *p++ = '@';
+    memcpy(p, id, idLength);
+    p += idLength;
+    if (suffix != 0) {
+        *p++ = '/';
+        *p++ = (char)('0' + suffix);
+    }
+    *p++ = '\n';
+    memcpy(p, data, length);
+    p += length;
+    *p++ = '\n';
+    *p++ = '+';
+    *p++ = '\n';
+    memcpy(p, quality, length);
+    p += length;
+    *p++ = '\n';
+    buffer->used = p - buffer->data;
+}
+
+    void
+FastqBuffer::flush()
+{
+    if (output->gzip) {
+        for (int i = 0; i < 2; i++) {
+            compress(&text[i], &compressed[i]);
+        }
+        output->write(compressed);
+    } else {
+        output->write(text);
+    }
+}
+
+    void
+FastqBuffer::compress(
+    ByteBuffer* from,
+    ByteBuffer* to)
+{
+    for (size_t offset = 0; offset < from->used; offset += BgzfInputBlock) {
+        size_t n = min(BgzfInputBlock, from->used - offset);
+        to->ensure(to->used + BAM_BLOCK);
+        char* block = to->data + to->used;
+        deflateReset(&zstream);
+        zstream.next_in = (Bytef*) (from->data + offset);
+        zstream.avail_in = (uInt) n;
+        zstream.next_out = (Bytef*) (block + BgzfHeaderSize);
+        zstream.avail_out = (uInt) (BAM_BLOCK - BgzfHeaderSize - BgzfFooterSize);
+        if (Z_STREAM_END != deflate(&zstream, Z_FINISH)) {
+            WriteErrorMessage("deflate failed to fit a block\n");
+            soft_exit(1);
+        }
+        size_t blockSize = BgzfHeaderSize + zstream.total_out + BgzfFooterSize;
+        memcpy(block, BgzfHeader, BgzfHeaderSize);
+        *(_uint16*) (block + 16) = (_uint16) (blockSize - 1);
+        *(_uint32*) (block + blockSize - 8) = (_uint32) crc32(0, (const Bytef*) (from->data + offset), (uInt) n);
+        *(_uint32*) (block + blockSize - 4) = (_uint32) n;
+        to->used += blockSize;
+    }
+    from->used = 0;
 }
 
-void
-WorkerThreadMain(void *param)
+//
+// A read waiting for its mate, with its ID, bases and qualities in one allocation.
+//
+struct PendingRead
 {
-    ThreadContext *context = (ThreadContext *)param;
+    PendingRead*    next;       // other reads in the shard with the same hash
+    _uint64         hash;
+    unsigned        flag;
+    unsigned        idLength;
+    unsigned        length;
+
+    inline char* id() { return (char*) (this + 1); }
+    inline char* data() { return id() + idLength; }
+    inline char* quality() { return data() + length; }
+
+    inline size_t bytes() { return sizeof(PendingRead) + idLength + 2 * length; }
+
+    static PendingRead* allocate(_uint64 hash, unsigned flag, unsigned idLength, unsigned length)
+    {
+        PendingRead* read = (PendingRead*) new char[sizeof(PendingRead) + idLength + 2 * length];
+        read->next = NULL;
+        read->hash = hash;
+        read->flag = flag;
+        read->idLength = idLength;
+        read->length = length;
+        return read;
+    }
+
+    static void release(PendingRead* read) { delete [] (char*) read; }
+
+    inline bool isMate(PendingRead* other)
+    { return hash == other->hash && idLength == other->idLength && !memcmp(id(), other->id(), idLength); }
+};
 
+typedef VariableSizeMap<_uint64, PendingRead*> PendingMap;
+
+//
+// Reads waiting for their mates, for the names that hash to this shard.
+//
+struct Shard
+{
+    ExclusiveLock   lock;
+    PendingMap      pending;
+    size_t          bytes;
+    FILE*           spillFile;
+    char*           spillFileName;
+    _int64          spilledReads;
+    size_t          spilledBytes;
+
+    // takes ownership of i_spillFileName
+    void initialize(char* i_spillFileName);
+
+    void destroy();
+
+    // add read, or if its mate is already there remove & return the mate
+    PendingRead* match(PendingRead* read);
+
+    // write all the pending reads to the spill file
+    void spill();
+
+    // append one read to the spill file
+    void spillRead(PendingRead* read);
+
+    // the next read from the spill file after a rewind, or NULL at its end
+    PendingRead* readSpilled();
+
+    void deleteSpillFile();
+
+    void deletePending();
+};
+
+    void
+Shard::initialize(
+    char* i_spillFileName)
+{
+    InitializeExclusiveLock(&lock);
+    bytes = 0;
+    spillFile = NULL;
+    spillFileName = i_spillFileName;
+    spilledReads = 0;
+    spilledBytes = 0;
+}
+
+    void
+Shard::destroy()
+{
+    DestroyExclusiveLock(&lock);
+    delete [] spillFileName;
+    spillFileName = NULL;
+}
+
+    PendingRead*
+Shard::match(
+    PendingRead* read)
+{
+    PendingRead** head = pending.tryFind(read->hash);
+    if (NULL != head) {
+        for (PendingRead** p = head; *p != NULL; p = &(*p)->next) {
+            if ((*p)->isMate(read)) {
+                PendingRead* mate = *p;
+                *p = mate->next;
+                if (NULL == *head) {
+                    pending.erase(read->hash);
+                }
+                bytes -= mate->bytes();
+                return mate;
+            }
+        }
+        read->next = *head;
+        *head = read;
+    } else {
+        pending.put(read->hash, read);
+    }
+    bytes += read->bytes();
+    return NULL;
+}
+
+    void
+Shard::spill()
+{
+    for (PendingMap::iterator i = pending.begin(); i != pending.end(); i = pending.next(i)) {
+        for (PendingRead* read = i->value; read != NULL; read = read->next) {
+            spillRead(read);
+        }
+    }
+    deletePending();
+}
+
+    void
+Shard::spillRead(
+    PendingRead* read)
+{
+    if (NULL == spillFile) {
+        spillFile = fopen(spillFileName, "w+b");
+        if (NULL == spillFile) {
+            WriteErrorMessage("Unable to create temporary file '%s'\n", spillFileName);
+            soft_exit(1);
+        }
+    }
+    if (1 != fwrite(read, read->bytes(), 1, spillFile)) {
+        WriteErrorMessage("Error writing temporary file '%s'\n", spillFileName);
+        soft_exit(1);
+    }
+    spilledReads++;
+    spilledBytes += read->bytes();
+}
+
+    PendingRead*
+Shard::readSpilled()
+{
+    PendingRead header;
+    if (1 != fread(&header, sizeof(header), 1, spillFile)) {
+        return NULL;
+    }
+    PendingRead* read = PendingRead::allocate(header.hash, header.flag, header.idLength, header.length);
+    if (1 != fread(read->id(), read->bytes() - sizeof(PendingRead), 1, spillFile)) {
+        WriteErrorMessage("Truncated temporary file '%s'\n", spillFileName);
+        soft_exit(1);
+    }
+    return read;
+}
+
+    void
+Shard::deleteSpillFile()
+{
+    fclose(spillFile);
+    spillFile = NULL;
+    DeleteSingleFile(spillFileName);
+    spilledBytes = 0;
+}
+
+    void
+Shard::deletePending()
+{
+    for (PendingMap::iterator i = pending.begin(); i != pending.end(); i = pending.next(i)) {
+        PendingRead* read = i->value;
+        while (read != NULL) {
+            PendingRead* next = read->next;
+            PendingRead::release(read);
+            read = next;
+        }
+    }
+    pending.clear();
+    bytes = 0;
+}
+
+//
+// Converts reads on each thread; for paired output a second pass pairs up the spilled reads a shard at a time.
+//
+struct ConvertContext : public TaskContextBase
+{
+    ReadSupplierGenerator*  readSupplierGenerator;
+    FastqOutput*            output;
+    bool                    paired;
+    Shard*                  shards;
+    int                     nShards;
+    size_t                  shardMemory;
+    bool                    finalPass;
+    volatile int*           nextShard;
+
+    // per-thread results, summed into the common context
+    _int64                  reads;
+    _int64                  pairs;
+    _int64                  unpaired;
+
+    void initializeThread()
+    { reads = pairs = unpaired = 0; }
+
+    void runThread();
+
+    void finishThread(ConvertContext* common)
+    {
+        common->reads += reads;
+        common->pairs += pairs;
+        common->unpaired += unpaired;
+    }
+
+    void convertReads(FastqBuffer* buffer);
+
+    // depth is how many times the shard's spill file has already been split
+    void pairSpilledReads(FastqBuffer* buffer, Shard* shard, int depth);
+
+    void writePair(FastqBuffer* buffer, PendingRead* a, PendingRead* b);
+};
+
+    void
+ConvertContext::runThread()
+{
+    FastqBuffer buffer(output);
+    if (! finalPass) {
+        convertReads(&buffer);
+    } else {
+        int shard;
+        while ((shard = InterlockedIncrementAndReturnNewValue(nextShard) - 1) < nShards) {
+            pairSpilledReads(&buffer, &shards[shard], 0);
+        }
+    }
+}
+
+    void
+ConvertContext::convertReads(
+    FastqBuffer* buffer)
+{
     ReadSupplier *readSupplier = readSupplierGenerator->generateNewReadSupplier();
 
     Read *read;
-     while (NULL != (read = readSupplier->getNextRead())) {
-        context->totalReads++;
-        fastqWriter[0]->writeRead(read);
-     } // for each read from the reader
+    while (NULL != (read = readSupplier->getNextRead())) {
+        reads++;
+        const char* id = read->getId();
+        unsigned idLength = read->getIdLength();
+        if (! paired) {
+            buffer->add(0, id, idLength, 0, read->getUnclippedData(), read->getUnclippedQuality(), read->getUnclippedLength());
+            buffer->endRecord();
+            continue;
+        }
+        unsigned flag = read->getOriginalSAMFlags();
+        if (0 == (flag & SAM_MULTI_SEGMENT)) {
+            unpaired++;
+            continue;
+        }
+        if (idLength > 2 && id[idLength - 2] == '/' && (id[idLength - 1] == '1' || id[idLength - 1] == '2')) {
+            idLength -= 2;
+        }
+        _uint64 hash = util::hash64(id, idLength);
+        if (0 == hash || ~(_uint64) 0 == hash) { // reserved for empty & tombstone in the map
+            hash = 1;
+        }
+
+        unsigned length = read->getUnclippedLength();
+        PendingRead* pending = PendingRead::allocate(hash, flag, idLength, length);
+        memcpy(pending->id(), id, idLength);
+        memcpy(pending->data(), read->getUnclippedData(), length);
+        memcpy(pending->quality(), read->getUnclippedQuality(), length);
+
+        Shard* shard = &shards[(hash >> 32) % nShards];
+        AcquireExclusiveLock(&shard->lock);
+        PendingRead* mate = shard->match(pending);
+        if (NULL == mate && shard->bytes > shardMemory) {
+            shard->spill();
+        }
+        ReleaseExclusiveLock(&shard->lock);
 
-     if (0 == InterlockedAdd64AndReturnNewValue(&nRunningThreads, -1)) {
-        SignalSingleWaiterObject(&allThreadsDone);
+        if (NULL != mate) {
+            writePair(buffer, mate, pending);
+            PendingRead::release(mate);
+            PendingRead::release(pending);
+        }
     }
+    delete readSupplier;
 }
 
-_int64
-ProcessPairedInput(PairedReadSupplierGenerator *pairedReadSupplierGenerator)
+    void
+ConvertContext::pairSpilledReads(
+    FastqBuffer* buffer,
+    Shard* shard,
+    int depth)
 {
-    //
-    // This runs single threaded, because it's the only easy way to assure that the two output files match.
-    //
-    PairedReadSupplier *readSupplier = pairedReadSupplierGenerator->generateNewPairedReadSupplier();
-    
-    Read *read[NUM_READS_PER_PAIR];
+    if (NULL != shard->spillFile && shard->bytes + shard->spilledBytes > shardMemory && depth < MaxSpillSplitDepth) {
+        //
+        // Pairing it all in memory would go over the shard's share, so split what's waiting by more bits of the hash
+        // (mates hash alike, so they land in the same piece), and pair the pieces one at a time.  A piece that's still
+        // too big gets split again.
+        //
+        shard->spill();
+        const int nPieces = 1 << SpillSplitBits;
+        Shard* pieces = new Shard[nPieces];
+        size_t pieceNameLength = strlen(shard->spillFileName) + 16;
+        for (int i = 0; i < nPieces; i++) {
+            char* pieceName = new char[pieceNameLength];
+            snprintf(pieceName, pieceNameLength, "%s.%d", shard->spillFileName, i);
+            pieces[i].initialize(pieceName);
+        }
 
-    const size_t idBufferSize = 10000;
-    char idBuffer[idBufferSize];
+        rewind(shard->spillFile);
+        PendingRead* read;
+        while (NULL != (read = shard->readSpilled())) {
+            pieces[(read->hash >> (SpillSplitBits * depth)) & (nPieces - 1)].spillRead(read);
+            PendingRead::release(read);
+        }
+        shard->deleteSpillFile();
 
-    _int64 totalReads = 0;
+        for (int i = 0; i < nPieces; i++) {
+            pairSpilledReads(buffer, &pieces[i], depth + 1);
+            pieces[i].destroy();
+        }
+        delete [] pieces;
+        return;
+    }
 
-    while (readSupplier->getNextReadPair(&read[0], &read[1])) {
-        for (int i = 0; i < NUM_READS_PER_PAIR; i++) {
-            //
-            // Create a new read with an ID that includes /1 or /2.  Don't bother to fill in the stuff that the
-            // FASTQ writer doesn't care about anyway.
-            //
-            snprintf(idBuffer, idBufferSize-1,"%.*s/%d", read[i]->getIdLength(), read[i]->getId(), i+1);
-            Read local;
-            local.init(idBuffer, (unsigned)strlen(idBuffer),read[i]->getUnclippedData(), read[i]->getUnclippedQuality(), read[i]->getUnclippedLength(),
-                0,0,0,0,0,0,0,NULL,0,0);
-            fastqWriter[i]->writeRead(&local);
+    if (NULL != shard->spillFile) {
+        //
+        // Match the spilled reads against what was left in memory, and each other.
+        //
+        rewind(shard->spillFile);
+        PendingRead* read;
+        while (NULL != (read = shard->readSpilled())) {
+            PendingRead* mate = shard->match(read);
+            if (NULL != mate) {
+                writePair(buffer, mate, read);
+                PendingRead::release(mate);
+                PendingRead::release(read);
+            }
         }
-        totalReads += 2;
+        shard->deleteSpillFile();
     }
 
-    return totalReads;
+    //
+    // Whatever's left never found its mate.
+    //
+    for (PendingMap::iterator i = shard->pending.begin(); i != shard->pending.end(); i = shard->pending.next(i)) {
+        for (PendingRead* read = i->value; read != NULL; read = read->next) {
+            unpaired++;
+        }
+    }
+    shard->deletePending();
 }
 
+    void
+ConvertContext::writePair(
+    FastqBuffer* buffer,
+    PendingRead* a,
+    PendingRead* b)
+{
+    if ((a->flag & SAM_LAST_SEGMENT) || (b->flag & SAM_FIRST_SEGMENT)) {
+        PendingRead* t = a;
+        a = b;
+        b = t;
+    }
+    buffer->add(0, a->id(), a->idLength, 1, a->data(), a->quality(), a->length);
+    buffer->add(1, b->id(), b->idLength, 2, b->data(), b->quality(), b->length);
+    buffer->endRecord();
+    pairs++;
+}
 
 int main(int argc, char * argv[])
 {
     BigAllocUseHugePages = false;
 
-    if (4 != argc && 5 != argc) usage();
+    int nThreads = GetNumberOfProcessors();
+    size_t pairingMemory = (size_t) 4096 << 20;
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-' && argv[arg][1] != 0; arg++) {
+        if (!strcmp(argv[arg], "-t") && arg + 1 < argc) {
+            nThreads = max(1, atoi(argv[++arg]));
+        } else if (!strcmp(argv[arg], "-m") && arg + 1 < argc) {
+            pairingMemory = (size_t) max(1, atoi(argv[++arg])) << 20;
+        } else {
+            usage();
+        }
+    }
+    if (3 != argc - arg && 4 != argc - arg) usage();
 
     static const char *genomeSuffix = "Genome";
-	size_t filenameLen = strlen(argv[1]) + 1 + strlen(genomeSuffix) + 1;
-	char *fileName = new char[strlen(argv[1]) + 1 + strlen(genomeSuffix) + 1];
-	snprintf(fileName,filenameLen,"%s%c%s",argv[1],PATH_SEP,genomeSuffix);
-	genome = Genome::loadFromFile(fileName, 0);
+	size_t filenameLen = strlen(argv[arg]) + 1 + strlen(genomeSuffix) + 1;
+	char *fileName = new char[strlen(argv[arg]) + 1 + strlen(genomeSuffix) + 1];
+	snprintf(fileName,filenameLen,"%s%c%s",argv[arg],PATH_SEP,genomeSuffix);
+	const Genome *genome = Genome::loadFromFile(fileName, 0);
 	if (NULL == genome) {
 		fprintf(stderr,"Unable to load genome from file '%s'\n",fileName);
 		return -1;
@@ -133,30 +713,14 @@ int main(int argc, char * argv[])
 	delete [] fileName;
 	fileName = NULL;
 
-    inputFileName = argv[2];
-
-    fastqWriter[0] = FASTQWriter::Factory(argv[3]);
-    if (NULL == fastqWriter[0]) {
-        fprintf(stderr,"Unable to open FASTQ writer for output file '%s'\n", argv[3]);
-        soft_exit(1);
-    }
-
-    _int64 totalReads = 0;
-    unsigned nThreads;
-
-#ifdef _DEBUG
-    nThreads = 1;
-#else   // _DEBUG
-    if (5 == argc) {
-        nThreads = 1;
-    } else {
-        nThreads = GetNumberOfProcessors();
-    }
-#endif // _DEBUG
+    const char *inputFileName = argv[arg + 1];
+    const char *outputFileName = argv[arg + 2];
+    bool paired = 4 == argc - arg;
 
+    FastqOutput output;
+    output.open(outputFileName, paired ? argv[arg + 3] : NULL);
 
     DataSupplier::ThreadCount = nThreads;
-    nRunningThreads = nThreads;
 
     ReaderContext readerContext;
     readerContext.clipping = NoClipping;
@@ -167,56 +731,65 @@ int main(int argc, char * argv[])
 	readerContext.header = NULL;
 	readerContext.headerLength = 0;
 	readerContext.headerBytes = 0;
+	readerContext.orderedOutput = false;
+	readerContext.trimmer = NULL;
 
-    if (5 == argc) {
-        if (!strcmp(argv[4], "-i")) {
-            fastqWriter[1] = fastqWriter[0];    // Interleaved
-        } else {
-            fastqWriter[1] = FASTQWriter::Factory(argv[4]);
-            if (NULL == fastqWriter[1]) {
-                fprintf(stderr,"Unable to open FASTQ writer for output file '%s'\n", argv[4]);
-                soft_exit(1);
-            }
-        }
-
-        PairedReadSupplierGenerator *pairedReadSupplierGenerator;
-        if (NULL != strrchr(inputFileName, '.') && !_stricmp(strrchr(inputFileName, '.'), ".bam")) {
-            pairedReadSupplierGenerator = BAMReader::createPairedReadSupplierGenerator(inputFileName, nThreads, true, readerContext);
-        } else {
-            pairedReadSupplierGenerator = SAMReader::createPairedReadSupplierGenerator(inputFileName, nThreads, true, readerContext);
-        }
-
-
-        totalReads = ProcessPairedInput(pairedReadSupplierGenerator);
-        if (fastqWriter[1] != fastqWriter[0]) {
-            delete fastqWriter[1];
-        } else {
-            fastqWriter[1] = NULL;
-        }
+    ConvertContext context;
+    if (NULL != strrchr(inputFileName, '.') && !_stricmp(strrchr(inputFileName, '.'), ".bam")) {
+        context.readSupplierGenerator = BAMReader::createReadSupplierGenerator(inputFileName, nThreads, readerContext);
     } else {
-        if (NULL != strrchr(inputFileName, '.') && !_stricmp(strrchr(inputFileName, '.'), ".bam")) {
-            readSupplierGenerator = BAMReader::createReadSupplierGenerator(inputFileName, nThreads, readerContext);
-        } else {
-            readSupplierGenerator = SAMReader::createReadSupplierGenerator(inputFileName, nThreads, readerContext);
-        }
-
-        CreateSingleWaiterObject(&allThreadsDone);
-        ThreadContext *contexts = new ThreadContext[nThreads];
+        context.readSupplierGenerator = SAMReader::createReadSupplierGenerator(inputFileName, nThreads, readerContext);
+    }
 
-        for (unsigned i = 0; i < nThreads; i++) {
-            contexts[i].whichThread = i;
+    context.totalThreads = nThreads;
+    context.bindToProcessors = false;
+#ifdef  _MSC_VER
+    context.useTimingBarrier = false;
+#endif  // _MSC_VER
+    context.output = &output;
+    context.paired = paired;
+    context.nShards = paired ? ShardsPerThread * nThreads : 0;
+    context.shardMemory = pairingMemory / max(1, context.nShards);
+    context.shards = paired ? new Shard[context.nShards] : NULL;
+    size_t spillNameLength = strlen(outputFileName) + 32;
+    for (int i = 0; i < context.nShards; i++) {
+        char* spillFileName = new char[spillNameLength];
+        snprintf(spillFileName, spillNameLength, "%s.pairs%d.tmp", outputFileName, i);
+        context.shards[i].initialize(spillFileName);
+    }
+    context.finalPass = false;
+    context.nextShard = NULL;
+    context.reads = context.pairs = context.unpaired = 0;
+
+    _int64 start = timeInMillis();
+    {
+        ParallelTask<ConvertContext> task(&context);
+        task.run();
+    }
 
-            StartNewThread(WorkerThreadMain, &contexts[i]);
+    _int64 spilledReads = 0;
+    if (paired) {
+        volatile int nextShard = 0;
+        context.finalPass = true;
+        context.nextShard = &nextShard;
+        ParallelTask<ConvertContext> task(&context);
+        task.run();
+        for (int i = 0; i < context.nShards; i++) {
+            spilledReads += context.shards[i].spilledReads;
+            context.shards[i].destroy();
         }
+        delete [] context.shards;
+    }
+    output.close();
 
-        WaitForSingleWaiterObject(&allThreadsDone);
-
-        for (unsigned i = 0; i < nThreads; i++) {
-            totalReads += contexts[i].totalReads;
-        }
+    _int64 elapsed = max((_int64) 1, timeInMillis() - start);
+    if (paired) {
+        printf("%lld reads, %lld pairs, %lld unpaired reads dropped, %lld reads spilled while pairing, %lld MB written in %llds, %lld reads/s\n",
+            context.reads, context.pairs, context.unpaired, spilledReads, output.bytesWritten >> 20, (elapsed + 500) / 1000, context.reads * 1000 / elapsed);
+    } else {
+        printf("%lld reads, %lld MB written in %llds, %lld reads/s\n",
+            context.reads, output.bytesWritten >> 20, (elapsed + 500) / 1000, context.reads * 1000 / elapsed);
     }
-    printf("%lld reads\n", totalReads);
-    delete fastqWriter[0];
 
 	return 0;
 }
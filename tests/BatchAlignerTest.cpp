@@ -0,0 +1,316 @@
+#include "stdafx.h"
+#include "Compat.h"
+#include "TestLib.h"
+#include "BatchAligner.h"
+#include "GenomeIndex.h"
+#include "BaseAligner.h"
+#include "IntersectingPairedEndAligner.h"
+#include "ChimericPairedEndAligner.h"
+#include "PairedAligner.h"
+#include "SeedSequencer.h"
+
+//
+// Test fixture that builds an index of a small random genome and makes reads from it: mostly exact or with a few
+// substitutions, in both directions, plus some random reads that shouldn't align and a few that are too short to try.
+// Each test aligns them with a BatchAligner and checks the results against the underlying aligners run directly.
+//
+struct BatchAlignerTest {
+    static const int ReadLength = 100;
+    static const int NumReads = 150;        // more than two chunks
+    static const int FragmentLength = 300;
+
+    BatchAlignerTest() : testIndex("BatchAlignerTest"), random(98765), index(NULL) {
+        InitializeSeedSequencers();     // the direct aligners run before any BatchAligner would do it
+
+        contigs[0] = random.bases(30000);
+        contigs[1] = random.bases(20000);
+        contigs[1].replace(1000, 500, contigs[0], 7000, 500);   // so some reads have two equally good alignments
+        testIndex.addContig(contigs[0]);
+        testIndex.addContig(contigs[1]);
+        index = testIndex.build();
+    }
+
+    ~BatchAlignerTest() {
+        delete index;
+        for (size_t i = 0; i < reads.size(); i++) {
+            delete reads[i];
+        }
+    }
+
+    //
+    // A read of the given contig and offset with nSubstitutions bases changed, reverse complemented if asked.  Its
+    // expected location and edit distance are recorded for the CIGAR checks.
+    //
+    void addRead(int c, int offset, bool rc, int nSubstitutions) {
+        std::string bases = contigs[c].substr(offset, ReadLength);
+        for (int i = 0; i < nSubstitutions; i++) {
+            int where = 10 + i * 30;
+            bases[where] = bases[where] == 'A' ? 'C' : 'A';
+        }
+        addRead(rc ? test::reverseComplement(bases) : bases,
+            index->getGenome()->getContigs()[c].beginningLocation + offset, nSubstitutions);
+    }
+
+    void addRead(const std::string &bases, GenomeLocation location, int editDistance) {
+        char id[20];
+        sprintf(id, "read%d", (int)reads.size());
+        ids.push_back(id);
+        data.push_back(bases);
+        qualities.push_back(std::string(bases.size(), 'I'));
+        expectedLocations.push_back(location);
+        expectedEditDistances.push_back(editDistance);
+        reads.push_back(new Read());
+    }
+
+    // Read objects point into the strings, so only set them up once all of the strings are made.
+    Read **makeReads() {
+        for (size_t i = 0; i < reads.size(); i++) {
+            reads[i]->init(ids[i].c_str(), (unsigned)ids[i].size(), data[i].c_str(), qualities[i].c_str(), (unsigned)data[i].size());
+        }
+        return &reads[0];
+    }
+
+    void makeSingleReads() {
+        for (int i = 0; i < NumReads; i++) {
+            if (i % 25 == 7) {
+                addRead(random.bases(ReadLength), InvalidGenomeLocation, -1);
+            } else if (i % 25 == 19) {
+                addRead(contigs[0].substr(200 + i, 30), InvalidGenomeLocation, -1);
+            } else {
+                int c = random.next(2);
+                addRead(c, random.next((int)contigs[c].size() - ReadLength), i % 2 == 1, i % 3);
+            }
+        }
+    }
+
+    void makePairs() {
+        for (int i = 0; i < NumReads; i++) {
+            int c = random.next(2);
+            int offset = random.next((int)contigs[c].size() - FragmentLength);
+            bool rc = i % 2 == 1;
+            addRead(c, rc ? offset + FragmentLength - ReadLength : offset, rc, i % 3);
+            addRead(c, rc ? offset : offset + FragmentLength - ReadLength, !rc, (i / 3) % 3);
+        }
+    }
+
+    //
+    // Runs the tasks in reverse order on the calling thread, to check that nothing depends on running them in order.
+    //
+    struct ReverseExecutor : public BatchAligner::Executor {
+        ReverseExecutor() : nRuns(0), nTasks(0) {}
+
+        virtual void run(int i_nTasks, Task task, void *context) {
+            nRuns++;
+            nTasks += i_nTasks;
+            for (int i = i_nTasks - 1; i >= 0; i--) {
+                task(context, i);
+            }
+        }
+
+        int nRuns;
+        int nTasks;
+    };
+
+    // A NotFound result has no meaningful location, so compare everything else.
+    static void compareSingle(const SingleAlignmentResult &expected, const SingleAlignmentResult &actual) {
+        ASSERT_EQ(expected.status, actual.status);
+        if (NotFound != expected.status) {
+            ASSERT_EQ(GenomeLocationAsInt64(expected.location), GenomeLocationAsInt64(actual.location));
+            ASSERT_EQ(expected.direction, actual.direction);
+            ASSERT_EQ(expected.score, actual.score);
+            ASSERT_EQ(expected.mapq, actual.mapq);
+        }
+    }
+
+    static void comparePaired(const PairedAlignmentResult &expected, const PairedAlignmentResult &actual) {
+        for (int r = 0; r < NUM_READS_PER_PAIR; r++) {
+            ASSERT_EQ(expected.status[r], actual.status[r]);
+            if (NotFound != expected.status[r]) {
+                ASSERT_EQ(GenomeLocationAsInt64(expected.location[r]), GenomeLocationAsInt64(actual.location[r]));
+                ASSERT_EQ(expected.direction[r], actual.direction[r]);
+                ASSERT_EQ(expected.score[r], actual.score[r]);
+                ASSERT_EQ(expected.mapq[r], actual.mapq[r]);
+            }
+        }
+    }
+
+    // The aligner's own result for a uniquely placed read should agree with where the read came from.
+    void checkCigar(int whichRead, AlignmentResult status, GenomeLocation location, const char *cigar, int editDistance) {
+        if (InvalidGenomeLocation == expectedLocations[whichRead] || !isOneLocation(status)) {
+            return;
+        }
+        ASSERT_EQ(GenomeLocationAsInt64(expectedLocations[whichRead]), GenomeLocationAsInt64(location));
+        ASSERT(NULL != cigar);
+        ASSERT_STREQ("100M", cigar);
+        ASSERT_EQ(expectedEditDistances[whichRead], editDistance);
+    }
+
+    test::TestIndex             testIndex;
+    test::Random                random;
+    GenomeIndex                *index;
+    std::string                 contigs[2];
+    std::vector<std::string>    ids;
+    std::vector<std::string>    data;
+    std::vector<std::string>    qualities;
+    std::vector<GenomeLocation> expectedLocations;
+    std::vector<int>            expectedEditDistances;
+    std::vector<Read *>         reads;
+};
+
+TEST_F(BatchAlignerTest, "single-end batches match BaseAligner") {
+    makeSingleReads();
+    Read **batchReads = makeReads();
+
+    AlignerOptions options("BatchAlignerTest");
+    options.numThreads = 2;
+    options.bindToProcessors = false;
+
+    //
+    // Align each read directly, set up the way BatchAligner sets up its workers.
+    //
+    BigAllocator *allocator = new BigAllocator(BaseAligner::getBigAllocatorReservation(index, true, options.maxHits, MAX_READ_LENGTH,
+        index->getSeedLength(), options.numSeedsFromCommandLine, options.seedCoverage, options.maxSecondaryAlignmentsPerContig));
+    BaseAligner *aligner = new (allocator) BaseAligner(index, options.maxHits, options.maxDist, MAX_READ_LENGTH,
+        options.numSeedsFromCommandLine, options.seedCoverage, options.minWeightToCheck, options.extraSearchDepth, options.noUkkonen,
+        options.noOrderedEvaluation, options.noTruncation, options.maxSecondaryAlignmentsPerContig, NULL, NULL, NULL, allocator);
+
+    std::vector<SingleAlignmentResult> expected(NumReads);
+    int nAligned = 0;
+    for (int i = 0; i < NumReads; i++) {
+        Read read(*batchReads[i]);
+        read.clip(options.clipping);
+        expected[i].status = NotFound;
+        if (read.getDataLength() >= options.minReadLength && read.countOfNs() <= options.maxDist) {
+            int nSecondaryResults;
+            ASSERT(aligner->AlignRead(&read, &expected[i], -1, 0, &nSecondaryResults, options.maxSecondaryAlignments, NULL));
+            nAligned += isOneLocation(expected[i].status);
+        }
+    }
+    aligner->~BaseAligner();
+    delete allocator;
+    ASSERT(nAligned > NumReads * 3 / 4);
+
+    //
+    // Then in batches, on the internal threads and through an executor, with and without CIGARs.
+    //
+    ReverseExecutor executor;
+    BatchAligner pooled(index, &options);
+    BatchAligner executed(index, &options, &executor);
+    ASSERT(!pooled.isPaired());
+
+    SingleBatchResults results;
+    for (int pass = 0; pass < 4; pass++) {
+        BatchAligner *batchAligner = pass % 2 == 0 ? &pooled : &executed;
+        bool computeCigars = pass >= 2;
+        ASSERT(batchAligner->alignReads(batchReads, NumReads, &results, computeCigars));
+        ASSERT_EQ(NumReads, results.getNumReads());
+        for (int i = 0; i < NumReads; i++) {
+            ASSERT_EQ(1, results.getNumAlignments(i));
+            const SingleAlignmentResult *result = results.getAlignments(i);
+            compareSingle(expected[i], *result);
+            if (computeCigars) {
+                checkCigar(i, result->status, result->location, results.getCigar(i, 0), results.getEditDistance(i, 0));
+                if (NotFound == result->status) {
+                    ASSERT(NULL == results.getCigar(i, 0));
+                }
+            }
+        }
+    }
+    ASSERT_EQ(2, executor.nRuns);
+    ASSERT_EQ(4, executor.nTasks);      // three chunks, but only as many tasks as threads
+
+    PairedBatchResults pairedResults;
+    ASSERT(!pooled.alignPairs(batchReads, NumReads / 2, &pairedResults));
+}
+
+TEST_F(BatchAlignerTest, "paired-end batches match ChimericPairedEndAligner") {
+    makePairs();
+    Read **batchReads = makeReads();
+
+    PairedAlignerOptions options("BatchAlignerTest");
+    options.numThreads = 2;
+    options.bindToProcessors = false;
+
+    //
+    // Align each pair directly, set up the way BatchAligner sets up its workers.
+    //
+    size_t memoryPoolSize = IntersectingPairedEndAligner::getBigAllocatorReservation(index, options.intersectingAlignerMaxHits,
+        MAX_READ_LENGTH, index->getSeedLength(), options.numSeedsFromCommandLine, options.seedCoverage, options.maxDist,
+        options.extraSearchDepth, options.maxCandidatePoolSize, options.maxSecondaryAlignmentsPerContig);
+    memoryPoolSize += ChimericPairedEndAligner::getBigAllocatorReservation(index, MAX_READ_LENGTH, options.maxHits, index->getSeedLength(),
+        options.numSeedsFromCommandLine, options.seedCoverage, options.maxDist, options.extraSearchDepth, options.maxCandidatePoolSize,
+        options.maxSecondaryAlignmentsPerContig);
+    memoryPoolSize += LVResultCache::getBigAllocatorReservation(options.lvCacheEntries);
+    BigAllocator *allocator = new BigAllocator(memoryPoolSize);
+
+    IntersectingPairedEndAligner *intersectingAligner = new (allocator) IntersectingPairedEndAligner(index, MAX_READ_LENGTH,
+        options.maxHits, options.maxDist, options.numSeedsFromCommandLine, options.seedCoverage, options.minSpacing, options.maxSpacing,
+        options.intersectingAlignerMaxHits, options.extraSearchDepth, options.maxCandidatePoolSize, options.maxSecondaryAlignmentsPerContig,
+        allocator, options.noUkkonen, options.noOrderedEvaluation, options.noTruncation);
+    intersectingAligner->setLVResultCache(allocator, options.lvCacheEntries);
+    intersectingAligner->setAdaptiveSeedSchedule(options.adaptiveSeedSchedule);
+
+    ChimericPairedEndAligner *aligner = new (allocator) ChimericPairedEndAligner(index, MAX_READ_LENGTH, options.maxHits, options.maxDist,
+        options.numSeedsFromCommandLine, options.seedCoverage, options.minWeightToCheck, options.forceSpacing, options.extraSearchDepth,
+        options.noUkkonen, options.noOrderedEvaluation, options.noTruncation, intersectingAligner, options.minReadLength,
+        options.maxSecondaryAlignmentsPerContig, allocator);
+
+    std::vector<PairedAlignmentResult> expected(NumReads);
+    SingleAlignmentResult singleSecondaryResult;
+    int nAligned = 0;
+    for (int i = 0; i < NumReads; i++) {
+        Read read0(*batchReads[2 * i]);
+        Read read1(*batchReads[2 * i + 1]);
+        read0.clip(options.clipping);
+        read1.clip(options.clipping);
+        int nSecondaryResults, nSingleSecondaryResults0, nSingleSecondaryResults1;
+        ASSERT(aligner->align(&read0, &read1, &expected[i], -1, 0, &nSecondaryResults, NULL, 0, options.maxSecondaryAlignments,
+            &nSingleSecondaryResults0, &nSingleSecondaryResults1, &singleSecondaryResult));
+        nAligned += isOneLocation(expected[i].status[0]) && isOneLocation(expected[i].status[1]);
+    }
+    aligner->~ChimericPairedEndAligner();
+    intersectingAligner->~IntersectingPairedEndAligner();
+    delete allocator;
+    ASSERT(nAligned > NumReads * 3 / 4);
+
+    ReverseExecutor executor;
+    BatchAligner pooled(index, &options);
+    BatchAligner executed(index, &options, &executor);
+    ASSERT(pooled.isPaired());
+
+    PairedBatchResults results;
+    for (int pass = 0; pass < 4; pass++) {
+        BatchAligner *batchAligner = pass % 2 == 0 ? &pooled : &executed;
+        bool computeCigars = pass >= 2;
+        ASSERT(batchAligner->alignPairs(batchReads, NumReads, &results, computeCigars));
+        ASSERT_EQ(NumReads, results.getNumPairs());
+        for (int i = 0; i < NumReads; i++) {
+            ASSERT_EQ(1, results.getNumPairedAlignments(i));
+            const PairedAlignmentResult *result = results.getPairedAlignments(i);
+            comparePaired(expected[i], *result);
+            for (int r = 0; r < NUM_READS_PER_PAIR; r++) {
+                ASSERT_EQ(0, results.getNumSingleAlignments(i, r));
+                if (computeCigars) {
+                    checkCigar(2 * i + r, result->status[r], result->location[r], results.getPairedCigar(i, 0, r),
+                        results.getPairedEditDistance(i, 0, r));
+                }
+            }
+        }
+    }
+    ASSERT_EQ(2, executor.nRuns);
+    ASSERT_EQ(4, executor.nTasks);
+
+    SingleBatchResults singleResults;
+    ASSERT(!pooled.alignReads(batchReads, NumReads, &singleResults));
+}
+
+TEST_F(BatchAlignerTest, "batches without an index fail") {
+    makeSingleReads();
+    AlignerOptions options("BatchAlignerTest");
+    options.numThreads = 1;
+    options.bindToProcessors = false;
+
+    BatchAligner batchAligner(NULL, &options);
+    SingleBatchResults results;
+    ASSERT(!batchAligner.alignReads(makeReads(), NumReads, &results));
+}
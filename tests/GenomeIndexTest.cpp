@@ -0,0 +1,142 @@
+#include "stdafx.h"
+#include "Compat.h"
+#include "TestLib.h"
+#include "GenomeIndex.h"
+#include "Seed.h"
+
+//
+// Test fixture that writes a small FASTA file and builds indices from it in the current directory.  The genome
+// is random apart from a stretch copied from one contig to the other (so some seeds have a few hits), a tandem
+// repeat (so some seeds have dozens of hits) and a run of Ns.
+//
+struct GenomeIndexTest {
+    static const int SeedLen = 20;
+
+    GenomeIndexTest() : testIndex("GenomeIndexTest") {
+        test::Random random(54321);
+        std::string contigs[2];
+        contigs[0] = random.bases(30000);
+        contigs[1] = random.bases(20000);
+        contigs[1].replace(1000, 500, contigs[0], 7000, 500);
+        std::string unit = contigs[0].substr(100, 37);
+        for (int i = 0; i < 40; i++) {
+            contigs[1].replace(5000 + i * unit.size(), unit.size(), unit);
+        }
+        contigs[1].replace(12000, 100, std::string(100, 'N'));
+        testIndex.addContig(contigs[0]);
+        testIndex.addContig(contigs[1]);
+    }
+
+    // The bases of a contig are contiguous, but getSubstring won't hand out a slice that reaches the contig's end.
+    static const char *contigBases(const Genome *genome, int c) {
+        const Genome::Contig *contig = &genome->getContigs()[c];
+        const char *bases = genome->getSubstring(contig->beginningLocation, contig->length - 1);
+        ASSERT(NULL != bases);
+        return bases;
+    }
+
+    static void compareLookup(GenomeIndex *expected, GenomeIndex *actual, Seed seed, _int64 *o_nHits) {
+        _int64 nHits[2], nRCHits[2];
+        const unsigned *hits[2], *rcHits[2];
+        expected->lookupSeed32(seed, &nHits[0], &hits[0], &nRCHits[0], &rcHits[0]);
+        actual->lookupSeed32(seed, &nHits[1], &hits[1], &nRCHits[1], &rcHits[1]);
+        ASSERT_EQ(nHits[0], nHits[1]);
+        ASSERT_EQ(nRCHits[0], nRCHits[1]);
+        for (_int64 i = 0; i < nHits[0]; i++) {
+            ASSERT_EQ(hits[0][i], hits[1][i]);
+        }
+        for (_int64 i = 0; i < nRCHits[0]; i++) {
+            ASSERT_EQ(rcHits[0][i], rcHits[1][i]);
+        }
+        *o_nHits = nHits[0] + nRCHits[0];
+    }
+
+    //
+    // Looks up every seed in the genome and a batch of random ones (which are almost all absent) in both indices,
+    // and returns the largest number of hits seen for one seed.
+    //
+    static _int64 compareLookups(GenomeIndex *expected, GenomeIndex *actual) {
+        const Genome *genome = expected->getGenome();
+        _int64 maxHits = 0;
+        _int64 nHits;
+        for (int c = 0; c < genome->getNumContigs(); c++) {
+            const Genome::Contig *contig = &genome->getContigs()[c];
+            const char *data = contigBases(genome, c);
+            for (GenomeDistance offset = 0; offset + SeedLen <= contig->length; offset++) {
+                if (Seed::DoesTextRepresentASeed(data + offset, SeedLen)) {
+                    compareLookup(expected, actual, Seed(data + offset, SeedLen), &nHits);
+                    ASSERT(nHits > 0);
+                    maxHits = __max(maxHits, nHits);
+                }
+            }
+        }
+
+        int nAbsent = 0;
+        _uint64 bases = 0x123456789abcdefULL;
+        for (int i = 0; i < 10000; i++) {
+            bases = bases * 6364136223846793005ULL + 1442695040888963407ULL;
+            compareLookup(expected, actual, Seed::fromBases(bases >> 24, SeedLen), &nHits);
+            nAbsent += 0 == nHits;
+        }
+        ASSERT(nAbsent > 9000);
+        return maxHits;
+    }
+
+    // The major version at the start of an index directory's GenomeIndex file.
+    unsigned majorVersion(const char *suffix) {
+        FILE *file = fopen((testIndex.getDirectory(suffix) + PATH_SEP + "GenomeIndex").c_str(), "r");
+        ASSERT(NULL != file);
+        unsigned version = 0;
+        int nRead = fscanf(file, "%u", &version);
+        fclose(file);
+        ASSERT_EQ(1, nRead);
+        return version;
+    }
+
+    test::TestIndex testIndex;
+};
+
+TEST_F(GenomeIndexTest, "snapshot matches its index directory") {
+    GenomeIndex *index = testIndex.build();
+    const char *snapshotFileName = "GenomeIndexTest.snapshot";
+    ASSERT(GenomeIndex::saveSnapshot(testIndex.getDirectory("idx").c_str(), snapshotFileName));
+    ASSERT(GenomeIndex::isSnapshot(snapshotFileName));
+    GenomeIndex *snapshot = GenomeIndex::loadFromDirectory((char *)snapshotFileName, false, false);
+    ASSERT(NULL != snapshot);
+
+    const Genome *genome = index->getGenome();
+    const Genome *snapshotGenome = snapshot->getGenome();
+    ASSERT_EQ(genome->getCountOfBases(), snapshotGenome->getCountOfBases());
+    ASSERT_EQ(genome->getNumContigs(), snapshotGenome->getNumContigs());
+    for (int c = 0; c < genome->getNumContigs(); c++) {
+        ASSERT_STREQ(genome->getContigs()[c].name, snapshotGenome->getContigs()[c].name);
+        ASSERT_EQ(genome->getContigs()[c].beginningLocation, snapshotGenome->getContigs()[c].beginningLocation);
+        ASSERT_EQ(genome->getContigs()[c].length, snapshotGenome->getContigs()[c].length);
+        ASSERT_EQ(0, memcmp(contigBases(genome, c), contigBases(snapshotGenome, c), genome->getContigs()[c].length));
+    }
+
+    ASSERT(compareLookups(index, snapshot) >= 38);
+
+    delete snapshot;
+    delete index;
+    DeleteSingleFile(snapshotFileName);
+}
+
+TEST_F(GenomeIndexTest, "direct seed table matches hash tables") {
+    GenomeIndex *direct = testIndex.build("direct");
+    GenomeIndex *hash = testIndex.build("hash", "-noDirect");
+
+    //
+    // Older versions of SNAP can read hash table indices, but have to reject direct ones.
+    //
+    ASSERT_EQ(6u, majorVersion("direct"));
+    ASSERT_EQ(5u, majorVersion("hash"));
+
+    //
+    // The tandem repeat's seeds have more hits than DirectScanLimit, so their buckets are binary searched.
+    //
+    ASSERT(compareLookups(hash, direct) > 16);
+
+    delete hash;
+    delete direct;
+}
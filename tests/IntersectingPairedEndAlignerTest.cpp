@@ -0,0 +1,164 @@
+#include "stdafx.h"
+#include "Compat.h"
+#include "TestLib.h"
+#include "GenomeIndex.h"
+#include "IntersectingPairedEndAligner.h"
+#include "LandauVishkin.h"
+#include "PairedAligner.h"
+#include "SeedSequencer.h"
+
+//
+// Test fixture with a random genome holding two pairs.  In the first, mate 0 is unique, and mate 1 comes from just
+// downstream, but with a mismatch in each of the first three seeds it looks up, so only its later seeds find it there.
+// Those first three seeds instead hit ten copies of a repeat, one of which is also in the insert window, but is a poor
+// match for the rest of the mate.  In the second, mate 0 is unique and mate 1 is an exact copy of one of ten copies of
+// a repeat, only one of which is in the insert window.
+//
+struct IntersectingPairedEndAlignerTest {
+    static const int ReadLength = 100;
+    static const int Mate0Offset = 2000;
+    static const int Mate1Offset = 2200;
+    static const int WindowRepeatOffset = 2640;
+    static const int RepeatMate0Offset = 62000;
+    static const int RepeatMate1Offset = 62200;
+    static const int NumRepeats = 10;
+
+    IntersectingPairedEndAlignerTest() : testIndex("IntersectingPairedEndAlignerTest"), random(24680), index(NULL) {
+        InitializeSeedSequencers();
+
+        std::string genome = random.bases(80000);
+
+        //
+        // Mate 1 is reverse complemented, so its first seeds come from the far end of its location.  Mismatch one base
+        // in each of them, and put that version of the far end (the repeat) in the window and elsewhere.
+        //
+        std::string mate1 = genome.substr(Mate1Offset, ReadLength);
+        for (int i = 0; i < 3; i++) {
+            int where = 50 + i * 20;
+            mate1[where] = mate1[where] == 'A' ? 'C' : 'A';
+        }
+        std::string repeat = mate1.substr(40);
+        genome.replace(WindowRepeatOffset, repeat.size(), repeat);
+        for (int i = 1; i < NumRepeats; i++) {
+            genome.replace(5000 * i + 5000, repeat.size(), repeat);
+        }
+
+        //
+        // The second pair's mate 1 is where it came from, and in nine more places, all far from mate 0.
+        //
+        std::string repeatMate1 = genome.substr(RepeatMate1Offset, ReadLength);
+        for (int i = 1; i < NumRepeats; i++) {
+            genome.replace(5000 * i + 7500, repeatMate1.size(), repeatMate1);
+        }
+
+        mates[0] = genome.substr(Mate0Offset, ReadLength);
+        mates[1] = test::reverseComplement(mate1);
+        repeatMates[0] = genome.substr(RepeatMate0Offset, ReadLength);
+        repeatMates[1] = test::reverseComplement(repeatMate1);
+        qualities = std::string(ReadLength, 'I');
+
+        testIndex.addContig(genome);
+        index = testIndex.build();
+    }
+
+    ~IntersectingPairedEndAlignerTest() {
+        delete index;
+    }
+
+    //
+    // Aligns the pair with an intersecting aligner set up as the paired aligner sets up its own, and returns how many
+    // seed lookups the adaptive schedule skipped.
+    //
+    _int64 align(const std::string *pair, bool adaptiveSeedSchedule, PairedAlignmentResult *result) {
+        PairedAlignerOptions options("IntersectingPairedEndAlignerTest");
+
+        BigAllocator *allocator = new BigAllocator(IntersectingPairedEndAligner::getBigAllocatorReservation(index,
+            options.intersectingAlignerMaxHits, MAX_READ_LENGTH, index->getSeedLength(), options.numSeedsFromCommandLine, options.seedCoverage,
+            options.maxDist, options.extraSearchDepth, options.maxCandidatePoolSize, options.maxSecondaryAlignmentsPerContig) +
+            LVResultCache::getBigAllocatorReservation(options.lvCacheEntries));
+        IntersectingPairedEndAligner *aligner = new (allocator) IntersectingPairedEndAligner(index, MAX_READ_LENGTH, options.maxHits,
+            options.maxDist, options.numSeedsFromCommandLine, options.seedCoverage, options.minSpacing, options.maxSpacing,
+            options.intersectingAlignerMaxHits, options.extraSearchDepth, options.maxCandidatePoolSize, options.maxSecondaryAlignmentsPerContig,
+            allocator, options.noUkkonen, options.noOrderedEvaluation, options.noTruncation);
+        aligner->setLandauVishkin(&lv, &reverseLV);     // the chimeric aligner normally lends it its own
+        aligner->setLVResultCache(allocator, options.lvCacheEntries);
+        aligner->setAdaptiveSeedSchedule(adaptiveSeedSchedule);
+
+        Read reads[NUM_READS_PER_PAIR];
+        for (int r = 0; r < NUM_READS_PER_PAIR; r++) {
+            reads[r].init("pair", 4, pair[r].c_str(), qualities.c_str(), ReadLength);
+        }
+
+        int nSecondaryResults, nSingleSecondaryResults0, nSingleSecondaryResults1;
+        SingleAlignmentResult singleSecondaryResult;
+        ASSERT(aligner->align(&reads[0], &reads[1], result, -1, 0, &nSecondaryResults, NULL, 0, options.maxSecondaryAlignments,
+            &nSingleSecondaryResults0, &nSingleSecondaryResults1, &singleSecondaryResult));
+
+        _int64 seedLookupsSkipped = aligner->getSeedLookupsSkipped();
+        aligner->~IntersectingPairedEndAligner();
+        delete allocator;
+        return seedLookupsSkipped;
+    }
+
+    //
+    // Aligns the pair both ways and checks that the adaptive schedule gives the same answer, returning the result and
+    // how many lookups it skipped.
+    //
+    _int64 alignBothWays(const std::string *pair, PairedAlignmentResult *result) {
+        ASSERT_EQ(0, align(pair, false, result));
+
+        PairedAlignmentResult adaptiveResult;
+        _int64 seedLookupsSkipped = align(pair, true, &adaptiveResult);
+        for (int r = 0; r < NUM_READS_PER_PAIR; r++) {
+            ASSERT_EQ(result->status[r], adaptiveResult.status[r]);
+            ASSERT_EQ(GenomeLocationAsInt64(result->location[r]), GenomeLocationAsInt64(adaptiveResult.location[r]));
+            ASSERT_EQ(result->direction[r], adaptiveResult.direction[r]);
+            ASSERT_EQ(result->score[r], adaptiveResult.score[r]);
+            ASSERT_EQ(result->mapq[r], adaptiveResult.mapq[r]);
+        }
+        return seedLookupsSkipped;
+    }
+
+    test::TestIndex     testIndex;
+    test::Random        random;
+    GenomeIndex        *index;
+    std::string         mates[NUM_READS_PER_PAIR];
+    std::string         repeatMates[NUM_READS_PER_PAIR];
+    std::string         qualities;
+    LandauVishkin<1>    lv;
+    LandauVishkin<-1>   reverseLV;
+};
+
+TEST_F(IntersectingPairedEndAlignerTest, "adaptive seed schedule is off by default and keeps an in-window mate") {
+    PairedAlignerOptions options("IntersectingPairedEndAlignerTest");
+    ASSERT(!options.adaptiveSeedSchedule);
+
+    GenomeLocation contigStart = index->getGenome()->getContigs()[0].beginningLocation;
+
+    //
+    // Mate 1's later seeds are what find it where it came from, so the adaptive schedule mustn't stop it on the
+    // strength of the repeat in the window.
+    //
+    PairedAlignmentResult result;
+    alignBothWays(mates, &result);
+    ASSERT(isOneLocation(result.status[0]));
+    ASSERT(isOneLocation(result.status[1]));
+    ASSERT_EQ(GenomeLocationAsInt64(contigStart + Mate0Offset), GenomeLocationAsInt64(result.location[0]));
+    ASSERT_EQ(GenomeLocationAsInt64(contigStart + Mate1Offset), GenomeLocationAsInt64(result.location[1]));
+    ASSERT_EQ(FORWARD, result.direction[0]);
+    ASSERT_EQ(RC, result.direction[1]);
+    ASSERT_EQ(3, result.score[1]);
+}
+
+TEST_F(IntersectingPairedEndAlignerTest, "adaptive seed schedule skips lookups for a repeat mate without changing the result") {
+    GenomeLocation contigStart = index->getGenome()->getContigs()[0].beginningLocation;
+
+    PairedAlignmentResult result;
+    ASSERT(alignBothWays(repeatMates, &result) > 0);
+    ASSERT(isOneLocation(result.status[0]));
+    ASSERT(isOneLocation(result.status[1]));
+    ASSERT_EQ(GenomeLocationAsInt64(contigStart + RepeatMate0Offset), GenomeLocationAsInt64(result.location[0]));
+    ASSERT_EQ(GenomeLocationAsInt64(contigStart + RepeatMate1Offset), GenomeLocationAsInt64(result.location[1]));
+    ASSERT_EQ(0, result.score[0]);
+    ASSERT_EQ(0, result.score[1]);
+}
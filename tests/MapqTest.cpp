@@ -0,0 +1,56 @@
+#include "stdafx.h"
+#include "Compat.h"
+#include "TestLib.h"
+#include "mapq.h"
+
+// The table lookup in mapqForErrorProbability has to agree exactly with the log10 formula that it
+// replaced, including right at and next to the MAPQ boundaries.
+struct MapqTest {
+    MapqTest() {
+        initializeMapqTables();
+    }
+
+    static int expected(double errorProbability) {
+        return __min(70, (int)(-10 * log10(errorProbability)));
+    }
+};
+
+TEST_F(MapqTest, "boundaries") {
+    for (int mapq = 0; mapq <= 70; mapq++) {
+        double boundary = pow(10.0, ((double)mapq) / -10.0);
+        double below = boundary;
+        double above = boundary;
+        for (int step = 0; step < 64; step++) {
+            ASSERT_EQ(expected(below), mapqForErrorProbability(below));
+            ASSERT_EQ(expected(above), mapqForErrorProbability(above));
+            below = nextafter(below, 0.0);
+            above = nextafter(above, 2.0);
+        }
+    }
+    ASSERT_EQ(expected(1.0), mapqForErrorProbability(1.0));
+    ASSERT_EQ(70, mapqForErrorProbability(1e-300));
+}
+
+TEST_F(MapqTest, "random probabilities") {
+    _uint64 seed = 12345;
+    for (int i = 0; i < 1000000; i++) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        double exponent = (double)(seed >> 11) / (double)(1ULL << 53) * -9;    // 1e-9 .. 1, uniform in log space
+        double errorProbability = pow(10.0, exponent);
+        ASSERT_EQ(expected(errorProbability), mapqForErrorProbability(errorProbability));
+    }
+}
+
+TEST_F(MapqTest, "computeMAPQ") {
+    _uint64 seed = 54321;
+    for (int i = 0; i < 1000000; i++) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        double best = (double)(seed >> 11) / (double)(1ULL << 53);
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        double others = best * pow(10.0, (double)(seed >> 11) / (double)(1ULL << 53) * -12);
+        double all = best + others;
+        double correctness = best / all;
+        int reference = correctness >= 1 ? 70 : expected(1 - correctness);
+        ASSERT_EQ(reference, computeMAPQ(all, best, 0, 0));
+    }
+}
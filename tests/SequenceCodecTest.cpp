@@ -0,0 +1,167 @@
+#include "stdafx.h"
+#include "Compat.h"
+#include "TestLib.h"
+#include "SequenceCodec.h"
+#include "Tables.h"
+#include "Bam.h"
+
+// Test fixture for the sequence codec tests.  Each test runs the codec both ways (vector and scalar)
+// over every length up to a few blocks, so that the vector bodies, the scalar tails and the
+// fall back for non-ACGTN blocks are all covered, and compares with a straightforward loop.
+struct SequenceCodecTest {
+    static const int MaxLength = 300;
+    char bases[MaxLength + 1];
+    char quality[MaxLength + 1];
+    _uint8 bamQuality[MaxLength];
+    char out[MaxLength + 16];
+    char expected[MaxLength + 16];
+    _uint8 nibbles[MaxLength / 2 + 16];
+
+    SequenceCodecTest() {
+        const char *alphabet = "ACGTNACGTNACGTNACGTNacgtRY=M";
+        unsigned seed = 12345;
+        for (int i = 0; i < MaxLength; i++) {
+            seed = seed * 1103515245 + 12345;
+            unsigned r = (seed >> 16) & 0x7fff;
+            // mostly ACGTN, with an occasional other character so that some blocks aren't
+            bases[i] = (r % 50 == 0) ? alphabet[20 + r % 8] : alphabet[r % 20];
+            quality[i] = '!' + (char)(r % 42);
+            bamQuality[i] = (r % 37 == 0) ? 0xff : (_uint8)(r % 94);
+        }
+        bases[MaxLength] = quality[MaxLength] = '\0';
+    }
+
+    ~SequenceCodecTest() {
+        SequenceCodec::setVectorized(true);
+    }
+};
+
+TEST_F(SequenceCodecTest, "pack and unpack") {
+    for (int v = 0; v < 2; v++) {
+        SequenceCodec::setVectorized(v == 0);
+        for (int length = 0; length <= MaxLength; length++) {
+            memset(nibbles, 0xcc, sizeof(nibbles));
+            SequenceCodec::packBases(nibbles, bases, length);
+            for (int i = 0; i < length; i++) {
+                _uint8 code = (i % 2 == 0) ? nibbles[i / 2] >> 4 : nibbles[i / 2] & 0xf;
+                ASSERT_EQ((int)BAMAlignment::SeqToCode[(_uint8)bases[i]], (int)code);
+            }
+            if (length % 2 == 1) {
+                ASSERT_EQ(0, nibbles[length / 2] & 0xf);
+            }
+            ASSERT_EQ(0xcc, (int)nibbles[(length + 1) / 2]);
+
+            memset(out, 'x', sizeof(out));
+            SequenceCodec::unpackBases(out, nibbles, length);
+            for (int i = 0; i < length; i++) {
+                expected[i] = BAMAlignment::CodeToSeq[BAMAlignment::SeqToCode[(_uint8)bases[i]]];
+            }
+            ASSERT_EQ(0, memcmp(expected, out, length));
+            ASSERT_EQ('x', out[length]);
+
+            memset(out, 'x', sizeof(out));
+            SequenceCodec::unpackBasesRC(out, nibbles, length);
+            for (int i = 0; i < length; i++) {
+                expected[i] = BAMAlignment::CodeToSeqRC[BAMAlignment::SeqToCode[(_uint8)bases[length - i - 1]]];
+            }
+            ASSERT_EQ(0, memcmp(expected, out, length));
+            ASSERT_EQ('x', out[length]);
+        }
+    }
+}
+
+TEST_F(SequenceCodecTest, "reverse complement") {
+    for (int v = 0; v < 2; v++) {
+        SequenceCodec::setVectorized(v == 0);
+        for (int length = 0; length <= MaxLength; length++) {
+            memset(out, 'x', sizeof(out));
+            SequenceCodec::reverseComplement(out, bases, length, COMPLEMENT);
+            for (int i = 0; i < length; i++) {
+                expected[i] = COMPLEMENT[(_uint8)bases[length - i - 1]];
+            }
+            ASSERT_EQ(0, memcmp(expected, out, length));
+            ASSERT_EQ('x', out[length]);
+
+            memset(out, 'x', sizeof(out));
+            SequenceCodec::reverse(out, quality, length);
+            for (int i = 0; i < length; i++) {
+                expected[i] = quality[length - i - 1];
+            }
+            ASSERT_EQ(0, memcmp(expected, out, length));
+            ASSERT_EQ('x', out[length]);
+        }
+    }
+}
+
+TEST_F(SequenceCodecTest, "qualities") {
+    for (int v = 0; v < 2; v++) {
+        SequenceCodec::setVectorized(v == 0);
+        for (int length = 0; length <= MaxLength; length++) {
+            SequenceCodec::qualityFromBAM(out, bamQuality, length);
+            for (int i = 0; i < length; i++) {
+                expected[i] = CIGAR_QUAL_TO_SAM[bamQuality[i]];
+            }
+            ASSERT_EQ(0, memcmp(expected, out, length));
+
+            SequenceCodec::qualityFromBAMReversed(out, bamQuality, length);
+            for (int i = 0; i < length; i++) {
+                expected[i] = CIGAR_QUAL_TO_SAM[bamQuality[length - i - 1]];
+            }
+            ASSERT_EQ(0, memcmp(expected, out, length));
+
+            memcpy(out, quality, length);
+            out[length] = 'x';
+            SequenceCodec::qualityToBAM(out, length);
+            for (int i = 0; i < length; i++) {
+                ASSERT_EQ(quality[i] - 33, (int)out[i]);
+            }
+            ASSERT_EQ('x', out[length]);
+        }
+    }
+}
+
+TEST_F(SequenceCodecTest, "prepare read") {
+    char rc[MaxLength + 16], rcQuality[MaxLength + 16], reversed[MaxLength + 16], complemented[MaxLength + 16];
+    for (int v = 0; v < 2; v++) {
+        SequenceCodec::setVectorized(v == 0);
+        for (int length = 0; length <= MaxLength; length++) {
+            memset(rc, 'x', sizeof(rc));
+            memset(rcQuality, 'x', sizeof(rcQuality));
+            memset(reversed, 'x', sizeof(reversed));
+            memset(complemented, 'x', sizeof(complemented));
+            unsigned nCount = SequenceCodec::prepareRead(rc, rcQuality, reversed, complemented, bases, quality, length, COMPLEMENT);
+
+            unsigned expectedNs = 0, expectedNsEitherCase = 0;
+            for (int i = 0; i < length; i++) {
+                expectedNs += bases[i] == 'N';
+                expectedNsEitherCase += IS_N[(_uint8)bases[i]];
+            }
+            ASSERT_EQ(expectedNs, nCount);
+            ASSERT_EQ(expectedNsEitherCase, SequenceCodec::countNs(bases, length));
+
+            for (int i = 0; i < length; i++) {
+                expected[i] = COMPLEMENT[(_uint8)bases[length - i - 1]];
+            }
+            ASSERT_EQ(0, memcmp(expected, rc, length));
+            ASSERT_EQ('x', rc[length]);
+
+            for (int i = 0; i < length; i++) {
+                expected[i] = quality[length - i - 1];
+            }
+            ASSERT_EQ(0, memcmp(expected, rcQuality, length));
+            ASSERT_EQ('x', rcQuality[length]);
+
+            for (int i = 0; i < length; i++) {
+                expected[i] = bases[length - i - 1];
+            }
+            ASSERT_EQ(0, memcmp(expected, reversed, length));
+            ASSERT_EQ('x', reversed[length]);
+
+            for (int i = 0; i < length; i++) {
+                expected[i] = COMPLEMENT[(_uint8)bases[i]];
+            }
+            ASSERT_EQ(0, memcmp(expected, complemented, length));
+            ASSERT_EQ('x', complemented[length]);
+        }
+    }
+}
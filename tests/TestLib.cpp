@@ -1,7 +1,11 @@
+#include "stdafx.h"
 #include <iostream>
 #include <cstring>
 
+#include "Compat.h"
 #include "TestLib.h"
+#include "GenomeIndex.h"
+#include "Tables.h"
 
 using namespace std;
 using namespace test;
@@ -41,3 +45,68 @@ int test::runAllTests(char *filter) {
     cout << endl << passed << " / " << tested << " tests passed." << endl;
     return (passed == tested ? 0 : 1);
 }
+
+std::string test::Random::bases(int length) {
+    std::string result;
+    for (int i = 0; i < length; i++) {
+        result += "ACGT"[next(4)];
+    }
+    return result;
+}
+
+std::string test::reverseComplement(const std::string &bases) {
+    std::string rc(bases.size(), 'N');
+    for (size_t i = 0; i < bases.size(); i++) {
+        rc[i] = COMPLEMENT[(unsigned char)bases[bases.size() - 1 - i]];
+    }
+    return rc;
+}
+
+test::TestIndex::~TestIndex() {
+    for (size_t i = 0; i < directories.size(); i++) {
+        const char *files[] = {"GenomeIndex", "Genome", "GenomeIndexHash", "OverflowTable"};
+        for (int f = 0; f < 4; f++) {
+            DeleteSingleFile((directories[i] + PATH_SEP + files[f]).c_str());
+        }
+#ifdef _MSC_VER
+        _rmdir(directories[i].c_str());
+#else
+        rmdir(directories[i].c_str());
+#endif
+    }
+    if (fastaWritten) {
+        DeleteSingleFile((name + ".fa").c_str());
+    }
+}
+
+void test::TestIndex::writeFasta() {
+    FILE *fasta = fopen((name + ".fa").c_str(), "w");
+    if (NULL == fasta) {
+        FAIL("unable to create the test FASTA file");
+    }
+    fastaWritten = true;
+    for (size_t c = 0; c < contigs.size(); c++) {
+        fprintf(fasta, ">contig%d\n", (int)c);
+        for (size_t i = 0; i < contigs[c].size(); i += 60) {
+            fprintf(fasta, "%s\n", contigs[c].substr(i, 60).c_str());
+        }
+    }
+    fclose(fasta);
+}
+
+GenomeIndex *test::TestIndex::build(const char *suffix, const char *extraArg) {
+    if (!fastaWritten) {
+        writeFasta();
+    }
+    std::string fastaFileName = name + ".fa";
+    std::string directory = getDirectory(suffix);
+    directories.push_back(directory);
+
+    const char *argv[] = {fastaFileName.c_str(), directory.c_str(), "-s", "20", "-t1", extraArg};
+    GenomeIndex::runIndexer(NULL == extraArg ? 5 : 6, argv);
+    GenomeIndex *index = GenomeIndex::loadFromDirectory((char *)directory.c_str(), false, false);
+    if (NULL == index) {
+        FAIL("unable to load the test index");
+    }
+    return index;
+}
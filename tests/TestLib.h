@@ -37,6 +37,8 @@
 #include <sstream>
 #include <vector>
 
+class GenomeIndex;
+
 namespace test {
 
 struct TestCase;
@@ -72,6 +74,52 @@ struct TestFailedException {
 
 int runAllTests(char *filter);
 
+//
+// Deterministic pseudo-random numbers, so that generated genomes and reads are the same on every run.
+//
+class Random {
+public:
+    Random(unsigned seed_) : seed(seed_) {}
+
+    int next(int n) {
+        seed = seed * 1103515245 + 12345;
+        return (seed >> 16) % n;
+    }
+
+    std::string bases(int length);
+
+private:
+    unsigned seed;
+};
+
+std::string reverseComplement(const std::string &bases);
+
+//
+// A genome index of contigs made up by the test.  The contigs (named contig0, contig1, ...) are written to <name>.fa,
+// and each build makes an index directory <name>.<suffix> from them.  Everything is deleted with the TestIndex, except
+// the GenomeIndex objects, which belong to the caller.
+//
+class TestIndex {
+public:
+    TestIndex(const char *name_) : name(name_), fastaWritten(false) {}
+    ~TestIndex();
+
+    void addContig(const std::string &bases) {contigs.push_back(bases);}
+
+    // Builds with seed size 20 on one thread, plus extraArg if there is one, and loads the index.
+    GenomeIndex *build(const char *suffix = "idx", const char *extraArg = NULL);
+
+    std::string getDirectory(const char *suffix) const {return name + "." + suffix;}
+
+private:
+    void writeFasta();
+
+    std::string name;
+    std::vector<std::string> contigs;
+    bool fastaWritten;
+    std::vector<std::string> directories;
+};
+
 }
 
 #define CONCAT1( x, y ) x ## y
@@ -0,0 +1,101 @@
+#include "stdafx.h"
+#include "Compat.h"
+#include "BenchLib.h"
+#include "Bam.h"
+#include "FileFormat.h"
+#include "Genome.h"
+#include "Read.h"
+#include "Tables.h"
+#include "LandauVishkin.h"
+
+// Encoding reads as BAM records the way the writers do, including computing the CIGAR against a
+// small in-memory genome, for reads that align with a couple of mismatches and for unaligned reads.
+struct BamBench {
+    static const unsigned Padding = 500;
+    static const int GenomeSize = 1 << 20;
+    static const int NReads = 256;
+    static const int ReadLength = 150;
+    static const size_t BufferSize = 1 << 20;
+
+    Genome *genome;
+    ReaderContext context;
+    LandauVishkinWithCigar lvc;
+    char bases[NReads][ReadLength];
+    char quality[NReads][ReadLength];
+    char ids[NReads][40];
+    Read reads[NReads];
+    GenomeLocation locations[NReads];
+    Direction directions[NReads];
+    char *buffer;
+
+    BamBench() {
+        bench::Random random;
+        char *padding = new char[Padding + 1];
+        memset(padding, 'n', Padding);
+        padding[Padding] = '\0';
+        char *reference = new char[GenomeSize + 1];
+        random.bases(reference, GenomeSize);
+        reference[GenomeSize] = '\0';
+
+        genome = new Genome(GenomeSize + 2 * Padding, GenomeSize + 2 * Padding, Padding, 2);
+        genome->addData(padding);
+        genome->startContig("chr1");
+        genome->addData(reference);
+        genome->addData(padding);
+        genome->fillInContigLengths();
+        genome->indexContigs();
+
+        for (int i = 0; i < NReads; i++) {
+            int offset = random.uniform(GenomeSize - ReadLength);
+            locations[i] = GenomeLocation(Padding) + offset;
+            directions[i] = (i & 1) ? RC : FORWARD;
+            for (int j = 0; j < ReadLength; j++) {
+                bases[i][j] = directions[i] == FORWARD ? reference[offset + j] : COMPLEMENT[reference[offset + ReadLength - 1 - j]];
+            }
+            bases[i][random.uniform(ReadLength)] = 'N';
+            bases[i][random.uniform(ReadLength)] = 'N';
+            random.qualities(quality[i], ReadLength);
+            int idLength = sprintf(ids[i], "HWI-ST1234:8:1101:%d:%d", 1000 + random.uniform(20000), 1000 + random.uniform(200000));
+            reads[i].init(ids[i], idLength, bases[i], quality[i], ReadLength);
+            reads[i].setReadGroup("FASTQ");
+        }
+        delete [] padding;
+        delete [] reference;
+
+        memset(&context, 0, sizeof(context));
+        context.genome = genome;
+        context.defaultReadGroup = "FASTQ";
+        context.defaultReadGroupAux = "RGZFASTQ";
+        context.defaultReadGroupAuxLen = 9;
+        buffer = new char[BufferSize];
+    }
+
+    ~BamBench() {
+        delete [] buffer;
+        delete genome;
+    }
+};
+
+BENCH_P(BamBench, "encode read", "aligned=1,0") {
+    bool aligned = state.arg("aligned") != 0;
+    const FileFormat *format = FileFormat::BAM[0];
+    size_t used = 0;
+    _int64 total = 0;
+    _int64 ops = 0;
+    int i = 0;
+    while (state.keepRunning()) {
+        size_t recordSize;
+        int addFrontClipping = 0;
+        if (used + 4096 > BufferSize) {
+            used = 0;
+        }
+        format->writeRead(context, &lvc, buffer + used, BufferSize - used, &recordSize, reads[i].getIdLength(), &reads[i],
+            aligned ? SingleHit : NotFound, aligned ? 60 : 0, aligned ? locations[i] : InvalidGenomeLocation, aligned ? directions[i] : FORWARD, false, &addFrontClipping);
+        used += recordSize;
+        total += recordSize;
+        ops++;
+        i = (i + 1) % NReads;
+    }
+    state.setBytesPerOp(ops > 0 ? total / ops : 0);
+    bench::Sink = total;
+}
@@ -0,0 +1,196 @@
+#include "stdafx.h"
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <algorithm>
+
+#include "BenchLib.h"
+
+using namespace std;
+using namespace bench;
+
+volatile _uint64 bench::Sink = 0;
+
+    bool
+State::startOrStop()
+{
+    if (remaining == iterations && remaining > 0) {
+        remaining--;
+        startTime = timeInNanos();
+        return true;
+    }
+    elapsed = timeInNanos() - startTime;
+    return false;
+}
+
+    void
+Random::bases(char* o_bases, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        o_bases[i] = "ACGT"[next() & 3];
+    }
+}
+
+    void
+Random::qualities(char* o_quality, size_t count)
+{
+    int q = 35;
+    for (size_t i = 0; i < count; i++) {
+        q = max(2, min(41, q + (int) uniform(5) - 2 - (q > 30 && uniform(8) == 0 ? 10 : 0)));
+        o_quality[i] = (char) ('!' + q);
+    }
+}
+
+    int
+State::arg(const char* name) const
+{
+    for (size_t i = 0; i < args.size(); i++) {
+        if (strcmp(args[i].first, name) == 0) {
+            return args[i].second;
+        }
+    }
+    fprintf(stderr, "benchmark has no parameter '%s'\n", name);
+    exit(1);
+    return 0;
+}
+
+namespace {
+
+//
+// One named parameter and the values it takes, parsed from "name=v1,v2,...".
+//
+struct Param {
+    string name;
+    vector<int> values;
+};
+
+    void
+parseParams(const char* spec, vector<Param>* o_params)
+{
+    o_params->clear();
+    const char* p = spec;
+    while (*p != '\0') {
+        while (*p == ' ') {
+            p++;
+        }
+        if (*p == '\0') {
+            break;
+        }
+        const char* eq = strchr(p, '=');
+        if (eq == NULL) {
+            fprintf(stderr, "bad benchmark parameter list '%s'\n", spec);
+            exit(1);
+        }
+        Param param;
+        param.name = string(p, eq - p);
+        p = eq + 1;
+        while (*p != '\0' && *p != ' ') {
+            char* end;
+            param.values.push_back((int) strtol(p, &end, 10));
+            p = *end == ',' ? end + 1 : end;
+        }
+        o_params->push_back(param);
+    }
+}
+
+    double
+runOnce(BenchCase* bc, void* fixture, _int64 iterations, const vector<pair<const char*, int> >& args, _int64* o_bytesPerOp)
+{
+    State state(iterations, args);
+    bc->body(fixture, state);
+    *o_bytesPerOp = state.getBytesPerOp();
+    return (double) state.getElapsedNanos();
+}
+
+    void
+measure(BenchCase* bc, void* fixture, const vector<pair<const char*, int> >& args, const string& label, const Options& options)
+{
+    //
+    // Grow the iteration count until one repetition takes at least the minimum time.  This also
+    // warms up the caches and branch predictors.
+    //
+    _int64 bytesPerOp;
+    double minNanos = options.minSeconds * 1e9;
+    _int64 iterations = 1;
+    double nanos = runOnce(bc, fixture, iterations, args, &bytesPerOp);
+    while (nanos < minNanos) {
+        double factor = nanos <= 0 ? 100 : min(100.0, max(2.0, 1.4 * minNanos / nanos));
+        iterations = (_int64) (iterations * factor);
+        nanos = runOnce(bc, fixture, iterations, args, &bytesPerOp);
+    }
+
+    vector<double> perOp;
+    for (int r = 0; r < options.repetitions; r++) {
+        perOp.push_back(runOnce(bc, fixture, iterations, args, &bytesPerOp) / iterations);
+    }
+    sort(perOp.begin(), perOp.end());
+    double median = perOp[perOp.size() / 2];
+    double fastest = perOp[0];
+    double spread = median > 0 ? 100.0 * (perOp[perOp.size() - 1] - fastest) / median : 0;
+
+    printf("  %-40s %12.1f ns/op  (min %10.1f, spread %5.1f%%)  %9.3g Mop/s", label.c_str(), median, fastest, spread, 1e3 / median);
+    if (bytesPerOp > 0) {
+        printf("  %9.1f MB/s", bytesPerOp * 1e3 / median);
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+} // namespace
+
+int bench::runAllBenchmarks(const Options& options) {
+    const vector<BenchCase*> &cases = BenchCase::getCases();
+    const char *prevFixture = "";
+    int run = 0;
+
+    printf("%d repetitions of at least %.2fs each; ns/op is the median\n\n", options.repetitions, options.minSeconds);
+    for (size_t i = 0; i < cases.size(); i++) {
+        BenchCase *bc = cases[i];
+        if (options.filter != NULL && strstr(bc->fixture, options.filter) == NULL && strstr(bc->name, options.filter) == NULL) {
+            continue;
+        }
+        if (strcmp(bc->fixture, prevFixture) != 0) {
+            if (strlen(prevFixture) != 0) {
+                printf("\n");
+            }
+            printf("%s:\n", bc->fixture);
+            prevFixture = bc->fixture;
+        }
+
+        vector<Param> params;
+        parseParams(bc->params, &params);
+        void* fixture = bc->create();
+
+        //
+        // Odometer over the cross product of the parameter values.
+        //
+        vector<size_t> which(params.size(), 0);
+        for (;;) {
+            vector<pair<const char*, int> > args;
+            string label = bc->name;
+            for (size_t p = 0; p < params.size(); p++) {
+                int value = params[p].values[which[p]];
+                args.push_back(make_pair(params[p].name.c_str(), value));
+                char buffer[64];
+                snprintf(buffer, sizeof(buffer), " %s=%d", params[p].name.c_str(), value);
+                label += buffer;
+            }
+            measure(bc, fixture, args, label, options);
+            run++;
+
+            size_t p = 0;
+            while (p < params.size() && ++which[p] == params[p].values.size()) {
+                which[p] = 0;
+                p++;
+            }
+            if (p == params.size()) {
+                break;
+            }
+        }
+        bc->destroy(fixture);
+    }
+
+    printf("\n%d benchmarks run.\n", run);
+    return 0;
+}
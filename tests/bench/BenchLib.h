@@ -0,0 +1,148 @@
+#pragma once
+
+/**
+ * A tiny microbenchmark library in the spirit of TestLib, for timing single kernels in isolation.
+ *
+ * Define a fixture struct holding the inputs (built once, in its constructor, outside the timing),
+ * then write the timed loop with BENCH_F:
+ *
+ *    struct MyFixture {
+ *        char data[1000];
+ *        MyFixture() { ... }
+ *    };
+ *
+ *    BENCH_F(MyFixture, "description") {
+ *        _uint64 sum = 0;
+ *        while (state.keepRunning()) {
+ *            sum += kernel(data, 1000);
+ *        }
+ *        state.setBytesPerOp(1000);
+ *        bench::Sink = sum;
+ *    }
+ *
+ * BENCH_P takes a parameter list; the body runs once for each point in the cross product, and reads
+ * the values with state.arg:
+ *
+ *    BENCH_P(MyFixture, "description", "k=4,8,16 len=100,250") {
+ *        int k = state.arg("k");
+ *        ...
+ *    }
+ *
+ * Anything before the first keepRunning() isn't timed, so per-parameter setup can go there.  Results
+ * that aren't otherwise used should be folded into bench::Sink so the compiler can't discard the work.
+ *
+ * The runner picks an iteration count that takes at least the minimum time, then times several
+ * repetitions of that many iterations and reports the median and fastest ns/op, the spread between
+ * the repetitions (which says how far to trust the numbers), and the derived throughput.
+ */
+
+#include "Compat.h"
+#include <vector>
+#include <utility>
+
+namespace bench {
+
+extern volatile _uint64 Sink;
+
+//
+// Deterministic inputs, so that numbers from different runs and builds are comparable.
+//
+class Random {
+public:
+    Random(_uint64 seed = 1) : state(seed) {}
+
+    _uint32 next() {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        return (_uint32) (state >> 33);
+    }
+
+    unsigned uniform(unsigned n) { return next() % n; }
+
+    void bases(char* o_bases, size_t count);        // ACGT
+    void qualities(char* o_quality, size_t count);  // phred+33, drifting like real qualities rather than white noise
+
+private:
+    _uint64 state;
+};
+
+class State {
+public:
+    State(_int64 i_iterations, const std::vector<std::pair<const char*, int> >& i_args)
+        : iterations(i_iterations), remaining(i_iterations), args(i_args), bytesPerOp(0), startTime(0), elapsed(0) {}
+
+    inline bool keepRunning() {
+        if (remaining > 0 && remaining < iterations) {
+            remaining--;
+            return true;
+        }
+        return startOrStop();
+    }
+
+    int arg(const char* name) const;
+
+    void setBytesPerOp(_int64 bytes) { bytesPerOp = bytes; }
+
+    _int64 getBytesPerOp() const { return bytesPerOp; }
+    _int64 getElapsedNanos() const { return elapsed; }
+
+private:
+    bool startOrStop();
+
+    const _int64 iterations;
+    _int64 remaining;
+    const std::vector<std::pair<const char*, int> >& args;
+    _int64 bytesPerOp;
+    _int64 startTime;
+    _int64 elapsed;
+};
+
+typedef void* (*FixtureFactory)();
+typedef void (*FixtureDestructor)(void* fixture);
+typedef void (*BodyFunction)(void* fixture, State& state);
+
+struct BenchCase {
+    BenchCase(const char *fixture_, const char *name_, const char *params_, FixtureFactory create_, FixtureDestructor destroy_, BodyFunction body_)
+            : fixture(fixture_), name(name_), params(params_), create(create_), destroy(destroy_), body(body_) {
+        getCases().push_back(this);
+    }
+
+    const char *fixture;
+    const char *name;
+    const char *params;
+    FixtureFactory create;
+    FixtureDestructor destroy;
+    BodyFunction body;
+
+    static std::vector<BenchCase*>& getCases() {
+        static std::vector<BenchCase*> cases;
+        return cases;
+    };
+};
+
+struct Options {
+    const char *filter;     // substring of the fixture or name, or NULL for all
+    double minSeconds;      // minimum time for each repetition
+    int repetitions;
+};
+
+int runAllBenchmarks(const Options& options);
+
+}
+
+#define BENCH_CONCAT1( x, y ) x ## y
+#define BENCH_CONCAT2( x, y ) BENCH_CONCAT1( x, y ) /* To escape weird macro expansion rules */
+#define BENCH_CLASS(line)   BENCH_CONCAT2(_bench_class_,   line)
+#define BENCH_CREATE(line)  BENCH_CONCAT2(_bench_create_,  line)
+#define BENCH_DESTROY(line) BENCH_CONCAT2(_bench_destroy_, line)
+#define BENCH_BODY(line)    BENCH_CONCAT2(_bench_body_,    line)
+#define BENCH_CASE(line)    BENCH_CONCAT2(_bench_case_,    line)
+
+#define BENCH_P(fixture, name, params) \
+    namespace { struct BENCH_CLASS(__LINE__) : public fixture { void _run(bench::State& state); }; } \
+    static void* BENCH_CREATE(__LINE__) () { return new BENCH_CLASS(__LINE__); } \
+    static void BENCH_DESTROY(__LINE__) (void* f) { delete (BENCH_CLASS(__LINE__)*) f; } \
+    static void BENCH_BODY(__LINE__) (void* f, bench::State& state) { ((BENCH_CLASS(__LINE__)*) f)->_run(state); } \
+    static bench::BenchCase BENCH_CASE(__LINE__) (#fixture, name, params, &BENCH_CREATE(__LINE__), &BENCH_DESTROY(__LINE__), &BENCH_BODY(__LINE__)); \
+    void BENCH_CLASS(__LINE__)::_run(bench::State& state) /* body follows */
+
+#define BENCH_F(fixture, name) BENCH_P(fixture, name, "")
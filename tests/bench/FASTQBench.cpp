@@ -0,0 +1,78 @@
+#include "stdafx.h"
+#include "Compat.h"
+#include "BenchLib.h"
+#include "FASTQ.h"
+
+// Just enough of a DataReader for FASTQReader::getReadFromBuffer, which only asks it about EOF and
+// batches, so that the parse can be timed from memory without the reader threads and file system.
+class MemoryDataReader : public DataReader {
+public:
+    virtual bool init(const char* fileName) { return true; }
+    virtual char* readHeader(_int64* io_headerSize) { return NULL; }
+    virtual void reinit(_int64 startingOffset, _int64 amountOfFileToProcess) {}
+    virtual bool getData(char** o_buffer, _int64* o_validBytes, _int64* o_startBytes = NULL) { return false; }
+    virtual void advance(_int64 bytes) {}
+    virtual void nextBatch() {}
+    virtual bool isEOF() { return true; }
+    virtual DataBatch getBatch() { return DataBatch(); }
+    virtual void holdBatch(DataBatch batch) {}
+    virtual bool releaseBatch(DataBatch batch) { return false; }
+    virtual _int64 getFileOffset() { return 0; }
+    virtual void getExtra(char** o_extra, _int64* o_length) { *o_extra = NULL; *o_length = 0; }
+    virtual const char* getFilename() { return "memory"; }
+};
+
+// A buffer of Illumina-style FASTQ records.
+struct FASTQBench {
+    static const int NReads = 4096;
+
+    char *buffer;
+    _int64 bufferSize;
+    MemoryDataReader data;
+    ReaderContext context;
+    Read read;
+
+    FASTQBench() {
+        memset(&context, 0, sizeof(context));
+        context.defaultReadGroup = "";
+        context.clipping = ClipBack;
+        buffer = NULL;
+        bufferSize = 0;
+    }
+
+    ~FASTQBench() {
+        delete [] buffer;
+    }
+
+    void setUp(int len) {
+        delete [] buffer;
+        buffer = new char[NReads * (2 * len + 100)];
+        bench::Random random;
+        char *p = buffer;
+        for (int i = 0; i < NReads; i++) {
+            p += sprintf(p, "@HWI-ST1234:8:1101:%d:%d 1:N:0:ACGTAC\n", 1000 + random.uniform(20000), 1000 + random.uniform(200000));
+            random.bases(p, len);
+            p += len;
+            p += sprintf(p, "\n+\n");
+            random.qualities(p, len);
+            p += len;
+            *p++ = '\n';
+        }
+        bufferSize = p - buffer;
+    }
+};
+
+BENCH_P(FASTQBench, "parse read", "len=100,150,250") {
+    setUp(state.arg("len"));
+    _uint64 sum = 0;
+    _int64 offset = 0;
+    while (state.keepRunning()) {
+        offset += FASTQReader::getReadFromBuffer(buffer + offset, bufferSize - offset, &read, "memory", &data, context);
+        sum += read.getDataLength();
+        if (offset >= bufferSize) {
+            offset = 0;
+        }
+    }
+    state.setBytesPerOp(bufferSize / NReads);
+    bench::Sink = sum;
+}
@@ -0,0 +1,131 @@
+#include "stdafx.h"
+#include "Compat.h"
+#include "BenchLib.h"
+#include "Genome.h"
+#include "FileFormat.h"
+#include "Read.h"
+#include <algorithm>
+
+// Contig lookups on a synthetic metagenome-like reference with a million short contigs: location to contig
+// through the bucket directory and name to contig through the hash, each against the binary searches they
+// replaced, plus writing the SAM header for all of those contigs.
+struct GenomeBench {
+    static const int NContigs = 1 << 20;
+    static const int ContigLength = 64;
+    static const unsigned Padding = 32;
+    static const int NLookups = 4096;
+    static const size_t HeaderBufferSize = 128 * 1024 * 1024;
+
+    Genome *genome;
+    GenomeLocation locations[NLookups];
+    char names[NLookups][48];
+    const char **sortedNames;
+    ReaderContext context;
+    char *headerBuffer;
+
+    GenomeBench() {
+        bench::Random random;
+        char chunk[ContigLength + Padding + 1];
+        random.bases(chunk, ContigLength);
+        memset(chunk + ContigLength, 'n', Padding);
+        chunk[ContigLength + Padding] = '\0';
+
+        genome = new Genome((GenomeDistance)NContigs * (ContigLength + Padding), (GenomeDistance)NContigs * (ContigLength + Padding), Padding, NContigs);
+        char name[48];
+        for (int i = 0; i < NContigs; i++) {
+            sprintf(name, "NODE_%d_length_%d_cov_%d.%d", i + 1, ContigLength, 1 + random.uniform(100), random.uniform(10));
+            genome->startContig(name);
+            genome->addData(chunk);
+        }
+        genome->fillInContigLengths();
+        genome->indexContigs();
+
+        const Genome::Contig *contigs = genome->getContigs();
+        for (int i = 0; i < NLookups; i++) {
+            locations[i] = GenomeLocation(random.uniform((unsigned)genome->getCountOfBases()));
+            strcpy(names[i], contigs[random.uniform(NContigs)].name);
+        }
+
+        sortedNames = new const char *[NContigs];
+        for (int i = 0; i < NContigs; i++) {
+            sortedNames[i] = contigs[i].name;
+        }
+        std::sort(sortedNames, sortedNames + NContigs, nameLess);
+
+        memset(&context, 0, sizeof(context));
+        context.genome = genome;
+        headerBuffer = new char[HeaderBufferSize];
+    }
+
+    ~GenomeBench() {
+        delete [] headerBuffer;
+        delete [] sortedNames;
+        delete genome;
+    }
+
+    static bool nameLess(const char *a, const char *b) {
+        return strcmp(a, b) < 0;
+    }
+
+    // What getContigAtLocation did before the directory.
+    const Genome::Contig *searchContigAtLocation(GenomeLocation location) {
+        const Genome::Contig *contigs = genome->getContigs();
+        int nContigs = genome->getNumContigs();
+        int low = 0;
+        int high = nContigs - 1;
+        while (low <= high) {
+            int mid = (low + high) / 2;
+            if (contigs[mid].beginningLocation <= location && (mid == nContigs - 1 || contigs[mid + 1].beginningLocation > location)) {
+                return &contigs[mid];
+            } else if (contigs[mid].beginningLocation <= location) {
+                low = mid + 1;
+            } else {
+                high = mid - 1;
+            }
+        }
+        return NULL;
+    }
+
+    // And getLocationOfContig before the hash.
+    bool searchContigName(const char *name) {
+        return std::binary_search(sortedNames, sortedNames + NContigs, name, nameLess);
+    }
+};
+
+BENCH_P(GenomeBench, "contig at location", "directory=1,0") {
+    bool directory = state.arg("directory") != 0;
+    _uint64 sum = 0;
+    int i = 0;
+    while (state.keepRunning()) {
+        const Genome::Contig *contig = directory ? genome->getContigAtLocation(locations[i]) : searchContigAtLocation(locations[i]);
+        sum += contig->nameLength;
+        i = (i + 1) % NLookups;
+    }
+    bench::Sink = sum;
+}
+
+BENCH_P(GenomeBench, "contig by name", "hash=1,0") {
+    bool hash = state.arg("hash") != 0;
+    _uint64 sum = 0;
+    int i = 0;
+    while (state.keepRunning()) {
+        GenomeLocation location;
+        if (hash) {
+            sum += genome->getLocationOfContig(names[i], &location);
+        } else {
+            sum += searchContigName(names[i]);
+        }
+        i = (i + 1) % NLookups;
+    }
+    bench::Sink = sum;
+}
+
+BENCH_F(GenomeBench, "SAM header, 1M contigs") {
+    const char *argv[] = {"snap-aligner", "paired", "index"};
+    size_t used = 0;
+    while (state.keepRunning()) {
+        FileFormat::SAM[0]->writeHeader(context, headerBuffer, HeaderBufferSize, &used, false, 3, argv, "bench", NULL, false);
+    }
+    state.setBytesPerOp(used);
+    bench::Sink = used;
+}
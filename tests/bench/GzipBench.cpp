@@ -0,0 +1,60 @@
+#include "stdafx.h"
+#include "Compat.h"
+#include "BenchLib.h"
+#include "Bam.h"
+#include "BigAlloc.h"
+#include "GzipDataWriter.h"
+
+// Compressing a chunk of FASTQ text with the same zlib settings and allocator as the gzip/BGZF output
+// filters.
+struct GzipBench {
+    static const size_t ChunkSize = 64000;     // a bit under BAM_BLOCK, as the writers leave room
+    static const int NChunks = 16;
+
+    char *input;
+    char *output;
+    ThreadHeap *heap;
+    z_stream zstream;
+
+    GzipBench() {
+        input = new char[NChunks * ChunkSize];
+        output = new char[BAM_BLOCK];
+        bench::Random random;
+        char *p = input;
+        char *end = input + NChunks * ChunkSize;
+        while (p + 400 < end) {
+            p += sprintf(p, "@HWI-ST1234:8:1101:%d:%d 1:N:0:ACGTAC\n", 1000 + random.uniform(20000), 1000 + random.uniform(200000));
+            random.bases(p, 150);
+            p += 150;
+            p += sprintf(p, "\n+\n");
+            random.qualities(p, 150);
+            p += 150;
+            *p++ = '\n';
+        }
+        memset(p, '\n', end - p);
+
+        heap = new ThreadHeap(ChunkSize * 8);
+        memset(&zstream, 0, sizeof(zstream));
+        zstream.zalloc = zalloc;
+        zstream.zfree = zfree;
+        zstream.opaque = heap;
+    }
+
+    ~GzipBench() {
+        delete heap;
+        delete [] input;
+        delete [] output;
+    }
+};
+
+BENCH_P(GzipBench, "compress chunk", "bgzf=1,0") {
+    bool bgzf = state.arg("bgzf") != 0;
+    _uint64 sum = 0;
+    int i = 0;
+    while (state.keepRunning()) {
+        sum += GzipCompressChunk(zstream, bgzf, output, BAM_BLOCK, input + i * ChunkSize, ChunkSize);
+        i = (i + 1) % NChunks;
+    }
+    state.setBytesPerOp(ChunkSize);
+    bench::Sink = sum;
+}
@@ -0,0 +1,60 @@
+#include "stdafx.h"
+#include "Compat.h"
+#include "BenchLib.h"
+#include "HashTable.h"
+
+// Tables laid out like the seed index's (4 byte keys, two 4 byte values per entry for forward and
+// reverse complement hits, 70% full), one small enough to stay in cache and one that isn't.
+struct HashTableBench {
+    static const unsigned KeySize = 4;
+    static const unsigned ValueSize = 4;
+    static const unsigned ValueCount = 2;
+    static const int SmallEntries = 1 << 16;
+    static const int LargeEntries = 1 << 22;
+    static const int NMisses = 1 << 20;
+
+    SNAPHashTable *small;
+    SNAPHashTable *large;
+    _uint32 *keys;      // LargeEntries keys that are in the tables (the small one has a prefix), then NMisses that aren't
+
+    HashTableBench() {
+        keys = new _uint32[LargeEntries + NMisses];
+        bench::Random random;
+        for (int i = 0; i < LargeEntries + NMisses; i++) {
+            keys[i] = random.next();
+        }
+        small = build(SmallEntries);
+        large = build(LargeEntries);
+    }
+
+    ~HashTableBench() {
+        delete small;
+        delete large;
+        delete [] keys;
+    }
+
+    SNAPHashTable *build(int entries) {
+        SNAPHashTable *table = new SNAPHashTable((_int64) (entries / 0.7), KeySize, ValueSize, ValueCount, 0xffffffff);
+        for (int i = 0; i < entries; i++) {
+            SNAPHashTable::ValueType values[ValueCount] = {(SNAPHashTable::ValueType) i, (SNAPHashTable::ValueType) i + 1};
+            table->Insert(keys[i], values);
+        }
+        return table;
+    }
+};
+
+BENCH_P(HashTableBench, "lookup", "entries=65536,4194304 hit=1,0") {
+    int entries = state.arg("entries");
+    bool hit = state.arg("hit") != 0;
+    SNAPHashTable *table = entries == SmallEntries ? small : large;
+    _uint32 *lookupKeys = hit ? keys : keys + LargeEntries;
+    int mask = (hit ? entries : NMisses) - 1;
+    _uint64 sum = 0;
+    int i = 0;
+    while (state.keepRunning()) {
+        SNAPHashTable::ValueType *value = table->GetFirstValueForKey(lookupKeys[i]);
+        sum += value != NULL ? (_uint32) *value : 1;
+        i = (i + 7919) & mask;
+    }
+    bench::Sink = sum;
+}
@@ -0,0 +1,103 @@
+#include "stdafx.h"
+#include "Compat.h"
+#include "BenchLib.h"
+#include "LandauVishkin.h"
+
+// Reads scored against the reference text they came from, with about k/2 differences each, so that
+// every call does the work of finding an alignment rather than bailing out at k.
+struct LandauVishkinBench {
+    static const int MaxLength = 300;
+    static const int NPatterns = 64;
+    static const int TextSlack = 2 * (MAX_K + 1);
+
+    LandauVishkin<> lv;
+    LandauVishkinWithCigar lvc;
+    char text[NPatterns][MaxLength + TextSlack];
+    char patterns[NPatterns][MaxLength];
+    char quality[NPatterns][MaxLength];
+    char cigar[1000];
+
+    LandauVishkinBench() {
+        initializeLVProbabilitiesToPhredPlus33();
+        bench::Random random;
+        for (int i = 0; i < NPatterns; i++) {
+            random.bases(text[i], sizeof(text[i]));
+            random.qualities(quality[i], MaxLength);
+        }
+    }
+
+    // mutate the first len bases of each pattern with edits differences from its text: mostly substitutions, some indels
+    void setUp(int edits, int len) {
+        bench::Random random(edits + 1);
+        for (int i = 0; i < NPatterns; i++) {
+            int t = 0;
+            for (int p = 0; p < MaxLength; p++) {
+                patterns[i][p] = text[i][t++];
+            }
+            for (int e = 0; e < edits; e++) {
+                int where = 1 + random.uniform(len - 2);
+                switch (random.uniform(8)) {
+                case 0:     // insertion
+                    memmove(patterns[i] + where + 1, patterns[i] + where, MaxLength - where - 1);
+                    patterns[i][where] = "ACGT"[random.uniform(4)];
+                    break;
+                case 1:     // deletion
+                    memmove(patterns[i] + where, patterns[i] + where + 1, MaxLength - where - 1);
+                    patterns[i][MaxLength - 1] = text[i][MaxLength + e];
+                    break;
+                default: {
+                    char base;
+                    do {
+                        base = "ACGT"[random.uniform(4)];
+                    } while (base == patterns[i][where]);
+                    patterns[i][where] = base;
+                    }
+                }
+            }
+        }
+    }
+};
+
+BENCH_P(LandauVishkinBench, "edit distance", "k=0,4,8,16,31 len=100,150,250") {
+    int k = state.arg("k");
+    int len = state.arg("len");
+    setUp(k / 2, len);
+    _uint64 sum = 0;
+    int i = 0;
+    while (state.keepRunning()) {
+        sum += lv.computeEditDistance(text[i], len + k, patterns[i], len, k);
+        i = (i + 1) % NPatterns;
+    }
+    state.setBytesPerOp(len);
+    bench::Sink = sum;
+}
+
+BENCH_P(LandauVishkinBench, "with match probability", "k=4,16,31 len=100,150,250") {
+    int k = state.arg("k");
+    int len = state.arg("len");
+    setUp(k / 2, len);
+    double total = 0;
+    int i = 0;
+    while (state.keepRunning()) {
+        double matchProbability;
+        lv.computeEditDistance(text[i], len + k, patterns[i], quality[i], len, k, &matchProbability);
+        total += matchProbability;
+        i = (i + 1) % NPatterns;
+    }
+    state.setBytesPerOp(len);
+    bench::Sink = (_uint64) total;
+}
+
+BENCH_P(LandauVishkinBench, "with cigar", "k=4,16 len=150") {
+    int k = state.arg("k");
+    int len = state.arg("len");
+    setUp(k / 2, len);
+    _uint64 sum = 0;
+    int i = 0;
+    while (state.keepRunning()) {
+        sum += lvc.computeEditDistance(text[i], len + k, patterns[i], len, k, cigar, sizeof(cigar), false, BAM_CIGAR_OPS);
+        i = (i + 1) % NPatterns;
+    }
+    state.setBytesPerOp(len);
+    bench::Sink = sum;
+}
@@ -0,0 +1,34 @@
+#include "stdafx.h"
+#include "Compat.h"
+#include "BenchLib.h"
+#include "mapq.h"
+
+// Turning an error probability into a MAPQ with the boundary table, against the log10 it replaced.
+struct MapqBench {
+    static const int NValues = 4096;
+
+    double errorProbabilities[NValues];
+
+    MapqBench() {
+        initializeMapqTables();
+        bench::Random random;
+        for (int i = 0; i < NValues; i++) {
+            errorProbabilities[i] = pow(10.0, -9.0 * random.uniform(1000000) / 1000000);
+        }
+    }
+};
+
+BENCH_P(MapqBench, "mapq from error probability", "table=1,0") {
+    bool table = state.arg("table") != 0;
+    _uint64 sum = 0;
+    int i = 0;
+    while (state.keepRunning()) {
+        if (table) {
+            sum += mapqForErrorProbability(errorProbabilities[i]);
+        } else {
+            sum += __min(70, (int)(-10 * log10(errorProbabilities[i])));
+        }
+        i = (i + 1) % NValues;
+    }
+    bench::Sink = sum;
+}
@@ -0,0 +1,64 @@
+#include "stdafx.h"
+#include "Compat.h"
+#include "BenchLib.h"
+#include "Genome.h"
+#include "PriorityQueue.h"
+
+// The k-way merge in SortedDataWriter: a queue holding the next location from each sorted run; each
+// op pops the smallest, peeks at the runner-up, and pushes that run's next location.
+struct PriorityQueueBench {
+    static const int MaxRuns = 1024;
+    static const int RunLength = 4096;
+
+    GenomeLocation *runs;     // MaxRuns sorted runs of RunLength
+    int next[MaxRuns];
+    PriorityQueue<GenomeLocation, _int64> queue;
+
+    PriorityQueueBench() {
+        runs = new GenomeLocation[MaxRuns * RunLength];
+        bench::Random random;
+        for (int r = 0; r < MaxRuns; r++) {
+            GenomeLocation location = random.uniform(1000);
+            for (int i = 0; i < RunLength; i++) {
+                location += 1 + random.uniform(2000);
+                runs[r * RunLength + i] = location;
+            }
+        }
+    }
+
+    ~PriorityQueueBench() {
+        delete [] runs;
+    }
+
+    void start(int nRuns) {
+        queue.clear();
+        for (int r = 0; r < nRuns; r++) {
+            next[r] = 1;
+            queue.add(r, runs[r * RunLength]);
+        }
+    }
+};
+
+BENCH_P(PriorityQueueBench, "merge", "runs=4,16,64,256,1024") {
+    int nRuns = state.arg("runs");
+    start(nRuns);
+    _uint64 sum = 0;
+    while (state.keepRunning()) {
+        if (queue.size() == 0) {
+            start(nRuns);
+        }
+        GenomeLocation smallest;
+        _int64 r = queue.pop(&smallest);
+        if (queue.size() > 0) {
+            GenomeLocation second;
+            queue.peek(&second);
+            sum += GenomeLocationAsInt64(second);
+        }
+        sum += GenomeLocationAsInt64(smallest);
+        if (next[r] < RunLength) {
+            queue.add(r, runs[r * RunLength + next[r]]);
+            next[r]++;
+        }
+    }
+    bench::Sink = sum;
+}
@@ -0,0 +1,33 @@
+#include "stdafx.h"
+#include "Compat.h"
+#include "BenchLib.h"
+#include "Seed.h"
+
+// Seeds taken from a stretch of random reference the way the aligners take them from reads: check
+// that the text is all ACGT, then encode it and its reverse complement.
+struct SeedBench {
+    static const int TextLength = 1 << 16;
+
+    char text[TextLength + LargestSeedSize];
+
+    SeedBench() {
+        bench::Random random;
+        random.bases(text, sizeof(text));
+    }
+};
+
+BENCH_P(SeedBench, "construct", "seedLen=16,20,24,32") {
+    unsigned seedLen = state.arg("seedLen");
+    unsigned keySize = (seedLen * 2 + 7) / 8 > 4 ? 4 : (seedLen * 2 + 7) / 8;
+    _uint64 sum = 0;
+    int offset = 0;
+    while (state.keepRunning()) {
+        if (Seed::DoesTextRepresentASeed(text + offset, seedLen)) {
+            Seed seed(text + offset, seedLen);
+            sum += seed.getLowBases(keySize) + seed.getHighBases(keySize) + seed.isBiggerThanItsReverseComplement();
+        }
+        offset = (offset + 13) & (TextLength - 1);
+    }
+    state.setBytesPerOp(seedLen);
+    bench::Sink = sum;
+}
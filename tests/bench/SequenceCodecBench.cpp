@@ -0,0 +1,122 @@
+#include "stdafx.h"
+#include "Compat.h"
+#include "BenchLib.h"
+#include "SequenceCodec.h"
+#include "Tables.h"
+
+// The per-read base and quality conversions, with the vector kernels on and off.
+struct SequenceCodecBench {
+    static const int NReads = 64;
+    static const int MaxLength = 256;
+
+    char bases[NReads][MaxLength];
+    char quality[NReads][MaxLength];
+    _uint8 nibbles[NReads][MaxLength / 2];
+    _uint8 bamQuality[NReads][MaxLength];
+    char out[MaxLength];
+
+    SequenceCodecBench() {
+        bench::Random random;
+        for (int i = 0; i < NReads; i++) {
+            random.bases(bases[i], MaxLength);
+            random.qualities(quality[i], MaxLength);
+            SequenceCodec::packBases(nibbles[i], bases[i], MaxLength);
+            for (int j = 0; j < MaxLength; j++) {
+                bamQuality[i][j] = quality[i][j] - '!';
+            }
+        }
+    }
+
+    ~SequenceCodecBench() {
+        SequenceCodec::setVectorized(true);
+    }
+};
+
+BENCH_P(SequenceCodecBench, "pack bases", "vector=1,0 len=150") {
+    SequenceCodec::setVectorized(state.arg("vector") != 0);
+    int len = state.arg("len");
+    _uint8 packed[MaxLength / 2];
+    _uint64 sum = 0;
+    int i = 0;
+    while (state.keepRunning()) {
+        SequenceCodec::packBases(packed, bases[i], len);
+        sum += packed[0];
+        i = (i + 1) % NReads;
+    }
+    state.setBytesPerOp(len);
+    bench::Sink = sum;
+}
+
+BENCH_P(SequenceCodecBench, "unpack bases", "vector=1,0 rc=0,1 len=150") {
+    SequenceCodec::setVectorized(state.arg("vector") != 0);
+    bool rc = state.arg("rc") != 0;
+    int len = state.arg("len");
+    _uint64 sum = 0;
+    int i = 0;
+    while (state.keepRunning()) {
+        if (rc) {
+            SequenceCodec::unpackBasesRC(out, nibbles[i], len);
+        } else {
+            SequenceCodec::unpackBases(out, nibbles[i], len);
+        }
+        sum += out[0];
+        i = (i + 1) % NReads;
+    }
+    state.setBytesPerOp(len);
+    bench::Sink = sum;
+}
+
+BENCH_P(SequenceCodecBench, "reverse complement", "vector=1,0 len=150") {
+    SequenceCodec::setVectorized(state.arg("vector") != 0);
+    int len = state.arg("len");
+    _uint64 sum = 0;
+    int i = 0;
+    while (state.keepRunning()) {
+        SequenceCodec::reverseComplement(out, bases[i], len, COMPLEMENT);
+        sum += out[0];
+        i = (i + 1) % NReads;
+    }
+    state.setBytesPerOp(len);
+    bench::Sink = sum;
+}
+
+BENCH_P(SequenceCodecBench, "quality from BAM", "vector=1,0 len=150") {
+    SequenceCodec::setVectorized(state.arg("vector") != 0);
+    int len = state.arg("len");
+    _uint64 sum = 0;
+    int i = 0;
+    while (state.keepRunning()) {
+        SequenceCodec::qualityFromBAMReversed(out, bamQuality[i], len);
+        sum += out[0];
+        i = (i + 1) % NReads;
+    }
+    state.setBytesPerOp(len);
+    bench::Sink = sum;
+}
+
+// The aligners' per-read setup, fused against the separate passes it replaced.
+BENCH_P(SequenceCodecBench, "prepare read", "vector=1,0 fused=1,0 len=150") {
+    SequenceCodec::setVectorized(state.arg("vector") != 0);
+    bool fused = state.arg("fused") != 0;
+    int len = state.arg("len");
+    char rcQuality[MaxLength], reversed[MaxLength], complemented[MaxLength];
+    _uint64 sum = 0;
+    int i = 0;
+    while (state.keepRunning()) {
+        if (fused) {
+            sum += SequenceCodec::prepareRead(out, rcQuality, reversed, complemented, bases[i], quality[i], len, COMPLEMENT);
+        } else {
+            SequenceCodec::reverseComplement(out, bases[i], len, COMPLEMENT);
+            SequenceCodec::reverse(rcQuality, quality[i], len);
+            SequenceCodec::reverse(reversed, bases[i], len);
+            SequenceCodec::reverse(complemented, out, len);
+            for (int j = 0; j < len; j++) {
+                sum += bases[i][j] == 'N';
+            }
+        }
+        sum += out[0] + complemented[0];
+        i = (i + 1) % NReads;
+    }
+    state.setBytesPerOp(len);
+    bench::Sink = sum;
+}
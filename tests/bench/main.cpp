@@ -0,0 +1,39 @@
+#include "stdafx.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "BenchLib.h"
+
+static void usage()
+{
+    fprintf(stderr,
+        "usage: benchmarks [filter] [-m minSeconds] [-r repetitions]\n"
+        "  filter  only run benchmarks whose fixture or name contains this substring\n"
+        "  -m      minimum time for each repetition (default 0.25)\n"
+        "  -r      repetitions; the median is reported (default 5)\n");
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    bench::Options options;
+    options.filter = NULL;
+    options.minSeconds = 0.25;
+    options.repetitions = 5;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            options.minSeconds = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            options.repetitions = atoi(argv[++i]);
+        } else if (argv[i][0] != '-' && options.filter == NULL) {
+            options.filter = argv[i];
+        } else {
+            usage();
+        }
+    }
+    if (options.minSeconds <= 0 || options.repetitions < 1) {
+        usage();
+    }
+    return bench::runAllBenchmarks(options);
+}